@@ -78,6 +78,7 @@
 
 .define OUTPUT_PB4
 ; .define SPI_DEBUG
+; .define BURST_WRITES	; Spend the spare cycles of the frame on more register writes
 ; .define ATTINY 85
 
 ; Internal configuration - DO NOT TOUCH
@@ -132,6 +133,12 @@
 	.error "Unsupported DAC type"
 .endif
 
+.ifdef BURST_WRITES
+	; The TCNT1 value after the second overflow up until which another register write
+	; still ends before the next frame, checked by tools/cycles.c
+	.equ BURST_LIMIT = 79
+	.message "[ATtiny85APU] Assembling with burst register writes"
+.endif
 
 
 .equ	USCK	= PB2
@@ -333,7 +340,11 @@ Registers:
 .org 0
 rjmp Init
 .org OVF1addr
+.ifdef BURST_WRITES
+rjmp PhaseAccEnvUpd	; The register writes are done after the output in the burst mode
+.else
 rjmp Cycle
+.endif
 
 ; .org INT_VECTORS_SIZE	; Unnecessary
 Init:
@@ -467,12 +478,15 @@ Init:
 Forever:
 	rjmp Forever
 
+.ifndef BURST_WRITES
 Cycle:
 	cbi	PortB,	PB3
 
 	sbis PINB,	PINB0	; If no input pending, skip this
 	rjmp AfterSPI
+.endif
 
+RegWrite:
 	rcall	SPITransfer
 
 	andi r18,	0x7F	;
@@ -496,8 +510,10 @@ Cycle:
 
 	ijmp
 
+.ifndef BURST_WRITES
 AfterSPI:
 	sbi PortB,	PB3
+.endif
 PhaseAccEnvUpd:
 	; UP TO 46 CYCLES AAAAAAAAAAAAAAAAAAAA
 	; lds env octave (only once)
@@ -551,7 +567,7 @@ PhaseAccEnvUpd:
 			com	EnvAVolume
 	PhaseAccEnvAUpd_Skip:
 	bst	EnvZeroFlg,	EnvBZero
-	brts PhaseAccEnvBUpd_End
+	brts PhaseAccEnvBUpd_Skip
 	PhaseAccEnvBUpd:
 		lds	r0,		ShiftedIncrementEB_L
 		; if octave MSB set, add to high and mid bytes
@@ -576,11 +592,11 @@ PhaseAccEnvUpd:
 		sts	PhaseAccEnvB_H,	r1
 		adc	r3,		r3	; r3 is 0, therefore r3 becomes carry
 	PhaseAccEnvBUpd_ValueUpdate:
-		breq PhaseAccEnvBUpd_End	; Z flag set by the last adc with r3
+		breq PhaseAccEnvBUpd_Skip	; Z flag set by the last adc with r3
 		; inc env pos by high byte
-		lds	EnvBVolume,	EnvStateA
+		lds	EnvBVolume,	EnvStateB
 		add	EnvBVolume,	r3
-		sts	EnvStateA,	EnvBVolume	; doesn't affect carry
+		sts	EnvStateB,	EnvBVolume	; doesn't affect carry
 		brcc PhaseAccEnvBUpd_End
 	PhaseAccEnvBUpd_Overflow:
 		bst r19,	ENV_B_ALT
@@ -595,6 +611,7 @@ PhaseAccEnvUpd:
 	PhaseAccEnvBUpd_End:
 		sbrs EnvZeroFlg, EnvBSlope
 			com	EnvBVolume
+	PhaseAccEnvBUpd_Skip:
 PhaseAccNoiseUpd:
 	lds	r0,		ShiftedIncrementN_L	;
 	add PhaseAccN_L,	r0			;	PhaseAcc += shifted inc value
@@ -756,6 +773,30 @@ Multiply:	; 27 cycles
 
 RealEnd:
 	out	OCR1B,	r0
+
+.ifdef BURST_WRITES
+	; Burst mode: as many register writes as there is time for in the frame,
+	; the handlers return to AfterSPI for the next one
+	cbi	PortB,	PB3
+	sbic PINB,	PINB0	; The first one is always done, if pending
+	rjmp RegWrite
+	rjmp BurstEnd
+AfterSPI:
+	sbis PINB,	PINB0	; If no more input pending, stop
+	rjmp BurstEnd
+	in	r16,	TIFR		;
+	sbrs r16,	TOV1		;	Before the second overflow,
+	rjmp BurstWrite			;__	there is always time for one more
+BurstCheck:
+	in	r16,	TCNT1			;
+	cpi	r16,	BURST_LIMIT		;	After it, only if it ends before the next frame
+	brsh BurstEnd				;__
+BurstWrite:
+	rjmp RegWrite
+BurstEnd:
+	sbi PortB,	PB3
+.endif
+DelayEnd:	; After the output, as the delay leaves r0 cleared
 	in	r0,		TIFR
 	bst	r0,		TOV1
 	brtc Delay
@@ -765,12 +806,13 @@ RealEnd:
 Delay:
 	in	r0,		TCNT1
 	com	r0
+	brmi DelayEnd	; The update can end right before the second overflow, then TCNT1 has already wrapped
 	lsr r0
-	breq RealEnd
+	breq DelayEnd
 	L00B:
 		dec	r0
 		brne L00B
-	rjmp RealEnd
+	rjmp DelayEnd
 
 
 ; Delay:
@@ -31,8 +31,116 @@ Written by alexmush
 #define ENV_B_ATT	6
 #define ENV_B_RST	7
 
+#define BURST_LIMIT	79	// TCNT1 after the second overflow up until which the firmware starts another burst write
+
 #define member_sizeof(type, member) sizeof(((type *)0)->member)
 
+// Checks of the layout of the t85APU struct (see t85apu.h), C99 has no static_assert
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define LAYOUT_ASSERT(condition, name) _Static_assert(condition, #name)
+#else
+#define LAYOUT_ASSERT(condition, name) typedef char name[(condition) ? 1 : -1]
+#endif
+
+#define CACHE_LINE 64
+#define T85APU_SIZE_BUDGET 256	// Without the register write buffer and the trace
+
+LAYOUT_ASSERT(offsetof(t85APU, octaveValues) == CACHE_LINE, everything_used_on_every_update_has_to_be_in_the_first_cache_line);
+LAYOUT_ASSERT(offsetof(t85APU, shiftRegister) + sizeof(uint16_t *) <= 2 * CACHE_LINE, the_rest_of_the_update_has_to_be_in_the_second_cache_line);
+#ifdef T85APU_REGWRITE_BUFFER_SIZE
+#define BUFFER_SIZE_IN_STRUCT (member_sizeof(t85APU, shiftRegister) - sizeof(uint16_t *))
+#else
+#define BUFFER_SIZE_IN_STRUCT 0
+#endif
+#ifdef T85APU_TRACE
+#define TRACE_SIZE_IN_STRUCT (member_sizeof(t85APU, traceRecords) + 2 * sizeof(uint64_t) + 2 * sizeof(uint32_t))
+#else
+#define TRACE_SIZE_IN_STRUCT 0
+#endif
+LAYOUT_ASSERT(sizeof(t85APU) <= T85APU_SIZE_BUDGET + BUFFER_SIZE_IN_STRUCT + TRACE_SIZE_IN_STRUCT, t85APU_is_over_its_size_budget);
+
+// Trace points, which compile to nothing without T85APU_TRACE
+#ifdef T85APU_TRACE
+#if defined(__GNUC__) || defined(__clang__)
+// The reader of the ring buffer may be on another thread, so the records have to be written before the head moves past them
+#define TRACE_PUBLISH(apu)	__atomic_store_n(&(apu)->traceHead, (apu)->traceHead + 1, __ATOMIC_RELEASE)
+#define TRACE_HEAD(apu)	__atomic_load_n(&(apu)->traceHead, __ATOMIC_ACQUIRE)
+#else
+#define TRACE_PUBLISH(apu)	((apu)->traceHead++)
+#define TRACE_HEAD(apu)	((apu)->traceHead)
+#endif
+
+static inline void t85APU_trace (t85APU * apu, uint8_t type, uint8_t addr, uint8_t data, uint32_t value) {
+	t85APU_traceRecord * record = &apu->traceRecords[apu->traceHead & (T85APU_TRACE - 1)];
+	// Between the ticks, clockCycle is the next one to be ticked, and the update on 0 has not been counted yet
+	record->time = (apu->traceUpdates - (apu->clockCycle ? 1 : 0)) * 512 + apu->clockCycle;
+	record->value = value;
+	record->type = type;
+	record->addr = addr;
+	record->data = data;
+	TRACE_PUBLISH(apu);
+}
+#define TRACE(apu, type, addr, data, value)	t85APU_trace(apu, type, addr, data, value)
+#define TRACE_COUNT(apu, counter)	((apu)->counter++)
+#else
+#define TRACE(apu, type, addr, data, value)	((void)0)
+#define TRACE_COUNT(apu, counter)	((void)0)
+#endif
+
+/*
+	The saved state (see t85APU_saveState), little-endian: the version (4 bytes), the size of the register write buffer (4 bytes),
+	the fields below in order, then the index into the register write buffer (4 bytes) and the buffer itself.
+	The settings (clock, rate, output type, quality, output stage, mutes, burst mode) are not part of it.
+*/
+#define STATE_VERSION		1
+#define STATE_HEADER_SIZE	8
+#define STATE_FIELDS(X) \
+	X(shiftedIncrements,	uint16_t) \
+	X(tonePhaseAccs,		uint16_t) \
+	X(noisePhaseAcc,		uint16_t) \
+	X(envPhaseAccs,			uint16_t) \
+	X(envCountdowns,		uint32_t) \
+	X(dutyCycles,			uint8_t) \
+	X(volumes,				uint8_t) \
+	X(channelConfigs,		uint8_t) \
+	X(envSmpVolume,			uint8_t) \
+	X(noiseMask,			uint8_t) \
+	X(envZeroFlg,			uint8_t) \
+	X(octaveValues,			uint8_t) \
+	X(envShape,				uint8_t) \
+	X(envStates,			uint8_t) \
+	X(noiseLFSR,			uint16_t) \
+	X(noiseXOR,				uint16_t) \
+	X(channelOutput,		uint16_t) \
+	X(updateLatency,		uint16_t) \
+	X(outputQueue,			uint32_t) \
+	X(currentOutput,		uint32_t) \
+	X(clockCycle,			uint16_t) \
+	X(outPending,			uint8_t) \
+	X(increments,			uint8_t) \
+	X(envLdBuffer,			uint16_t) \
+	X(smpPhaseAccs,			uint16_t)
+#define STATE_DOUBLES(X) \
+	X(ticks) \
+	X(lowPassState) \
+	X(highPassState)
+
+#define STATE_FIELD_SIZE(field, type)	+ member_sizeof(t85APU, field)
+#define STATE_DOUBLE_SIZE(field)		+ sizeof(double)
+#define STATE_FIELDS_SIZE (0 STATE_FIELDS(STATE_FIELD_SIZE) STATE_DOUBLES(STATE_DOUBLE_SIZE))
+
+static uint8_t * t85APU_putLE (uint8_t * buffer, uint64_t value, size_t bytes) {
+	for (size_t i = 0; i < bytes; i++) buffer[i] = value >> (8*i);
+	return buffer + bytes;
+}
+
+static uint64_t t85APU_getLE (const uint8_t ** buffer, size_t bytes) {
+	uint64_t value = 0;
+	for (size_t i = 0; i < bytes; i++) value |= (uint64_t)(*buffer)[i] << (8*i);
+	*buffer += bytes;
+	return value;
+}
+
 static const uint_fast8_t outputTypesBitdepths[] = {
 	8,	// T85APU_OUTPUT_PB4
 	8,	// T85APU_OUTPUT_PB4_EXACT
@@ -48,17 +156,27 @@ static const double outputQualityThreshold[] = {
 	1.0,	// T85APU_OUTPUT_PB4_EXACT, PWM is a bitch and changes every cycle
 };
 
+// Aligned to a cache line where possible, so that the first 64 bytes are in 1 line. It can be freed with free() either way
+static t85APU * t85APU_alloc (void) {
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(_WIN32)
+	t85APU * apu = (t85APU *) aligned_alloc(CACHE_LINE, (sizeof(t85APU) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE);
+	if (apu) memset(apu, 0, sizeof(t85APU));
+	return apu;
+#else
+	return (t85APU *) calloc(1, sizeof(t85APU));
+#endif
+}
+
 #ifdef T85APU_REGWRITE_BUFFER_SIZE
 t85APU * t85APU_new (double clock, double rate, uint_fast8_t outputType) {
 #else
 t85APU * t85APU_new (double clock, double rate, uint_fast8_t outputType, size_t shiftRegisterSize) {
 #endif
-	t85APU * apu = (t85APU *) calloc(1, sizeof(t85APU));
+	t85APU * apu = t85APU_alloc();
 	if (!apu) {
 		fprintf(stderr, "Could not allocate t85APU\n");
 		return NULL;
 	}
-	apu->resamplingBuffer = NULL;
 	t85APU_setClocknRate(apu, clock, rate);
 	t85APU_setOutputType(apu, outputType);
 	double tmp;
@@ -66,7 +184,6 @@ t85APU * t85APU_new (double clock, double rate, uint_fast8_t outputType, size_t
 	 modf(log2(apu->ticksPerClockCycle), &tmp) == 0.0 && apu->ticksPerClockCycle <= outputQualityThreshold[apu->outputType]
 	 ? 0 : 1);
 	t85APU_reset(apu);
-	apu->ticks = 0;
 	#ifdef T85APU_REGWRITE_BUFFER_SIZE
 	memset(apu->shiftRegister, 0, sizeof(uint16_t)*T85APU_REGWRITE_BUFFER_SIZE);
 	#else
@@ -80,7 +197,7 @@ t85APU * t85APU_new (double clock, double rate, uint_fast8_t outputType, size_t
 	#endif
 	apu->shiftRegCurIdx = 0;
 	apu->shiftRegister[0] = 0;
-	memset(apu->channelMute,	false,	sizeof(bool)*5);
+	apu->channelMutes = 0;
 	return apu;
 }
 
@@ -100,25 +217,36 @@ void t85APU_reset (t85APU * apu) {
 	memset(apu->envPhaseAccs,		0,	sizeof(uint16_t)*2);
 	memset(apu->smpPhaseAccs,		0,	sizeof(uint16_t)*2);
 	memset(apu->envStates,			0,	sizeof(uint8_t)*2);
+	memset(apu->envCountdowns,		0,	sizeof(uint32_t)*2);
 	apu->envLdBuffer = 0;
+	apu->updateLatency = 0;
 	
-	memset(apu->channelOutput,		0,	sizeof(uint8_t)*5);
+	memset(apu->channelOutput,		0,	sizeof(uint16_t)*5);
 	apu->noiseMask = 0x7F;
 
 	apu->clockCycle = 0;	// technically simplified
+	apu->lowPassState = 0;
+	apu->highPassState = 0;
+	// The output and the phase of the sample rate converter too, so that a reset t85APU renders the same as a new one
+	memset(apu->outputQueue,		0,	sizeof(uint32_t)*3);
+	apu->outPending = 0;
+	apu->currentOutput = 0;
+	apu->ticks = 0;
+	apu->qualityFade = 0;
 
 	apu->noiseXOR	= 0x2400;
 	apu->noiseLFSR	= 0;
 
 	apu->envShape = 0;
 	apu->envZeroFlg = (1<<EnvAZero|1<<EnvBZero|1<<SmpAZero|1<<SmpBZero);
+
+	if (apu->backend && apu->backend->reset) apu->backend->reset(apu);
 }
 
 void t85APU_delete (t85APU * apu) {
 	if (!apu) return;
+	t85APU_setBackend(apu, NULL, NULL);
 
-	if (apu->resamplingBuffer) free(apu->resamplingBuffer);
-	
 	#ifndef T85APU_REGWRITE_BUFFER_SIZE
 	if (apu->shiftRegister) free(apu->shiftRegister);
 	#endif
@@ -134,15 +262,22 @@ void t85APU_setClocknRate (t85APU * apu, double clock, double rate) {
 	if (!clock)	clock = 8000000;
 	if (!rate)	rate = clock / 512;
 
-	apu->ticksPerClockCycle = clock / rate; 
+	// The resampler keeps no per-tick history, so there is nothing to reallocate.
+	// apu->ticks is the fraction of a master clock that has already elapsed,
+	// which is the same phase regardless of the clock speed, so it is kept as is.
+	apu->ticksPerClockCycle = clock / rate;
+	apu->outputRate = rate;
+	t85APU_setOutputFilter(apu, apu->lowPassRC, apu->highPassRC);
+}
 
-	if (apu->resamplingBuffer) free(apu->resamplingBuffer);
-	apu->resamplingBuffer = calloc(ceil(apu->ticksPerClockCycle), sizeof(uint32_t));
-	if (!apu->resamplingBuffer) {
-		fprintf(stderr, "Could not allocate t85APU resampling buffer, quality will be forced to be 0\n");
-		apu->quality = 0;
-	}
-};
+void t85APU_setOutputFilter (t85APU * apu, double lowPassRC, double highPassRC) {
+	if (!apu) return;
+	apu->lowPassRC	= lowPassRC > 0 ? lowPassRC : 0;
+	apu->highPassRC	= highPassRC > 0 ? highPassRC : 0;
+	// One-pole coefficients for the output sample rate
+	apu->lowPassCoef	= apu->lowPassRC	? 1 - exp(-1 / (apu->lowPassRC * apu->outputRate))	: 1;
+	apu->highPassCoef	= apu->highPassRC	? 1 - exp(-1 / (apu->highPassRC * apu->outputRate))	: 0;
+}
 
 void t85APU_setOutputType (t85APU * apu, uint_fast8_t outputType) {
 	if (!apu) return;
@@ -152,7 +287,25 @@ void t85APU_setOutputType (t85APU * apu, uint_fast8_t outputType) {
 		outputType = T85APU_OUTPUT_PB4;
 	
 	apu->outputBitdepth	= outputTypesBitdepths	[outputType];
-	apu->outputDelay	= outputTypesDelays		[outputType];
+	apu->outputDelay	= apu->backend ? apu->backend->outputDelay : outputTypesDelays[outputType];
+}
+
+void t85APU_setBackend (t85APU * apu, const t85APU_backend * backend, void * data) {
+	if (!apu) return;
+	if (apu->backend && apu->backend->free) apu->backend->free(apu);
+	apu->backend = backend;
+	apu->backendData = backend ? data : NULL;
+	t85APU_setOutputType(apu, apu->outputType);
+}
+
+// The amount of writes the register write buffer holds
+static inline size_t t85APU_bufferSize (const t85APU * apu) {
+	#ifdef T85APU_REGWRITE_BUFFER_SIZE
+	(void)apu;
+	return T85APU_REGWRITE_BUFFER_SIZE;
+	#else
+	return apu->shiftRegSize;
+	#endif
 }
 
 uint16_t t85APU_shiftReg (t85APU * apu, uint16_t newData) {
@@ -172,6 +325,7 @@ uint16_t t85APU_shiftReg (t85APU * apu, uint16_t newData) {
 	apu->shiftRegister[apu->shiftRegSize-1] = newData;
 	#endif
 	if (apu->shiftRegCurIdx > 0) apu->shiftRegCurIdx--;
+	if (out & 0x8000) TRACE_COUNT(apu, traceTaken);
 	return out;
 }
 
@@ -183,13 +337,57 @@ void t85APU_writeReg (t85APU * apu, uint8_t addr, uint8_t data) {
 #else
 	if (apu->shiftRegCurIdx < apu->shiftRegSize)
 #endif
+	{
 		apu->shiftRegister[apu->shiftRegCurIdx++] = shiftRegData;
+		TRACE_COUNT(apu, traceQueued);
+		TRACE(apu, T85APU_TRACE_QUEUE, addr, data, apu->traceQueued);
+	} else TRACE(apu, T85APU_TRACE_DROP, addr, data, 0);
+}
+
+// Traces the writes that were just put into the buffer, and the ones that did not fit into it
+static inline void t85APU_traceWrites (t85APU * apu, const uint16_t * writes, size_t accepted, size_t count) {
+#ifdef T85APU_TRACE
+	for (size_t i = 0; i < count; i++) {
+		uint8_t addr = (writes[i] >> 8) & 0x7F, data = writes[i] & 0xFF;
+		if (i < accepted) {
+			TRACE_COUNT(apu, traceQueued);
+			TRACE(apu, T85APU_TRACE_QUEUE, addr, data, apu->traceQueued);
+		} else TRACE(apu, T85APU_TRACE_DROP, addr, data, 0);
+	}
+#else
+	(void)apu; (void)writes; (void)accepted; (void)count;
+#endif
+}
+
+size_t t85APU_writeRegs (t85APU * apu, const uint8_t (*pairs)[2], size_t count) {
+	if (!apu || !pairs) return 0;
+	size_t space = t85APU_bufferSize(apu) - apu->shiftRegCurIdx;
+	size_t accepted = count < space ? count : space;
+	uint16_t * writes = apu->shiftRegister + apu->shiftRegCurIdx;
+	for (size_t i = 0; i < accepted; i++) writes[i] = (pairs[i][0] << 8) | pairs[i][1] | 0x8000;
+	apu->shiftRegCurIdx += accepted;
+	t85APU_traceWrites(apu, writes, accepted, accepted);
+#ifdef T85APU_TRACE
+	for (size_t i = accepted; i < count; i++) TRACE(apu, T85APU_TRACE_DROP, pairs[i][0], pairs[i][1], 0);
+#endif
+	return accepted;
+}
+
+size_t t85APU_writePackedRegs (t85APU * apu, const uint16_t * writes, size_t count) {
+	if (!apu || !writes) return 0;
+	size_t space = t85APU_bufferSize(apu) - apu->shiftRegCurIdx;
+	size_t accepted = count < space ? count : space;
+	memcpy(apu->shiftRegister + apu->shiftRegCurIdx, writes, accepted * sizeof(uint16_t));
+	apu->shiftRegCurIdx += accepted;
+	t85APU_traceWrites(apu, writes, accepted, count);
+	return accepted;
 }
 
 void t85APU_handleReg (t85APU * apu, uint8_t addr, uint8_t data) {
 	if (!apu) return;
 
 	addr &= 0x7F;
+	TRACE(apu, T85APU_TRACE_APPLY, addr, data, apu->traceTaken);
 	uint8_t r0, r1 = data, r2, r3, ZL, ZH;
 	switch(addr){
 		case 0:
@@ -299,6 +497,7 @@ void t85APU_handleReg (t85APU * apu, uint8_t addr, uint8_t data) {
 				apu->envZeroFlg |= data & 1<<ENV_B_ATT;
 			}
 			apu->envShape = data;
+			memset(apu->envCountdowns,	0,	sizeof(uint32_t)*2);
 			break;
 		case 29:
 		case 30:
@@ -308,7 +507,7 @@ void t85APU_handleReg (t85APU * apu, uint8_t addr, uint8_t data) {
 			if (addr == 30) r2 >>= 4;
 
 			apu->shiftedIncrements[addr-23] = data << (1+(r2 & 0x07));
-			
+			apu->envCountdowns[addr-29] = 0;
 			break;
 		case 31:
 			// Envelope high pitch
@@ -325,6 +524,7 @@ void t85APU_handleReg (t85APU * apu, uint8_t addr, uint8_t data) {
 				apu->shiftedIncrements[7] = r2 << (1+((data >> 4) & 0x07));
 			}
 			apu->octaveValues[6] = data;
+			memset(apu->envCountdowns,	0,	sizeof(uint32_t)*2);
 			break;
 		default:
 			break;
@@ -333,7 +533,212 @@ void t85APU_handleReg (t85APU * apu, uint8_t addr, uint8_t data) {
 
 void t85APU_setQuality (t85APU * apu, uint_fast8_t quality) {
 	if (!apu) return;
-	apu->quality = apu->resamplingBuffer ? quality : 0;	// Force quality to 0 if no resampling buffer
+	apu->quality = quality;
+	apu->qualityFade = 0;
+}
+
+void t85APU_fadeQuality (t85APU * apu, uint_fast8_t quality, uint_fast16_t samples) {
+	if (!apu) return;
+	if (quality == apu->quality) return;
+	apu->fadeQuality = apu->quality;
+	apu->quality = quality;
+	apu->qualityFade = apu->qualityFadeLength = samples;
+}
+
+void t85APU_setBurstWrites (t85APU * apu, bool burstWrites) {
+	if (!apu) return;
+	apu->burstWrites = burstWrites;
+}
+
+size_t t85APU_traceRead (t85APU * apu, uint64_t * cursor, t85APU_traceRecord * records, size_t count) {
+#ifdef T85APU_TRACE
+	if (!apu || !cursor || !records) return 0;
+	// The record after the head may be getting written right now, so one less than the whole ring is kept
+	uint64_t head = TRACE_HEAD(apu);
+	uint64_t oldest = head >= T85APU_TRACE ? head - T85APU_TRACE + 1 : 0;
+	if (*cursor < oldest || *cursor > head) *cursor = oldest;
+	size_t copied = head - *cursor < count ? head - *cursor : count;
+	for (size_t i = 0; i < copied; i++) records[i] = apu->traceRecords[(*cursor + i) & (T85APU_TRACE - 1)];
+
+	// Drop the ones that got overwritten while they were being copied
+	head = TRACE_HEAD(apu);
+	oldest = head >= T85APU_TRACE ? head - T85APU_TRACE + 1 : 0;
+	if (*cursor < oldest) {
+		size_t lost = oldest - *cursor < copied ? oldest - *cursor : copied;
+		memmove(records, records + lost, (copied - lost) * sizeof(t85APU_traceRecord));
+		copied -= lost;
+		*cursor = oldest;
+	}
+	*cursor += copied;
+	return copied;
+#else
+	(void)apu; (void)cursor; (void)records; (void)count;
+	return 0;
+#endif
+}
+
+// floor((a * n + add) / 2^shift) without overflowing, for a and add below 2^53 and shift from 32 to 52
+static uint64_t t85APU_mulShift (uint64_t a, uint32_t n, uint64_t add, uint_fast8_t shift) {
+	uint64_t low = (a & 0xFFFFFFFF) * n + add;
+	uint64_t high = (a >> 32) * n + (low < add ? (uint64_t)1 << 32 : 0);	// With the carry out of the low half
+	return (high + (low >> 32)) >> (shift - 32);
+}
+
+/*
+	The amount of samples until the tick the output changes on is in one, in closed form, bit-exact with stepping them like t85APU_resample does.
+	While ticks + ticksPerClockCycle stays below the next power of 2 of ticksPerClockCycle, every sum of the steps is exact in units of its ulp,
+	so the master clocks after n samples are floor((ticks + n * ticksPerClockCycle) / 2^shift) in those units, and the estimate in doubles is only
+	off by a step on the rounding. Returns false otherwise, or if the fraction is not in those units (e.g. from before the rate changed).
+*/
+static bool t85APU_latencySamples (const t85APU * apu, uint64_t change, uint64_t * samples, uint64_t * total) {
+	int exponent;
+	frexp(apu->ticksPerClockCycle, &exponent);	// ticksPerClockCycle is in [2^(exponent-1), 2^exponent)
+	int shift = 53 - exponent;
+	if (shift < 32 || shift > 52 || apu->ticksPerClockCycle + 1 >= ldexp(1, exponent)) return false;
+	double fraction = ldexp(apu->ticks, shift), step = ldexp(apu->ticksPerClockCycle, shift);
+	if (fraction != floor(fraction)) return false;
+
+	double estimate = ceil((change + 1 - apu->ticks) / apu->ticksPerClockCycle);
+	if (estimate > UINT32_MAX - 1) return false;
+	uint32_t n = estimate < 1 ? 1 : (uint32_t)estimate;
+	while (t85APU_mulShift((uint64_t)step, n, (uint64_t)fraction, shift) <= change) n++;
+	while (n > 1 && t85APU_mulShift((uint64_t)step, n - 1, (uint64_t)fraction, shift) > change) n--;
+	*samples = n;
+	*total = t85APU_mulShift((uint64_t)step, n, (uint64_t)fraction, shift);
+	return true;
+}
+
+/*
+	The amount of updates before the one that takes the write at the given position in the burst mode. How many writes an update takes depends
+	on the cycles the update and the writes take, so they are replayed on a copy of the emulator, with only the writes up to that position in its buffer.
+	The write at the end of the buffer is yet to be pushed, and only stands in for it, as its own cycles come after it is taken.
+*/
+void t85APU_cycle (t85APU * apu);	// With the updates, below
+
+static bool t85APU_burstQueue (const t85APU * apu, size_t position, uint64_t * updates) {
+	if (position > apu->shiftRegCurIdx) return false;	// The writes ahead of it are not known
+	#ifdef T85APU_REGWRITE_BUFFER_SIZE
+	t85APU * copy = (t85APU *) malloc(sizeof(t85APU));
+	#else
+	t85APU * copy = (t85APU *) malloc(sizeof(t85APU) + (position + 1) * sizeof(uint16_t));
+	#endif
+	if (!copy) {
+		fprintf(stderr, "Could not allocate the copy of t85APU for the latency\n");
+		return false;
+	}
+	memcpy(copy, apu, sizeof(t85APU));
+	#ifndef T85APU_REGWRITE_BUFFER_SIZE
+	copy->shiftRegister = (uint16_t *)(copy + 1);
+	copy->shiftRegSize = position + 1;
+	memcpy(copy->shiftRegister, apu->shiftRegister, position * sizeof(uint16_t));
+	#endif
+	copy->shiftRegister[position] = position < apu->shiftRegCurIdx ? apu->shiftRegister[position] : 0x8000 | 0x20 << 8;	// An unused register
+	copy->shiftRegCurIdx = position + 1;
+	// Every update takes at least 1 write
+	for (*updates = 0;; (*updates)++) {
+		t85APU_cycle(copy);
+		if (!copy->shiftRegCurIdx) break;
+	}
+	free(copy);
+	return true;
+}
+
+bool t85APU_getLatency (const t85APU * apu, size_t position, t85APU_latency * latency) {
+	if (!apu || !latency || position >= t85APU_bufferSize(apu)) return false;
+	// Between the ticks, clockCycle is the next one to be ticked, so on 0 the update is on the very next tick
+	if (apu->burstWrites && !apu->backend) {
+		if (!t85APU_burstQueue(apu, position, &latency->queue)) return false;
+		latency->queue *= 512;
+	} else latency->queue = (uint64_t)position * 512;
+	latency->update = (512 - apu->clockCycle) & 511;
+	if (apu->burstWrites && !apu->backend) latency->update += 512;
+	if (apu->backend) latency->output = apu->backend->writeLatency;
+	else {
+		// The output of an update is put (511+outputDelay)>>9 entries into the output queue, which shifts at (outputDelay & 511) into every update
+		uint_fast16_t stages = (511 + apu->outputDelay) >> 9;
+		latency->output = stages ? (uint64_t)(stages - 1) * 512 + (apu->outputDelay & 511) : 0;
+	}
+
+	// The tick the output changes on, counting from 0, and the first sample that includes it
+	uint64_t change = latency->queue + latency->update + latency->output;
+	if (!t85APU_latencySamples(apu, change, &latency->samples, &latency->total)) {
+		// The sample lengths are stepped like t85APU_resample does, when they are not exact in the units of the fraction
+		uint64_t total = 0, samples = 0;
+		double ticks = apu->ticks, tmp;
+		while (total <= change) {
+			ticks += apu->ticksPerClockCycle;
+			total += (size_t)floor(ticks);
+			ticks = modf(ticks, &tmp);
+			samples++;
+		}
+		latency->samples = samples;
+		latency->total = total;
+	}
+	latency->resampler = latency->total - change;
+	// A one-pole low-pass delays low frequencies by (1 - coef) / coef samples
+	latency->filter = apu->lowPassRC ? (1 - apu->lowPassCoef) / apu->lowPassCoef : 0;
+	return true;
+}
+
+size_t t85APU_getStateSize (const t85APU * apu) {
+	if (!apu) return 0;
+	return STATE_HEADER_SIZE + STATE_FIELDS_SIZE + 4 + 2 * t85APU_bufferSize(apu);
+}
+
+bool t85APU_saveState (const t85APU * apu, uint8_t * buffer) {
+	if (!apu || !buffer) return false;
+	if (apu->backend) {
+		fprintf(stderr, "The state of a t85APU backend cannot be saved\n");
+		return false;
+	}
+	buffer = t85APU_putLE(buffer, STATE_VERSION, 4);
+	buffer = t85APU_putLE(buffer, t85APU_bufferSize(apu), 4);
+	#define SAVE_FIELD(field, type) \
+		for (size_t i = 0; i < member_sizeof(t85APU, field) / sizeof(type); i++) buffer = t85APU_putLE(buffer, ((const type *)&apu->field)[i], sizeof(type));
+	#define SAVE_DOUBLE(field) { \
+		uint64_t bits; \
+		memcpy(&bits, &apu->field, sizeof(double)); \
+		buffer = t85APU_putLE(buffer, bits, sizeof(double)); \
+	}
+	STATE_FIELDS(SAVE_FIELD)
+	STATE_DOUBLES(SAVE_DOUBLE)
+	#undef SAVE_FIELD
+	#undef SAVE_DOUBLE
+	buffer = t85APU_putLE(buffer, apu->shiftRegCurIdx, 4);
+	for (size_t i = 0; i < t85APU_bufferSize(apu); i++) buffer = t85APU_putLE(buffer, apu->shiftRegister[i], 2);
+	return true;
+}
+
+bool t85APU_loadState (t85APU * apu, const uint8_t * buffer, size_t size) {
+	if (!apu || !buffer) return false;
+	if (apu->backend) {
+		fprintf(stderr, "The state of a t85APU backend cannot be loaded\n");
+		return false;
+	}
+	if (size != t85APU_getStateSize(apu)) {
+		fprintf(stderr, "The saved t85APU state is for a register write buffer of a different size\n");
+		return false;
+	}
+	if (t85APU_getLE(&buffer, 4) != STATE_VERSION || t85APU_getLE(&buffer, 4) != t85APU_bufferSize(apu)) {
+		fprintf(stderr, "The saved t85APU state is of an unsupported version\n");
+		return false;
+	}
+	#define LOAD_FIELD(field, type) \
+		for (size_t i = 0; i < member_sizeof(t85APU, field) / sizeof(type); i++) ((type *)&apu->field)[i] = (type)t85APU_getLE(&buffer, sizeof(type));
+	#define LOAD_DOUBLE(field) { \
+		uint64_t bits = t85APU_getLE(&buffer, sizeof(double)); \
+		memcpy(&apu->field, &bits, sizeof(double)); \
+	}
+	STATE_FIELDS(LOAD_FIELD)
+	STATE_DOUBLES(LOAD_DOUBLE)
+	#undef LOAD_FIELD
+	#undef LOAD_DOUBLE
+	apu->outPending = apu->outPending ? 1 : 0;
+	apu->shiftRegCurIdx = t85APU_getLE(&buffer, 4);
+	if (apu->shiftRegCurIdx > t85APU_bufferSize(apu)) apu->shiftRegCurIdx = t85APU_bufferSize(apu);
+	for (size_t i = 0; i < t85APU_bufferSize(apu); i++) apu->shiftRegister[i] = t85APU_getLE(&buffer, 2);
+	apu->qualityFade = 0;
+	return true;
 }
 
 bool t85APU_shiftRegisterPending(t85APU * apu) {
@@ -341,57 +746,236 @@ bool t85APU_shiftRegisterPending(t85APU * apu) {
 	return (apu->shiftRegister[0] & 0x8000) ? true : false;
 }
 
+// The amount added to the envelope's phase accumulator on every update
+static inline uint32_t t85APU_envStep (t85APU * apu, uint_fast8_t env) {
+	return (uint32_t)apu->shiftedIncrements[6+env] << ((apu->octaveValues[6] & (1<<3) << (env*4)) ? 8 : 0);
+}
+
+// The amount of updates until (and including) the next one that carries into the envelope's state
+static uint32_t t85APU_envCountdown (t85APU * apu, uint_fast8_t env) {
+	uint32_t step = t85APU_envStep(apu, env);
+	if (!step) return UINT32_MAX;
+	return (0x10000 - apu->envPhaseAccs[env] + step - 1) / step;
+}
+
+// Advances the envelope by the given amount of updates in closed form, bit-exact with doing them one by one
+static void t85APU_envAdvance (t85APU * apu, uint_fast8_t env, uint32_t updates) {
+	uint8_t zeroBit	= (1<<EnvAZero) << (env*4);
+	uint8_t slopeBit	= (1<<EnvASlope) << (env*4);
+	uint8_t holdBit	= (1<<ENV_A_HOLD) << (env*4);
+	uint8_t altBit	= (1<<ENV_A_ALT) << (env*4);
+	if (apu->envZeroFlg & zeroBit) return;
+
+	uint64_t step = t85APU_envStep(apu, env);
+	uint64_t total = apu->envPhaseAccs[env] + step * updates;
+	uint64_t carries = total >> 16;	// Each update carries at most 0xFF, so it overflows the state at most once
+	if (!carries) {
+		apu->envPhaseAccs[env] = total;
+		return;
+	}
+	uint64_t state = apu->envStates[env];
+	if ((apu->envShape & holdBit) && state + carries > 0xFF) {
+		// Stops on the update that first overflows the state
+		uint64_t updatesToOverflow = ((((256 - state) << 16) - apu->envPhaseAccs[env]) + step - 1) / step;
+		total = apu->envPhaseAccs[env] + step * updatesToOverflow;
+		carries = total >> 16;
+		if (apu->envShape & altBit) apu->envZeroFlg ^= slopeBit;
+		apu->envZeroFlg |= zeroBit;
+		apu->envSmpVolume[env] = 0xFF;
+		TRACE(apu, T85APU_TRACE_ENV_HOLD, env, (state + carries) & 0xFF, 0);
+	} else {
+		// Every overflow inverts the slope if alternating
+		if ((apu->envShape & altBit) && ((state + carries) >> 8) & 1) apu->envZeroFlg ^= slopeBit;
+		apu->envSmpVolume[env] = (state + carries) & 0xFF;
+		// Only traced once, at the current update
+		if (state + carries > 0xFF) TRACE(apu, T85APU_TRACE_ENV_OVERFLOW, env, (state + carries) & 0xFF, 0);
+	}
+	apu->envPhaseAccs[env] = total & 0xFFFF;
+	apu->envStates[env] = (state + carries) & 0xFF;
+	if (!(apu->envZeroFlg & slopeBit)) apu->envSmpVolume[env] ^= 0xFF;
+}
+
+// A step of the noise LFSR is affine over GF(2): lfsr' = (lfsr >> 1) ^ (lfsr & 1 ? 0 : noiseXOR),
+// so any amount of them is one too, kept as the images of the 16 bits plus the image of 0
+typedef struct {
+	uint16_t cols[16];
+	uint16_t constant;
+} t85APU_lfsrMap;
+
+static inline uint16_t t85APU_lfsrApply (const t85APU_lfsrMap * map, uint16_t lfsr) {
+	uint16_t out = map->constant;
+	for (uint_fast8_t bit = 0; bit < 16; bit++) if (lfsr & 1<<bit) out ^= map->cols[bit];
+	return out;
+}
+
+// Steps the noise LFSR the given amount of times, bit-exact with stepping it one by one, in O(log steps)
+static uint16_t t85APU_lfsrJump (uint16_t lfsr, uint16_t noiseXOR, uint64_t steps) {
+	t85APU_lfsrMap power;	// The map of 2^n steps
+	power.constant = noiseXOR;
+	power.cols[0] = noiseXOR;	// 1 shifts out without the XOR, so its image is 0, i.e. the constant cancelled
+	for (uint_fast8_t bit = 1; bit < 16; bit++) power.cols[bit] = 1<<(bit-1);
+	while (steps) {
+		if (steps & 1) lfsr = t85APU_lfsrApply(&power, lfsr);
+		steps >>= 1;
+		if (!steps) break;
+		// Square it: the images of the bits go through the linear part, the image of 0 through the whole map
+		t85APU_lfsrMap squared;
+		for (uint_fast8_t bit = 0; bit < 16; bit++) squared.cols[bit] = t85APU_lfsrApply(&power, power.cols[bit]) ^ power.constant;
+		squared.constant = t85APU_lfsrApply(&power, power.constant);
+		power = squared;
+	}
+	return lfsr;
+}
+
+/*
+	Cycle counts of the firmware's paths, for the burst mode (avr/main.asm assembled with BURST_WRITES).
+	It does the register writes after the output, so how many of them fit into an update depends on how long it took.
+*/
+
+// The shifts of an increment by the octave (like L003..L005), each one skipped if its bit is set
+static inline uint_fast16_t t85APU_shiftCycles (uint_fast8_t octave) {
+	return (octave & 1<<2 ? 3 : 10) + (octave & 1<<1 ? 3 : 6) + (octave & 1<<0 ? 3 : 4);
+}
+
+// PhaseAccEnvXUpd, without loading the octaves and the shape
+static uint_fast16_t t85APU_envCycles (t85APU * apu, uint_fast8_t env) {
+	if (apu->envZeroFlg & (1<<EnvAZero) << (env*4)) return 3;
+	uint_fast16_t cycles = 6 + ((apu->octaveValues[6] & (1<<3) << (env*4)) ? 11 : 15);	// MidHi or MidLo
+	uint32_t carries = (apu->envPhaseAccs[env] + t85APU_envStep(apu, env)) >> 16;
+	if (!carries) return cycles + 2;
+	if (apu->envStates[env] + carries <= 0xFF) return cycles + 10;
+	return cycles + 11
+		+ ((apu->envShape & (1<<ENV_A_ALT) << (env*4)) ? 3 : 2)
+		+ ((apu->envShape & (1<<ENV_A_HOLD) << (env*4)) ? 3 : 2);
+}
+
+// ChannelGenericRoutine with r16 of the channel, with the rcall
+static inline uint_fast16_t t85APU_channelCycles (uint8_t r16) {
+	if (!(r16 & 1<<7)) return 3 + 11;
+	return 3 + 4 + (r16 & 1<<6 ? 10 : 3) + (r16 & 1<<0 ? 4 : 3) + (r16 & 1<<1 ? 6 : 3) + 8;
+}
+
+// The update up until the output (PhaseAccEnvUpd..RealEnd), from the state before it
+static uint_fast16_t t85APU_updateCycles (t85APU * apu) {
+	uint_fast16_t cycles = 4 + t85APU_envCycles(apu, 0) + t85APU_envCycles(apu, 1);
+
+	uint8_t noiseMask = apu->noiseMask;
+	if ((uint16_t)(apu->noisePhaseAcc + apu->shiftedIncrements[5]) < apu->shiftedIncrements[5]) {
+		cycles += 14 + (apu->noiseLFSR & 1 ? 2 : 8) + 4;
+		noiseMask = apu->noiseLFSR & 1 ? 0x7F : 0xFF;
+	} else cycles += 8;
+
+	cycles += 7;
+	for (int ch = 0; ch < 5; ch++) {
+		uint8_t r16 = apu->channelConfigs[ch] & noiseMask;
+		if ((uint16_t)(apu->tonePhaseAccs[ch] + apu->shiftedIncrements[ch]) >> 8 < apu->dutyCycles[ch]) r16 |= 1<<7;
+		cycles += 11 + t85APU_channelCycles(r16);
+	}
+	return cycles + 21;	// Multiply, with the 8-bit output
+}
+
+// RegWrite up until the handler's rjmp AfterSPI, from the state before the write
+static uint_fast16_t t85APU_regWriteCycles (t85APU * apu, uint8_t addr, uint8_t data) {
+	uint_fast16_t cycles = 68;	// The 2 SPI transfers and the jump table
+	addr &= 0x7F;
+	switch (addr) {
+		case 0: case 1: case 2: case 3: case 4: case 5:
+			return cycles + 11 + t85APU_shiftCycles(apu->octaveValues[addr]);
+		case 6: case 7: case 8: {
+			uint_fast8_t ch = (addr - 6) << 1;
+			cycles += (data & 1<<3 ? 4 : 3) + (data & 1<<7 ? (addr == 8 ? 4 : 6) : 3);	// The phase resets
+			cycles += 7 + (apu->octaveValues[ch] == (data & 0x07) ? 2 : 10 + t85APU_shiftCycles(data));
+			cycles += 6 + (apu->octaveValues[ch+1] == ((data >> 4) & 0x07) ? 2 : 10 + t85APU_shiftCycles(data >> 4));
+			return cycles + 2;
+		}
+		case 28:
+			return cycles + 10 + (data & 1<<ENV_A_RST ? 11 : 3) + (data & 1<<ENV_B_RST ? 11 : 3) + 4;
+		case 29:
+			return cycles + 12 + t85APU_shiftCycles(apu->octaveValues[6]);
+		case 30:
+			return cycles + 15 + t85APU_shiftCycles(apu->octaveValues[6] >> 4);
+		case 31:
+			cycles += 5 + ((apu->octaveValues[6] ^ data) & 0x07 ? 8 + t85APU_shiftCycles(data) : 2);
+			cycles += 2 + ((apu->octaveValues[6] ^ data) & 0x70 ? 8 + t85APU_shiftCycles(data >> 4) : 2);
+			return cycles + 4;
+		default:
+			return cycles + (addr < 32 ? 4 : 2);
+	}
+}
+
+// Does the register writes of the burst mode, with the output at the given master clock of the update
+static void t85APU_burstWrites (t85APU * apu, uint_fast16_t realEnd) {
+	// The first write is always done, and the next ones only if they are started in time for the next update
+	uint_fast16_t time = realEnd + 7;	// At BurstEnd
+	if (apu->shiftRegister[0] & 0x8000) {
+		time = realEnd + 6;	// At RegWrite
+		for (;;) {
+			uint16_t data = t85APU_shiftReg(apu, 0);
+			time += t85APU_regWriteCycles(apu, (data >> 8) & 0xFF, data & 0xFF);
+			t85APU_handleReg(apu, (data >> 8) & 0xFF, data & 0xFF);
+			// At AfterSPI
+			if (!(apu->shiftRegister[0] & 0x8000)) {
+				time += 3;
+				break;
+			}
+			if (time + 2 < 256) time += 8;	// TOV1 is not set yet
+			else if (((time + 5) & 0xFF) < BURST_LIMIT) time += 10;	// TCNT1 at BurstCheck
+			else {
+				time += 9;
+				break;
+			}
+		}
+	}
+
+	// BurstEnd, then the Delay loop up until the second overflow
+	time += 2;
+	while (time < 256) {
+		if (time + 4 >= 256) {	// TCNT1 has wrapped by the time it is read
+			time += 8;
+			break;
+		}
+		uint_fast8_t count = (uint8_t)~(time + 4) >> 1;
+		time += 10 + 3 * count;
+	}
+	time += 9;	// Acknowledging the second overflow, and reti
+
+	// One instruction of the main loop runs after reti, and the interrupt waits for its 2 cycles to end
+	apu->updateLatency = time + 2 >= 512 ? time + 2 - 512 : (512 - time) & 1;
+}
+
 void t85APU_cycle (t85APU * apu) {
 	if (!apu) return;
+	if (apu->backend) {
+		apu->backend->update(apu);
+		TRACE_COUNT(apu, traceUpdates);
+		return;
+	}
 
-	uint_fast8_t skipCount = 4;
-	if (apu->shiftRegister[0] & 0x8000) {
-		// TODO handle skip count
+	uint_fast16_t realEnd = 0;
+	if (apu->burstWrites) {
+		// The interrupt's response and rjmp
+		realEnd = apu->updateLatency + 4 + 2 + t85APU_updateCycles(apu);
+	} else if (apu->shiftRegister[0] & 0x8000) {
 		uint16_t data = t85APU_shiftReg(apu, 0);
 		t85APU_handleReg(apu, (data >> 8) & 0xFF, data & 0xFF);
 	}
 	// PhaseAccEnvUpd:
-	uint8_t r18 = apu->octaveValues[6];
-	if (!(apu->envZeroFlg & 1<<EnvAZero)) {
-		uint32_t fakeAcc = apu->envPhaseAccs[0];
-		fakeAcc += (apu->shiftedIncrements[6] << ((r18 & 1<<3) ? 8 : 0));
-		apu->envPhaseAccs[0] = fakeAcc & 0xFFFF;
-		uint8_t r3 = (fakeAcc >> 16) & 0xFF;
-		if (r3) {
-			apu->envStates[0] += r3;
-			apu->envSmpVolume[0] = apu->envStates[0];
-			if (apu->envStates[0] < r3) {	// If the envelope overflowed
-				if (apu->envShape & 1<<ENV_A_ALT) apu->envZeroFlg ^= 1<<EnvASlope;
-				if (apu->envShape & 1<<ENV_A_HOLD) {
-					apu->envSmpVolume[0] = 0xFF;
-					apu->envZeroFlg |= 1<<EnvAZero;
-				}
-			}
-			if (!(apu->envZeroFlg & 1<<EnvASlope)) apu->envSmpVolume[0] ^= 0xFF;
-		}	
-	}
-	if (!(apu->envZeroFlg & 1<<EnvBZero)) {
-		uint32_t fakeAcc = apu->envPhaseAccs[1];
-		fakeAcc += (apu->shiftedIncrements[7] << ((r18 & 1<<7) ? 8 : 0));
-		apu->envPhaseAccs[1] = fakeAcc & 0xFFFF;
-		uint8_t r3 = (fakeAcc >> 16) & 0xFF;
-		if (r3) {
-			apu->envStates[1] += r3;
-			apu->envSmpVolume[1] = apu->envStates[1];
-			if (apu->envStates[1] < r3) {	// If the envelope overflowed
-				if (apu->envShape & 1<<ENV_B_ALT) apu->envZeroFlg ^= 1<<EnvBSlope;
-				if (apu->envShape & 1<<ENV_B_HOLD) {
-					apu->envSmpVolume[1] = 0xFF;
-					apu->envZeroFlg |= 1<<EnvBZero;
-				}
-			}
-			if (!(apu->envZeroFlg & 1<<EnvBSlope)) apu->envSmpVolume[1] ^= 0xFF;
-		}	
+	for (uint_fast8_t env = 0; env < 2; env++) {
+		if (apu->envZeroFlg & (1<<EnvAZero) << (env*4)) continue;
+		if (apu->envCountdowns[env] > 1) {
+			// No carry on this update, so only the phase accumulator moves
+			apu->envCountdowns[env]--;
+			apu->envPhaseAccs[env] += t85APU_envStep(apu, env);
+		} else {
+			t85APU_envAdvance(apu, env, 1);
+			apu->envCountdowns[env] = t85APU_envCountdown(apu, env);
+		}
 	}
 
 	apu->noisePhaseAcc += apu->shiftedIncrements[5];
 	if (apu->noisePhaseAcc < apu->shiftedIncrements[5])	{	// If overflowed
 		bool carry = apu->noiseLFSR & 1;
+		if (apu->noiseMask != (carry ? 0x7F : 0xFF)) TRACE(apu, T85APU_TRACE_NOISE_MASK, 0, apu->noiseMask ^ 0x80, 0);
 		apu->noiseMask = carry ? 0x7F : 0xFF;
 		apu->noiseLFSR >>= 1;
 		if (!carry) apu->noiseLFSR ^= apu->noiseXOR;
@@ -411,10 +995,59 @@ void t85APU_cycle (t85APU * apu) {
 		} else apu->channelOutput[ch] = 0;
 	}
 	uint32_t output = 0;
-	for (int i = 0; i < 5; i++) {output += apu->channelMute[i] ? 0 : apu->channelOutput[i];}
+	for (int i = 0; i < 5; i++) {output += apu->channelMutes & 1<<i ? 0 : apu->channelOutput[i];}
 	output *= 274;	// the Multiply routine
 	output >>= 20 - (uint32_t)fmin(apu->outputBitdepth, 20);
 	apu->outputQueue[(511+apu->outputDelay)>>9] = output;
+
+	if (apu->burstWrites) t85APU_burstWrites(apu, realEnd);
+	TRACE_COUNT(apu, traceUpdates);
+}
+
+uint32_t t85APU_runUpdate (t85APU * apu) {
+	if (!apu) return 0;
+	t85APU_cycle(apu);
+	return apu->outputQueue[(511+apu->outputDelay)>>9];
+}
+
+void t85APU_skipUpdates (t85APU * apu, uint32_t updates) {
+	if (!apu || !updates) return;
+	if (apu->backend) {
+		// The firmware has no closed form
+		while (updates--) apu->backend->update(apu);
+		return;
+	}
+
+	for (uint_fast8_t env = 0; env < 2; env++) {
+		if (apu->envZeroFlg & (1<<EnvAZero) << (env*4)) continue;
+		if (updates < apu->envCountdowns[env]) {
+			// No carry in them, so only the phase accumulator moves
+			apu->envCountdowns[env] -= updates;
+			apu->envPhaseAccs[env] += t85APU_envStep(apu, env) * updates;
+		} else {
+			t85APU_envAdvance(apu, env, updates);
+			apu->envCountdowns[env] = t85APU_envCountdown(apu, env);
+		}
+	}
+
+	// The LFSR steps once per overflow; all but the last are jumped over, since the mask only depends on the last carry
+	uint64_t noiseTotal = apu->noisePhaseAcc + (uint64_t)apu->shiftedIncrements[5] * updates;
+	uint64_t overflows = noiseTotal >> 16;
+	if (overflows) {
+		apu->noiseLFSR = t85APU_lfsrJump(apu->noiseLFSR, apu->noiseXOR, overflows - 1);
+		bool carry = apu->noiseLFSR & 1;
+		// Only traced once, at the current update
+		if (apu->noiseMask != (carry ? 0x7F : 0xFF)) TRACE(apu, T85APU_TRACE_NOISE_MASK, 0, apu->noiseMask ^ 0x80, 0);
+		apu->noiseMask = carry ? 0x7F : 0xFF;
+		apu->noiseLFSR >>= 1;
+		if (!carry) apu->noiseLFSR ^= apu->noiseXOR;
+	}
+	apu->noisePhaseAcc = noiseTotal & 0xFFFF;
+
+	for (int ch = 0; ch < 5; ch++) apu->tonePhaseAccs[ch] += apu->shiftedIncrements[ch] * updates;
+	#ifdef T85APU_TRACE
+	apu->traceUpdates += updates;
+	#endif
 }
 
 void t85APU_tick (t85APU * apu) {
@@ -436,144 +1069,158 @@ void t85APU_tick (t85APU * apu) {
 	apu->clockCycle &= 511;
 }
 
-uint32_t t85APU_calc(t85APU *apu) {
-	if (!apu) return 0;
+// Ticks the given amount of master clocks, up to the end of the update at most, without summing the output, bit-exact with t85APU_tick
+static void t85APU_advanceTicks (t85APU * apu, uint_fast16_t run) {
+	if (!apu->clockCycle) {
+		t85APU_cycle(apu);
+		apu->outPending = 1;
+	}
+	uint_fast16_t end = apu->clockCycle + run;
+	if (apu->outPending && end - 1 >= (apu->outputDelay & 511)) {
+		apu->outPending = 0;
+		apu->outputQueue[0] = apu->outputQueue[1];
+		apu->outputQueue[1] = apu->outputQueue[2];
+	}
+	if (apu->outputType == T85APU_OUTPUT_PB4_EXACT)
+		apu->currentOutput = ((end - 1) & 0xFF) > apu->outputQueue[0] ? 0x00 : 0xFF;
+	else apu->currentOutput = apu->outputQueue[0];
+	apu->clockCycle = end & 511;
+}
 
-	apu->ticks += apu->ticksPerClockCycle;
-	uint32_t output;
-	size_t totalSize = floor(apu->ticks);
-	for (size_t i = 0; i < totalSize; i++) {
-		t85APU_tick (apu);
-		if (apu->quality >= 1 && totalSize > 0) apu->resamplingBuffer[i] = apu->currentOutput;
+void t85APU_advance (t85APU * apu, uint64_t masterClocks) {
+	if (!apu) return;
+	if (apu->clockCycle && masterClocks) {
+		uint_fast16_t run = masterClocks < 512u - apu->clockCycle ? masterClocks : 512u - apu->clockCycle;
+		t85APU_advanceTicks(apu, run);
+		masterClocks -= run;
 	}
-	double totalOutput = 0;
-	double tmp;
-	apu->ticks = modf(apu->ticks, &tmp);
-	switch (apu->quality) {
-		case 1:
-			for (size_t i = 0; i < totalSize; i++) totalOutput += (double)apu->resamplingBuffer[i];
-			totalOutput /= totalSize;
-			output = (uint32_t)totalOutput;
-			break;
-		case 0:
-		default:
-			output = apu->currentOutput;
-			break;
+	while (masterClocks >= 512) {
+		// The output only depends on the last update, so all of the ones before it that have no write to take are skipped.
+		// The burst mode needs the cycle count of every update, so it has no closed form
+		uint64_t skippable = masterClocks / 512 - 1;
+		if (skippable && !apu->burstWrites && !(apu->shiftRegister[0] & 0x8000)) {
+			uint32_t updates = skippable < UINT32_MAX ? (uint32_t)skippable : UINT32_MAX;
+			t85APU_skipUpdates(apu, updates);
+			masterClocks -= (uint64_t)updates * 512;
+			continue;
+		}
+		t85APU_advanceTicks(apu, 512);
+		masterClocks -= 512;
 	}
-	return output;
+	if (masterClocks) t85APU_advanceTicks(apu, masterClocks);
 }
 
-uint16_t t85APU_calcU16 (t85APU * apu) {
-	if (!apu) return 0;
+// The amount of master clocks in 0..end-1 on which the exact PWM output is high, with the given duty value
+static inline uint32_t t85APU_pwmHighTime (uint32_t end, uint32_t duty) {
+	uint32_t highPerPeriod = duty < 0xFF ? duty + 1 : 0x100;
+	return (end >> 8) * highPerPeriod + ((end & 0xFF) < highPerPeriod ? (end & 0xFF) : highPerPeriod);
+}
 
-	apu->ticks += apu->ticksPerClockCycle;
-	uint16_t output;
-	size_t totalSize = floor(apu->ticks);
-	for (size_t i = 0; i < totalSize; i++) {
+// Ticks the t85APU for the given amount of master clocks, returns the sum of the outputs on each of them
+static uint64_t t85APU_integrate (t85APU * apu, size_t ticks) {
+	uint64_t totalOutput = 0;
+	while (ticks) {
 		t85APU_tick (apu);
-		if (apu->quality >= 1 && totalSize > 0) apu->resamplingBuffer[i] = (apu->currentOutput)<<(16-apu->outputBitdepth);
+		totalOutput += apu->currentOutput;
+		ticks--;
+		if (!ticks || !apu->clockCycle) continue;
+
+		// The duty value of the output only changes on an update or an output queue shift,
+		// so every master clock up until the next one of those can be done at once
+		uint_fast16_t next = 512;
+		uint_fast16_t shiftCycle = apu->outputDelay & 511;
+		if (apu->outPending && shiftCycle < next) next = shiftCycle > apu->clockCycle ? shiftCycle : apu->clockCycle;
+		size_t run = next - apu->clockCycle < ticks ? next - apu->clockCycle : ticks;
+		if (!run) continue;
+
+		if (apu->outputType == T85APU_OUTPUT_PB4_EXACT) {
+			// The PWM is high for the first (duty + 1) master clocks of every 256
+			uint32_t duty = apu->outputQueue[0];
+			uint32_t end = apu->clockCycle + run;
+			totalOutput += 0xFF * (uint64_t)(t85APU_pwmHighTime(end, duty) - t85APU_pwmHighTime(apu->clockCycle, duty));
+			apu->currentOutput = ((end - 1) & 0xFF) > duty ? 0x00 : 0xFF;
+		} else {
+			totalOutput += (uint64_t)apu->currentOutput * run;
+		}
+		apu->clockCycle = (apu->clockCycle + run) & 511;
+		ticks -= run;
 	}
-	double totalOutput = 0;
-	double tmp;
-	apu->ticks = modf(apu->ticks, &tmp);
-	switch (apu->quality) {
-		case 1:
-			for (size_t i = 0; i < totalSize; i++) totalOutput += (double)apu->resamplingBuffer[i];
-			totalOutput /= totalSize;
-			output = (uint16_t)totalOutput;
-			break;
-		case 0:
-		default:
-			output = (apu->currentOutput)<<(16-apu->outputBitdepth);
-			break;
+	return totalOutput;
+}
+
+// Runs the raw output through the RC low-pass and the DC-blocking capacitor of the output stage
+static inline double t85APU_outputStage (t85APU * apu, double output) {
+	if (apu->lowPassRC) {
+		apu->lowPassState += apu->lowPassCoef * (output - apu->lowPassState);
+		output = apu->lowPassState;
+	}
+	if (apu->highPassRC) {
+		apu->highPassState += apu->highPassCoef * (output - apu->highPassState);
+		output -= apu->highPassState;
 	}
 	return output;
 }
 
-int16_t t85APU_calcS16 (t85APU * apu) {
-	if (!apu) return 0;
-
+// Calculates 1 sample, with the raw output shifted left by the given amount
+static uint32_t t85APU_resample (t85APU * apu, uint_fast8_t shift, bool isSigned) {
 	apu->ticks += apu->ticksPerClockCycle;
-	uint16_t output;
 	size_t totalSize = floor(apu->ticks);
-	for (size_t i = 0; i < totalSize; i++) {
-		t85APU_tick (apu);
-		if (apu->quality >= 1 && totalSize > 0) apu->resamplingBuffer[i] = (apu->currentOutput)<<(15-apu->outputBitdepth);
-	}
-	double totalOutput = 0;
 	double tmp;
 	apu->ticks = modf(apu->ticks, &tmp);
-	switch (apu->quality) {
-		case 1:
-			for (size_t i = 0; i < totalSize; i++) totalOutput += (double)apu->resamplingBuffer[i];
-			totalOutput /= totalSize;
-			output = (uint16_t)totalOutput;
-			break;
-		case 0:
-		default:
-			output = (apu->currentOutput)<<(15-apu->outputBitdepth);
-			break;
+	uint64_t totalOutput = t85APU_integrate(apu, totalSize);
+	bool averaged = apu->quality >= 1 && totalSize;	// Nothing gets ticked if the rate is above the clock
+
+	if (!apu->lowPassRC && !apu->highPassRC && !apu->qualityFade)
+		return averaged ? (uint32_t)((totalOutput << shift) / totalSize) : apu->currentOutput << shift;
+
+	double output = averaged ? (double)totalOutput / totalSize : apu->currentOutput;
+	if (apu->qualityFade) {
+		// Both the point and the averaged outputs are at hand, so the one at the old quality is faded out linearly
+		double faded = apu->fadeQuality >= 1 && totalSize ? (double)totalOutput / totalSize : apu->currentOutput;
+		output += (faded - output) * apu->qualityFade / (apu->qualityFadeLength + 1);
+		apu->qualityFade--;
 	}
-	return (int16_t)output;
+	output = t85APU_outputStage(apu, output);
+	// Without the DC-blocking capacitor the output stays positive, with it it is centered on 0
+	// (or on the middle of the range in the unsigned outputs)
+	int_fast8_t bits = shift + apu->outputBitdepth;
+	if (apu->highPassRC && !isSigned) output += (double)(1 << (apu->outputBitdepth - 1));
+	output = floor(ldexp(output, shift));
+	double min = isSigned ? -ldexp(1, bits) : 0, max = ldexp(1, bits) - 1;
+	if (output < min) output = min;
+	if (output > max) output = max;
+	return isSigned ? (uint32_t)(int32_t)output : (uint32_t)output;
 }
 
-uint32_t t85APU_calcU32 (t85APU * apu) {
+uint32_t t85APU_calc(t85APU *apu) {
 	if (!apu) return 0;
+	return t85APU_resample(apu, 0, false);
+}
 
-	apu->ticks += apu->ticksPerClockCycle;
-	uint32_t output;
-	size_t totalSize = floor(apu->ticks);
-	for (size_t i = 0; i < totalSize; i++) {
-		t85APU_tick (apu);
-		if (apu->quality >= 1 && totalSize > 0) apu->resamplingBuffer[i] = (apu->currentOutput)<<(32-apu->outputBitdepth);
-	}
-	double totalOutput = 0;
-	double tmp;
-	apu->ticks = modf(apu->ticks, &tmp);
-	switch (apu->quality) {
-		case 1:
-			for (size_t i = 0; i < totalSize; i++) totalOutput += (double)apu->resamplingBuffer[i];
-			totalOutput /= totalSize;
-			output = (uint32_t)totalOutput;
-			break;
-		case 0:
-		default:
-			output = (apu->currentOutput)<<(32-apu->outputBitdepth);
-			break;
-	}
-	return output;
+uint16_t t85APU_calcU16 (t85APU * apu) {
+	if (!apu) return 0;
+	return (uint16_t)t85APU_resample(apu, 16-apu->outputBitdepth, false);
 }
 
-int32_t t85APU_calcS32 (t85APU * apu) {
+int16_t t85APU_calcS16 (t85APU * apu) {
 	if (!apu) return 0;
+	return (int16_t)t85APU_resample(apu, 15-apu->outputBitdepth, true);
+}
 
-	apu->ticks += apu->ticksPerClockCycle;
-	uint32_t output;
-	size_t totalSize = floor(apu->ticks);
-	for (size_t i = 0; i < totalSize; i++) {
-		t85APU_tick (apu);
-		if (apu->quality >= 1 && totalSize > 0) apu->resamplingBuffer[i] = (apu->currentOutput)<<(31-apu->outputBitdepth);
-	}
-	double totalOutput = 0;
-	double tmp;
-	apu->ticks = modf(apu->ticks, &tmp);
-	switch (apu->quality) {
-		case 1:
-			for (size_t i = 0; i < totalSize; i++) totalOutput += (double)apu->resamplingBuffer[i];
-			totalOutput /= totalSize;
-			output = (uint16_t)totalOutput;
-			break;
-		case 0:
-		default:
-			output = (apu->currentOutput)<<(31-apu->outputBitdepth);
-			break;
-	}
-	return (int32_t)output;
+uint32_t t85APU_calcU32 (t85APU * apu) {
+	if (!apu) return 0;
+	return t85APU_resample(apu, 32-apu->outputBitdepth, false);
+}
+
+int32_t t85APU_calcS32 (t85APU * apu) {
+	if (!apu) return 0;
+	return (int32_t)t85APU_resample(apu, 31-apu->outputBitdepth, true);
 }
 
 void t85APU_setMute(t85APU * apu, uint_fast8_t channel, bool mute){
 	if (!apu) return;
 
 	if (channel > 4) return;
-	apu->channelMute[channel] = mute;
+	if (mute) apu->channelMutes |= 1<<channel;
+	else apu->channelMutes &= ~(1<<channel);
 }
\ No newline at end of file
@@ -25,65 +25,158 @@ extern "C"
 #undef T85APU_REGWRITE_BUFFER_SIZE
 #endif
 
+/*
+	The T85APU_TRACE define enables the event trace, which keeps the last T85APU_TRACE events (has to be a power of 2) of every t85APU in a ring buffer, see t85APU_traceRead. If it is 0 or less (or undefined), the trace points are compiled out.
+*/
+
+#if T85APU_TRACE < 1
+#undef T85APU_TRACE
+#elif T85APU_TRACE & (T85APU_TRACE - 1)
+#error "T85APU_TRACE has to be a power of 2"
+#endif
+
+/**
+ * @brief An event of the trace.
+ */
+typedef struct __t85apu_tracerecord {
+	uint64_t time;	// Master clocks since the t85APU was created, the updates are on multiples of 512
+	uint32_t value;	// Depends on the type
+	uint8_t type;	// T85APU_TRACE_XXX
+	uint8_t addr;	// The register number, or the envelope
+	uint8_t data;	// The data of the register write, or the new value
+} t85APU_traceRecord;
+
+/**
+ * @brief The latency from a register write to the output, split into the stages it goes through, see @c t85APU_getLatency.
+ */
+typedef struct __t85apu_latency {
+	uint64_t queue;	// Master clocks spent waiting for the writes ahead of it in the register write buffer, 512 per write, or 512 per update it takes to get to it in the burst mode
+	uint64_t update;	// Master clocks until the update that takes it from the buffer, plus 1 more update in the burst mode, where writes take effect on the next update
+	uint64_t output;	// Master clocks from that update to its output reaching the output (the outputDelay stages of the output queue)
+	uint64_t resampler;	// Master clocks from then to the end of the first sample that includes it, i.e. its last one is the one the write is heard on
+	uint64_t total;	// The sum of the stages, in master clocks
+	uint64_t samples;	// The amount of samples calculated up to and including the first one that includes it, e.g. 1 if the next one does
+	double filter;	// The group delay of the low-pass output stage at low frequencies, in samples (on top of the rest, 0 if it is disabled)
+} t85APU_latency;
+
 typedef struct __t85apu {
-	// Replica of internal RAM
-	uint16_t noiseLFSR;
-	uint16_t envPhaseAccs[2];
-	uint16_t smpPhaseAccs[2];
-	uint8_t envStates[2];
-	uint8_t envShape;
+	/*
+		The layout is by how often the fields are used, checked in t85apu.c:
+		- The first 64 bytes are everything that an update of the emulation uses on every update
+		- The next 64 bytes are the rest of what it uses: the envelopes' settings and states (only used while they run), the noise LFSR (only used when it steps) and the output
+		- Then what every sample uses, and then the settings and what the register writes use
+	*/
 
+	// Synthesis, replica of internal RAM and registers
+	uint16_t shiftedIncrements[8];	// This is simplified
+	uint16_t tonePhaseAccs[5];	// Phase accumulators
+	uint16_t noisePhaseAcc;
+	uint16_t envPhaseAccs[2];
+	uint32_t envCountdowns[2];	// Emulator-only: updates until the next carry into envStates, 0 if it has to be recalculated
 	uint8_t dutyCycles[5];
-	uint16_t noiseXOR;
 	uint8_t volumes[5];
 	uint8_t channelConfigs[5];
-	uint16_t envLdBuffer;
-
-	uint8_t increments[8];
-	uint16_t shiftedIncrements[8];	// This is simplified
-	uint8_t octaveValues[7];
-
-	// Replica of registers
-	// Phase accumulators
-	uint16_t tonePhaseAccs[5];
-	uint16_t noisePhaseAcc;
-
 	uint8_t envSmpVolume[4];
-
 	uint8_t noiseMask;
 	uint8_t envZeroFlg;
+	uint8_t channelMutes;	// Emulator-only: bit N mutes channel N
+	uint8_t outputBitdepth;	// Compile-time option
+	bool burstWrites;	// Compile-time option: BURST_WRITES of the firmware
 
-	// Compile-time options
-	uint_fast8_t outputType;
-	uint_fast8_t outputBitdepth;
-	uint_fast16_t outputDelay;
+	// Envelopes and noise
+	uint8_t octaveValues[7];
+	uint8_t envShape;
+	uint8_t envStates[2];
+	uint16_t noiseLFSR;
+	uint16_t noiseXOR;
 
-	// Sample rate converter
-	uint_fast16_t clockCycle;	// 0..511, on 0 an update is invoked
-	double ticksPerClockCycle;
-	double ticks;	// Reset when updated to keep precision
-	uint_fast8_t quality;	// 0 - no interpolation/alialising, 1 - averaging of outputs per sample
-	bool outPending;
-	uint32_t * resamplingBuffer;
-	
-	// Output
+	// Output of the update
+	uint16_t outputDelay;	// Compile-time option
 	uint16_t channelOutput[5];
-	uint32_t currentOutput;
+	uint16_t updateLatency;	// Emulator-only timing of the firmware: master clocks from the overflow to the interrupt of the update, only kept in the burst mode
 	uint32_t outputQueue[3];	// Only really applies to the PWM output
 
-	// Emulator-only options
-	bool channelMute[5];
+	// Alternative backend, runs the updates instead of the emulation if set
+	const struct __t85apu_backend * backend;
 
 	// Shift register emulation
+	size_t shiftRegCurIdx;
 	#ifdef T85APU_REGWRITE_BUFFER_SIZE
 	uint16_t shiftRegister[T85APU_REGWRITE_BUFFER_SIZE];
 	#else
 	uint16_t * shiftRegister;
+	#endif
+
+	// Sample rate converter
+	double ticksPerClockCycle;
+	double ticks;	// Reset when updated to keep precision
+	uint32_t currentOutput;
+	uint16_t clockCycle;	// 0..511, on 0 an update is invoked
+	uint8_t quality;	// 0 - no interpolation/alialising, 1 - averaging of outputs per sample
+	uint8_t outputType;	// Compile-time option
+	bool outPending;
+	uint8_t fadeQuality;	// The quality being crossfaded from
+	uint16_t qualityFade;	// Samples left of the crossfade
+	uint16_t qualityFadeLength;
+
+	// Only used by the register writes
+	uint8_t increments[8];
+	uint16_t envLdBuffer;
+	uint16_t smpPhaseAccs[2];
+	#ifndef T85APU_REGWRITE_BUFFER_SIZE
 	size_t shiftRegSize;
 	#endif
-	size_t shiftRegCurIdx;
+	void * backendData;
+
+	// Output stage
+	double outputRate;
+	double lowPassRC;	// 0 if disabled
+	double highPassRC;	// 0 if disabled
+	double lowPassCoef;
+	double highPassCoef;
+	double lowPassState;
+	double highPassState;
+
+	// Event trace
+	#ifdef T85APU_TRACE
+	t85APU_traceRecord traceRecords[T85APU_TRACE];
+	uint64_t traceHead;	// The amount of records ever written
+	uint64_t traceUpdates;	// The amount of updates ever run
+	uint32_t traceQueued;	// The amount of register writes ever pushed onto the register write buffer
+	uint32_t traceTaken;	// The amount of register writes ever taken from it
+	#endif
 } t85APU;
 
+/**
+ * @brief An alternative implementation of the t85APU's updates, e.g. the recompiled firmware of t85apu_firmware.h.
+ */
+typedef struct __t85apu_backend {
+	/**
+	 * @brief Runs 1 update (512 master clocks), taking the register writes from the shift register with @c t85APU_shiftReg. Has to set @c outputQueue[0] to the output from the start of the update, and @c outputQueue[1] to the output from @c outputDelay master clocks into it.
+	 */
+	void (*update) (t85APU * apu);
+	/**
+	 * @brief Resets @c backendData along with the t85APU, can be a null pointer.
+	 */
+	void (*reset) (t85APU * apu);
+	/**
+	 * @brief Makes @c backendData of @p dst (which is a copy of @p src) its own, can be a null pointer if there is nothing to copy. Returns false if an error has occured.
+	 */
+	bool (*copy) (t85APU * dst, const t85APU * src);
+	/**
+	 * @brief Frees @c backendData, can be a null pointer.
+	 */
+	void (*free) (t85APU * apu);
+	/**
+	 * @brief The amount of master clocks after the start of an update at which the output switches to @c outputQueue[1], 1..511.
+	 */
+	uint_fast16_t outputDelay;
+	/**
+	 * @brief The amount of master clocks from the start of the update that takes a register write to the output changing from it, for @c t85APU_getLatency.
+	 */
+	uint_fast32_t writeLatency;
+} t85APU_backend;
+
 /**
  * @name T85APU_OUTPUT defines
  * Output types for t85APU.
@@ -95,11 +188,42 @@ typedef struct __t85apu {
  */
 #define T85APU_OUTPUT_PB4 0
 /**
- * @brief Output type for t85APU: emulates the PWM output from the @c OUT pin as the exact PWM (at the rate of (t85APU's clock / 256)). Can take more CPU time.
+ * @brief Output type for t85APU: emulates the PWM output from the @c OUT pin as the exact PWM (at the rate of (t85APU's clock / 256)). Its high time is integrated in closed form, so it costs about the same as @c T85APU_OUTPUT_PB4.
  */
 #define T85APU_OUTPUT_PB4_EXACT 1
 ///@}
 
+/**
+ * @name T85APU_TRACE types
+ * Types of the events of the trace.
+ */
+///@{
+/**
+ * @brief A register write got pushed onto the register write buffer. @c value is its sequence number, counting from 1.
+ */
+#define T85APU_TRACE_QUEUE 0
+/**
+ * @brief A register write did not fit into the register write buffer, and got dropped.
+ */
+#define T85APU_TRACE_DROP 1
+/**
+ * @brief A register write got applied by the emulation. @c value is the sequence number of the last write taken from the register write buffer, i.e. this one's unless the write did not come from it.
+ */
+#define T85APU_TRACE_APPLY 2
+/**
+ * @brief The state of envelope @c addr overflowed (into @c data), inverting its slope if it alternates.
+ */
+#define T85APU_TRACE_ENV_OVERFLOW 3
+/**
+ * @brief Envelope @c addr overflowed and stopped, as it holds.
+ */
+#define T85APU_TRACE_ENV_HOLD 4
+/**
+ * @brief The noise output flipped, changing the mask of the channel configs to @c data.
+ */
+#define T85APU_TRACE_NOISE_MASK 5
+///@}
+
 /**
  * @name t85APU functions
  * Functions interacting with the t85APU.
@@ -136,6 +260,7 @@ void t85APU_delete (t85APU * apu);
 /**
  * @brief Resets all internal variables of the t85APU to their default initalization state - effectively the same as pulling the @c /RESET pin low on real hardware.
  * @note This does NOT clear the register write buffer as it is considered emulated external hardware. This also does not reset the settings of the t85APU (clock speed, sample rate, output type, quality and muting).
+ * The output and the sample rate converter are reset too, so with the settings of a new t85APU and an empty register write buffer, it renders exactly the same as a new one.
  * 
  * @param apu The t85APU instance to reset.
  */
@@ -143,12 +268,22 @@ void t85APU_reset (t85APU * apu);
 
 /**
  * @brief Sets clock speed and sample rate of the t85APU.
+ * @note This does not allocate any memory, and the phase of the master clock carries over, so it is safe to call it between any 2 samples (e.g. to pitch-bend the entire chip by varying its clock).
  * 
  * @param apu The t85APU instance to set the clock speed and sample rate for.
  * @param clock The master clock speed of the t85APU, in Hz. If not set (i.e. 0), will default to 8000000 - 8MHz. 
  * @param rate The output sample rate of the t85APU, in Hz. If not set (i.e. 0), will default to (clock / 512).
  */
 void t85APU_setClocknRate (t85APU * apu, double clock, double rate);
+/**
+ * @brief Sets up the emulation of the analog output stage that follows the @c OUT pin on real boards - an RC low-pass filter followed by a DC-blocking capacitor. It is applied to every sample as it is calculated. Both are disabled by default.
+ * @note With the DC-blocking capacitor enabled, the output is centered on 0 in the @c t85APU_calcSXX functions, and on the middle of the range in the others.
+ * 
+ * @param apu The t85APU instance to set the output stage for.
+ * @param lowPassRC The time constant of the low-pass filter (its resistance in Ω times its capacitance in F), in seconds. If not set (i.e. 0), the low-pass filter is disabled.
+ * @param highPassRC The time constant of the DC-blocking capacitor (its capacitance in F times the load resistance in Ω), in seconds. If not set (i.e. 0), the DC-blocking capacitor is disabled.
+ */
+void t85APU_setOutputFilter (t85APU * apu, double lowPassRC, double highPassRC);
 /**
  * @brief Sets the output type of the t85APU.
  * 
@@ -165,6 +300,23 @@ void t85APU_setOutputType (t85APU * apu, uint_fast8_t outputType);
  * @li 1 averages all of the outputs in that tick and makes that the final output. Takes more CPU time, but doesn't have alialising issues. 
  */
 void t85APU_setQuality	  (t85APU * apu, uint_fast8_t quality);
+/**
+ * @brief Sets the sample rate converter quality like @c t85APU_setQuality, but crossfades from the output at the current quality to the output at the new one, so that switching does not click.
+ * 
+ * @param apu The t85APU instance to set the quality of the sample rate converter for.
+ * @param quality The quality setting, same as in @c t85APU_setQuality.
+ * @param samples The length of the crossfade, in samples. If 0, it switches immediately.
+ */
+void t85APU_fadeQuality	  (t85APU * apu, uint_fast8_t quality, uint_fast16_t samples);
+
+/**
+ * @brief Enables or disables the burst mode of the firmware (assembled with @c BURST_WRITES), which does the register writes after the output of an update, and keeps doing them while there is time left before the next one. The amount of writes done on each update is emulated from the cycle counts of the firmware's paths. Disabled by default.
+ * @note The register writes then take effect on the update after the one they are taken on, like on the firmware. This does not apply to backends, the firmware backend runs the firmware as it is recompiled.
+ * 
+ * @param apu The t85APU instance to set the burst mode for.
+ * @param burstWrites @c true to do as many register writes per update as the firmware's burst mode does, @c false to do at most one per update.
+ */
+void t85APU_setBurstWrites (t85APU * apu, bool burstWrites);
 
 /**
  * @brief Pushes data onto the register write buffer of the t85APU.
@@ -174,6 +326,24 @@ void t85APU_setQuality	  (t85APU * apu, uint_fast8_t quality);
  * @param data The data to write to the register.
  */
 void t85APU_writeReg (t85APU * apu, uint8_t addr, uint8_t data);
+/**
+ * @brief Pushes several register writes onto the register write buffer of the t85APU at once, in order. The ones that do not fit into it are dropped, like with @c t85APU_writeReg.
+ * 
+ * @param apu The t85APU instance to push the register writes onto.
+ * @param pairs The register number and data of each write.
+ * @param count The amount of writes.
+ * @return The amount of writes that fit into the buffer, the first ones of @p pairs.
+ */
+size_t t85APU_writeRegs (t85APU * apu, const uint8_t (*pairs)[2], size_t count);
+/**
+ * @brief Pushes several pre-packed register writes onto the register write buffer of the t85APU at once, in order, with a single copy. The ones that do not fit into it are dropped, like with @c t85APU_writeReg.
+ * 
+ * @param apu The t85APU instance to push the register writes onto.
+ * @param writes The writes as the buffer holds them, i.e. @c (0x8000 | addr << 8 | data). Bit 15 has to be set on all of them.
+ * @param count The amount of writes.
+ * @return The amount of writes that fit into the buffer, the first ones of @p writes.
+ */
+size_t t85APU_writePackedRegs (t85APU * apu, const uint16_t * writes, size_t count);
 
 /**
  * @brief Calculates 1 sample and return its raw value.
@@ -211,6 +381,32 @@ uint32_t t85APU_calcU32 (t85APU * apu);
  */
 int32_t t85APU_calcS32 (t85APU * apu);
 
+/**
+ * @brief Moves the t85APU forward by the given amount of master clocks without calculating any samples, e.g. to seek in a song. The result is bit-exact with ticking it that many times.
+ * The writes pending in the register write buffer are taken on the updates they would be, and the updates in between that take no write are skipped in closed form, so seeking by minutes takes about as long as the writes in them.
+ * To apply timestamped writes (e.g. from a register log), advance up to the timestamp of each one, then push it with @c t85APU_writeReg.
+ * @note In the burst mode, or with a backend, every update is run, since their cycle counts have no closed form. That still skips the output and the sample rate converter.
+ * 
+ * @param apu The t85APU instance.
+ * @param masterClocks The amount of master clocks to move forward by.
+ */
+void t85APU_advance (t85APU * apu, uint64_t masterClocks);
+/**
+ * @brief Runs 1 update right away, without ticking its master clocks, taking a register write from the register write buffer like it always does. For previews, see @c t85APU_regLog_preview.
+ * @note The output queue is not advanced, so switching back to the @c t85APU_calcXXX functions afterwards gives the output of the last update a PWM cycle early.
+ * 
+ * @param apu The t85APU instance.
+ * @return The raw output of the update (0..255).
+ */
+uint32_t t85APU_runUpdate (t85APU * apu);
+/**
+ * @brief Advances the state of the t85APU by the given amount of updates in closed form, without calculating their output, which costs about as much as 1 update (the noise LFSR is jumped over all of its steps in the amount of bits of their count). For previews, see @c t85APU_regLog_preview.
+ * @note The register write buffer is not taken from, so the updates that have a write pending should be run with @c t85APU_runUpdate instead. The cycle counts of the burst mode are not calculated either. Backends have no closed form, so they run every update.
+ * 
+ * @param apu The t85APU instance.
+ * @param updates The amount of updates to skip.
+ */
+void t85APU_skipUpdates (t85APU * apu, uint32_t updates);
 
 /**
  * @brief Tells you whether the register write buffer has at least one write pending.
@@ -221,6 +417,48 @@ int32_t t85APU_calcS32 (t85APU * apu);
  */
 bool t85APU_shiftRegisterPending (t85APU * apu);
 
+/**
+ * @brief Calculates the current latency from a register write to the output: how long it waits in the register write buffer, for the update that takes it, in the output queue, and in the sample rate converter, from the current state.
+ * A write pushed now lands at position @c shiftRegCurIdx, so the latency of the next write is <tt>t85APU_getLatency(apu, apu->shiftRegCurIdx, &latency)</tt>, and every position after it is 512 master clocks later outside of the burst mode.
+ * @note In the burst mode, the updates are replayed on a copy of the emulator to find how many writes each of them takes, so it costs an update per write ahead of it, and only the positions up to @c shiftRegCurIdx (the writes already in the buffer, and the next one) can be calculated. With a backend, the @c output stage is its @c writeLatency.
+ * The samples are counted in closed form, so it costs the same for any position. Only right after the sample rate changed (or if it is over the clock) they are stepped one by one.
+ * 
+ * @param apu The t85APU instance.
+ * @param position The position of the write in the register write buffer, 0 being the next one to be taken.
+ * @param latency Where to store the latency.
+ * @return true if the latency was calculated.
+ * @return false if the position is past the end of the buffer, i.e. a write there would be dropped, or past @c shiftRegCurIdx in the burst mode.
+ */
+bool t85APU_getLatency (const t85APU * apu, size_t position, t85APU_latency * latency);
+
+/**
+ * @brief Gets the size of the state saved by @c t85APU_saveState, which depends on the size of the register write buffer.
+ * 
+ * @param apu The t85APU instance.
+ * @return The size of the state in bytes.
+ */
+size_t t85APU_getStateSize (const t85APU * apu);
+/**
+ * @brief Saves the state of the emulation, i.e. everything that changes while it runs, including the register write buffer, in a portable little-endian format.
+ * @note The settings (clock speed, sample rate, output type, quality, output stage, mutes and burst mode) are not saved, and neither is the state of a backend, so it fails with one.
+ * 
+ * @param apu The t85APU instance.
+ * @param buffer Where to save it to, @c t85APU_getStateSize bytes.
+ * @return true if the state was saved.
+ * @return false if an error has occured.
+ */
+bool t85APU_saveState (const t85APU * apu, uint8_t * buffer);
+/**
+ * @brief Restores the state saved by @c t85APU_saveState. The t85APU has to have a register write buffer of the same size, and no backend.
+ * 
+ * @param apu The t85APU instance.
+ * @param buffer The saved state.
+ * @param size The size of the saved state in bytes.
+ * @return true if the state was restored.
+ * @return false if an error has occured, in which case the t85APU is left as it was.
+ */
+bool t85APU_loadState (t85APU * apu, const uint8_t * buffer, size_t size);
+
 /**
  * @brief Enables or disables channel muting in the total output of @c t85APU_calcXXX functions.
  * 
@@ -230,6 +468,35 @@ bool t85APU_shiftRegisterPending (t85APU * apu);
  */
 void t85APU_setMute(t85APU * apu, uint_fast8_t channel, bool mute);
 
+/**
+ * @brief Replaces the emulation of the t85APU's updates with an alternative backend. The previous backend, if any, is freed.
+ * @note The settings, the register write buffer and the output stage are kept, and still work the same way with the backend.
+ * 
+ * @param apu The t85APU instance to set the backend for.
+ * @param backend The backend. If set to a null pointer, the built-in emulation is used again.
+ * @param data The data of the backend, stored into @c backendData.
+ */
+void t85APU_setBackend (t85APU * apu, const t85APU_backend * backend, void * data);
+/**
+ * @brief Takes the oldest register write out of the register write buffer, for use by backends.
+ * 
+ * @param apu The t85APU instance.
+ * @param newData What to shift into the end of the buffer, usually 0.
+ * @return The register write in the same format as in the buffer: @c 0x8000 set if it is pending, the register number in the high byte and the data in the low byte.
+ */
+uint16_t t85APU_shiftReg (t85APU * apu, uint16_t newData);
+/**
+ * @brief Copies the events of the trace from the ring buffer, oldest first. It is lock-free, so it can be called from another thread than the one running the t85APU.
+ * @note Only the last (T85APU_TRACE - 1) events are kept. If the events at @p cursor have already been overwritten, the cursor skips to the oldest one that is still kept, so the amount of lost events is how far it moved past where it was minus the return value. Without the @c T85APU_TRACE define, there is never anything to read.
+ * 
+ * @param apu The t85APU instance.
+ * @param cursor The sequence number of the next event to read, counting from 0. Set it to 0 before the first call, and it is advanced past the copied events.
+ * @param records Where to copy the events to.
+ * @param count The maximum amount of events to copy.
+ * @return The amount of events copied.
+ */
+size_t t85APU_traceRead (t85APU * apu, uint64_t * cursor, t85APU_traceRecord * records, size_t count);
+
 ///@}
 
 #ifdef __cplusplus
@@ -55,17 +55,27 @@ class t85APUHandle {
 		/**
 		 * @brief Resets all internal variables of the t85APU to their default initalization state - effectively the same as pulling the @c /RESET pin low on real hardware.
 		 * @note This does NOT clear the register write buffer as it is considered emulated external hardware. This also does not reset the settings of the t85APU (clock speed, sample rate, output type, quality and muting).
+		 * The output and the sample rate converter are reset too, so with the settings of a new t85APU and an empty register write buffer, it renders exactly the same as a new one.
 		 * 
 		 */
 		inline void reset() { t85APU_reset(apu); }
 
 		/**
 		 * @brief Sets clock speed and sample rate of the t85APU.
+		 * @note This does not allocate any memory, and the phase of the master clock carries over, so it is safe to call it between any 2 samples (e.g. to pitch-bend the entire chip by varying its clock).
 		 * 
 		 * @param clock The master clock speed of the t85APU, in Hz. If not set (i.e. 0), will default to 8000000 - 8MHz. 
 		 * @param rate The output sample rate of the t85APU, in Hz. If not set (i.e. 0), will default to (clock / 512).
 		 */
 		inline void setClocknRate(double clock, double rate) { t85APU_setClocknRate(apu, clock, rate); }
+		/**
+		 * @brief Sets up the emulation of the analog output stage that follows the @c OUT pin on real boards - an RC low-pass filter followed by a DC-blocking capacitor. It is applied to every sample as it is calculated. Both are disabled by default.
+		 * @note With the DC-blocking capacitor enabled, the output is centered on 0 in the @c calcSXX functions, and on the middle of the range in the others.
+		 * 
+		 * @param lowPassRC The time constant of the low-pass filter (its resistance in Ω times its capacitance in F), in seconds. If not set (i.e. 0), the low-pass filter is disabled.
+		 * @param highPassRC The time constant of the DC-blocking capacitor (its capacitance in F times the load resistance in Ω), in seconds. If not set (i.e. 0), the DC-blocking capacitor is disabled.
+		 */
+		inline void setOutputFilter(double lowPassRC, double highPassRC) { t85APU_setOutputFilter(apu, lowPassRC, highPassRC); }
 		/**
 		 * @brief Sets the output type of the t85APU.
 		 * 
@@ -80,6 +90,19 @@ class t85APUHandle {
 		 * @li 1 averages all of the outputs in that tick and makes that the final output. Takes more CPU time, but doesn't have alialising issues. 
 		 */
 		inline void setQuality(uint_fast8_t quality) { t85APU_setQuality(apu, quality); }
+		/**
+		 * @brief Sets the sample rate converter quality like @c setQuality, but crossfades from the output at the current quality to the output at the new one, so that switching does not click.
+		 * 
+		 * @param quality The quality setting, same as in @c setQuality.
+		 * @param samples The length of the crossfade, in samples. If 0, it switches immediately.
+		 */
+		inline void fadeQuality(uint_fast8_t quality, uint_fast16_t samples) { t85APU_fadeQuality(apu, quality, samples); }
+		/**
+		 * @brief Enables or disables the burst mode of the firmware (assembled with @c BURST_WRITES), which does the register writes after the output of an update, and keeps doing them while there is time left before the next one. Disabled by default.
+		 * 
+		 * @param burstWrites @c true to do as many register writes per update as the firmware's burst mode does, @c false to do at most one per update.
+		 */
+		inline void setBurstWrites(bool burstWrites) { t85APU_setBurstWrites(apu, burstWrites); }
 
 		/**
 		 * @brief Pushes data onto the register write buffer of the t85APU.
@@ -88,6 +111,33 @@ class t85APUHandle {
 		 * @param data The data to write to the register.
 		 */
 		inline void writeReg(uint8_t addr, uint8_t data) {t85APU_writeReg(apu, addr, data); }
+		/**
+		 * @brief Pushes several register writes onto the register write buffer of the t85APU at once, in order. The ones that do not fit into it are dropped.
+		 * 
+		 * @param pairs The register number and data of each write.
+		 * @param count The amount of writes.
+		 * @return The amount of writes that fit into the buffer.
+		 */
+		inline size_t writeRegs(const uint8_t (*pairs)[2], size_t count) { return t85APU_writeRegs(apu, pairs, count); }
+		/**
+		 * @brief Pushes several register writes onto the register write buffer of the t85APU at once, in order. The ones that do not fit into it are dropped.
+		 *
+		 * @param packets A contiguous range (with @c data() and @c size()) of 2-byte writes with the register number first, e.g. a t85APUPatch of t85apu_patch.hpp.
+		 * @return The amount of writes that fit into the buffer.
+		 */
+		template <typename Packets>
+		inline size_t writeRegs(const Packets & packets) {
+			static_assert(sizeof(*packets.data()) == 2, "The writes have to be laid out like a pair of bytes");
+			return t85APU_writeRegs(apu, reinterpret_cast<const uint8_t (*)[2]>(packets.data()), packets.size());
+		}
+		/**
+		 * @brief Pushes several pre-packed register writes onto the register write buffer of the t85APU at once, in order, with a single copy. The ones that do not fit into it are dropped.
+		 * 
+		 * @param writes The writes as the buffer holds them, i.e. @c (0x8000 | addr << 8 | data).
+		 * @param count The amount of writes.
+		 * @return The amount of writes that fit into the buffer.
+		 */
+		inline size_t writePackedRegs(const uint16_t * writes, size_t count) { return t85APU_writePackedRegs(apu, writes, count); }
 
 		/**
 		 * @brief Calculates 1 sample and return its raw value.
@@ -119,6 +169,48 @@ class t85APUHandle {
 		 * @return The sample value, mapped from its raw value to 0..2147483647.
 		 */
 		inline int32_t calcS32 () { return t85APU_calcS32(apu); }
+		/**
+		 * @brief Moves the t85APU forward by the given amount of master clocks without calculating any samples, e.g. to seek in a song. The result is bit-exact with ticking it that many times.
+		 * @note In the burst mode, or with a backend, every update is run, since their cycle counts have no closed form.
+		 * 
+		 * @param masterClocks The amount of master clocks to move forward by.
+		 */
+		inline void advance (uint64_t masterClocks) { t85APU_advance(apu, masterClocks); }
+		/**
+		 * @brief Runs 1 update right away, without ticking its master clocks, taking a register write from the register write buffer like it always does. For previews.
+		 * 
+		 * @return The raw output of the update (0..255).
+		 */
+		inline uint32_t runUpdate () { return t85APU_runUpdate(apu); }
+		/**
+		 * @brief Advances the state of the t85APU by the given amount of updates in closed form, without calculating their output. For previews.
+		 * @note The register write buffer is not taken from, so the updates that have a write pending should be run with @c runUpdate instead.
+		 * 
+		 * @param updates The amount of updates to skip.
+		 */
+		inline void skipUpdates (uint32_t updates) { t85APU_skipUpdates(apu, updates); }
+
+		/**
+		 * @brief Gets the size of the state saved by @c saveState.
+		 *
+		 * @return The size of the state in bytes.
+		 */
+		inline size_t getStateSize () { return t85APU_getStateSize(apu); }
+		/**
+		 * @brief Saves the state of the emulation (but not the settings) in a portable little-endian format. Fails with a backend.
+		 *
+		 * @param buffer Where to save it to, @c getStateSize bytes.
+		 * @return true if the state was saved.
+		 */
+		inline bool saveState (uint8_t * buffer) { return t85APU_saveState(apu, buffer); }
+		/**
+		 * @brief Restores the state saved by @c saveState. The register write buffer has to be of the same size.
+		 *
+		 * @param buffer The saved state.
+		 * @param size The size of the saved state in bytes.
+		 * @return true if the state was restored.
+		 */
+		inline bool loadState (const uint8_t * buffer, size_t size) { return t85APU_loadState(apu, buffer, size); }
 
 		/**
 		 * @brief Tells you whether the register write buffer has at least one write pending.
@@ -127,6 +219,30 @@ class t85APUHandle {
 		 * @return false if there are no writes pending (aka the buffer is completely empty).
 		 */
 		inline bool shiftRegisterPending() { return t85APU_shiftRegisterPending(apu); }
+		/**
+		 * @brief Calculates the current latency from a register write at the given position of the register write buffer to the output, split into its stages.
+		 * 
+		 * @param position The position of the write in the buffer, 0 being the next one to be taken.
+		 * @param latency Where to store the latency.
+		 * @return true if the latency was calculated, false if a write at that position would be dropped (or is past the writes pushed so far, in the burst mode).
+		 */
+		inline bool getLatency (size_t position, t85APU_latency & latency) { return t85APU_getLatency(apu, position, &latency); }
+		/**
+		 * @brief Calculates the current latency from a register write pushed now to the output, split into its stages.
+		 * 
+		 * @param latency Where to store the latency.
+		 * @return true if the latency was calculated, false if the buffer is full and the write would be dropped.
+		 */
+		inline bool getLatency (t85APU_latency & latency) { return t85APU_getLatency(apu, apu->shiftRegCurIdx, &latency); }
+		/**
+		 * @brief Copies the events of the trace (with the @c T85APU_TRACE define) from the ring buffer, oldest first.
+		 * 
+		 * @param cursor The sequence number of the next event to read, set it to 0 before the first call. It is advanced past the copied events, and skips ahead past the lost ones.
+		 * @param records Where to copy the events to.
+		 * @param count The maximum amount of events to copy.
+		 * @return The amount of events copied.
+		 */
+		inline size_t traceRead(uint64_t & cursor, t85APU_traceRecord * records, size_t count) { return t85APU_traceRead(apu, &cursor, records, count); }
 
 		/**
 		 * @brief Enables or disables channel muting in the total output of @c t85APU_calcXXX functions.
@@ -156,13 +272,17 @@ class t85APUHandle {
 			apu->shiftRegister = (uint16_t *)calloc(__apu->shiftRegSize, sizeof(uint16_t));
 			if (!apu->shiftRegister) {
 				fprintf(stderr, "Could not allocate t85apu shift register, deleting the t85APU\n");
-				if (apu->resamplingBuffer) free(apu->resamplingBuffer);
 				free(apu);
 				apu = nullptr;
 				return;
 			}
 			memcpy(apu->shiftRegister, __apu->shiftRegister, apu->shiftRegSize);
 			#endif
+			if (apu->backend && apu->backend->copy && !apu->backend->copy(apu, __apu)) {
+				apu->backend = nullptr;
+				t85APU_delete(apu);
+				apu = nullptr;
+			}
 		}
 		/**
 		 * @brief Move constructor.
@@ -190,13 +310,17 @@ class t85APUHandle {
 			apu->shiftRegister = (uint16_t *)calloc(__apu.apu->shiftRegSize, sizeof(uint16_t));
 			if (!apu->shiftRegister) {
 				fprintf(stderr, "Could not allocate t85apu shift register, deleting the t85APU\n");
-				if (apu->resamplingBuffer) free(apu->resamplingBuffer);
 				free(apu);
 				apu = nullptr;
 				return;
 			}
 			memcpy(apu->shiftRegister, __apu.apu->shiftRegister, apu->shiftRegSize);
 			#endif
+			if (apu->backend && apu->backend->copy && !apu->backend->copy(apu, __apu.apu)) {
+				apu->backend = nullptr;
+				t85APU_delete(apu);
+				apu = nullptr;
+			}
 		}
 		/**
 		 * @brief Move constructor.
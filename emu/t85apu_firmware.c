@@ -0,0 +1,242 @@
+/*
+t85apu_firmware.c
+Part of the ATtiny85APU emulation library
+Written by alexmush
+2024-2024
+*/
+
+#include "t85apu_firmware.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// I/O addresses of the ATtiny85 (add 0x20 for the data address)
+#define IO_USICR	0x0D
+#define IO_USIDR	0x0F
+#define IO_PINB		0x16
+#define IO_DDRB		0x17
+#define IO_PORTB	0x18
+#define IO_OCR1B	0x2B
+#define IO_GTCCR	0x2C
+#define IO_OCR1C	0x2D
+#define IO_TCNT1	0x2F
+#define IO_TCCR1	0x30
+#define IO_TIFR		0x38
+#define IO_TIMSK	0x39
+#define IO_SPL		0x3D
+#define IO_SPH		0x3E
+#define IO_SREG		0x3F
+
+#define USICLK	1
+#define USICS0	2
+#define USIWM0	4
+#define TOV1	2	// Same bit as TOIE1 in TIMSK
+#define PSR0	0
+#define PSR1	1
+#define DI		0	// PINB0
+
+#define OVF1_VECTOR	4
+#define INTERRUPT_CYCLES	4
+#define RAMEND	0x25F
+#define BOOT_CYCLE_LIMIT	65536	// The firmware has to start its timer before this
+
+#define IO(io) (fw->data[0x20 + (io)])
+
+t85APU_firmware * t85APU_firmware_new (void) {
+	t85APU_firmware * fw = (t85APU_firmware *) calloc(1, sizeof(t85APU_firmware));
+	if (!fw) {
+		fprintf(stderr, "Could not allocate t85APU firmware\n");
+		return NULL;
+	}
+	t85APU_firmware_reset(fw);
+	return fw;
+}
+
+void t85APU_firmware_reset (t85APU_firmware * fw) {
+	if (!fw) return;
+	memset(fw->data, 0, sizeof(fw->data));
+	IO(IO_SPL) = RAMEND & 0xFF;
+	IO(IO_SPH) = RAMEND >> 8;
+	IO(IO_OCR1C) = 0xFF;
+	fw->pc = 0;
+	fw->cycles = 0;
+	fw->event = 0;
+	fw->irqHold = false;
+	fw->halted = false;
+
+	fw->timerRunning = false;
+	fw->timerStart = 0;
+	fw->timerPrescale = 1;
+	fw->nextOverflow = 0;
+	fw->pwmDuty = 0;
+	fw->inputBits = 0;
+
+	// Boot, the updates start on the first overflow of the timer
+	while (!fw->timerRunning && !fw->halted && fw->cycles < BOOT_CYCLE_LIMIT)
+		t85APU_firmware_runUntil(fw, fw->cycles + 1);
+	if (!fw->timerRunning) {
+		fprintf(stderr, "The t85APU firmware did not start its timer\n");
+		fw->halted = true;
+	}
+	fw->frameStart = fw->timerRunning ? fw->nextOverflow : fw->cycles;
+	t85APU_firmware_runUntil(fw, fw->frameStart);
+}
+
+void t85APU_firmware_delete (t85APU_firmware * fw) {
+	if (!fw) return;
+	free(fw);
+}
+
+void t85APU_firmware_runUntil (t85APU_firmware * fw, uint64_t cycle) {
+	if (!fw) return;
+	for (;;) {
+		// Also done after the last instruction, which can end past the overflow
+		if (fw->timerRunning && fw->cycles >= fw->nextOverflow) {
+			// In the PWM mode OCR1B only takes effect on an overflow
+			fw->pwmDuty = IO(IO_OCR1B);
+			IO(IO_TIFR) |= 1<<TOV1;
+			fw->nextOverflow += 256 * fw->timerPrescale;
+			continue;
+		}
+		if (fw->cycles >= cycle) break;
+		if (fw->halted) {
+			fw->cycles = cycle;
+			continue;
+		}
+
+		fw->event = cycle;
+		if (fw->irqHold) {
+			fw->irqHold = false;
+			fw->event = fw->cycles + 1;
+		} else if ((IO(IO_SREG) & 0x80) && (IO(IO_TIFR) & IO(IO_TIMSK) & 1<<TOV1)) {
+			t85APU_firmware_push(fw, fw->pc & 0xFF);
+			t85APU_firmware_push(fw, fw->pc >> 8);
+			IO(IO_SREG) &= 0x7F;
+			IO(IO_TIFR) &= ~(1<<TOV1);
+			fw->pc = OVF1_VECTOR;
+			fw->cycles += INTERRUPT_CYCLES;
+			continue;
+		}
+		if (fw->timerRunning && fw->event > fw->nextOverflow) fw->event = fw->nextOverflow;
+		t85APU_firmware_run(fw);
+	}
+}
+
+// The DI pin, driven by the register write buffer of the t85APU
+static inline uint8_t t85APU_firmware_inputBit (t85APU_firmware * fw) {
+	if (!fw->apu || fw->inputBits >= 16) return 0;
+	return (fw->apu->shiftRegister[0] >> (15 - fw->inputBits)) & 1;
+}
+
+static inline uint8_t t85APU_firmware_timerCount (t85APU_firmware * fw) {
+	if (!fw->timerRunning) return IO(IO_TCNT1);
+	return ((fw->cycles - fw->timerStart) / fw->timerPrescale) & 0xFF;
+}
+
+uint8_t t85APU_firmware_in (t85APU_firmware * fw, uint8_t io) {
+	switch (io) {
+		case IO_PINB:
+			return (IO(IO_PORTB) & IO(IO_DDRB)) | (t85APU_firmware_inputBit(fw) << DI);
+		case IO_TCNT1:
+			return t85APU_firmware_timerCount(fw);
+		default:
+			return IO(io);
+	}
+}
+
+void t85APU_firmware_out (t85APU_firmware * fw, uint8_t io, uint8_t value) {
+	switch (io) {
+		case IO_USICR:
+			// Only the software clock strobe of the three-wire mode is used by the firmware
+			if ((value & 1<<USICLK) && (value & 3<<USIWM0) && !(value & 3<<USICS0)) {
+				IO(IO_USIDR) = IO(IO_USIDR) << 1 | t85APU_firmware_inputBit(fw);
+				if (++fw->inputBits >= 16) {
+					if (fw->apu) t85APU_shiftReg(fw->apu, 0);
+					fw->inputBits = 0;
+				}
+			}
+			IO(io) = value & ~(1<<USICLK | 1);	// The strobes read as 0
+			break;
+		case IO_TIFR:
+			IO(io) &= ~value;
+			break;
+		case IO_GTCCR:
+			IO(io) = value & ~(1<<PSR1 | 1<<PSR0);
+			break;
+		case IO_TCNT1:
+			IO(io) = value;
+			fw->timerStart = fw->cycles - (uint64_t)value * fw->timerPrescale;
+			fw->nextOverflow = fw->timerStart + 256 * fw->timerPrescale;
+			break;
+		case IO_TCCR1: {
+			uint8_t count = t85APU_firmware_timerCount(fw);
+			uint_fast8_t clockSelect = value & 0x0F;
+			IO(io) = value;
+			IO(IO_TCNT1) = count;
+			fw->timerRunning = clockSelect != 0;
+			if (fw->timerRunning) {
+				fw->timerPrescale = 1 << (clockSelect - 1);
+				fw->timerStart = fw->cycles - (uint64_t)count * fw->timerPrescale;
+				fw->nextOverflow = fw->timerStart + 256 * fw->timerPrescale;
+			}
+			break;
+		}
+		default:
+			IO(io) = value;
+			break;
+	}
+	if (fw->timerRunning && fw->event > fw->nextOverflow) fw->event = fw->nextOverflow;
+}
+
+// t85APU backend
+
+static void t85APU_firmware_update (t85APU * apu) {
+	t85APU_firmware * fw = (t85APU_firmware *) apu->backendData;
+	fw->apu = apu;
+	// The duty value latched on each of the 2 overflows of the update
+	t85APU_firmware_runUntil(fw, fw->frameStart + 1);
+	apu->outputQueue[0] = fw->pwmDuty;
+	t85APU_firmware_runUntil(fw, fw->frameStart + 257);
+	apu->outputQueue[1] = fw->pwmDuty;
+	fw->frameStart += 512;
+}
+
+static void t85APU_firmware_resetBackend (t85APU * apu) {
+	t85APU_firmware * fw = (t85APU_firmware *) apu->backendData;
+	fw->apu = apu;
+	t85APU_firmware_reset(fw);
+}
+
+static bool t85APU_firmware_copy (t85APU * dst, const t85APU * src) {
+	t85APU_firmware * fw = (t85APU_firmware *) malloc(sizeof(t85APU_firmware));
+	if (!fw) {
+		fprintf(stderr, "Could not allocate t85APU firmware\n");
+		return false;
+	}
+	memcpy(fw, src->backendData, sizeof(t85APU_firmware));
+	fw->apu = dst;
+	dst->backendData = fw;
+	return true;
+}
+
+static void t85APU_firmware_free (t85APU * apu) {
+	t85APU_firmware_delete((t85APU_firmware *) apu->backendData);
+}
+
+static const t85APU_backend t85APU_firmwareBackend = {
+	t85APU_firmware_update,
+	t85APU_firmware_resetBackend,
+	t85APU_firmware_copy,
+	t85APU_firmware_free,
+	256,	// The second overflow of the update
+	512,	// The write is shifted in during the update, so its output is latched on the first overflow of the next one
+};
+
+bool t85APU_useFirmware (t85APU * apu) {
+	if (!apu) return false;
+	t85APU_firmware * fw = t85APU_firmware_new();
+	if (!fw) return false;
+	t85APU_setBackend(apu, &t85APU_firmwareBackend, fw);
+	t85APU_reset(apu);
+	return true;
+}
@@ -0,0 +1,124 @@
+/*
+t85apu_firmware.h
+Part of the ATtiny85APU emulation library
+Written by alexmush
+2024-2024
+*/
+
+#ifndef __T85APU_FIRMWARE_H__
+#define __T85APU_FIRMWARE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "t85apu.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+	The firmware backend runs the actual firmware (avr/main.asm) instead of the C emulation in t85apu.c.
+	The firmware is statically recompiled into C by tools/avr2c.c when building, so every instruction takes
+	its exact amount of cycles, and the timer, the USI and the pins it uses are emulated around it.
+*/
+
+#define T85APU_FIRMWARE_DATA_SIZE	0x260	// Registers, I/O and SRAM of the ATtiny85, all at their data addresses
+
+typedef struct __t85apu_firmware {
+	// CPU
+	uint8_t data[T85APU_FIRMWARE_DATA_SIZE];
+	uint_fast16_t pc;	// In words
+	uint64_t cycles;	// Master clocks since the reset
+	uint64_t event;		// The recompiled code returns at the first instruction boundary at or after this
+	bool irqHold;	// An instruction has to run before the next interrupt (after sei and reti)
+	bool halted;	// The firmware jumped outside of itself
+
+	// Timer/Counter1
+	bool timerRunning;
+	uint64_t timerStart;	// The cycle on which TCNT1 was 0
+	uint_fast16_t timerPrescale;
+	uint64_t nextOverflow;
+	uint8_t pwmDuty;	// OCR1B as latched on the last overflow
+
+	// Inputs
+	t85APU * apu;	// Where the register writes are shifted in from
+	uint_fast8_t inputBits;	// Bits of the current register write shifted in by the USI
+
+	uint64_t frameStart;	// The overflow the current 512-cycle frame of the t85APU starts on
+} t85APU_firmware;
+
+/**
+ * @name t85APU firmware functions
+ * Functions for running the firmware backend.
+ */
+///@{
+/**
+ * @brief Switches a t85APU instance over to running the recompiled firmware. The firmware is booted from the reset, and is reset along with the t85APU.
+ * @note The firmware has no per-channel outputs, so the channel muting settings and @c channelOutput are not supported by it.
+ *
+ * @param apu The t85APU instance to switch over.
+ * @return true if the backend was set up.
+ * @return false if an error has occured.
+ */
+bool t85APU_useFirmware (t85APU * apu);
+/**
+ * @brief Creates a new instance of the firmware, not attached to any t85APU, and boots it.
+ *
+ * @return The pointer to the newly created instance. Returns a null pointer if an error has occured.
+ */
+t85APU_firmware * t85APU_firmware_new (void);
+/**
+ * @brief Resets the firmware and runs its initialization, up until the first timer overflow.
+ *
+ * @param fw The firmware instance to reset.
+ */
+void t85APU_firmware_reset (t85APU_firmware * fw);
+/**
+ * @brief Deletes the firmware instance from memory.
+ *
+ * @param fw The firmware instance to delete.
+ */
+void t85APU_firmware_delete (t85APU_firmware * fw);
+/**
+ * @brief Runs the firmware, with its timer and interrupts, up until the given cycle.
+ * @note The firmware stops at the first instruction boundary at or after @p cycle.
+ *
+ * @param fw The firmware instance.
+ * @param cycle The cycle, counted from the reset, to run up until.
+ */
+void t85APU_firmware_runUntil (t85APU_firmware * fw, uint64_t cycle);
+///@}
+
+/*
+	Internal interface between the recompiled firmware and the hardware emulation around it
+*/
+
+// Generated by tools/avr2c.c, runs until fw->event
+void t85APU_firmware_run (t85APU_firmware * fw);
+// Reads and writes an I/O register (by its I/O address) with side effects, fw->cycles is up to date
+uint8_t t85APU_firmware_in (t85APU_firmware * fw, uint8_t io);
+void t85APU_firmware_out (t85APU_firmware * fw, uint8_t io, uint8_t value);
+
+static inline void t85APU_firmware_push (t85APU_firmware * fw, uint8_t value) {
+	uint_fast16_t sp = fw->data[0x5D] | fw->data[0x5E] << 8;
+	if (sp < T85APU_FIRMWARE_DATA_SIZE) fw->data[sp] = value;
+	sp--;
+	fw->data[0x5D] = sp & 0xFF;
+	fw->data[0x5E] = (sp >> 8) & 0xFF;
+}
+
+static inline uint8_t t85APU_firmware_pop (t85APU_firmware * fw) {
+	uint_fast16_t sp = (fw->data[0x5D] | fw->data[0x5E] << 8) + 1;
+	fw->data[0x5D] = sp & 0xFF;
+	fw->data[0x5E] = (sp >> 8) & 0xFF;
+	return sp < T85APU_FIRMWARE_DATA_SIZE ? fw->data[sp] : 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
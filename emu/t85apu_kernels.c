@@ -0,0 +1,217 @@
+/*
+t85apu_kernels.c
+Part of the ATtiny85APU emulation library
+Written by alexmush
+2024-2024
+*/
+
+#include "t85apu_kernels.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The variants for extensions beyond the base instruction set are compiled with target attributes, so no compiler flags are needed for them
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define T85APU_KERNELS_X86
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define T85APU_KERNELS_NEON
+#include <arm_neon.h>
+#ifdef __linux__
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+#define SAMPLE_SCALE (1.0f / 32768.0f)
+
+// Generic, also used for the tails of the other variants
+
+static void t85APU_convertGeneric (float * output, const int16_t * samples, size_t count, float left, float right) {
+	for (size_t i = 0; i < count; i++) {
+		float sample = samples[i] * SAMPLE_SCALE;
+		output[2*i+0] = sample * left;
+		output[2*i+1] = sample * right;
+	}
+}
+
+static void t85APU_mixGeneric (float * dst, const float * src, size_t count) {
+	for (size_t i = 0; i < count; i++) dst[i] += src[i];
+}
+
+static bool t85APU_supportsGeneric (void) {
+	return true;
+}
+
+#ifdef T85APU_KERNELS_X86
+
+// SSE2
+
+__attribute__((target("sse2")))
+static void t85APU_convertSSE2 (float * output, const int16_t * samples, size_t count, float left, float right) {
+	__m128 scale = _mm_set1_ps(SAMPLE_SCALE), l = _mm_set1_ps(left), r = _mm_set1_ps(right);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128i raw = _mm_loadu_si128((const __m128i *)(samples + i));
+		// Sign-extended by unpacking with itself and shifting back down
+		__m128 lo = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(raw, raw), 16)), scale);
+		__m128 hi = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(raw, raw), 16)), scale);
+		__m128 a = _mm_mul_ps(lo, l), b = _mm_mul_ps(lo, r);
+		_mm_storeu_ps(output + 2*i + 0, _mm_unpacklo_ps(a, b));
+		_mm_storeu_ps(output + 2*i + 4, _mm_unpackhi_ps(a, b));
+		a = _mm_mul_ps(hi, l), b = _mm_mul_ps(hi, r);
+		_mm_storeu_ps(output + 2*i + 8, _mm_unpacklo_ps(a, b));
+		_mm_storeu_ps(output + 2*i + 12, _mm_unpackhi_ps(a, b));
+	}
+	t85APU_convertGeneric(output + 2*i, samples + i, count - i, left, right);
+}
+
+__attribute__((target("sse2")))
+static void t85APU_mixSSE2 (float * dst, const float * src, size_t count) {
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_loadu_ps(src + i)));
+	t85APU_mixGeneric(dst + i, src + i, count - i);
+}
+
+static bool t85APU_supportsSSE2 (void) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+}
+
+// AVX2
+
+__attribute__((target("avx2")))
+static void t85APU_convertAVX2 (float * output, const int16_t * samples, size_t count, float left, float right) {
+	__m256 scale = _mm256_set1_ps(SAMPLE_SCALE), l = _mm256_set1_ps(left), r = _mm256_set1_ps(right);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 sample = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(samples + i)))), scale);
+		__m256 a = _mm256_mul_ps(sample, l), b = _mm256_mul_ps(sample, r);
+		// Interleaved within each 128-bit lane, then the lanes are put in order
+		__m256 lo = _mm256_unpacklo_ps(a, b), hi = _mm256_unpackhi_ps(a, b);
+		_mm256_storeu_ps(output + 2*i + 0, _mm256_permute2f128_ps(lo, hi, 0x20));
+		_mm256_storeu_ps(output + 2*i + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+	}
+	t85APU_convertGeneric(output + 2*i, samples + i, count - i, left, right);
+}
+
+__attribute__((target("avx2")))
+static void t85APU_mixAVX2 (float * dst, const float * src, size_t count) {
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_loadu_ps(src + i)));
+	t85APU_mixGeneric(dst + i, src + i, count - i);
+}
+
+static bool t85APU_supportsAVX2 (void) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+// AVX-512
+
+__attribute__((target("avx512f")))
+static void t85APU_convertAVX512 (float * output, const int16_t * samples, size_t count, float left, float right) {
+	__m512 scale = _mm512_set1_ps(SAMPLE_SCALE), l = _mm512_set1_ps(left), r = _mm512_set1_ps(right);
+	__m512i first = _mm512_setr_epi32(0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+	__m512i second = _mm512_setr_epi32(8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31);
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m512 sample = _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i *)(samples + i)))), scale);
+		__m512 a = _mm512_mul_ps(sample, l), b = _mm512_mul_ps(sample, r);
+		_mm512_storeu_ps(output + 2*i + 0, _mm512_permutex2var_ps(a, first, b));
+		_mm512_storeu_ps(output + 2*i + 16, _mm512_permutex2var_ps(a, second, b));
+	}
+	t85APU_convertGeneric(output + 2*i, samples + i, count - i, left, right);
+}
+
+__attribute__((target("avx512f")))
+static void t85APU_mixAVX512 (float * dst, const float * src, size_t count) {
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+		_mm512_storeu_ps(dst + i, _mm512_add_ps(_mm512_loadu_ps(dst + i), _mm512_loadu_ps(src + i)));
+	t85APU_mixGeneric(dst + i, src + i, count - i);
+}
+
+static bool t85APU_supportsAVX512 (void) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx512f");
+}
+
+#endif
+
+#ifdef T85APU_KERNELS_NEON
+
+// NEON
+
+static void t85APU_convertNEON (float * output, const int16_t * samples, size_t count, float left, float right) {
+	float32x4_t l = vdupq_n_f32(left), r = vdupq_n_f32(right);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		int16x8_t raw = vld1q_s16(samples + i);
+		float32x4_t lo = vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(raw))), SAMPLE_SCALE);
+		float32x4_t hi = vmulq_n_f32(vcvtq_f32_s32(vmovl_high_s16(raw)), SAMPLE_SCALE);
+		// vst2q interleaves the left and right samples on its own
+		float32x4x2_t stereo;
+		stereo.val[0] = vmulq_f32(lo, l);
+		stereo.val[1] = vmulq_f32(lo, r);
+		vst2q_f32(output + 2*i + 0, stereo);
+		stereo.val[0] = vmulq_f32(hi, l);
+		stereo.val[1] = vmulq_f32(hi, r);
+		vst2q_f32(output + 2*i + 8, stereo);
+	}
+	t85APU_convertGeneric(output + 2*i, samples + i, count - i, left, right);
+}
+
+static void t85APU_mixNEON (float * dst, const float * src, size_t count) {
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+		vst1q_f32(dst + i, vaddq_f32(vld1q_f32(dst + i), vld1q_f32(src + i)));
+	t85APU_mixGeneric(dst + i, src + i, count - i);
+}
+
+static bool t85APU_supportsNEON (void) {
+#if defined(__linux__) && defined(HWCAP_ASIMD)
+	return getauxval(AT_HWCAP) & HWCAP_ASIMD;
+#else
+	return true;	// Part of the base instruction set of aarch64
+#endif
+}
+
+#endif
+
+// Best first
+static const struct {
+	t85APU_kernels kernels;
+	bool (*supported)(void);
+} kernelVariants[] = {
+#ifdef T85APU_KERNELS_X86
+	{{"avx512",	t85APU_convertAVX512,	t85APU_mixAVX512},	t85APU_supportsAVX512},
+	{{"avx2",	t85APU_convertAVX2,		t85APU_mixAVX2},	t85APU_supportsAVX2},
+	{{"sse2",	t85APU_convertSSE2,		t85APU_mixSSE2},	t85APU_supportsSSE2},
+#endif
+#ifdef T85APU_KERNELS_NEON
+	{{"neon",	t85APU_convertNEON,		t85APU_mixNEON},	t85APU_supportsNEON},
+#endif
+	{{"generic",	t85APU_convertGeneric,	t85APU_mixGeneric},	t85APU_supportsGeneric},
+};
+
+#define KERNEL_VARIANT_COUNT (sizeof(kernelVariants) / sizeof(kernelVariants[0]))
+
+const t85APU_kernels * t85APU_getKernels (void) {
+	const char * forced = getenv("T85APU_KERNELS");
+	if (forced && *forced) {
+		size_t i = 0;
+		while (i < KERNEL_VARIANT_COUNT && strcmp(forced, kernelVariants[i].kernels.name)) i++;
+		if (i == KERNEL_VARIANT_COUNT)
+			fprintf(stderr, "Unknown T85APU_KERNELS \"%s\", picking the best kernels for this CPU\n", forced);
+		else if (!kernelVariants[i].supported())
+			fprintf(stderr, "The %s kernels are not supported by this CPU, picking the best ones that are\n", forced);
+		else return &kernelVariants[i].kernels;
+	}
+	for (size_t i = 0; i < KERNEL_VARIANT_COUNT - 1; i++)
+		if (kernelVariants[i].supported()) return &kernelVariants[i].kernels;
+	return &kernelVariants[KERNEL_VARIANT_COUNT - 1].kernels;
+}
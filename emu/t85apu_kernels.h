@@ -0,0 +1,51 @@
+/*
+t85apu_kernels.h
+Part of the ATtiny85APU emulation library
+Written by alexmush
+2024-2024
+*/
+
+#ifndef __T85APU_KERNELS_H__
+#define __T85APU_KERNELS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+	The inner loops of the mixer, in variants for each instruction set. The best variant the CPU supports is picked at runtime,
+	so that one build runs on every host. The T85APU_KERNELS environment variable forces a variant by its name, for testing.
+	Every variant gives bit-identical results, as they do the same float operations in the same order.
+*/
+
+/**
+ * @brief A set of kernels for one instruction set.
+ */
+typedef struct __t85apu_kernels {
+	const char * name;
+	/**
+	 * @brief Converts signed 16-bit samples to interleaved stereo floats, i.e. output[2*i] = samples[i] / 32768 * left and output[2*i+1] = samples[i] / 32768 * right.
+	 */
+	void (*convert)(float * output, const int16_t * samples, size_t count, float left, float right);
+	/**
+	 * @brief Adds @p src to @p dst, @p count floats.
+	 */
+	void (*mix)(float * dst, const float * src, size_t count);
+} t85APU_kernels;
+
+/**
+ * @brief Picks the kernels for the CPU it is running on, or the ones named by the T85APU_KERNELS environment variable if they are supported.
+ *
+ * @return The kernels, which stay valid forever. Never a null pointer.
+ */
+const t85APU_kernels * t85APU_getKernels (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
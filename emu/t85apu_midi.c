@@ -0,0 +1,346 @@
+/*
+t85apu_midi.c
+Part of the ATtiny85APU emulation library
+Written by alexmush
+2024-2024
+*/
+
+#include "t85apu_midi.h"
+#include "t85apu_regdefines.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VOICE_COUNT		5
+#define REG_COUNT		32
+#define WRITE_QUEUE_SIZE	256	// A power of 2, far more than the writes of a chord on every channel
+#define NO_NOTE			0xFF
+#define NOTE_DUTY		0x80
+
+#define MIDI_NOTE_OFF	0x80
+#define MIDI_NOTE_ON	0x90
+#define MIDI_CONTROL	0xB0
+#define MIDI_ALL_SOUND_OFF	120
+#define MIDI_ALL_NOTES_OFF	123
+
+typedef struct {
+	uint8_t note;	// NO_NOTE if free
+	uint8_t channel;
+	uint8_t envelope;	// The envelope it fades with, if there is a decay
+	uint32_t age;	// When it was last allocated or freed, the oldest one gets taken first
+} t85APU_midiVoice;
+
+struct __t85apu_mididriver {
+	t85APU * apu;
+
+	// The time of the next sample is baseTime + samples * ticksPerSample, rebased when the clock or the rate changes
+	double baseTime;
+	uint64_t samples;
+	double ticksPerSample;
+	double clock;	// The clock the pitches are for
+
+	uint8_t increments[128];
+	uint8_t octaves[128];
+	double decay;
+	uint8_t envIncrement;
+	uint8_t envOctave;
+	uint8_t nextEnvelope;
+
+	t85APU_midiVoice voices[VOICE_COUNT];
+	uint32_t age;
+
+	uint8_t regs[REG_COUNT];	// What the registers will hold once the queued writes are applied, without the phase reset bits
+
+	uint16_t writes[WRITE_QUEUE_SIZE];	// Packed like the register write buffer holds them
+	size_t writeHead;
+	size_t writeCount;
+
+	t85APU_midiEvent * events;
+	size_t eventHead;
+	size_t eventCount;
+	size_t eventCapacity;
+};
+
+// The same calculation as explained in examples/example.c
+static void t85APU_midiPitch (double clock, double frequency, int width, int maxOctave, uint8_t * increment, uint8_t * octave) {
+	double period = frequency / (clock / 512.0) * (1 << width);
+	if (period > (1 << width) - 1) period = (1 << width) - 1;
+	int oct = period >= 1 ? (int)floor(log2(period) - 7) : 0;
+	if (oct < 0) oct = 0;
+	if (oct > maxOctave) oct = maxOctave;
+	double inc = round(period / (1 << oct));
+	if (inc > UINT8_MAX && oct < maxOctave) {
+		oct++;
+		inc = round(period / (1 << oct));
+	}
+	if (inc > UINT8_MAX) inc = UINT8_MAX;
+	if (inc < 0) inc = 0;
+	*increment = (uint8_t)inc;
+	*octave = (uint8_t)oct;
+}
+
+static void t85APU_midiWrite (t85APU_midiDriver * driver, uint8_t addr, uint8_t data) {
+	if (driver->writeCount == WRITE_QUEUE_SIZE) {
+		fprintf(stderr, "The t85APU MIDI driver's write queue is full, dropping a write\n");
+		return;
+	}
+	driver->writes[(driver->writeHead + driver->writeCount++) & (WRITE_QUEUE_SIZE - 1)] = 0x8000 | addr << 8 | data;
+}
+
+// Queues a write unless the register already holds the data
+static void t85APU_midiSet (t85APU_midiDriver * driver, uint8_t addr, uint8_t data) {
+	if (driver->regs[addr] == data) return;
+	driver->regs[addr] = data;
+	t85APU_midiWrite(driver, addr, data);
+}
+
+static void t85APU_midiPushWrites (t85APU_midiDriver * driver) {
+	while (driver->writeCount) {
+		size_t chunk = WRITE_QUEUE_SIZE - driver->writeHead;
+		if (chunk > driver->writeCount) chunk = driver->writeCount;
+		size_t pushed = t85APU_writePackedRegs(driver->apu, driver->writes + driver->writeHead, chunk);
+		driver->writeHead = (driver->writeHead + pushed) & (WRITE_QUEUE_SIZE - 1);
+		driver->writeCount -= pushed;
+		if (pushed < chunk) break;
+	}
+}
+
+static void t85APU_midiSetEnvelopePitch (t85APU_midiDriver * driver) {
+	// One falling slope per decay
+	t85APU_midiPitch(driver->clock, 1.0 / driver->decay, 23, 15, &driver->envIncrement, &driver->envOctave);
+	t85APU_midiSet(driver, EPLOA, driver->envIncrement);
+	t85APU_midiSet(driver, EPLOB, driver->envIncrement);
+	t85APU_midiSet(driver, EPIHI, PitchHi_Env_A(driver->envOctave) | PitchHi_Env_B(driver->envOctave));
+}
+
+// Picks up changes of the clock or the sample rate of the t85APU
+static void t85APU_midiSync (t85APU_midiDriver * driver) {
+	t85APU * apu = driver->apu;
+	if (apu->ticksPerClockCycle != driver->ticksPerSample) {
+		driver->baseTime += driver->samples * driver->ticksPerSample;
+		driver->samples = 0;
+		driver->ticksPerSample = apu->ticksPerClockCycle;
+	}
+	double clock = apu->ticksPerClockCycle * apu->outputRate;
+	if (clock == driver->clock) return;
+	driver->clock = clock;
+	for (int note = 0; note < 128; note++)
+		t85APU_midiPitch(clock, 440.0 * pow(2.0, (note - 69) / 12.0), 15, 7, &driver->increments[note], &driver->octaves[note]);
+	if (driver->decay) t85APU_midiSetEnvelopePitch(driver);
+}
+
+// Sets the registers to what a reset t85APU holds once the writes still in its register write buffer are applied, and frees every voice
+static void t85APU_midiResetRegs (t85APU_midiDriver * driver) {
+	t85APU * apu = driver->apu;
+	for (int ch = 0; ch < VOICE_COUNT; ch++) driver->voices[ch].note = NO_NOTE;
+	memset(driver->regs, 0, REG_COUNT);
+	memset(driver->regs + CFG_A, Pan(3, 3), VOICE_COUNT);
+	driver->regs[NTPLO] = 0x00;
+	driver->regs[NTPHI] = 0x24;
+	for (size_t i = 0; i < apu->shiftRegCurIdx; i++) {
+		uint8_t addr = (apu->shiftRegister[i] >> 8) & (REG_COUNT - 1), data = apu->shiftRegister[i] & 0xFF;
+		if ((addr >= PHIAB && addr <= PHIEN) || addr == E_SHP) data &= ~0x88;	// Without the phase reset bits
+		driver->regs[addr] = data;
+	}
+}
+
+t85APU_midiDriver * t85APU_midiDriver_new (t85APU * apu) {
+	if (!apu) return NULL;
+	t85APU_midiDriver * driver = (t85APU_midiDriver *) calloc(1, sizeof(t85APU_midiDriver));
+	if (!driver) {
+		fprintf(stderr, "Could not allocate t85APU MIDI driver\n");
+		return NULL;
+	}
+	driver->apu = apu;
+	t85APU_midiResetRegs(driver);
+	t85APU_midiSync(driver);
+	for (int ch = 0; ch < VOICE_COUNT; ch++) t85APU_midiSet(driver, DUTYA + ch, NOTE_DUTY);
+	return driver;
+}
+
+void t85APU_midiDriver_delete (t85APU_midiDriver * driver) {
+	if (!driver) return;
+	if (driver->events) free(driver->events);
+	free(driver);
+}
+
+static void t85APU_midiNoteOff (t85APU_midiDriver * driver, int ch) {
+	if (driver->decay) t85APU_midiSet(driver, CFG_A + ch, driver->regs[CFG_A + ch] & ~(Pan(3, 3)));	// The envelope ignores the static volume
+	else t85APU_midiSet(driver, VOL_A + ch, 0);
+	driver->voices[ch].note = NO_NOTE;
+	driver->voices[ch].age = ++driver->age;
+}
+
+static void t85APU_midiAllNotesOff (t85APU_midiDriver * driver) {
+	for (int ch = 0; ch < VOICE_COUNT; ch++)
+		if (driver->voices[ch].note != NO_NOTE) t85APU_midiNoteOff(driver, ch);
+}
+
+void t85APU_midiDriver_setDecay (t85APU_midiDriver * driver, double seconds) {
+	if (!driver) return;
+	if (seconds < 0) seconds = 0;
+	if (seconds == driver->decay) return;
+	t85APU_midiAllNotesOff(driver);
+	driver->decay = seconds;
+	if (seconds) {
+		t85APU_midiSetEnvelopePitch(driver);
+		t85APU_midiSet(driver, E_SHP, bit(ENVA_HOLD) | bit(ENVB_HOLD));
+	}
+}
+
+void t85APU_midiDriver_reset (t85APU_midiDriver * driver) {
+	if (!driver) return;
+	driver->writeHead = driver->writeCount = 0;
+	t85APU_midiResetRegs(driver);
+	for (int ch = 0; ch < VOICE_COUNT; ch++) {
+		t85APU_midiSet(driver, DUTYA + ch, NOTE_DUTY);
+		// The writes left in the buffer may have been a note-on
+		if (driver->decay) t85APU_midiSet(driver, CFG_A + ch, driver->regs[CFG_A + ch] & ~(Pan(3, 3)));
+		else t85APU_midiSet(driver, VOL_A + ch, 0);
+	}
+	if (driver->decay) {
+		t85APU_midiSetEnvelopePitch(driver);
+		t85APU_midiSet(driver, E_SHP, bit(ENVA_HOLD) | bit(ENVB_HOLD));
+	}
+}
+
+static int t85APU_midiFindVoice (const t85APU_midiDriver * driver, uint8_t channel, uint8_t note) {
+	for (int ch = 0; ch < VOICE_COUNT; ch++)
+		if (driver->voices[ch].note == note && driver->voices[ch].channel == channel) return ch;
+	return -1;
+}
+
+// The voice freed the longest ago, or if none are free, the one playing the oldest note
+static int t85APU_midiAllocVoice (const t85APU_midiDriver * driver) {
+	int best = -1;
+	for (int pass = 0; pass < 2 && best < 0; pass++) {
+		for (int ch = 0; ch < VOICE_COUNT; ch++) {
+			if ((driver->voices[ch].note == NO_NOTE) == (pass == 1)) continue;
+			if (best < 0 || driver->voices[ch].age < driver->voices[best].age) best = ch;
+		}
+	}
+	return best;
+}
+
+static void t85APU_midiNoteOn (t85APU_midiDriver * driver, uint8_t channel, uint8_t note, uint8_t velocity) {
+	int ch = t85APU_midiFindVoice(driver, channel, note);
+	if (ch < 0) ch = t85APU_midiAllocVoice(driver);
+	driver->voices[ch].note = note;
+	driver->voices[ch].channel = channel;
+	driver->voices[ch].age = ++driver->age;
+
+	// The pitch, with a phase reset so that every note starts the same
+	uint8_t octaveReg = PHIAB + ch / 2, shift = (ch & 1) * 4;
+	t85APU_midiSet(driver, PILOA + ch, driver->increments[note]);
+	driver->regs[octaveReg] = (driver->regs[octaveReg] & ~(0x7 << shift)) | driver->octaves[note] << shift;
+	t85APU_midiWrite(driver, octaveReg, driver->regs[octaveReg] | bit(PR_SQ_A + shift));
+
+	if (!driver->decay) {
+		// A square curve, which is closer to how loud the velocities are meant to sound than a linear one
+		uint32_t volume = (velocity * velocity * 255 + 127 * 127 / 2) / (127 * 127);
+		t85APU_midiSet(driver, CFG_A + ch, Pan(3, 3));
+		t85APU_midiSet(driver, VOL_A + ch, volume ? volume : 1);
+		return;
+	}
+	// The envelope volume, either full or halved, times the panning volume: 0.5, 1, 1.5, 2 and 3
+	static const uint8_t levelPans[5] = {1, 1, 3, 2, 3};
+	static const uint8_t levelVolumes[5] = {0x7F, 0xFF, 0x7F, 0xFF, 0xFF};
+	int level = (velocity - 1) * 5 / 127;
+	uint8_t envelope = driver->nextEnvelope;
+	driver->nextEnvelope ^= 1;
+	// Restarting the envelope would restart the note still fading with it too, so that one is stolen along with it
+	for (int other = 0; other < VOICE_COUNT; other++)
+		if (other != ch && driver->voices[other].note != NO_NOTE && driver->voices[other].envelope == envelope) t85APU_midiNoteOff(driver, other);
+	driver->voices[ch].envelope = envelope;
+	t85APU_midiSet(driver, VOL_A + ch, levelVolumes[level]);
+	t85APU_midiSet(driver, CFG_A + ch, bit(ENV_EN) | EnvNum(envelope) | Pan(levelPans[level], levelPans[level]));
+	t85APU_midiWrite(driver, E_SHP, driver->regs[E_SHP] | bit(ENVA_RST + envelope * 4));
+}
+
+static void t85APU_midiHandleEvent (t85APU_midiDriver * driver, const t85APU_midiEvent * event) {
+	uint8_t channel = event->status & 0x0F, type = event->status & 0xF0;
+	if (type == MIDI_NOTE_ON && !event->data2) type = MIDI_NOTE_OFF;	// A note-on with a velocity of 0 is a note-off
+	switch (type) {
+		case MIDI_NOTE_ON:
+			t85APU_midiNoteOn(driver, channel, event->data1 & 0x7F, event->data2 & 0x7F);
+			break;
+		case MIDI_NOTE_OFF: {
+			int ch = t85APU_midiFindVoice(driver, channel, event->data1 & 0x7F);
+			if (ch >= 0) t85APU_midiNoteOff(driver, ch);
+			break;
+		}
+		case MIDI_CONTROL:
+			if (event->data1 == MIDI_ALL_SOUND_OFF || event->data1 == MIDI_ALL_NOTES_OFF) t85APU_midiAllNotesOff(driver);
+			break;
+	}
+}
+
+bool t85APU_midiDriver_queue (t85APU_midiDriver * driver, const t85APU_midiEvent * event) {
+	if (!driver || !event) return false;
+	if (driver->eventCount == driver->eventCapacity) {
+		if (driver->eventHead) {
+			memmove(driver->events, driver->events + driver->eventHead, (driver->eventCount - driver->eventHead) * sizeof(t85APU_midiEvent));
+			driver->eventCount -= driver->eventHead;
+			driver->eventHead = 0;
+		} else {
+			size_t capacity = driver->eventCapacity ? driver->eventCapacity * 2 : 64;
+			t85APU_midiEvent * events = (t85APU_midiEvent *) realloc(driver->events, capacity * sizeof(t85APU_midiEvent));
+			if (!events) {
+				fprintf(stderr, "Could not allocate t85APU MIDI driver events\n");
+				return false;
+			}
+			driver->events = events;
+			driver->eventCapacity = capacity;
+		}
+	}
+	driver->events[driver->eventCount++] = *event;
+	return true;
+}
+
+void t85APU_midiDriver_render (t85APU_midiDriver * driver, int16_t * output, size_t samples) {
+	if (!driver) return;
+	t85APU_midiSync(driver);
+	for (size_t i = 0; i < samples; i++) {
+		double end = driver->baseTime + (driver->samples + 1) * driver->ticksPerSample;
+		while (driver->eventHead < driver->eventCount && driver->events[driver->eventHead].time < end)
+			t85APU_midiHandleEvent(driver, &driver->events[driver->eventHead++]);
+		if (driver->eventHead == driver->eventCount) driver->eventHead = driver->eventCount = 0;
+		if (driver->writeCount) t85APU_midiPushWrites(driver);
+		int16_t sample = t85APU_calcS16(driver->apu);
+		if (output) output[i] = sample;
+		driver->samples++;
+	}
+}
+
+uint64_t t85APU_midiDriver_getTime (const t85APU_midiDriver * driver) {
+	if (!driver) return 0;
+	return (uint64_t)(driver->baseTime + driver->samples * driver->ticksPerSample);
+}
+
+int t85APU_midiDriver_getVoice (const t85APU_midiDriver * driver, uint8_t channel, uint8_t note) {
+	if (!driver) return -1;
+	return t85APU_midiFindVoice(driver, channel, note);
+}
+
+bool t85APU_midi_readEvent (FILE * file, double clock, t85APU_midiEvent * event) {
+	if (!file || !event) return false;
+	char line[256];
+	while (fgets(line, sizeof(line), file)) {
+		const char * start = line;
+		while (*start == ' ' || *start == '\t') start++;
+		if (*start == '#' || *start == '\n' || *start == '\r' || !*start) continue;
+		double seconds;
+		unsigned status, data1, data2 = 0;
+		if (sscanf(start, "%lf %x %x %x", &seconds, &status, &data1, &data2) < 3 || status < 0x80 || status > 0xFF || data1 > 0x7F || data2 > 0x7F) {
+			line[strcspn(line, "\r\n")] = 0;
+			fprintf(stderr, "Could not parse MIDI event \"%s\"\n", line);
+			return false;
+		}
+		event->time = seconds > 0 ? (uint64_t)(seconds * clock + 0.5) : 0;
+		event->status = status;
+		event->data1 = data1;
+		event->data2 = data2;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,141 @@
+/*
+t85apu_midi.h
+Part of the ATtiny85APU emulation library
+Written by alexmush
+2024-2024
+*/
+
+#ifndef __T85APU_MIDI_H__
+#define __T85APU_MIDI_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "t85apu.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+	A MIDI driver plays a t85APU like a live instrument: it turns timestamped MIDI events into register writes, allocating the 5 tone channels to the notes,
+	and pushes the writes while rendering, on the sample each event is timestamped with rather than at the start of the block.
+	Since the register write buffer only applies 1 write per update (512 master clocks), a note-on is kept to as few writes as possible,
+	with the one that makes it audible last, so that it does not start at the wrong pitch.
+
+	Events can be read from a text stream (a file, or a pipe from whatever receives the MIDI), one per line:
+		<time in seconds> <status> <data 1> <data 2>
+	with the bytes in hex, e.g. "0.250 90 3C 7F" for a middle C at full velocity 250 ms in. Empty lines and lines starting with '#' are skipped.
+	Only note-ons, note-offs and the all sound off / all notes off controllers (120 and 123) are handled, on every MIDI channel.
+*/
+
+/**
+ * @brief A MIDI event, timestamped in master clocks since the driver was created.
+ */
+typedef struct __t85apu_midievent {
+	uint64_t time;
+	uint8_t status;
+	uint8_t data1;
+	uint8_t data2;
+} t85APU_midiEvent;
+
+typedef struct __t85apu_mididriver t85APU_midiDriver;
+
+/**
+ * @name t85APU_midiDriver functions
+ * Functions interacting with the MIDI driver.
+ */
+///@{
+/**
+ * @brief Creates a new MIDI driver playing the given t85APU, and queues the writes that set up its channels.
+ * @note The t85APU stays owned by the caller, and should only be rendered through the driver from then on, so that its clock stays in step with the timestamps.
+ *
+ * @param apu A freshly reset t85APU, with its clock, sample rate and output type set up. The clock can be changed later, the note pitches follow it.
+ * @return The pointer to the newly created MIDI driver. Returns a null pointer if an error has occured.
+ */
+t85APU_midiDriver * t85APU_midiDriver_new (t85APU * apu);
+/**
+ * @brief Deletes the MIDI driver from memory. The t85APU is left as it is.
+ *
+ * @param driver The MIDI driver to delete.
+ */
+void t85APU_midiDriver_delete (t85APU_midiDriver * driver);
+
+/**
+ * @brief Brings the MIDI driver back in step with its t85APU after that was reset with @c t85APU_reset, which the driver cannot tell on its own:
+ * it ends every note, and queues the writes that set up the channels again. The events still queued are kept.
+ * @note Any other reset of the t85APU under the driver (e.g. loading a state) leaves the driver writing registers it thinks hold something else.
+ *
+ * @param driver The MIDI driver instance.
+ */
+void t85APU_midiDriver_reset (t85APU_midiDriver * driver);
+
+/**
+ * @brief Sets how the notes fade out.
+ * @li With no decay (the default), a note holds its volume until its note-off, and the velocity sets its static volume (@c VOL_X) on a square curve.
+ * @li With a decay, every note-on restarts one of the envelopes (taking turns between the 2 of them) as a one-shot falling slope, and the velocity picks
+ * the envelope volume (full or halved by @c VOL_X) and the panning volume, for 5 levels.
+ * Since restarting an envelope would restart every note fading with it, a note-on ends the note still playing on the envelope it takes, so at most 2 notes play at once.
+ *
+ * @param driver The MIDI driver instance.
+ * @param seconds How long a note takes to fade to silence, 0 for no decay.
+ */
+void t85APU_midiDriver_setDecay (t85APU_midiDriver * driver, double seconds);
+
+/**
+ * @brief Queues a MIDI event to be played when its time comes during rendering. Events have to be queued in the order of their timestamps,
+ * and ones that are already due get played at the start of the next sample rendered.
+ *
+ * @param driver The MIDI driver instance.
+ * @param event The event.
+ * @return true if the event was queued.
+ * @return false if an error has occured.
+ */
+bool t85APU_midiDriver_queue (t85APU_midiDriver * driver, const t85APU_midiEvent * event);
+/**
+ * @brief Renders samples with @c t85APU_calcS16, playing the queued events right before the sample that their timestamp falls into,
+ * and pushing their register writes onto the register write buffer as soon as there is room for them.
+ *
+ * @param driver The MIDI driver instance.
+ * @param output Where to write the samples to. Can be a null pointer to just run the emulation.
+ * @param samples The amount of samples to render.
+ */
+void t85APU_midiDriver_render (t85APU_midiDriver * driver, int16_t * output, size_t samples);
+/**
+ * @brief Gets the time of the next sample the driver will render, in master clocks since it was created.
+ *
+ * @param driver The MIDI driver instance.
+ * @return The time, rounded down.
+ */
+uint64_t t85APU_midiDriver_getTime (const t85APU_midiDriver * driver);
+/**
+ * @brief Gets the tone channel playing a note.
+ *
+ * @param driver The MIDI driver instance.
+ * @param channel The MIDI channel (0..15).
+ * @param note The MIDI note number.
+ * @return The tone channel (0..4), or -1 if the note is not playing.
+ */
+int t85APU_midiDriver_getVoice (const t85APU_midiDriver * driver, uint8_t channel, uint8_t note);
+
+/**
+ * @brief Reads the next event from a text stream, see the format above.
+ * Blocks until a whole line is available, so it can read from a pipe while the events come in.
+ *
+ * @param file The stream.
+ * @param clock The master clock speed to convert the time into master clocks at, in Hz.
+ * @param event Where to store the event.
+ * @return true if an event was read.
+ * @return false at the end of the stream, or if a line could not be parsed (which is reported on stderr).
+ */
+bool t85APU_midi_readEvent (FILE * file, double clock, t85APU_midiEvent * event);
+///@}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,348 @@
+/*
+t85apu_mixer.cpp
+Part of the ATtiny85APU emulation library
+Written by alexmush
+2024-2024
+*/
+
+#include "t85apu_mixer.h"
+#include "t85apu_kernels.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+// Internal block sizes, chosen so that no allocation happens while rendering
+#define MIXER_BLOCK_SIZE	1024	// Frames rendered per chip before mixing
+#define MIXER_CHUNK_SIZE	256		// Frames per reduction task, 2 KiB per chip buffer
+
+// Quality governor
+#define GOVERNOR_TOP_QUALITY	1		// The box average, the highest quality the t85APU has
+#define GOVERNOR_FADE_TIME		0.005	// Seconds that each switch is crossfaded over
+#define GOVERNOR_RAISE_LOAD		0.5		// Fraction of the deadline the average load has to stay under to raise the quality
+#define GOVERNOR_RAISE_BLOCKS	32		// For this many blocks in a row
+#define GOVERNOR_AVERAGE_COEF	0.125f	// Of the exponential moving average of the load
+
+struct t85APU_mixerChip {
+	t85APU * apu;
+	float gain;
+	float pan;
+	float * buffer;	// MIXER_BLOCK_SIZE interleaved stereo frames
+	int16_t * samples;	// MIXER_BLOCK_SIZE samples straight from the t85APU
+};
+
+// Each thread owns one of these, pops its own tasks from the back and steals others' from the front
+struct t85APU_mixerQueue {
+	std::mutex mutex;
+	std::deque<size_t> tasks;
+};
+
+struct __t85apu_mixer {
+	double rate;
+	std::vector<t85APU_mixerChip> chips;
+	std::vector<float> buffers;
+	std::vector<int16_t> samples;
+	const t85APU_kernels * kernels;	// Picked for the CPU once, when creating the mixer
+
+	// Current job
+	void (*job)(t85APU_mixer * mixer, size_t task);
+	size_t frames;
+	float * output;
+
+	// Thread pool, thread 0 is the one calling t85APU_mixer_render
+	std::vector<std::thread> threads;
+	std::unique_ptr<t85APU_mixerQueue[]> queues;
+	size_t queueCount;
+	std::mutex jobMutex;
+	std::condition_variable jobStarted;
+	std::condition_variable jobDone;
+	uint64_t jobGeneration;
+	std::atomic<size_t> tasksLeft;
+	bool quitting;
+
+	// Quality governor, the stats are atomic so that they can be read from any thread
+	float deadline;	// 0 if disabled
+	std::atomic<uint8_t> quality;
+	size_t blocksUnderLoad;
+	std::atomic<uint64_t> blocks;
+	std::atomic<uint64_t> overruns;
+	std::atomic<uint64_t> switchesDown;
+	std::atomic<uint64_t> switchesUp;
+	std::atomic<float> load;
+	std::atomic<float> averageLoad;
+};
+
+static bool t85APU_mixer_popTask (t85APU_mixer * mixer, size_t worker, size_t & task) {
+	{
+		t85APU_mixerQueue & own = mixer->queues[worker];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.tasks.empty()) {
+			task = own.tasks.back();
+			own.tasks.pop_back();
+			return true;
+		}
+	}
+	for (size_t i = 1; i < mixer->queueCount; i++) {
+		t85APU_mixerQueue & victim = mixer->queues[(worker + i) % mixer->queueCount];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.tasks.empty()) {
+			task = victim.tasks.front();
+			victim.tasks.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+static void t85APU_mixer_work (t85APU_mixer * mixer, size_t worker) {
+	size_t task;
+	while (t85APU_mixer_popTask(mixer, worker, task)) {
+		mixer->job(mixer, task);
+		if (--mixer->tasksLeft == 0) {
+			std::lock_guard<std::mutex> lock(mixer->jobMutex);
+			mixer->jobDone.notify_all();
+		}
+	}
+}
+
+static void t85APU_mixer_thread (t85APU_mixer * mixer, size_t worker) {
+	uint64_t generation = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mixer->jobMutex);
+			mixer->jobStarted.wait(lock, [&] { return mixer->quitting || mixer->jobGeneration != generation; });
+			if (mixer->quitting) return;
+			generation = mixer->jobGeneration;
+		}
+		t85APU_mixer_work(mixer, worker);
+	}
+}
+
+// Runs the job on tasks 0..taskCount-1 on all threads, returns once all of them are done
+static void t85APU_mixer_run (t85APU_mixer * mixer, void (*job)(t85APU_mixer *, size_t), size_t taskCount) {
+	mixer->job = job;
+	mixer->tasksLeft = taskCount;
+	for (size_t i = 0; i < taskCount; i++) {
+		t85APU_mixerQueue & queue = mixer->queues[i % mixer->queueCount];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(i);
+	}
+	{
+		std::lock_guard<std::mutex> lock(mixer->jobMutex);
+		mixer->jobGeneration++;
+	}
+	mixer->jobStarted.notify_all();
+	t85APU_mixer_work(mixer, 0);
+	std::unique_lock<std::mutex> lock(mixer->jobMutex);
+	mixer->jobDone.wait(lock, [&] { return mixer->tasksLeft == 0; });
+}
+
+static void t85APU_mixer_renderChip (t85APU_mixer * mixer, size_t task) {
+	t85APU_mixerChip & chip = mixer->chips[task];
+	float left	= chip.gain * (chip.pan > 0 ? 1 - chip.pan : 1);
+	float right	= chip.gain * (chip.pan < 0 ? 1 + chip.pan : 1);
+	for (size_t i = 0; i < mixer->frames; i++) chip.samples[i] = t85APU_calcS16(chip.apu);
+	mixer->kernels->convert(chip.buffer, chip.samples, mixer->frames, left, right);
+}
+
+// Pairwise sums all of the chip buffers into the first one, one chunk at a time
+static void t85APU_mixer_reduceChunk (t85APU_mixer * mixer, size_t task) {
+	size_t start = task * MIXER_CHUNK_SIZE * 2;
+	size_t end = (task + 1) * MIXER_CHUNK_SIZE * 2;
+	if (end > mixer->frames * 2) end = mixer->frames * 2;
+	size_t count = mixer->chips.size();
+	for (size_t stride = 1; stride < count; stride <<= 1) {
+		for (size_t i = 0; i + stride < count; i += stride << 1) {
+			float * dst = mixer->chips[i].buffer;
+			const float * src = mixer->chips[i + stride].buffer;
+			mixer->kernels->mix(dst + start, src + start, end - start);
+		}
+	}
+	const float * mix = mixer->chips[0].buffer;
+	for (size_t j = start; j < end; j++) mixer->output[j] = mix[j];
+}
+
+#ifdef T85APU_REGWRITE_BUFFER_SIZE
+t85APU_mixer * t85APU_mixer_new (size_t chipCount, double rate, size_t threadCount) {
+#else
+t85APU_mixer * t85APU_mixer_new (size_t chipCount, double rate, size_t threadCount, size_t shiftRegisterSize) {
+#endif
+	if (!chipCount) return NULL;
+	if (!rate) rate = 8000000 / 512;
+	if (!threadCount) threadCount = std::thread::hardware_concurrency();
+	if (!threadCount) threadCount = 1;
+
+	t85APU_mixer * mixer = new (std::nothrow) t85APU_mixer;
+	if (!mixer) {
+		fprintf(stderr, "Could not allocate t85APU_mixer\n");
+		return NULL;
+	}
+	mixer->rate = rate;
+	mixer->jobGeneration = 0;
+	mixer->tasksLeft = 0;
+	mixer->quitting = false;
+	mixer->queueCount = threadCount;
+	mixer->kernels = t85APU_getKernels();
+	mixer->deadline = 0;
+	mixer->quality = GOVERNOR_TOP_QUALITY;
+	mixer->blocksUnderLoad = 0;
+	mixer->blocks = mixer->overruns = mixer->switchesDown = mixer->switchesUp = 0;
+	mixer->load = mixer->averageLoad = 0;
+	try {
+		mixer->buffers.resize(chipCount * MIXER_BLOCK_SIZE * 2);
+		mixer->samples.resize(chipCount * MIXER_BLOCK_SIZE);
+		mixer->queues.reset(new t85APU_mixerQueue[threadCount]);
+		mixer->chips.reserve(chipCount);
+	} catch (const std::bad_alloc &) {
+		fprintf(stderr, "Could not allocate t85APU_mixer buffers\n");
+		delete mixer;
+		return NULL;
+	}
+	for (size_t i = 0; i < chipCount; i++) {
+		t85APU_mixerChip chip;
+		#ifdef T85APU_REGWRITE_BUFFER_SIZE
+		chip.apu = t85APU_new(0, rate, T85APU_OUTPUT_PB4);
+		#else
+		chip.apu = t85APU_new(0, rate, T85APU_OUTPUT_PB4, shiftRegisterSize);
+		#endif
+		if (!chip.apu) {
+			fprintf(stderr, "Could not create the t85APUs, deleting the t85APU_mixer\n");
+			t85APU_mixer_delete(mixer);
+			return NULL;
+		}
+		chip.gain = 1.0f;
+		chip.pan = 0.0f;
+		chip.buffer = mixer->buffers.data() + i * MIXER_BLOCK_SIZE * 2;
+		chip.samples = mixer->samples.data() + i * MIXER_BLOCK_SIZE;
+		mixer->chips.push_back(chip);
+	}
+	for (size_t i = 1; i < threadCount; i++) {
+		try {
+			mixer->threads.emplace_back(t85APU_mixer_thread, mixer, i);
+		} catch (const std::system_error &) {
+			// Whatever did start still steals from the queues of the threads that did not
+			fprintf(stderr, "Could not start all t85APU_mixer threads, continuing with %zu\n", i);
+			break;
+		}
+	}
+	return mixer;
+}
+
+void t85APU_mixer_delete (t85APU_mixer * mixer) {
+	if (!mixer) return;
+	{
+		std::lock_guard<std::mutex> lock(mixer->jobMutex);
+		mixer->quitting = true;
+	}
+	mixer->jobStarted.notify_all();
+	for (std::thread & thread : mixer->threads) thread.join();
+	for (t85APU_mixerChip & chip : mixer->chips) t85APU_delete(chip.apu);
+	delete mixer;
+}
+
+t85APU * t85APU_mixer_getChip (t85APU_mixer * mixer, size_t chip) {
+	if (!mixer || chip >= mixer->chips.size()) return NULL;
+	return mixer->chips[chip].apu;
+}
+
+size_t t85APU_mixer_getChipCount (t85APU_mixer * mixer) {
+	if (!mixer) return 0;
+	return mixer->chips.size();
+}
+
+const char * t85APU_mixer_getKernelName (t85APU_mixer * mixer) {
+	if (!mixer) return NULL;
+	return mixer->kernels->name;
+}
+
+void t85APU_mixer_setClock (t85APU_mixer * mixer, size_t chip, double clock) {
+	if (!mixer || chip >= mixer->chips.size()) return;
+	t85APU_setClocknRate(mixer->chips[chip].apu, clock, mixer->rate);
+}
+
+void t85APU_mixer_setGain (t85APU_mixer * mixer, size_t chip, float gain) {
+	if (!mixer || chip >= mixer->chips.size()) return;
+	mixer->chips[chip].gain = gain;
+}
+
+void t85APU_mixer_setPan (t85APU_mixer * mixer, size_t chip, float pan) {
+	if (!mixer || chip >= mixer->chips.size()) return;
+	if (pan < -1.0f) pan = -1.0f;
+	if (pan > 1.0f) pan = 1.0f;
+	mixer->chips[chip].pan = pan;
+}
+
+void t85APU_mixer_setGovernor (t85APU_mixer * mixer, float deadline) {
+	if (!mixer) return;
+	mixer->deadline = deadline > 0 ? deadline : 0;
+	if (!mixer->deadline) return;
+	mixer->quality = GOVERNOR_TOP_QUALITY;
+	mixer->blocksUnderLoad = 0;
+	mixer->averageLoad = 0;
+	for (t85APU_mixerChip & chip : mixer->chips) t85APU_setQuality(chip.apu, GOVERNOR_TOP_QUALITY);
+}
+
+void t85APU_mixer_getStats (t85APU_mixer * mixer, t85APU_mixerStats * stats) {
+	if (!mixer || !stats) return;
+	stats->blocks		= mixer->blocks.load(std::memory_order_relaxed);
+	stats->overruns		= mixer->overruns.load(std::memory_order_relaxed);
+	stats->switchesDown	= mixer->switchesDown.load(std::memory_order_relaxed);
+	stats->switchesUp	= mixer->switchesUp.load(std::memory_order_relaxed);
+	stats->load			= mixer->load.load(std::memory_order_relaxed);
+	stats->averageLoad	= mixer->averageLoad.load(std::memory_order_relaxed);
+	stats->quality		= mixer->quality.load(std::memory_order_relaxed);
+}
+
+// Lowers the quality right away when a block overruns the deadline, and only raises it after a while well under it
+static void t85APU_mixer_govern (t85APU_mixer * mixer, float load) {
+	float average = mixer->averageLoad.load(std::memory_order_relaxed);
+	average += GOVERNOR_AVERAGE_COEF * (load - average);
+	mixer->load.store(load, std::memory_order_relaxed);
+	mixer->averageLoad.store(average, std::memory_order_relaxed);
+	mixer->blocks.fetch_add(1, std::memory_order_relaxed);
+	if (!mixer->deadline) return;
+
+	uint8_t quality = mixer->quality.load(std::memory_order_relaxed);
+	if (load > mixer->deadline) {
+		mixer->overruns.fetch_add(1, std::memory_order_relaxed);
+		mixer->blocksUnderLoad = 0;
+		if (quality > 0) {
+			quality--;
+			mixer->switchesDown.fetch_add(1, std::memory_order_relaxed);
+		}
+	} else if (average < mixer->deadline * GOVERNOR_RAISE_LOAD && quality < GOVERNOR_TOP_QUALITY) {
+		if (++mixer->blocksUnderLoad >= GOVERNOR_RAISE_BLOCKS) {
+			mixer->blocksUnderLoad = 0;
+			quality++;
+			mixer->switchesUp.fetch_add(1, std::memory_order_relaxed);
+		}
+	} else mixer->blocksUnderLoad = 0;
+
+	if (quality == mixer->quality.load(std::memory_order_relaxed)) return;
+	mixer->quality.store(quality, std::memory_order_relaxed);
+	double fade = mixer->rate * GOVERNOR_FADE_TIME;
+	for (t85APU_mixerChip & chip : mixer->chips)
+		t85APU_fadeQuality(chip.apu, quality, fade < UINT16_MAX ? (uint_fast16_t)fade : UINT16_MAX);
+}
+
+void t85APU_mixer_render (t85APU_mixer * mixer, float * output, size_t frames) {
+	if (!mixer || !output) return;
+	while (frames) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		mixer->frames = frames < MIXER_BLOCK_SIZE ? frames : MIXER_BLOCK_SIZE;
+		mixer->output = output;
+		t85APU_mixer_run(mixer, t85APU_mixer_renderChip, mixer->chips.size());
+		t85APU_mixer_run(mixer, t85APU_mixer_reduceChunk, (mixer->frames + MIXER_CHUNK_SIZE - 1) / MIXER_CHUNK_SIZE);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		t85APU_mixer_govern(mixer, (float)(elapsed.count() * mixer->rate / mixer->frames));
+		output += mixer->frames * 2;
+		frames -= mixer->frames;
+	}
+}
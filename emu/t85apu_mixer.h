@@ -0,0 +1,152 @@
+/*
+t85apu_mixer.h
+Part of the ATtiny85APU emulation library
+Written by alexmush
+2024-2024
+*/
+
+#ifndef __T85APU_MIXER_H__
+#define __T85APU_MIXER_H__
+
+#include "t85apu.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief A set of t85APUs, each with its own clock, gain and panning, mixed into one stereo output.
+ * The chips are rendered in parallel on a work-stealing thread pool owned by the mixer, and summed in a fixed order, so the output does not depend on the thread count or scheduling.
+ */
+typedef struct __t85apu_mixer t85APU_mixer;
+
+/**
+ * @brief The decisions of the quality governor of a t85APU_mixer, see @c t85APU_mixer_setGovernor.
+ */
+typedef struct __t85apu_mixerstats {
+	uint64_t blocks;	// The amount of blocks rendered
+	uint64_t overruns;	// The amount of blocks that took longer to render than the deadline
+	uint64_t switchesDown;	// The amount of times the quality was lowered
+	uint64_t switchesUp;	// The amount of times the quality was raised
+	float load;	// The time it took to render the last block, as a fraction of how long it plays for
+	float averageLoad;	// The same, averaged over the last several blocks
+	uint8_t quality;	// The quality the governor renders the t85APUs at, as in t85APU_setQuality. Only meaningful while it is enabled
+} t85APU_mixerStats;
+
+/**
+ * @name t85APU_mixer functions
+ * Functions interacting with the t85APU_mixer.
+ */
+///@{
+#ifdef T85APU_REGWRITE_BUFFER_SIZE
+/**
+ * @brief Creates a new t85APU_mixer along with all of its t85APUs.
+ *
+ * @param chipCount The amount of t85APUs to create. Has to be at least 1.
+ * @param rate The output sample rate of the mixer, in Hz. If not set (i.e. 0), will default to (8000000 / 512).
+ * @param threadCount The amount of threads to render on, including the calling thread. If not set (i.e. 0), will default to the amount of hardware threads.
+ * @return The pointer to the newly created t85APU_mixer. Returns a null pointer if an error has occured.
+ */
+t85APU_mixer * t85APU_mixer_new (size_t chipCount, double rate, size_t threadCount);
+#else
+/**
+ * @brief Creates a new t85APU_mixer along with all of its t85APUs.
+ *
+ * @param chipCount The amount of t85APUs to create. Has to be at least 1.
+ * @param rate The output sample rate of the mixer, in Hz. If not set (i.e. 0), will default to (8000000 / 512).
+ * @param threadCount The amount of threads to render on, including the calling thread. If not set (i.e. 0), will default to the amount of hardware threads.
+ * @param shiftRegisterSize The size of the register write buffer of each t85APU. Has to be at least 1.
+ * @return The pointer to the newly created t85APU_mixer. Returns a null pointer if an error has occured.
+ */
+t85APU_mixer * t85APU_mixer_new (size_t chipCount, double rate, size_t threadCount, size_t shiftRegisterSize);
+#endif
+/**
+ * @brief Deletes the t85APU_mixer along with all of its t85APUs, and stops its threads.
+ *
+ * @param mixer The t85APU_mixer to delete.
+ */
+void t85APU_mixer_delete (t85APU_mixer * mixer);
+
+/**
+ * @brief Gets one of the t85APUs of the mixer, e.g. to write registers to it. It stays owned by the mixer.
+ *
+ * @param mixer The t85APU_mixer instance.
+ * @param chip The index of the t85APU.
+ * @return The pointer to the t85APU, or a null pointer if the index is out of range.
+ */
+t85APU * t85APU_mixer_getChip (t85APU_mixer * mixer, size_t chip);
+/**
+ * @brief Gets the amount of t85APUs in the mixer.
+ *
+ * @param mixer The t85APU_mixer instance.
+ * @return The amount of t85APUs.
+ */
+size_t t85APU_mixer_getChipCount (t85APU_mixer * mixer);
+/**
+ * @brief Gets the name of the kernels the mixer converts and mixes the samples with, picked for the CPU when creating it ("avx512", "avx2", "sse2", "neon" or "generic").
+ * They can be forced with the T85APU_KERNELS environment variable, e.g. for testing, if the CPU supports them. Every one of them gives the same output.
+ *
+ * @param mixer The t85APU_mixer instance.
+ * @return The name of the kernels, or a null pointer if the mixer is a null pointer.
+ */
+const char * t85APU_mixer_getKernelName (t85APU_mixer * mixer);
+
+/**
+ * @brief Sets the master clock speed of one of the t85APUs. The sample rate stays that of the mixer.
+ *
+ * @param mixer The t85APU_mixer instance.
+ * @param chip The index of the t85APU.
+ * @param clock The master clock speed of the t85APU, in Hz. If not set (i.e. 0), will default to 8000000 - 8MHz.
+ */
+void t85APU_mixer_setClock (t85APU_mixer * mixer, size_t chip, double clock);
+/**
+ * @brief Sets the gain of one of the t85APUs in the mix.
+ *
+ * @param mixer The t85APU_mixer instance.
+ * @param chip The index of the t85APU.
+ * @param gain The linear gain, 1.0 by default.
+ */
+void t85APU_mixer_setGain (t85APU_mixer * mixer, size_t chip, float gain);
+/**
+ * @brief Sets the panning of one of the t85APUs in the mix.
+ *
+ * @param mixer The t85APU_mixer instance.
+ * @param chip The index of the t85APU.
+ * @param pan The panning, from -1.0 (left only) through 0.0 (center, the default) to 1.0 (right only).
+ */
+void t85APU_mixer_setPan (t85APU_mixer * mixer, size_t chip, float pan);
+
+/**
+ * @brief Enables or disables the quality governor, which measures how long each block takes to render and lowers the quality of all of the t85APUs when it is over the deadline,
+ * then raises it back once there is plenty of time left. Each switch is crossfaded (see @c t85APU_fadeQuality). Disabled by default.
+ * @note The governor sets the quality of the t85APUs itself, overriding @c t85APU_setQuality. When enabled, it starts from the highest quality.
+ *
+ * @param mixer The t85APU_mixer instance.
+ * @param deadline The time rendering a block may take, as a fraction of how long the block plays for, e.g. 0.5 to leave half of the time to the rest of the audio callback. 0 disables the governor.
+ */
+void t85APU_mixer_setGovernor (t85APU_mixer * mixer, float deadline);
+/**
+ * @brief Gets the decisions of the quality governor. It can be called from any thread, the fields are each up to date but not necessarily from the same block.
+ *
+ * @param mixer The t85APU_mixer instance.
+ * @param stats The struct to write them to.
+ */
+void t85APU_mixer_getStats (t85APU_mixer * mixer, t85APU_mixerStats * stats);
+
+/**
+ * @brief Renders the mix of all of the t85APUs.
+ * @note The t85APUs must not be accessed from other threads while this is running.
+ *
+ * @param mixer The t85APU_mixer instance.
+ * @param output The buffer to write the samples to, interleaved left then right. Each chip contributes 0.0..1.0 (times its gain) to it.
+ * @param frames The amount of stereo samples to render.
+ */
+void t85APU_mixer_render (t85APU_mixer * mixer, float * output, size_t frames);
+///@}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,291 @@
+/*
+t85apu_patch.hpp
+Part of the ATtiny85APU emulation library
+Written by alexmush
+2024-2024
+*/
+
+
+#ifndef __cplusplus
+#error "This is a C++ header, meant only for C++. Use the macros of t85apu_regdefines.h for C"
+#endif
+
+
+#ifndef __T85APU_PATCH_HPP__
+#define __T85APU_PATCH_HPP__
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <utility>
+
+#include "t85apu.h"
+#include "t85apu_regdefines.h"
+
+/*
+	Compile-time (C++14) register write packets. Every register has its own function taking typed fields, so a field can only go
+	into the register that holds it, and a field that is out of range (e.g. an octave of 8 for a tone) fails to compile when used in a constant expression.
+	E.g. an instrument patch baked into read-only data, pushed onto the register write buffer in one call:
+
+		constexpr auto lead = t85APU_patch(
+			t85APU_duty(t85APUChannel::A, 0x40),
+			t85APU_volume(t85APUChannel::A, 0xFF),
+			t85APU_envelopePitchLow(t85APUEnvelope::A, 0x40),
+			t85APU_envelopeOctaves(4, 0),
+			t85APU_envelopeShape(t85APUEnvelopeShape().hold(t85APUEnvelope::A).reset(t85APUEnvelope::A)),
+			t85APU_config(t85APUChannel::A, t85APUConfig().envelope(t85APUEnvelope::A).pan(3, 3))
+		);
+		apu.writeRegs(lead);
+*/
+
+/**
+ * @brief A register write, as pushed onto the register write buffer with @c t85APU_writeReg.
+ */
+struct t85APUPacket {
+	uint8_t addr;
+	uint8_t data;
+};
+static_assert(sizeof(t85APUPacket) == 2, "t85APUPacket has to be laid out like a pair of bytes");
+
+/**
+ * @brief A fixed list of register writes, e.g. an instrument patch or a sound effect.
+ */
+template <size_t count>
+using t85APUPatch = std::array<t85APUPacket, count>;
+
+/**
+ * @brief A view of register writes, from a t85APUPatch, a C array or a pointer and a count.
+ */
+struct t85APUPacketSpan {
+	const t85APUPacket * packets;
+	size_t count;
+
+	constexpr t85APUPacketSpan (const t85APUPacket * first, size_t amount) : packets(first), count(amount) {}
+	template <size_t length>
+	constexpr t85APUPacketSpan (const t85APUPatch<length> & patch) : packets(patch.data()), count(length) {}
+	template <size_t length>
+	constexpr t85APUPacketSpan (const t85APUPacket (&array)[length]) : packets(array), count(length) {}
+
+	constexpr const t85APUPacket * data () const { return packets; }
+	constexpr const t85APUPacket * begin () const { return packets; }
+	constexpr const t85APUPacket * end () const { return packets + count; }
+	constexpr size_t size () const { return count; }
+};
+
+/**
+ * @brief The tone channels.
+ */
+enum class t85APUChannel : uint8_t { A, B, C, D, E };
+/**
+ * @brief The envelopes.
+ */
+enum class t85APUEnvelope : uint8_t { A, B };
+
+namespace t85APUPatchDetail {
+	// Not constexpr, so a field out of range stops the compilation of a constant expression. At runtime the field gets masked to its bits.
+	// The fields are taken as unsigned, so that e.g. a volume of 0x1FF gets here instead of being narrowed to a byte on the way
+	inline unsigned outOfRange (const char * field, unsigned value, unsigned max) {
+		fprintf(stderr, "t85APU %s %u is out of range (0..%u), masking it\n", field, value, max);
+		return value & max;
+	}
+
+	constexpr unsigned checked (const char * field, unsigned value, unsigned max) {
+		return value <= max ? value : outOfRange(field, value, max);
+	}
+
+	constexpr uint8_t index (t85APUChannel channel) { return (uint8_t)channel; }
+	constexpr uint8_t index (t85APUEnvelope envelope) { return (uint8_t)envelope; }
+
+	constexpr t85APUPacket packet (unsigned addr, unsigned data) { return t85APUPacket{(uint8_t)addr, (uint8_t)data}; }
+
+	constexpr t85APUPatch<1> asPatch (const t85APUPacket & packet) { return t85APUPatch<1>{{packet}}; }
+	template <size_t count>
+	constexpr const t85APUPatch<count> & asPatch (const t85APUPatch<count> & patch) { return patch; }
+
+	template <size_t first, size_t second, size_t... i>
+	constexpr t85APUPatch<first + second> join (const t85APUPatch<first> & a, const t85APUPatch<second> & b, std::index_sequence<i...>) {
+		return t85APUPatch<first + second>{{(i < first ? a[i] : b[i - first])...}};
+	}
+
+	template <size_t first, size_t second>
+	constexpr t85APUPatch<first + second> join (const t85APUPatch<first> & a, const t85APUPatch<second> & b) {
+		return join(a, b, std::make_index_sequence<first + second>());
+	}
+
+	constexpr t85APUPatch<0> concat () { return t85APUPatch<0>{}; }
+	template <typename First, typename... Rest>
+	constexpr auto concat (const First & first, const Rest &... rest) {
+		return join(asPatch(first), concat(rest...));
+	}
+}
+
+/**
+ * @brief The fields of a channel config register (@c CFG_X), see @c t85APU_config.
+ */
+struct t85APUConfig {
+	uint8_t value;
+
+	constexpr explicit t85APUConfig (uint8_t bits = 0) : value(bits) {}
+	/**
+	 * @brief ORs the noise into the channel's pulse.
+	 */
+	constexpr t85APUConfig noise () const { return t85APUConfig(value | bit(NOISE_EN)); }
+	/**
+	 * @brief Uses the envelope as the volume of the channel, halved if the static volume is under 0x80.
+	 */
+	constexpr t85APUConfig envelope (t85APUEnvelope envelope) const {
+		return t85APUConfig((value & ~EnvNum(1)) | bit(ENV_EN) | EnvNum(t85APUPatchDetail::index(envelope)));
+	}
+	/**
+	 * @brief Sets the panning volume of each ear (0..3), which multiplies the static or envelope volume.
+	 */
+	constexpr t85APUConfig pan (unsigned left, unsigned right) const {
+		return t85APUConfig((value & ~(Pan(3, 3))) | Pan(t85APUPatchDetail::checked("left pan", left, 3), t85APUPatchDetail::checked("right pan", right, 3)));
+	}
+};
+
+/**
+ * @brief The fields of the envelope shape register (@c E_SHP), see @c t85APU_envelopeShape and the table of shapes in examples/example.c.
+ */
+struct t85APUEnvelopeShape {
+	uint8_t value;
+
+	constexpr explicit t85APUEnvelopeShape (uint8_t bits = 0) : value(bits) {}
+	/**
+	 * @brief Stops the envelope at the end of its first slope.
+	 */
+	constexpr t85APUEnvelopeShape hold (t85APUEnvelope envelope) const { return with(ENVA_HOLD, envelope); }
+	/**
+	 * @brief Reverses the direction of the envelope after each slope.
+	 */
+	constexpr t85APUEnvelopeShape alternate (t85APUEnvelope envelope) const { return with(ENVA_ALT, envelope); }
+	/**
+	 * @brief Starts the envelope rising instead of falling.
+	 */
+	constexpr t85APUEnvelopeShape attack (t85APUEnvelope envelope) const { return with(ENVA_ATT, envelope); }
+	/**
+	 * @brief Resets the phase of the envelope to the envelope load registers (@c t85APU_envelopeLoad).
+	 */
+	constexpr t85APUEnvelopeShape reset (t85APUEnvelope envelope) const { return with(ENVA_RST, envelope); }
+
+	private:
+		constexpr t85APUEnvelopeShape with (uint8_t envABit, t85APUEnvelope envelope) const {
+			return t85APUEnvelopeShape(value | bit(envABit + 4 * t85APUPatchDetail::index(envelope)));
+		}
+};
+
+/**
+ * @name t85APU register packets
+ * Functions building the register writes, and patches of them.
+ */
+///@{
+/**
+ * @brief The pitch increment of a tone channel (@c PILOX).
+ */
+constexpr t85APUPacket t85APU_pitchLow (t85APUChannel channel, unsigned increment) {
+	return t85APUPatchDetail::packet(PILOA + t85APUPatchDetail::index(channel), t85APUPatchDetail::checked("pitch increment", increment, 0xFF));
+}
+/**
+ * @brief The pitch increment of the noise (@c PILON).
+ */
+constexpr t85APUPacket t85APU_noisePitchLow (unsigned increment) {
+	return t85APUPatchDetail::packet(PILON, t85APUPatchDetail::checked("noise pitch increment", increment, 0xFF));
+}
+/**
+ * @brief The octaves (0..7) of tone channels A and B (@c PHIAB), and their phase resets.
+ */
+constexpr t85APUPacket t85APU_octavesAB (unsigned a, unsigned b, bool resetA = false, bool resetB = false) {
+	return t85APUPatchDetail::packet(PHIAB, PitchHi_Sq_A(t85APUPatchDetail::checked("octave", a, 7)) | PitchHi_Sq_B(t85APUPatchDetail::checked("octave", b, 7))
+		| (resetA ? bit(PR_SQ_A) : 0) | (resetB ? bit(PR_SQ_B) : 0));
+}
+/**
+ * @brief The octaves (0..7) of tone channels C and D (@c PHICD), and their phase resets.
+ */
+constexpr t85APUPacket t85APU_octavesCD (unsigned c, unsigned d, bool resetC = false, bool resetD = false) {
+	return t85APUPatchDetail::packet(PHICD, PitchHi_Sq_C(t85APUPatchDetail::checked("octave", c, 7)) | PitchHi_Sq_D(t85APUPatchDetail::checked("octave", d, 7))
+		| (resetC ? bit(PR_SQ_C) : 0) | (resetD ? bit(PR_SQ_D) : 0));
+}
+/**
+ * @brief The octaves (0..7) of tone channel E and the noise (@c PHIEN), and their phase resets.
+ */
+constexpr t85APUPacket t85APU_octavesEN (unsigned e, unsigned noise, bool resetE = false, bool resetNoise = false) {
+	return t85APUPatchDetail::packet(PHIEN, PitchHi_Sq_E(t85APUPatchDetail::checked("octave", e, 7)) | PitchHi_Noise(t85APUPatchDetail::checked("octave", noise, 7))
+		| (resetE ? bit(PR_SQ_E) : 0) | (resetNoise ? bit(PR_NOISE) : 0));
+}
+/**
+ * @brief The duty cycle of a tone channel (@c DUTYX), 0 disabling its pulse.
+ */
+constexpr t85APUPacket t85APU_duty (t85APUChannel channel, unsigned duty) {
+	return t85APUPatchDetail::packet(DUTYA + t85APUPatchDetail::index(channel), t85APUPatchDetail::checked("duty", duty, 0xFF));
+}
+/**
+ * @brief The noise tap value (@c NTPLO and @c NTPHI), 0x2400 after reset.
+ */
+constexpr t85APUPatch<2> t85APU_noiseTaps (unsigned taps) {
+	taps = t85APUPatchDetail::checked("noise taps", taps, 0xFFFF);
+	return t85APUPatch<2>{{t85APUPatchDetail::packet(NTPLO, taps & 0xFF), t85APUPatchDetail::packet(NTPHI, taps >> 8)}};
+}
+/**
+ * @brief The static volume of a tone channel (@c VOL_X).
+ */
+constexpr t85APUPacket t85APU_volume (t85APUChannel channel, unsigned volume) {
+	return t85APUPatchDetail::packet(VOL_A + t85APUPatchDetail::index(channel), t85APUPatchDetail::checked("volume", volume, 0xFF));
+}
+/**
+ * @brief The config of a tone channel (@c CFG_X).
+ */
+constexpr t85APUPacket t85APU_config (t85APUChannel channel, t85APUConfig config) {
+	return t85APUPatchDetail::packet(CFG_A + t85APUPatchDetail::index(channel), config.value);
+}
+/**
+ * @brief The phase the envelopes get reset to (@c ELDLO and @c ELDHI), 0x4000 being 25% through a slope.
+ */
+constexpr t85APUPatch<2> t85APU_envelopeLoad (unsigned phase) {
+	phase = t85APUPatchDetail::checked("envelope load", phase, 0xFFFF);
+	return t85APUPatch<2>{{t85APUPatchDetail::packet(ELDLO, phase & 0xFF), t85APUPatchDetail::packet(ELDHI, phase >> 8)}};
+}
+/**
+ * @brief The shapes of both envelopes and their phase resets (@c E_SHP).
+ */
+constexpr t85APUPacket t85APU_envelopeShape (t85APUEnvelopeShape shape) {
+	return t85APUPatchDetail::packet(E_SHP, shape.value);
+}
+/**
+ * @brief The pitch increment of an envelope (@c EPLOA or @c EPLOB).
+ */
+constexpr t85APUPacket t85APU_envelopePitchLow (t85APUEnvelope envelope, unsigned increment) {
+	return t85APUPatchDetail::packet(EPLOA + t85APUPatchDetail::index(envelope), t85APUPatchDetail::checked("envelope pitch increment", increment, 0xFF));
+}
+/**
+ * @brief The octaves (0..15) of both envelopes (@c EPIHI).
+ */
+constexpr t85APUPacket t85APU_envelopeOctaves (unsigned a, unsigned b) {
+	return t85APUPatchDetail::packet(EPIHI, PitchHi_Env_A(t85APUPatchDetail::checked("envelope octave", a, 15)) | PitchHi_Env_B(t85APUPatchDetail::checked("envelope octave", b, 15)));
+}
+
+/**
+ * @brief Joins register writes and patches into one patch, in order.
+ *
+ * @param parts Each either a t85APUPacket or a t85APUPatch.
+ * @return The patch of all of their writes.
+ */
+template <typename... Parts>
+constexpr auto t85APU_patch (const Parts &... parts) {
+	return t85APUPatchDetail::concat(parts...);
+}
+
+/**
+ * @brief Pushes register writes onto the register write buffer of the t85APU at once, in order, with @c t85APU_writeRegs.
+ * @note Like with @c t85APU_writeReg, the writes that do not fit into the buffer are dropped, so it has to have room for the whole patch.
+ *
+ * @param apu The t85APU instance.
+ * @param packets The writes, e.g. a t85APUPatch.
+ * @return The amount of writes that fit into the buffer.
+ */
+inline size_t t85APU_writePatch (t85APU * apu, t85APUPacketSpan packets) {
+	return t85APU_writeRegs(apu, reinterpret_cast<const uint8_t (*)[2]>(packets.data()), packets.size());
+}
+///@}
+
+#endif	// __T85APU_PATCH_HPP__
@@ -0,0 +1,171 @@
+/*
+t85apu_pitch.hpp
+Part of the ATtiny85APU emulation library
+Written by alexmush
+2024-2024
+*/
+
+
+#ifndef __cplusplus
+#error "This is a C++ header, meant only for C++. Use the t85apu_pitchgen tool to generate tables for C"
+#endif
+
+
+#ifndef __T85APU_PITCH_HPP__
+#define __T85APU_PITCH_HPP__
+
+#include <cstdint>
+
+/*
+	Compile-time (C++14) pitch calculations, the same as the ones explained in examples/example.cpp.
+	E.g. to have a full MIDI note table of an 8MHz t85APU baked into read-only data:
+
+		constexpr t85APUNoteTable notes = t85APU_noteTable<8000000>;
+		apu.writeReg(PILOA, notes.tone[60].increment);
+		apu.writeReg(PHIAB, PitchHi_Sq_A(notes.tone[60].octave));
+*/
+
+/**
+ * @brief A pitch as the t85APU registers hold it.
+ */
+struct t85APUPitch {
+	/**
+	 * @brief The pitch increment value (@c PILOX, @c PILON, @c EPLOA or @c EPLOB).
+	 */
+	uint8_t increment;
+	/**
+	 * @brief The octave number (0..7 for tone and noise, 0..15 for envelopes), to be put into the octave register with the @c PitchHi_XXX macros.
+	 */
+	uint8_t octave;
+	/**
+	 * @brief How far off the actual pitch is from the requested one, in cents.
+	 */
+	double cents;
+};
+
+/**
+ * @brief Pitches of all 128 MIDI notes.
+ */
+struct t85APUNoteTable {
+	/**
+	 * @brief For the tone and noise generators.
+	 */
+	t85APUPitch tone[128];
+	/**
+	 * @brief For the envelopes, used melodically.
+	 */
+	t85APUPitch envelope[128];
+};
+
+namespace t85APUConstexprMath {
+	constexpr double LN2 = 0.693147180559945309417232121458;
+
+	// 2^x
+	constexpr double exp2 (double x) {
+		double scale = 1.0;
+		while (x >= 1.0) { x -= 1.0; scale *= 2.0; }
+		while (x < 0.0) { x += 1.0; scale /= 2.0; }
+		// e^(x ln 2) for x in 0..1
+		double y = x * LN2, term = 1.0, sum = 1.0;
+		for (int i = 1; i < 30; i++) { term *= y / i; sum += term; }
+		return sum * scale;
+	}
+
+	// log2(x), x has to be positive
+	constexpr double log2 (double x) {
+		double exponent = 0.0;
+		while (x >= 2.0) { x /= 2.0; exponent += 1.0; }
+		while (x < 1.0) { x *= 2.0; exponent -= 1.0; }
+		// 2 atanh((x-1)/(x+1)) = ln x, for x in 1..2
+		double z = (x - 1.0) / (x + 1.0), z2 = z * z, power = z, sum = 0.0;
+		for (int i = 1; i < 60; i += 2) { sum += power / i; power *= z2; }
+		return exponent + 2.0 * sum / LN2;
+	}
+
+	// Number of the most significant set bit, -1 for 0
+	constexpr int msb (uint32_t x) {
+		int bit = -1;
+		while (x) { x >>= 1; bit++; }
+		return bit;
+	}
+
+	// Calculates the pitch for a phase accumulator of the given width (15 for tone/noise, 23 for envelopes)
+	constexpr t85APUPitch pitch (double clock, double frequency, int width, int maxOctave) {
+		double chipSampleRate = clock / 512.0;
+		double period = frequency / chipSampleRate * (1 << width);
+		if (period < 0) period = 0;
+		if (period > (1 << width) - 1) period = (1 << width) - 1;
+
+		int octave = msb((uint32_t)period) - 7;
+		if (octave < 0) octave = 0;
+		if (octave > maxOctave) octave = maxOctave;
+
+		int increment = (int)(period / (1 << octave) + 0.5);
+		if (increment > UINT8_MAX && octave < maxOctave) {
+			octave++;
+			increment /= 2;
+		}
+		if (increment > UINT8_MAX) increment = UINT8_MAX;
+
+		double actual = (double)(increment << octave) / (1 << width) * chipSampleRate;
+		double cents = increment && frequency > 0 ? 1200.0 * log2(actual / frequency) : 0.0;
+		return t85APUPitch{(uint8_t)increment, (uint8_t)octave, cents};
+	}
+}
+
+/**
+ * @brief Calculates the frequency of a MIDI note in 12-tone equal temperament.
+ *
+ * @param note The MIDI note number, 69 being A4.
+ * @param a4 The frequency of A4, in Hz.
+ * @return The frequency of the note, in Hz.
+ */
+constexpr double t85APU_noteFrequency (int note, double a4 = 440.0) {
+	return a4 * t85APUConstexprMath::exp2((note - 69) / 12.0);
+}
+
+/**
+ * @brief Calculates the pitch registers for the tone and noise generators.
+ *
+ * @param clock The master clock speed of the t85APU, in Hz.
+ * @param frequency The frequency, in Hz.
+ * @return The pitch, clamped to what the registers can hold.
+ */
+constexpr t85APUPitch t85APU_tonePitch (double clock, double frequency) {
+	return t85APUConstexprMath::pitch(clock, frequency, 15, 7);
+}
+
+/**
+ * @brief Calculates the pitch registers for the envelopes (used melodically, i.e. 1 period per slope).
+ *
+ * @param clock The master clock speed of the t85APU, in Hz.
+ * @param frequency The frequency, in Hz.
+ * @return The pitch, clamped to what the registers can hold.
+ */
+constexpr t85APUPitch t85APU_envelopePitch (double clock, double frequency) {
+	return t85APUConstexprMath::pitch(clock, frequency, 23, 15);
+}
+
+/**
+ * @brief Calculates the pitches of all MIDI notes.
+ *
+ * @param clock The master clock speed of the t85APU, in Hz.
+ * @param a4 The frequency of A4, in Hz.
+ * @return The note table.
+ */
+constexpr t85APUNoteTable t85APU_makeNoteTable (double clock, double a4 = 440.0) {
+	t85APUNoteTable table{};
+	for (int note = 0; note < 128; note++) {
+		table.tone[note] = t85APU_tonePitch(clock, t85APU_noteFrequency(note, a4));
+		table.envelope[note] = t85APU_envelopePitch(clock, t85APU_noteFrequency(note, a4));
+	}
+	return table;
+}
+
+/**
+ * @brief The note table of a t85APU running at the given master clock speed, in Hz, calculated at compile time.
+ */
+template <uint32_t clock>
+constexpr t85APUNoteTable t85APU_noteTable = t85APU_makeNoteTable(clock);
+
+#endif	// __T85APU_PITCH_HPP__
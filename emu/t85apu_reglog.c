@@ -0,0 +1,498 @@
+/*
+t85apu_reglog.c
+Part of the ATtiny85APU emulation library
+Written by alexmush
+2024-2024
+*/
+
+#include "t85apu_reglog.h"
+#include "t85apu_regdefines.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REGLOG_VERSION		1
+#define REGLOG_HEADER_SIZE	24
+#define REGLOG_WRITE_SIZE	10
+
+#define REG_COUNT	32
+
+static void putLE (uint8_t * buffer, uint64_t value, int bytes) {
+	for (int i = 0; i < bytes; i++) buffer[i] = (value >> (i*8)) & 0xFF;
+}
+
+static uint64_t getLE (const uint8_t * buffer, int bytes) {
+	uint64_t value = 0;
+	for (int i = 0; i < bytes; i++) value |= (uint64_t)buffer[i] << (i*8);
+	return value;
+}
+
+t85APU_regLog * t85APU_regLog_new (double clock, size_t capacity) {
+	t85APU_regLog * log = (t85APU_regLog *) calloc(1, sizeof(t85APU_regLog));
+	if (!log) {
+		fprintf(stderr, "Could not allocate t85APU register log\n");
+		return NULL;
+	}
+	log->clock = clock ? clock : 8000000;
+	if (capacity) {
+		log->writes = (t85APU_regWrite *) calloc(capacity, sizeof(t85APU_regWrite));
+		if (!log->writes) {
+			fprintf(stderr, "Could not allocate t85APU register log writes, deleting the register log\n");
+			free(log);
+			return NULL;
+		}
+	}
+	return log;
+}
+
+t85APU_regLog * t85APU_regLog_load (const char * path) {
+	t85APU_regLog * log = t85APU_regLog_new(0, 0);
+	size_t capacity = 0;
+	if (log && !t85APU_regLog_read(log, &capacity, path)) {
+		t85APU_regLog_delete(log);
+		return NULL;
+	}
+	return log;
+}
+
+bool t85APU_regLog_read (t85APU_regLog * log, size_t * capacity, const char * path) {
+	if (!log || !capacity) return false;
+	log->count = 0;
+	FILE * file = fopen(path, "rb");
+	if (!file) {
+		fprintf(stderr, "Could not open register log '%s'\n", path);
+		return false;
+	}
+	uint8_t header[REGLOG_HEADER_SIZE];
+	if (fread(header, 1, REGLOG_HEADER_SIZE, file) != REGLOG_HEADER_SIZE || memcmp(header, "T85L", 4) || getLE(header+4, 4) != REGLOG_VERSION) {
+		fprintf(stderr, "'%s' is not a version %d register log\n", path, REGLOG_VERSION);
+		fclose(file);
+		return false;
+	}
+	uint64_t clockBits = getLE(header+8, 8);
+	double clock;
+	memcpy(&clock, &clockBits, sizeof(double));
+	uint64_t count = getLE(header+16, 8);
+	if (count > SIZE_MAX / sizeof(t85APU_regWrite)) {
+		fprintf(stderr, "Register log '%s' is too large\n", path);
+		fclose(file);
+		return false;
+	}
+	if (count > *capacity) {
+		t85APU_regWrite * writes = (t85APU_regWrite *) realloc(log->writes, (size_t)count * sizeof(t85APU_regWrite));
+		if (!writes) {
+			fprintf(stderr, "Could not allocate t85APU register log writes\n");
+			fclose(file);
+			return false;
+		}
+		log->writes = writes;
+		*capacity = (size_t)count;
+	}
+	log->clock = clock ? clock : 8000000;
+
+	// Read in chunks of records, rather than 1 record per call
+	uint8_t records[REGLOG_WRITE_SIZE * 256];
+	for (size_t i = 0; i < count; ) {
+		size_t chunk = count - i < 256 ? (size_t)(count - i) : 256;
+		if (fread(records, REGLOG_WRITE_SIZE, chunk, file) != chunk) {
+			fprintf(stderr, "Register log '%s' is truncated\n", path);
+			fclose(file);
+			return false;
+		}
+		for (size_t j = 0; j < chunk; j++, i++) {
+			const uint8_t * record = records + j * REGLOG_WRITE_SIZE;
+			log->writes[i].time = getLE(record, 8);
+			log->writes[i].addr = record[8];
+			log->writes[i].data = record[9];
+		}
+	}
+	fclose(file);
+	log->count = (size_t)count;
+	return true;
+}
+
+bool t85APU_regLog_save (const t85APU_regLog * log, const char * path) {
+	if (!log) return false;
+	FILE * file = fopen(path, "wb");
+	if (!file) {
+		fprintf(stderr, "Could not open register log '%s' for writing\n", path);
+		return false;
+	}
+	uint8_t header[REGLOG_HEADER_SIZE];
+	uint64_t clockBits;
+	memcpy(&clockBits, &log->clock, sizeof(double));
+	memcpy(header, "T85L", 4);
+	putLE(header+4, REGLOG_VERSION, 4);
+	putLE(header+8, clockBits, 8);
+	putLE(header+16, log->count, 8);
+	bool success = fwrite(header, 1, REGLOG_HEADER_SIZE, file) == REGLOG_HEADER_SIZE;
+	uint8_t record[REGLOG_WRITE_SIZE];
+	for (size_t i = 0; success && i < log->count; i++) {
+		putLE(record, log->writes[i].time, 8);
+		record[8] = log->writes[i].addr;
+		record[9] = log->writes[i].data;
+		success = fwrite(record, 1, REGLOG_WRITE_SIZE, file) == REGLOG_WRITE_SIZE;
+	}
+	if (fclose(file)) success = false;
+	if (!success) fprintf(stderr, "Could not write register log '%s'\n", path);
+	return success;
+}
+
+void t85APU_regLog_delete (t85APU_regLog * log) {
+	if (!log) return;
+	if (log->writes) free(log->writes);
+	free(log);
+}
+
+// The update that a write at the given time gets applied on, if nothing is in the way
+#define intendedFrame(time) (((time) + 511) >> 9)
+
+#define isPhaseResetReg(addr) ((addr) >= PHIAB && (addr) <= PHIEN)
+#define PHASE_RESET_BITS (bit(PR_SQ_A)|bit(PR_SQ_B))
+#define ENV_RESET_BITS (bit(ENVA_RST)|bit(ENVB_RST))
+
+// Returns the tone channel whose registers only affect it, or -1 if the register affects several
+static int regChannel (uint8_t addr) {
+	if (addr <= PILOE) return addr - PILOA;
+	if (addr >= DUTYA && addr <= DUTYE) return addr - DUTYA;
+	if (addr >= VOL_A && addr <= VOL_E) return addr - VOL_A;
+	if (addr >= CFG_A && addr <= CFG_E) return addr - CFG_A;
+	return -1;
+}
+
+static bool channelAudible (const uint8_t * regs, int ch) {
+	uint8_t cfg = regs[CFG_A+ch];
+	return PanLeft(cfg)
+		&& (regs[DUTYA+ch] || (cfg & bit(NOISE_EN)))
+		&& (regs[VOL_A+ch] || (cfg & bit(ENV_EN)));
+}
+
+static bool writeRedundant (const uint8_t * regs, uint8_t addr, uint8_t data) {
+	if (addr >= REG_COUNT) return true;	// Ignored by the t85APU
+	if (isPhaseResetReg(addr))
+		return !(data & PHASE_RESET_BITS) && (data & ~PHASE_RESET_BITS) == (regs[addr] & ~PHASE_RESET_BITS);
+	if (addr == E_SHP)
+		return !(data & ENV_RESET_BITS) && data == regs[addr];
+	return data == regs[addr];
+}
+
+size_t t85APU_regLog_optimize (t85APU_regWrite * writes, size_t count, t85APU_regOptStats * stats) {
+	t85APU_regOptStats tmpStats;
+	if (!stats) stats = &tmpStats;
+	memset(stats, 0, sizeof(t85APU_regOptStats));
+	if (!writes || !count) return count;
+
+	t85APU_regWrite * src = (t85APU_regWrite *) malloc(count * sizeof(t85APU_regWrite));
+	uint64_t * origFrames = (uint64_t *) malloc(count * sizeof(uint64_t));
+	size_t * queue = (size_t *) malloc(count * sizeof(size_t));
+	bool * dead = (bool *) calloc(count, sizeof(bool));
+	if (!src || !origFrames || !queue || !dead) {
+		fprintf(stderr, "Could not allocate the register log optimizer, leaving the writes as they are\n");
+		free(src); free(origFrames); free(queue); free(dead);
+		return count;
+	}
+	memcpy(src, writes, count * sizeof(t85APU_regWrite));
+
+	// Where every write lands without any optimization (1 write per update, first in first out)
+	for (size_t i = 0; i < count; i++) {
+		src[i].addr &= 0x7F;
+		origFrames[i] = intendedFrame(src[i].time);
+		if (i && origFrames[i] <= origFrames[i-1]) origFrames[i] = origFrames[i-1] + 1;
+	}
+
+	// Dead writes: overwritten before the update they were meant for
+	size_t last[REG_COUNT];
+	bool hasLast[REG_COUNT] = {false};
+	for (size_t j = 0; j < count; j++) {
+		uint8_t addr = src[j].addr;
+		if (addr >= REG_COUNT) continue;
+		if (hasLast[addr]) {
+			size_t i = last[addr];
+			bool sameFrame = intendedFrame(src[i].time) == intendedFrame(src[j].time);
+			if (addr == ELDLO || addr == ELDHI) {
+				// Only ever read by an envelope phase reset, and there was none in between
+				dead[i] = true;
+			} else if (sameFrame && isPhaseResetReg(addr)) {
+				src[j].data |= src[i].data & PHASE_RESET_BITS;
+				dead[i] = true;
+			} else if (sameFrame && (addr != E_SHP || !(src[i].data & ENV_RESET_BITS))) {
+				dead[i] = true;
+			}
+			if (dead[i]) stats->droppedDead++;
+		}
+		last[addr] = j;
+		hasLast[addr] = true;
+		if (addr == E_SHP && (src[j].data & ENV_RESET_BITS)) hasLast[ELDLO] = hasLast[ELDHI] = false;
+	}
+
+	// Schedule 1 write per update, emulating the state to drop redundant writes
+	uint8_t regs[REG_COUNT] = {0};
+	for (int ch = 0; ch < 5; ch++) regs[CFG_A+ch] = 0x0F;
+	regs[NTPHI] = 0x24;
+
+	size_t queueLen = 0, next = 0, out = 0;
+	uint64_t frame = 0, lastTime = 0;
+	while (next < count || queueLen) {
+		if (!queueLen && intendedFrame(src[next].time) > frame) frame = intendedFrame(src[next].time);
+		for (; next < count && intendedFrame(src[next].time) <= frame; next++) {
+			if (!dead[next]) queue[queueLen++] = next;
+		}
+		if (!queueLen) continue;
+
+		// Pick the first write that affects something audible, and does not have to wait for a previous write to the same channel
+		size_t pick = 0;
+		for (size_t q = 0; q < queueLen; q++) {
+			const t85APU_regWrite * w = &src[queue[q]];
+			int ch = regChannel(w->addr);
+			if (ch < 0) { pick = q; break; }
+			bool blocked = false;
+			for (size_t p = 0; p < q && !blocked; p++) blocked = regChannel(src[queue[p]].addr) == ch;
+			if (blocked) continue;
+			uint8_t before = regs[w->addr];
+			bool audible = channelAudible(regs, ch);
+			regs[w->addr] = w->data;
+			audible = audible || channelAudible(regs, ch);
+			regs[w->addr] = before;
+			if (audible) { pick = q; break; }
+		}
+		size_t idx = queue[pick];
+		memmove(queue + pick, queue + pick + 1, (queueLen - pick - 1) * sizeof(size_t));
+		queueLen--;
+
+		if (writeRedundant(regs, src[idx].addr, src[idx].data)) {
+			stats->droppedRedundant++;
+			continue;
+		}
+		regs[src[idx].addr] = src[idx].data;
+		if (pick) stats->reordered++;
+
+		writes[out] = src[idx];
+		if (writes[out].time < lastTime) writes[out].time = lastTime;	// Has to be queued after the ones before it
+		lastTime = writes[out].time;
+		out++;
+
+		if (frame > origFrames[idx]) {
+			uint64_t delay = (frame - origFrames[idx]) << 9;
+			if (delay > stats->worstDelay) stats->worstDelay = delay;
+		} else {
+			uint64_t advance = (origFrames[idx] - frame) << 9;
+			if (advance > stats->worstAdvance) stats->worstAdvance = advance;
+		}
+		frame++;
+	}
+
+	free(src); free(origFrames); free(queue); free(dead);
+	return out;
+}
+
+size_t t85APU_regLog_preview (const t85APU_regLog * log, t85APU * apu, uint32_t blockUpdates, uint32_t stride, t85APU_previewBlock * blocks, size_t blockCount) {
+	if (!log || !apu || !blocks || !blockUpdates) return 0;
+	if (!stride) stride = 1;
+
+	size_t next = 0;
+	uint64_t update = 0;
+	for (size_t b = 0; b < blockCount; b++) {
+		uint64_t start = update, end = update + blockUpdates;
+		uint8_t min = 0xFF, max = 0;
+		double sum = 0;
+		uint32_t sampled = 0;
+		while (update < end) {
+			// Pushed right before the master clock they are timestamped with, and the updates are on every 512th one
+			while (next < log->count && log->writes[next].time <= update << 9) {
+				t85APU_writeReg(apu, log->writes[next].addr, log->writes[next].data);
+				next++;
+			}
+			bool sample = !((update - start) % stride);
+			if (sample || t85APU_shiftRegisterPending(apu)) {
+				uint32_t output = t85APU_runUpdate(apu);
+				update++;
+				if (!sample) continue;
+				if (output < min) min = output;
+				if (output > max) max = output;
+				sum += (double)output * output;
+				sampled++;
+				continue;
+			}
+			// Up to the next sampled update, or the one that takes the next write
+			uint64_t target = start + ((update - start) / stride + 1) * stride;
+			if (target > end) target = end;
+			if (next < log->count && (log->writes[next].time + 511) >> 9 < target) target = (log->writes[next].time + 511) >> 9;
+			t85APU_skipUpdates(apu, (uint32_t)(target - update));
+			update = target;
+		}
+		blocks[b].min = min;
+		blocks[b].max = max;
+		blocks[b].rms = sqrt(sum / sampled);
+	}
+	return blockCount;
+}
+
+#define SEEKINDEX_VERSION		1
+#define SEEKINDEX_HEADER_SIZE	40
+#define CHECKPOINT_HEADER_SIZE	16
+
+#define checkpointAt(index, i) ((index)->checkpoints + (i) * (CHECKPOINT_HEADER_SIZE + (index)->stateSize))
+
+// Pushes the writes of the log from *next on that are before end onto the register write buffer, each right before its master clock, and moves the t85APU up to end
+static void replayUntil (const t85APU_regLog * log, t85APU * apu, uint64_t now, uint64_t end, size_t * next) {
+	while (*next < log->count && log->writes[*next].time < end) {
+		const t85APU_regWrite * write = &log->writes[*next];
+		t85APU_advance(apu, write->time - now);
+		now = write->time;
+		t85APU_writeReg(apu, write->addr, write->data);
+		(*next)++;
+	}
+	t85APU_advance(apu, end - now);
+}
+
+t85APU_seekIndex * t85APU_seekIndex_build (const t85APU_regLog * log, t85APU * apu, double seconds) {
+	if (!log || !apu) return NULL;
+	uint64_t interval = (uint64_t)(seconds * log->clock);
+	if (!interval) {
+		fprintf(stderr, "The interval of a seek index has to be at least 1 master clock\n");
+		return NULL;
+	}
+	size_t stateSize = t85APU_getStateSize(apu);
+	uint64_t lastTime = log->count ? log->writes[log->count-1].time : 0;
+	size_t count = (size_t)(lastTime / interval) + 1;
+	size_t recordSize = CHECKPOINT_HEADER_SIZE + stateSize;
+	if (count > SIZE_MAX / recordSize) {
+		fprintf(stderr, "The seek index would be too large\n");
+		return NULL;
+	}
+	t85APU_seekIndex * index = (t85APU_seekIndex *) calloc(1, sizeof(t85APU_seekIndex));
+	if (!index || !(index->data = (uint8_t *) malloc(count * recordSize))) {
+		fprintf(stderr, "Could not allocate t85APU seek index\n");
+		free(index);
+		return NULL;
+	}
+	index->interval = interval;
+	index->count = count;
+	index->logCount = log->count;
+	index->stateSize = stateSize;
+	index->checkpoints = index->data;
+
+	size_t next = 0;
+	for (size_t i = 0; i < count; i++) {
+		uint64_t time = (uint64_t)i * interval;
+		if (i) replayUntil(log, apu, time - interval, time, &next);
+		uint8_t * checkpoint = index->data + i * recordSize;
+		putLE(checkpoint, time, 8);
+		putLE(checkpoint+8, next, 8);
+		if (!t85APU_saveState(apu, checkpoint + CHECKPOINT_HEADER_SIZE)) {
+			t85APU_seekIndex_delete(index);
+			return NULL;
+		}
+	}
+	replayUntil(log, apu, (uint64_t)(count - 1) * interval, lastTime + 1, &next);
+	return index;
+}
+
+t85APU_seekIndex * t85APU_seekIndex_open (const void * data, size_t size) {
+	const uint8_t * header = (const uint8_t *) data;
+	if (!data || size < SEEKINDEX_HEADER_SIZE || memcmp(header, "T85I", 4) || getLE(header+4, 4) != SEEKINDEX_VERSION) {
+		fprintf(stderr, "Not a version %d seek index\n", SEEKINDEX_VERSION);
+		return NULL;
+	}
+	uint64_t interval = getLE(header+8, 8), count = getLE(header+16, 8), stateSize = getLE(header+32, 8);
+	if (!interval || !count || stateSize > SIZE_MAX - CHECKPOINT_HEADER_SIZE
+		|| count > (size - SEEKINDEX_HEADER_SIZE) / (CHECKPOINT_HEADER_SIZE + stateSize)) {
+		fprintf(stderr, "The seek index is truncated or corrupted\n");
+		return NULL;
+	}
+	t85APU_seekIndex * index = (t85APU_seekIndex *) calloc(1, sizeof(t85APU_seekIndex));
+	if (!index) {
+		fprintf(stderr, "Could not allocate t85APU seek index\n");
+		return NULL;
+	}
+	index->interval = interval;
+	index->count = (size_t)count;
+	index->logCount = getLE(header+24, 8);
+	index->stateSize = (size_t)stateSize;
+	index->checkpoints = header + SEEKINDEX_HEADER_SIZE;
+	return index;
+}
+
+t85APU_seekIndex * t85APU_seekIndex_load (const char * path) {
+	FILE * file = fopen(path, "rb");
+	if (!file) {
+		fprintf(stderr, "Could not open seek index '%s'\n", path);
+		return NULL;
+	}
+	uint8_t * data = NULL;
+	size_t size = 0, capacity = 0;
+	for (;;) {
+		if (size == capacity) {
+			uint8_t * grown = capacity <= SIZE_MAX / 2 ? (uint8_t *) realloc(data, capacity = capacity ? capacity * 2 : 65536) : NULL;
+			if (!grown) {
+				fprintf(stderr, "Could not allocate seek index '%s'\n", path);
+				free(data);
+				fclose(file);
+				return NULL;
+			}
+			data = grown;
+		}
+		size_t got = fread(data + size, 1, capacity - size, file);
+		size += got;
+		if (!got) break;
+	}
+	fclose(file);
+	t85APU_seekIndex * index = t85APU_seekIndex_open(data, size);
+	if (!index) {
+		fprintf(stderr, "Could not load seek index '%s'\n", path);
+		free(data);
+		return NULL;
+	}
+	index->data = data;
+	return index;
+}
+
+bool t85APU_seekIndex_save (const t85APU_seekIndex * index, const char * path) {
+	if (!index) return false;
+	FILE * file = fopen(path, "wb");
+	if (!file) {
+		fprintf(stderr, "Could not open seek index '%s' for writing\n", path);
+		return false;
+	}
+	uint8_t header[SEEKINDEX_HEADER_SIZE];
+	memcpy(header, "T85I", 4);
+	putLE(header+4, SEEKINDEX_VERSION, 4);
+	putLE(header+8, index->interval, 8);
+	putLE(header+16, index->count, 8);
+	putLE(header+24, index->logCount, 8);
+	putLE(header+32, index->stateSize, 8);
+	size_t checkpointsSize = index->count * (CHECKPOINT_HEADER_SIZE + index->stateSize);
+	bool success = fwrite(header, 1, SEEKINDEX_HEADER_SIZE, file) == SEEKINDEX_HEADER_SIZE
+		&& fwrite(index->checkpoints, 1, checkpointsSize, file) == checkpointsSize;
+	if (fclose(file)) success = false;
+	if (!success) fprintf(stderr, "Could not write seek index '%s'\n", path);
+	return success;
+}
+
+void t85APU_seekIndex_delete (t85APU_seekIndex * index) {
+	if (!index) return;
+	if (index->data) free(index->data);
+	free(index);
+}
+
+bool t85APU_seekIndex_seek (const t85APU_seekIndex * index, const t85APU_regLog * log, t85APU * apu, uint64_t time, size_t * nextWrite) {
+	if (!index || !log || !apu) return false;
+	if (index->logCount != log->count) {
+		fprintf(stderr, "The seek index was built from a different register log\n");
+		return false;
+	}
+	uint64_t i = time / index->interval;
+	if (i >= index->count) i = index->count - 1;
+	const uint8_t * checkpoint = checkpointAt(index, i);
+	uint64_t start = getLE(checkpoint, 8), next = getLE(checkpoint+8, 8);
+	if (next > log->count || (next < log->count && log->writes[next].time < start)) {
+		fprintf(stderr, "The seek index was built from a different register log\n");
+		return false;
+	}
+	if (!t85APU_loadState(apu, checkpoint + CHECKPOINT_HEADER_SIZE, index->stateSize)) return false;
+	size_t nextIndex = (size_t)next;
+	replayUntil(log, apu, start, time, &nextIndex);
+	if (nextWrite) *nextWrite = nextIndex;
+	return true;
+}
@@ -0,0 +1,231 @@
+/*
+t85apu_reglog.h
+Part of the ATtiny85APU emulation library
+Written by alexmush
+2024-2024
+*/
+
+#ifndef __T85APU_REGLOG_H__
+#define __T85APU_REGLOG_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "t85apu.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+	A register log is a list of register writes, each timestamped with the amount of master clocks since the t85APU was reset, sorted by time.
+	Each write is meant to be pushed onto the register write buffer (with t85APU_writeReg) right before the master clock it is timestamped with gets ticked.
+
+	The file format is little-endian:
+		4 bytes		"T85L"
+		4 bytes		Format version (1)
+		8 bytes		Master clock speed in Hz, as a double, informational only
+		8 bytes		Amount of writes
+		10 bytes per write:
+			8 bytes		Timestamp
+			1 byte		Register number
+			1 byte		Data
+
+	A seek index is a list of checkpoints of a register log, each one being the saved state (see t85APU_saveState) of a t85APU running the log
+	at a multiple of a fixed interval, so that seeking only has to replay the writes since the nearest checkpoint before it.
+	Its file format is little-endian, with fixed-size checkpoints so that it can be memory-mapped and used in place:
+		4 bytes		"T85I"
+		4 bytes		Format version (1)
+		8 bytes		Interval between the checkpoints, in master clocks
+		8 bytes		Amount of checkpoints
+		8 bytes		Amount of writes of the register log it was built from
+		8 bytes		Size of each saved state
+		(16 + size of each saved state) bytes per checkpoint, the first one at time 0:
+			8 bytes		Timestamp
+			8 bytes		Index of the first write at or after the timestamp, i.e. not yet pushed onto the register write buffer
+			The saved state
+*/
+
+typedef struct __t85apu_regwrite {
+	uint64_t time;	// In master clocks since reset
+	uint8_t addr;
+	uint8_t data;
+} t85APU_regWrite;
+
+typedef struct __t85apu_reglog {
+	double clock;	// The master clock speed the timestamps were made at, in Hz
+	size_t count;
+	t85APU_regWrite * writes;
+} t85APU_regLog;
+
+/**
+ * @brief Statistics of the register log optimizer.
+ */
+typedef struct __t85apu_regoptstats {
+	size_t droppedDead;			// Writes overwritten before they could be observed
+	size_t droppedRedundant;	// Writes that did not change anything
+	size_t reordered;			// Writes that got applied in a different order
+	uint64_t worstDelay;		// The most master clocks that a kept write got applied later than before
+	uint64_t worstAdvance;		// The most master clocks that a kept write got applied earlier than before
+} t85APU_regOptStats;
+
+/**
+ * @brief The summary of a block of a waveform preview, see @c t85APU_regLog_preview.
+ */
+typedef struct __t85apu_previewblock {
+	uint8_t min;	// The lowest raw output (0..255) of the updates sampled in the block
+	uint8_t max;	// The highest one
+	float rms;		// The root mean square of them
+} t85APU_previewBlock;
+
+/**
+ * @brief A seek index of a register log, see the file format above. The checkpoints are kept in the file format, so it can point into a memory-mapped file.
+ */
+typedef struct __t85apu_seekindex {
+	uint64_t interval;	// In master clocks
+	size_t count;	// The amount of checkpoints
+	uint64_t logCount;	// The amount of writes of the register log it was built from
+	size_t stateSize;
+	const uint8_t * checkpoints;
+	uint8_t * data;	// The memory it owns, a null pointer if the checkpoints belong to the caller
+} t85APU_seekIndex;
+
+/**
+ * @name t85APU_regLog functions
+ * Functions interacting with register logs.
+ */
+///@{
+/**
+ * @brief Creates a new empty register log.
+ *
+ * @param clock The master clock speed the timestamps are made at, in Hz. If not set (i.e. 0), will default to 8000000 - 8MHz.
+ * @param capacity The amount of writes to allocate memory for.
+ * @return The pointer to the newly created register log. Returns a null pointer if an error has occured.
+ */
+t85APU_regLog * t85APU_regLog_new (double clock, size_t capacity);
+/**
+ * @brief Loads a register log from a file.
+ *
+ * @param path The path to the file.
+ * @return The pointer to the loaded register log. Returns a null pointer if an error has occured.
+ */
+t85APU_regLog * t85APU_regLog_load (const char * path);
+/**
+ * @brief Loads a register log from a file into an existing one, reusing its memory for the writes and only growing it when the file has more of them, e.g. to load many logs one after another without allocating for each.
+ *
+ * @param log The register log to load into. Its clock and writes are replaced.
+ * @param capacity The amount of writes the memory of @p log has room for, 0 for a log with none. Updated when it grows.
+ * @param path The path to the file.
+ * @return true if the log was loaded successfully.
+ * @return false if an error has occured, in which case the log is left empty.
+ */
+bool t85APU_regLog_read (t85APU_regLog * log, size_t * capacity, const char * path);
+/**
+ * @brief Saves a register log to a file.
+ *
+ * @param log The register log to save.
+ * @param path The path to the file.
+ * @return true if the log was saved successfully.
+ * @return false if an error has occured.
+ */
+bool t85APU_regLog_save (const t85APU_regLog * log, const char * path);
+/**
+ * @brief Deletes the register log from memory.
+ *
+ * @param log The register log to delete.
+ */
+void t85APU_regLog_delete (t85APU_regLog * log);
+
+/**
+ * @brief Removes dead and redundant writes from a register log and reorders the remaining ones, so that the writes that matter get applied sooner.
+ * @note The writes are assumed to start from a freshly reset t85APU. Since the t85APU applies 1 write per 512 master clocks, the timing of the kept writes changes - the worst case of that is reported in @p stats.
+ * @li Writes that get overwritten before the update that would apply them (or, for @c ELDLO / @c ELDHI, before an envelope phase reset uses them) are dropped. For @c PHIAB / @c PHICD / @c PHIEN, the phase resets of a dropped write are merged into the one overwriting it.
+ * @li Writes that do not change the state of the t85APU (e.g. writing the same volume twice, or the byte of a @c NTPLO / @c NTPHI or @c ELDLO / @c ELDHI pair that did not change) are dropped.
+ * @li Writes to channels that are silent both before and after them are let through after the pending writes that affect audible channels.
+ *
+ * @param writes The writes to optimize, sorted by time. They are modified in place.
+ * @param count The amount of writes.
+ * @param stats Where to store the statistics of the optimization. Can be a null pointer.
+ * @return The amount of writes left.
+ */
+size_t t85APU_regLog_optimize (t85APU_regWrite * writes, size_t count, t85APU_regOptStats * stats);
+/**
+ * @brief Renders a waveform preview of the register log, i.e. the minimum, maximum and RMS of the raw output over each block of updates, hundreds of times faster than rendering it.
+ * Only every @p stride -th update of each block (starting from its first one) has its output calculated, the ones in between are skipped in closed form with @c t85APU_skipUpdates.
+ * Every write is still pushed onto the register write buffer right before the update that takes it, and the updates that take a write are always run, so the writes are applied on the same updates as when rendering.
+ * @note To preview the whole log, render ((the time of its last write) / 512 / @p blockUpdates + 1) blocks.
+ * @note In the burst mode, how many writes an update takes depends on the cycle counts of the updates before it, which the skipped updates do not have, so the writes can be applied a few updates off.
+ *
+ * @param log The register log.
+ * @param apu A freshly reset t85APU to run it on, with its register write buffer size, burst mode, backend and mutes set up. Its output type, quality and output stage do not matter.
+ * @param blockUpdates The amount of updates (512 master clocks each) per block. Has to be at least 1.
+ * @param stride Every how many updates the output is calculated, 1 to calculate all of them. 0 is treated as 1.
+ * @param blocks Where to write the blocks to.
+ * @param blockCount The amount of blocks to render.
+ * @return The amount of blocks rendered, 0 if an error has occured.
+ */
+size_t t85APU_regLog_preview (const t85APU_regLog * log, t85APU * apu, uint32_t blockUpdates, uint32_t stride, t85APU_previewBlock * blocks, size_t blockCount);
+
+/**
+ * @brief Builds a seek index of a register log by running the whole log once (with @c t85APU_advance, so only the updates around the writes are calculated).
+ *
+ * @param log The register log.
+ * @param apu A freshly reset t85APU to run it on, with its register write buffer size and burst mode set up, and no backend. It is left at the end of the log.
+ * @param seconds The interval between the checkpoints, in seconds at the clock speed of the log. Shorter intervals make seeking faster, and the index larger.
+ * @return The pointer to the newly created seek index. Returns a null pointer if an error has occured.
+ */
+t85APU_seekIndex * t85APU_seekIndex_build (const t85APU_regLog * log, t85APU * apu, double seconds);
+/**
+ * @brief Loads a seek index from a file.
+ *
+ * @param path The path to the file.
+ * @return The pointer to the loaded seek index. Returns a null pointer if an error has occured.
+ */
+t85APU_seekIndex * t85APU_seekIndex_load (const char * path);
+/**
+ * @brief Opens a seek index in memory, e.g. a memory-mapped file, without copying its checkpoints.
+ * @note The memory has to stay valid until the seek index is deleted.
+ *
+ * @param data The seek index in its file format.
+ * @param size The size of it in bytes.
+ * @return The pointer to the opened seek index. Returns a null pointer if an error has occured.
+ */
+t85APU_seekIndex * t85APU_seekIndex_open (const void * data, size_t size);
+/**
+ * @brief Saves a seek index to a file.
+ *
+ * @param index The seek index to save.
+ * @param path The path to the file.
+ * @return true if the index was saved successfully.
+ * @return false if an error has occured.
+ */
+bool t85APU_seekIndex_save (const t85APU_seekIndex * index, const char * path);
+/**
+ * @brief Deletes the seek index from memory.
+ *
+ * @param index The seek index to delete.
+ */
+void t85APU_seekIndex_delete (t85APU_seekIndex * index);
+/**
+ * @brief Seeks a t85APU to the given time of a register log, by restoring the nearest checkpoint before it and replaying the writes since then.
+ * The state is exactly the one of a t85APU that ran the log from its start, with every write at or before @p time - 1 pushed onto the register write buffer.
+ * @note The settings of the t85APU (output type, quality, output stage) are kept, and its resampler and output stage continue from the state saved in the checkpoint.
+ *
+ * @param index The seek index of the register log.
+ * @param log The register log it was built from.
+ * @param apu The t85APU to seek, with the same register write buffer size and burst mode that the index was built with, and no backend.
+ * @param time The time to seek to, in master clocks since reset.
+ * @param nextWrite Where to store the index of the first write not pushed yet, i.e. the one to continue playing the log from. Can be a null pointer.
+ * @return true if the t85APU was seeked.
+ * @return false if an error has occured.
+ */
+bool t85APU_seekIndex_seek (const t85APU_seekIndex * index, const t85APU_regLog * log, t85APU * apu, uint64_t time, size_t * nextWrite);
+///@}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -115,6 +115,9 @@ int main (int argc, char ** argv) {
 	//* Finally, let's write the data to the actual registers:
 	t85APU_writeReg(apu, PILOA, increment);
 	t85APU_writeReg(apu, PHIAB, PitchHi_Sq_A(octave));
+	//* Doing all of this on every note is slow, so for notes it is better to precalculate it.
+	// The t85apu_pitchgen tool prints the pitches of all MIDI notes for a given clock speed
+	// as static const arrays, after which a note-on is just 2 array lookups.
 
 	// And let it simmer for a bit:
 	writeFrames(20);
@@ -117,6 +117,10 @@ int main (int argc, char ** argv) {
 	//* Finally, let's write the data to the actual registers:
 	apu.writeReg(PILOA, increment);
 	apu.writeReg(PHIAB, PitchHi_Sq_A(octave));
+	//* Doing all of this on every note is slow, so for notes it is better to precalculate it.
+	// The t85apu_pitch.hpp header can do it for all MIDI notes at compile time:
+	// constexpr t85APUNoteTable notes = t85APU_noteTable<clockSpeed>;
+	// after which a note-on is just notes.tone[note].increment and notes.tone[note].octave.
 
 	// And let it simmer for a bit:
 	writeFrames(20);
@@ -210,6 +214,8 @@ int main (int argc, char ** argv) {
 	// or finishing a non-repeating envelope.
 	// And finally, enable the envelope on the channel (and specify its index):
 	apu.writeReg(CFG_A, bit(ENV_EN)|EnvNum(0)|Pan(3, 3));
+	// The t85apu_patch.hpp header can bake these 4 writes into one patch at compile time,
+	// checking every field, and apu.writeRegs(patch) pushes it in one call.
 
 	// The period of an envelope can be calculated by the following formula:
 	// (1 << 23) / (increment << octave) / chipSampleRate,
@@ -0,0 +1,512 @@
+/*
+	t85APU firmware recompiler
+	© alexmush, 2024
+	Statically recompiles the firmware (avr/main.asm) into C, as the t85APU_firmware_run function of t85apu_firmware.h.
+	Every instruction becomes a few lines of C with its exact cycle count, and the flags nothing reads are not calculated.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avrasm.h"
+
+#define DATA_SIZE		0x260	// The data space of the ATtiny85, has to match T85APU_FIRMWARE_DATA_SIZE
+#define VECTOR_COUNT	15		// Interrupt vectors of the ATtiny85
+#define IO_SREG			0x3F
+#define ALL_FLAGS		0xFF
+
+typedef struct {
+	const avrAsm_program * program;
+	FILE * out;
+	uint8_t * liveOut;	// Flags that are read after each instruction, before being written again
+	bool * isTarget;	// Whether each instruction is jumped to by a goto
+	bool fallsThrough;	// Whether the last instruction emitted runs into the next one
+} generator;
+
+static const char * const flagNames[8] = {"fC", "fZ", "fN", "fV", "fS", "fH", "fT", "fI"};
+
+static const avrAsm_insn * nextInsn (const avrAsm_program * program, const avrAsm_insn * insn) {
+	return avrAsm_insnAt(program, insn->addr + insn->words);
+}
+
+static uint8_t flagsRead (const avrAsm_insn * insn) {
+	if (insn->op == AVRASM_IN && insn->k == IO_SREG) return ALL_FLAGS;
+	return avrAsm_ops[insn->op].flagsRead;
+}
+
+static uint8_t flagsWritten (const avrAsm_insn * insn) {
+	if (insn->op == AVRASM_OUT && insn->k == IO_SREG) return ALL_FLAGS;
+	return avrAsm_ops[insn->op].flagsWritten;
+}
+
+// Backwards dataflow over the control flow graph. Unknown successors (ijmp, icall, reti, leaving the program) read every flag
+static void computeLiveness (generator * gen) {
+	const avrAsm_program * program = gen->program;
+	size_t count = program->count;
+	uint8_t * liveIn = (uint8_t *) calloc(count, 1);
+	size_t * returnSites = (size_t *) malloc((count + 1) * sizeof(size_t));
+	if (!liveIn || !returnSites) {
+		fprintf(stderr, "Could not allocate memory\n");
+		exit(2);
+	}
+	size_t returnSiteCount = 0;
+	for (size_t i = 0; i < count; i++) {
+		const avrAsm_insn * insn = &program->insns[i];
+		if (insn->op == AVRASM_RCALL || insn->op == AVRASM_ICALL) {
+			const avrAsm_insn * site = nextInsn(program, insn);
+			if (site) returnSites[returnSiteCount++] = site - program->insns;
+		}
+	}
+
+	#define LIVE_AT(addr) (avrAsm_insnAt(program, addr) ? liveIn[avrAsm_insnAt(program, addr) - program->insns] : ALL_FLAGS)
+	uint8_t interruptLive = 0;	// Read by an interrupt handler before being written, so they have to be kept everywhere
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (size_t i = count; i-- > 0;) {
+			const avrAsm_insn * insn = &program->insns[i];
+			uint8_t live = interruptLive;
+			uint32_t next = insn->addr + insn->words;
+			switch (insn->op) {
+				case AVRASM_RJMP:
+				case AVRASM_RCALL:
+					live |= LIVE_AT(insn->k);
+					break;
+				case AVRASM_RET:
+					for (size_t s = 0; s < returnSiteCount; s++) live |= liveIn[returnSites[s]];
+					if (!returnSiteCount) live = ALL_FLAGS;
+					break;
+				case AVRASM_RETI:
+				case AVRASM_IJMP:
+				case AVRASM_ICALL:
+					live = ALL_FLAGS;
+					break;
+				default:
+					live |= LIVE_AT(next);
+					if (avrAsm_isBranch(insn->op)) live |= LIVE_AT(insn->k);
+					if (avrAsm_isSkip(insn->op)) {
+						const avrAsm_insn * skipped = avrAsm_insnAt(program, next);
+						live |= skipped ? LIVE_AT(next + skipped->words) : ALL_FLAGS;
+					}
+					break;
+			}
+			uint8_t in = flagsRead(insn) | (live & ~flagsWritten(insn));
+			if (live != gen->liveOut[i] || in != liveIn[i]) {
+				gen->liveOut[i] = live;
+				liveIn[i] = in;
+				changed = true;
+			}
+		}
+		uint8_t vectorsLive = 0;
+		for (uint32_t addr = 1; addr < VECTOR_COUNT; addr++) {
+			if (avrAsm_insnAt(program, addr)) vectorsLive |= LIVE_AT(addr);
+		}
+		if ((vectorsLive | interruptLive) != interruptLive) {
+			interruptLive |= vectorsLive;
+			changed = true;
+		}
+	}
+	#undef LIVE_AT
+	free(liveIn);
+	free(returnSites);
+}
+
+static void markTargets (generator * gen) {
+	const avrAsm_program * program = gen->program;
+	for (size_t i = 0; i < program->count; i++) {
+		const avrAsm_insn * insn = &program->insns[i];
+		const avrAsm_insn * target = NULL;
+		if (insn->op == AVRASM_RJMP || insn->op == AVRASM_RCALL || avrAsm_isBranch(insn->op)) target = avrAsm_insnAt(program, insn->k);
+		if (avrAsm_isSkip(insn->op)) {
+			const avrAsm_insn * skipped = nextInsn(program, insn);
+			if (skipped) target = nextInsn(program, skipped);
+		}
+		if (target) gen->isTarget[target - program->insns] = true;
+	}
+}
+
+static bool live (const generator * gen, const avrAsm_insn * insn, int flag) {
+	return gen->liveOut[insn - gen->program->insns] & (1 << flag);
+}
+
+// Jumps to an address, through the dispatcher if there is no instruction there
+static void emitGoto (generator * gen, uint32_t addr) {
+	if (avrAsm_insnAt(gen->program, addr)) fprintf(gen->out, "goto L_%04X;", addr);
+	else fprintf(gen->out, "pc = 0x%04X; goto dispatch;", addr);
+}
+
+// Calculates the flags of an addition or a subtraction of a and b into res (9 bits, not masked yet)
+static void emitArithFlags (generator * gen, const avrAsm_insn * insn, bool subtract, bool keepZ) {
+	FILE * out = gen->out;
+	if (live(gen, insn, AVRASM_FLAG_C)) fprintf(out, "\tfC = (res >> 8) & 1;\n");
+	if (live(gen, insn, AVRASM_FLAG_H)) {
+		if (subtract) fprintf(out, "\tfH = (((~a & b) | (b & res) | (res & ~a)) >> 3) & 1;\n");
+		else fprintf(out, "\tfH = (((a & b) | (b & ~res) | (~res & a)) >> 3) & 1;\n");
+	}
+	fprintf(out, "\tres &= 0xFF;\n");
+	if (live(gen, insn, AVRASM_FLAG_Z)) fprintf(out, keepZ ? "\tfZ = fZ & !res;\n" : "\tfZ = !res;\n");
+	if (live(gen, insn, AVRASM_FLAG_N)) fprintf(out, "\tfN = res >> 7;\n");
+	const char * overflow = subtract ? "((((a ^ b) & (a ^ res)) >> 7) & 1)" : "((((a ^ res) & (b ^ res)) >> 7) & 1)";
+	if (live(gen, insn, AVRASM_FLAG_V)) fprintf(out, "\tfV = %s;\n", overflow);
+	if (live(gen, insn, AVRASM_FLAG_S)) fprintf(out, "\tfS = (res >> 7) ^ %s;\n", overflow);
+}
+
+// Calculates Z, N, V and S for a result in res, with V given as an expression
+static void emitResultFlags (generator * gen, const avrAsm_insn * insn, const char * overflow) {
+	FILE * out = gen->out;
+	if (live(gen, insn, AVRASM_FLAG_Z)) fprintf(out, "\tfZ = !res;\n");
+	if (live(gen, insn, AVRASM_FLAG_N)) fprintf(out, "\tfN = res >> 7;\n");
+	if (live(gen, insn, AVRASM_FLAG_V)) fprintf(out, "\tfV = %s;\n", overflow);
+	if (live(gen, insn, AVRASM_FLAG_S)) fprintf(out, "\tfS = (res >> 7) ^ (%s);\n", overflow);
+}
+
+static void emitIn (generator * gen, const char * dst, int io) {
+	if (io == IO_SREG) fprintf(gen->out, "\t%s = fC | fZ << 1 | fN << 2 | fV << 3 | fS << 4 | fH << 5 | fT << 6 | fI << 7;\n", dst);
+	else fprintf(gen->out, "\tfw->cycles = cycles;\n\t%s = t85APU_firmware_in(fw, 0x%02X);\n", dst, io);
+}
+
+// Writes to an I/O register, the value is in res
+static void emitOut (generator * gen, const avrAsm_insn * insn, int io) {
+	FILE * out = gen->out;
+	if (io == IO_SREG) {
+		fprintf(out, "\tfC = res & 1; fZ = (res >> 1) & 1; fN = (res >> 2) & 1; fV = (res >> 3) & 1;\n");
+		fprintf(out, "\tfS = (res >> 4) & 1; fH = (res >> 5) & 1; fT = (res >> 6) & 1;\n");
+		// Setting I works like sei
+		fprintf(out, "\tif (!fI && (res >> 7)) { fI = 1; fw->irqHold = true; pc = 0x%04X; goto suspend; }\n", insn->addr + insn->words);
+		fprintf(out, "\tfI = res >> 7;\n");
+	} else {
+		fprintf(out, "\tfw->cycles = cycles;\n\tt85APU_firmware_out(fw, 0x%02X, res);\n\tevent = fw->event;\n", io);
+	}
+}
+
+static bool checkDataAddr (const avrAsm_insn * insn) {
+	if (insn->k < DATA_SIZE) return true;
+	fprintf(stderr, "%s:%d: error: 0x%04X is outside of the data space\n", insn->file, insn->line, insn->k);
+	return false;
+}
+
+// Emits the pointer address calculation of ld / st into a, with the pre-decrement or post-increment
+static void emitPointer (generator * gen, const avrAsm_insn * insn, bool before) {
+	FILE * out = gen->out;
+	int p = insn->ptr;
+	if (before) {
+		if (insn->ptrMode == AVRASM_PTR_PREDEC) fprintf(out, "\ta = ((d[%d] | d[%d] << 8) - 1) & 0xFFFF;\n\td[%d] = a & 0xFF; d[%d] = a >> 8;\n", p, p+1, p, p+1);
+		else fprintf(out, "\ta = ((d[%d] | d[%d] << 8) + %d) & 0xFFFF;\n", p, p+1, insn->k);
+	} else if (insn->ptrMode == AVRASM_PTR_POSTINC) {
+		fprintf(out, "\tb = (a + 1) & 0xFFFF;\n\td[%d] = b & 0xFF; d[%d] = b >> 8;\n", p, p+1);
+	}
+}
+
+static bool emitInsn (generator * gen, const avrAsm_insn * insn) {
+	FILE * out = gen->out;
+	const avrAsm_opInfo * info = &avrAsm_ops[insn->op];
+	const avrAsm_insn * next = nextInsn(gen->program, insn);
+	uint32_t nextAddr = insn->addr + insn->words;
+	int d = insn->d, r = insn->r;
+	int cycles = info->cycles;
+	bool counted = false;	// Whether the cycles have been added already, writes happen on the last cycle of an instruction
+
+	const avrAsm_label * label = avrAsm_labelAt(gen->program, insn->addr);
+	if (label && label->addr == insn->addr) fprintf(out, "\n\t// %s:\n", label->name);
+	// Right before the label, so that -Wimplicit-fallthrough takes it
+	if (gen->fallsThrough) fprintf(out, "\t/* fallthrough */\n");
+	gen->fallsThrough = false;
+	fprintf(out, "\tcase 0x%04X:", insn->addr);
+	if (gen->isTarget[insn - gen->program->insns]) fprintf(out, " L_%04X:", insn->addr);
+	fprintf(out, "\t// %s\n", insn->text);
+	fprintf(out, "\tif (cycles >= event) { pc = 0x%04X; goto suspend; }\n", insn->addr);
+
+	switch (insn->op) {
+		case AVRASM_ADD: case AVRASM_ADC: case AVRASM_LSL: case AVRASM_ROL:
+			if (insn->op == AVRASM_LSL || insn->op == AVRASM_ROL) r = d;
+			fprintf(out, "\ta = d[%d]; b = d[%d];\n\tres = a + b%s;\n", d, r, insn->op == AVRASM_ADC || insn->op == AVRASM_ROL ? " + fC" : "");
+			emitArithFlags(gen, insn, false, false);
+			fprintf(out, "\td[%d] = res;\n", d);
+			break;
+		case AVRASM_SUB: case AVRASM_SBC: case AVRASM_CP: case AVRASM_CPC:
+		case AVRASM_SUBI: case AVRASM_SBCI: case AVRASM_CPI: {
+			bool immediate = info->format == AVRASM_FMT_RD_K;
+			bool carry = insn->op == AVRASM_SBC || insn->op == AVRASM_CPC || insn->op == AVRASM_SBCI;
+			if (immediate) fprintf(out, "\ta = d[%d]; b = 0x%02X;\n", d, insn->k);
+			else fprintf(out, "\ta = d[%d]; b = d[%d];\n", d, r);
+			fprintf(out, "\tres = a - b%s;\n", carry ? " - fC" : "");
+			emitArithFlags(gen, insn, true, carry);
+			if (insn->op != AVRASM_CP && insn->op != AVRASM_CPC && insn->op != AVRASM_CPI) fprintf(out, "\td[%d] = res;\n", d);
+			break;
+		}
+		case AVRASM_NEG:
+			fprintf(out, "\ta = 0; b = d[%d];\n\tres = a - b;\n", d);
+			emitArithFlags(gen, insn, true, false);
+			fprintf(out, "\td[%d] = res;\n", d);
+			break;
+		case AVRASM_AND: case AVRASM_OR: case AVRASM_EOR: case AVRASM_TST:
+		case AVRASM_ANDI: case AVRASM_ORI: case AVRASM_SBR: case AVRASM_CBR: case AVRASM_CLR: {
+			char src[32];
+			if (insn->op == AVRASM_CLR) {
+				fprintf(out, "\tres = 0;\n");
+			} else {
+				if (insn->op == AVRASM_TST) snprintf(src, sizeof(src), "d[%d]", d);
+				else if (info->format == AVRASM_FMT_RD_K) snprintf(src, sizeof(src), "0x%02X", insn->op == AVRASM_CBR ? ~insn->k & 0xFF : insn->k);
+				else snprintf(src, sizeof(src), "d[%d]", r);
+				char op = insn->op == AVRASM_OR || insn->op == AVRASM_ORI || insn->op == AVRASM_SBR ? '|'
+					: insn->op == AVRASM_EOR ? '^' : '&';
+				fprintf(out, "\tres = d[%d] %c %s;\n", d, op, src);
+			}
+			emitResultFlags(gen, insn, "0");
+			if (insn->op != AVRASM_TST) fprintf(out, "\td[%d] = res;\n", d);
+			break;
+		}
+		case AVRASM_COM:
+			fprintf(out, "\tres = d[%d] ^ 0xFF;\n", d);
+			if (live(gen, insn, AVRASM_FLAG_C)) fprintf(out, "\tfC = 1;\n");
+			emitResultFlags(gen, insn, "0");
+			fprintf(out, "\td[%d] = res;\n", d);
+			break;
+		case AVRASM_INC: case AVRASM_DEC: {
+			bool inc = insn->op == AVRASM_INC;
+			fprintf(out, "\tres = (d[%d] %c 1) & 0xFF;\n", d, inc ? '+' : '-');
+			emitResultFlags(gen, insn, inc ? "res == 0x80" : "res == 0x7F");
+			fprintf(out, "\td[%d] = res;\n", d);
+			break;
+		}
+		case AVRASM_LSR: case AVRASM_ROR: case AVRASM_ASR:
+			// V = N ^ C, with C being the bit shifted out
+			fprintf(out, "\ta = d[%d];\n", d);
+			if (insn->op == AVRASM_LSR) fprintf(out, "\tres = a >> 1;\n");
+			else if (insn->op == AVRASM_ROR) fprintf(out, "\tres = (a >> 1) | fC << 7;\n");
+			else fprintf(out, "\tres = (a >> 1) | (a & 0x80);\n");
+			if (live(gen, insn, AVRASM_FLAG_C)) fprintf(out, "\tfC = a & 1;\n");
+			emitResultFlags(gen, insn, "(res >> 7) ^ (a & 1)");
+			fprintf(out, "\td[%d] = res;\n", d);
+			break;
+		case AVRASM_ADIW: case AVRASM_SBIW: {
+			bool add = insn->op == AVRASM_ADIW;
+			fprintf(out, "\ta = d[%d] | d[%d] << 8;\n\tres = (a %c %d) & 0xFFFF;\n", d, d+1, add ? '+' : '-', insn->k);
+			const char * overflow = add ? "(~a & res) >> 15" : "(a & ~res) >> 15";
+			if (live(gen, insn, AVRASM_FLAG_C)) fprintf(out, "\tfC = (%s) & 1;\n", add ? "(a & ~res) >> 15" : "(~a & res) >> 15");
+			if (live(gen, insn, AVRASM_FLAG_Z)) fprintf(out, "\tfZ = !res;\n");
+			if (live(gen, insn, AVRASM_FLAG_N)) fprintf(out, "\tfN = res >> 15;\n");
+			if (live(gen, insn, AVRASM_FLAG_V)) fprintf(out, "\tfV = (%s) & 1;\n", overflow);
+			if (live(gen, insn, AVRASM_FLAG_S)) fprintf(out, "\tfS = ((res >> 15) ^ (%s)) & 1;\n", overflow);
+			fprintf(out, "\td[%d] = res & 0xFF; d[%d] = res >> 8;\n", d, d+1);
+			break;
+		}
+		case AVRASM_SWAP:
+			fprintf(out, "\td[%d] = (uint8_t)(d[%d] << 4 | d[%d] >> 4);\n", d, d, d);
+			break;
+		case AVRASM_MOV:
+			fprintf(out, "\td[%d] = d[%d];\n", d, r);
+			break;
+		case AVRASM_MOVW:
+			fprintf(out, "\td[%d] = d[%d]; d[%d] = d[%d];\n", d, r, d+1, r+1);
+			break;
+		case AVRASM_LDI:
+			fprintf(out, "\td[%d] = 0x%02X;\n", d, insn->k);
+			break;
+		case AVRASM_SER:
+			fprintf(out, "\td[%d] = 0xFF;\n", d);
+			break;
+		case AVRASM_BST:
+			fprintf(out, "\tfT = (d[%d] >> %d) & 1;\n", d, r);
+			break;
+		case AVRASM_BLD:
+			fprintf(out, "\td[%d] = (d[%d] & 0x%02X) | fT << %d;\n", d, d, ~(1 << r) & 0xFF, r);
+			break;
+
+		case AVRASM_IN:
+			emitIn(gen, "res", insn->k);
+			fprintf(out, "\td[%d] = res;\n", d);
+			break;
+		case AVRASM_OUT:
+			fprintf(out, "\tres = d[%d];\n", d);
+			fprintf(out, "\tcycles += %d;\n", cycles);
+			counted = true;
+			emitOut(gen, insn, insn->k);
+			break;
+		case AVRASM_SBI: case AVRASM_CBI:
+			emitIn(gen, "res", insn->k);
+			if (insn->op == AVRASM_SBI) fprintf(out, "\tres |= 0x%02X;\n", 1 << r);
+			else fprintf(out, "\tres &= 0x%02X;\n", ~(1 << r) & 0xFF);
+			fprintf(out, "\tcycles += %d;\n", cycles);
+			counted = true;
+			emitOut(gen, insn, insn->k);
+			break;
+		case AVRASM_LDS:
+			if (!checkDataAddr(insn)) return false;
+			if (insn->k >= 0x20 && insn->k < 0x60) {
+				emitIn(gen, "res", insn->k - 0x20);
+				fprintf(out, "\td[%d] = res;\n", d);
+			} else {
+				fprintf(out, "\td[%d] = d[0x%03X];\n", d, insn->k);
+			}
+			break;
+		case AVRASM_STS:
+			if (!checkDataAddr(insn)) return false;
+			if (insn->k >= 0x20 && insn->k < 0x60) {
+				fprintf(out, "\tres = d[%d];\n", d);
+				fprintf(out, "\tcycles += %d;\n", cycles);
+				counted = true;
+				emitOut(gen, insn, insn->k - 0x20);
+			} else {
+				fprintf(out, "\td[0x%03X] = d[%d];\n", insn->k, d);
+			}
+			break;
+		case AVRASM_LD: case AVRASM_LDD:
+			emitPointer(gen, insn, true);
+			fprintf(out, "\tif (a - 0x20 < 0x40) { fw->cycles = cycles; res = t85APU_firmware_in(fw, a - 0x20); }\n");
+			fprintf(out, "\telse res = a < T85APU_FIRMWARE_DATA_SIZE ? d[a] : 0;\n");
+			emitPointer(gen, insn, false);
+			fprintf(out, "\td[%d] = res;\n", d);
+			break;
+		case AVRASM_ST: case AVRASM_STD:
+			emitPointer(gen, insn, true);
+			fprintf(out, "\tres = d[%d];\n", d);
+			emitPointer(gen, insn, false);
+			fprintf(out, "\tcycles += %d;\n", cycles);
+			counted = true;
+			fprintf(out, "\tif (a - 0x20 < 0x40) { fw->cycles = cycles; t85APU_firmware_out(fw, a - 0x20, res); event = fw->event; }\n");
+			fprintf(out, "\telse if (a < T85APU_FIRMWARE_DATA_SIZE) d[a] = res;\n");
+			break;
+		case AVRASM_PUSH:
+			fprintf(out, "\tt85APU_firmware_push(fw, d[%d]);\n", d);
+			break;
+		case AVRASM_POP:
+			fprintf(out, "\td[%d] = t85APU_firmware_pop(fw);\n", d);
+			break;
+
+		case AVRASM_RJMP:
+			fprintf(out, "\tcycles += %d; ", cycles);
+			emitGoto(gen, insn->k);
+			fprintf(out, "\n");
+			return true;
+		case AVRASM_RCALL:
+			fprintf(out, "\tt85APU_firmware_push(fw, 0x%02X); t85APU_firmware_push(fw, 0x%02X);\n", nextAddr & 0xFF, nextAddr >> 8);
+			fprintf(out, "\tcycles += %d; ", cycles);
+			emitGoto(gen, insn->k);
+			fprintf(out, "\n");
+			return true;
+		case AVRASM_ICALL:
+			fprintf(out, "\tt85APU_firmware_push(fw, 0x%02X); t85APU_firmware_push(fw, 0x%02X);\n", nextAddr & 0xFF, nextAddr >> 8);
+			// Fall through
+		case AVRASM_IJMP:
+			fprintf(out, "\tcycles += %d; pc = d[30] | d[31] << 8; goto dispatch;\n", cycles);
+			return true;
+		case AVRASM_RET:
+			fprintf(out, "\tpc = t85APU_firmware_pop(fw) << 8; pc |= t85APU_firmware_pop(fw);\n");
+			fprintf(out, "\tcycles += %d; goto dispatch;\n", cycles);
+			return true;
+		case AVRASM_RETI:
+			// An instruction has to run before the next interrupt
+			fprintf(out, "\tpc = t85APU_firmware_pop(fw) << 8; pc |= t85APU_firmware_pop(fw);\n");
+			fprintf(out, "\tfI = 1; fw->irqHold = true; cycles += %d; goto suspend;\n", cycles);
+			return true;
+
+		case AVRASM_CLI:
+			fprintf(out, "\tfI = 0;\n");
+			break;
+		case AVRASM_SEI:
+			fprintf(out, "\tfI = 1; fw->irqHold = true; cycles += %d; pc = 0x%04X; goto suspend;\n", cycles, nextAddr);
+			return true;
+		case AVRASM_NOP:
+			break;
+
+		case AVRASM_CPSE: case AVRASM_SBRS: case AVRASM_SBRC: case AVRASM_SBIS: case AVRASM_SBIC: {
+			// Skips the next instruction (with its size) if the condition holds
+			bool io = insn->op == AVRASM_SBIS || insn->op == AVRASM_SBIC;
+			if (io) emitIn(gen, "res", insn->k);
+			if (insn->op == AVRASM_CPSE) fprintf(out, "\tif (d[%d] == d[%d]) { ", d, r);
+			else if (io) fprintf(out, "\tif (%s((res >> %d) & 1)) { ", insn->op == AVRASM_SBIC ? "!" : "", r);
+			else fprintf(out, "\tif (%s((d[%d] >> %d) & 1)) { ", insn->op == AVRASM_SBRC ? "!" : "", d, r);
+			int skipWords = next ? next->words : 1;
+			fprintf(out, "cycles += %d; ", cycles + skipWords);
+			emitGoto(gen, nextAddr + skipWords);
+			fprintf(out, " }\n");
+			break;
+		}
+
+		default:
+			if (avrAsm_isBranch(insn->op)) {
+				fprintf(out, "\tif (%s%s) { cycles += %d; ", info->branchIfSet ? "" : "!", flagNames[info->branchFlag], cycles + 1);
+				emitGoto(gen, insn->k);
+				fprintf(out, " }\n");
+				break;
+			}
+			fprintf(stderr, "%s:%d: error: '%s' is not supported by the recompiler\n", insn->file, insn->line, info->name);
+			return false;
+	}
+	if (!counted) fprintf(out, "\tcycles += %d;\n", cycles);
+	// Falling through into a gap leaves the program
+	if (!next) fprintf(out, "\tpc = 0x%04X; goto dispatch;\n", nextAddr);
+	gen->fallsThrough = next != NULL;
+	return true;
+}
+
+static bool emitProgram (generator * gen, const char * source) {
+	FILE * out = gen->out;
+	const avrAsm_program * program = gen->program;
+	fprintf(out, "/*\n\tGenerated by t85apu_avr2c from %s, do not edit.\n*/\n\n", source);
+	fprintf(out, "#include \"t85apu_firmware.h\"\n\n");
+	fprintf(out, "void t85APU_firmware_run (t85APU_firmware * fw) {\n");
+	fprintf(out, "\tuint8_t * const d = fw->data;\n");
+	fprintf(out, "\tuint64_t cycles = fw->cycles, event = fw->event;\n");
+	fprintf(out, "\tuint_fast16_t pc = fw->pc;\n");
+	fprintf(out, "\tunsigned a = 0, b = 0, res = 0;\n");
+	fprintf(out, "\tunsigned fC, fZ, fN, fV, fS, fH, fT, fI;\n");
+	fprintf(out, "\tres = d[0x5F];\n");
+	fprintf(out, "\tfC = res & 1; fZ = (res >> 1) & 1; fN = (res >> 2) & 1; fV = (res >> 3) & 1;\n");
+	fprintf(out, "\tfS = (res >> 4) & 1; fH = (res >> 5) & 1; fT = (res >> 6) & 1; fI = res >> 7;\n");
+	fprintf(out, "\t(void)a; (void)b;\n\n");
+	fprintf(out, "dispatch:\n\tswitch (pc) {\n");
+
+	for (size_t i = 0; i < program->count; i++) {
+		if (!emitInsn(gen, &program->insns[i])) return false;
+	}
+
+	fprintf(out, "\n\tdefault:\n\t\tfw->halted = true;\n\t\tbreak;\n\t}\n\n");
+	fprintf(out, "suspend:\n");
+	fprintf(out, "\td[0x5F] = fC | fZ << 1 | fN << 2 | fV << 3 | fS << 4 | fH << 5 | fT << 6 | fI << 7;\n");
+	fprintf(out, "\tfw->pc = pc;\n\tfw->cycles = cycles;\n}\n");
+	return true;
+}
+
+int main (int argc, char ** argv) {
+	avrAsm_options options;
+	memset(&options, 0, sizeof(options));
+	argc = avrAsm_parseArgs(&options, argc, argv);
+	if (argc != 3) {
+		fprintf(stderr, "Usage: t85apu_avr2c [-I include dir] [-D NAME[=value]] <firmware source> <output C file>\n");
+		return 1;
+	}
+	avrAsm_program * program = avrAsm_load(argv[1], &options);
+	if (!program) return 2;
+
+	generator gen;
+	gen.program = program;
+	gen.liveOut = (uint8_t *) calloc(program->count + 1, 1);
+	gen.isTarget = (bool *) calloc(program->count + 1, sizeof(bool));
+	gen.fallsThrough = false;
+	if (!gen.liveOut || !gen.isTarget) {
+		fprintf(stderr, "Could not allocate memory\n");
+		return 2;
+	}
+	computeLiveness(&gen);
+	markTargets(&gen);
+
+	gen.out = fopen(argv[2], "w");
+	if (!gen.out) {
+		fprintf(stderr, "Could not open '%s' for writing\n", argv[2]);
+		return 3;
+	}
+	bool success = emitProgram(&gen, argv[1]);
+	if (fclose(gen.out)) success = false;
+	if (!success) {
+		fprintf(stderr, "Could not recompile '%s'\n", argv[1]);
+		remove(argv[2]);
+	}
+
+	free(gen.liveOut);
+	free(gen.isTarget);
+	avrAsm_delete(program);
+	return success ? 0 : 3;
+}
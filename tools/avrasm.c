@@ -0,0 +1,1093 @@
+/*
+	t85APU tools - AVR assembly front-end
+	© alexmush, 2024
+	A 2-pass assembler for the subset of the AVRA dialect (and the instruction set) the firmware uses.
+	Symbols are case-insensitive, like in AVRA.
+*/
+
+#include "avrasm.h"
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define C_	(1<<AVRASM_FLAG_C)
+#define Z_	(1<<AVRASM_FLAG_Z)
+#define N_	(1<<AVRASM_FLAG_N)
+#define V_	(1<<AVRASM_FLAG_V)
+#define S_	(1<<AVRASM_FLAG_S)
+#define H_	(1<<AVRASM_FLAG_H)
+#define T_	(1<<AVRASM_FLAG_T)
+#define I_	(1<<AVRASM_FLAG_I)
+#define ARITH	(C_|Z_|N_|V_|S_|H_)
+#define LOGIC	(Z_|N_|V_|S_)
+
+#define OP(name, format, words, cycles, read, written)	{name, AVRASM_FMT_##format, words, cycles, read, written, -1, false}
+#define BR(name, flag, ifSet)	{name, AVRASM_FMT_K, 1, 1, 1<<AVRASM_FLAG_##flag, 0, AVRASM_FLAG_##flag, ifSet}
+
+// Cycle counts are the ones of the AVRe core (ATtiny25/45/85)
+const avrAsm_opInfo avrAsm_ops[AVRASM_OP_COUNT] = {
+	[AVRASM_ADD]	= OP("add",		RD_RR,	1, 1, 0,		ARITH),
+	[AVRASM_ADC]	= OP("adc",		RD_RR,	1, 1, C_,		ARITH),
+	[AVRASM_SUB]	= OP("sub",		RD_RR,	1, 1, 0,		ARITH),
+	[AVRASM_SBC]	= OP("sbc",		RD_RR,	1, 1, C_|Z_,	ARITH),
+	[AVRASM_AND]	= OP("and",		RD_RR,	1, 1, 0,		LOGIC),
+	[AVRASM_OR]		= OP("or",		RD_RR,	1, 1, 0,		LOGIC),
+	[AVRASM_EOR]	= OP("eor",		RD_RR,	1, 1, 0,		LOGIC),
+	[AVRASM_CP]		= OP("cp",		RD_RR,	1, 1, 0,		ARITH),
+	[AVRASM_CPC]	= OP("cpc",		RD_RR,	1, 1, C_|Z_,	ARITH),
+	[AVRASM_CPSE]	= OP("cpse",	RD_RR,	1, 1, 0,		0),
+	[AVRASM_MOV]	= OP("mov",		RD_RR,	1, 1, 0,		0),
+	[AVRASM_MOVW]	= OP("movw",	RD_RR,	1, 1, 0,		0),
+	[AVRASM_LDI]	= OP("ldi",		RD_K,	1, 1, 0,		0),
+	[AVRASM_ANDI]	= OP("andi",	RD_K,	1, 1, 0,		LOGIC),
+	[AVRASM_ORI]	= OP("ori",		RD_K,	1, 1, 0,		LOGIC),
+	[AVRASM_SUBI]	= OP("subi",	RD_K,	1, 1, 0,		ARITH),
+	[AVRASM_SBCI]	= OP("sbci",	RD_K,	1, 1, C_|Z_,	ARITH),
+	[AVRASM_CPI]	= OP("cpi",		RD_K,	1, 1, 0,		ARITH),
+	[AVRASM_SBR]	= OP("sbr",		RD_K,	1, 1, 0,		LOGIC),
+	[AVRASM_CBR]	= OP("cbr",		RD_K,	1, 1, 0,		LOGIC),
+	[AVRASM_ADIW]	= OP("adiw",	RD_K6,	1, 2, 0,		C_|Z_|N_|V_|S_),
+	[AVRASM_SBIW]	= OP("sbiw",	RD_K6,	1, 2, 0,		C_|Z_|N_|V_|S_),
+	[AVRASM_CLR]	= OP("clr",		RD,		1, 1, 0,		LOGIC),
+	[AVRASM_SER]	= OP("ser",		RD,		1, 1, 0,		0),
+	[AVRASM_COM]	= OP("com",		RD,		1, 1, 0,		C_|Z_|N_|V_|S_),
+	[AVRASM_NEG]	= OP("neg",		RD,		1, 1, 0,		ARITH),
+	[AVRASM_INC]	= OP("inc",		RD,		1, 1, 0,		LOGIC),
+	[AVRASM_DEC]	= OP("dec",		RD,		1, 1, 0,		LOGIC),
+	[AVRASM_TST]	= OP("tst",		RD,		1, 1, 0,		LOGIC),
+	[AVRASM_LSL]	= OP("lsl",		RD,		1, 1, 0,		ARITH),
+	[AVRASM_LSR]	= OP("lsr",		RD,		1, 1, 0,		C_|Z_|N_|V_|S_),
+	[AVRASM_ROL]	= OP("rol",		RD,		1, 1, C_,		ARITH),
+	[AVRASM_ROR]	= OP("ror",		RD,		1, 1, C_,		C_|Z_|N_|V_|S_),
+	[AVRASM_ASR]	= OP("asr",		RD,		1, 1, 0,		C_|Z_|N_|V_|S_),
+	[AVRASM_SWAP]	= OP("swap",	RD,		1, 1, 0,		0),
+	[AVRASM_BST]	= OP("bst",		RD_B,	1, 1, 0,		T_),
+	[AVRASM_BLD]	= OP("bld",		RD_B,	1, 1, T_,		0),
+	[AVRASM_SBRS]	= OP("sbrs",	RD_B,	1, 1, 0,		0),
+	[AVRASM_SBRC]	= OP("sbrc",	RD_B,	1, 1, 0,		0),
+	[AVRASM_SBI]	= OP("sbi",		A_B,	1, 2, 0,		0),
+	[AVRASM_CBI]	= OP("cbi",		A_B,	1, 2, 0,		0),
+	[AVRASM_SBIS]	= OP("sbis",	A_B,	1, 1, 0,		0),
+	[AVRASM_SBIC]	= OP("sbic",	A_B,	1, 1, 0,		0),
+	[AVRASM_IN]		= OP("in",		RD_A,	1, 1, 0,		0),
+	[AVRASM_OUT]	= OP("out",		A_RR,	1, 1, 0,		0),
+	[AVRASM_LDS]	= OP("lds",		RD_K16,	2, 2, 0,		0),
+	[AVRASM_STS]	= OP("sts",		K16_RR,	2, 2, 0,		0),
+	[AVRASM_LD]		= OP("ld",		RD_PTR,	1, 2, 0,		0),
+	[AVRASM_LDD]	= OP("ldd",		RD_PTR,	1, 2, 0,		0),
+	[AVRASM_ST]		= OP("st",		PTR_RR,	1, 2, 0,		0),
+	[AVRASM_STD]	= OP("std",		PTR_RR,	1, 2, 0,		0),
+	[AVRASM_PUSH]	= OP("push",	RD,		1, 2, 0,		0),
+	[AVRASM_POP]	= OP("pop",		RD,		1, 2, 0,		0),
+	[AVRASM_RJMP]	= OP("rjmp",	K,		1, 2, 0,		0),
+	[AVRASM_RCALL]	= OP("rcall",	K,		1, 3, 0,		0),
+	[AVRASM_IJMP]	= OP("ijmp",	NONE,	1, 2, 0,		0),
+	[AVRASM_ICALL]	= OP("icall",	NONE,	1, 3, 0,		0),
+	[AVRASM_RET]	= OP("ret",		NONE,	1, 4, 0,		0),
+	[AVRASM_RETI]	= OP("reti",	NONE,	1, 4, 0,		I_),
+	[AVRASM_BREQ]	= BR("breq", Z, true),
+	[AVRASM_BRNE]	= BR("brne", Z, false),
+	[AVRASM_BRCS]	= BR("brcs", C, true),
+	[AVRASM_BRCC]	= BR("brcc", C, false),
+	[AVRASM_BRSH]	= BR("brsh", C, false),
+	[AVRASM_BRLO]	= BR("brlo", C, true),
+	[AVRASM_BRMI]	= BR("brmi", N, true),
+	[AVRASM_BRPL]	= BR("brpl", N, false),
+	[AVRASM_BRGE]	= BR("brge", S, false),
+	[AVRASM_BRLT]	= BR("brlt", S, true),
+	[AVRASM_BRHS]	= BR("brhs", H, true),
+	[AVRASM_BRHC]	= BR("brhc", H, false),
+	[AVRASM_BRTS]	= BR("brts", T, true),
+	[AVRASM_BRTC]	= BR("brtc", T, false),
+	[AVRASM_BRVS]	= BR("brvs", V, true),
+	[AVRASM_BRVC]	= BR("brvc", V, false),
+	[AVRASM_BRIE]	= BR("brie", I, true),
+	[AVRASM_BRID]	= BR("brid", I, false),
+	[AVRASM_CLI]	= OP("cli",		NONE,	1, 1, 0,		I_),
+	[AVRASM_SEI]	= OP("sei",		NONE,	1, 1, 0,		I_),
+	[AVRASM_NOP]	= OP("nop",		NONE,	1, 1, 0,		0),
+};
+
+bool avrAsm_isSkip (uint8_t op) {
+	return op == AVRASM_CPSE || op == AVRASM_SBRS || op == AVRASM_SBRC || op == AVRASM_SBIS || op == AVRASM_SBIC;
+}
+
+bool avrAsm_isBranch (uint8_t op) {
+	return avrAsm_ops[op].branchFlag >= 0;
+}
+
+#define SEG_CODE	0
+#define SEG_DATA	1
+#define SEG_EEPROM	2
+
+#define SYM_EQU		0
+#define SYM_SET		1
+#define SYM_LABEL	2
+#define SYM_DEFINE	3
+#define SYM_REG		4	// .def
+
+#define MAX_LINE		1024
+#define MAX_CONDS		32
+#define MAX_INCLUDES	16
+
+typedef struct {
+	char * name;	// Lowercase
+	int64_t value;
+	uint8_t kind;
+	uint8_t seg;	// For labels
+	int pass;	// The pass it was last defined on
+} symbol;
+
+typedef struct {
+	bool active;	// Whether this branch is being assembled
+	bool taken;	// Whether any branch of this conditional has been
+	bool parentActive;
+} conditional;
+
+typedef struct {
+	const avrAsm_options * options;
+	int pass;
+	symbol * syms;
+	size_t symCount, symCap;
+	uint8_t seg;
+	uint32_t segPC[3];
+	conditional conds[MAX_CONDS];
+	int condDepth;
+	int includeDepth;
+	bool inComment;
+	bool undefinedSym;	// Set when an expression used a symbol that is not defined (yet)
+
+	avrAsm_program * program;
+	size_t insnCap, labelCap;
+	char ** files;	// Kept for the instructions to point to
+	size_t fileCount;
+
+	const char * file;
+	int line;
+	bool failed;
+} context;
+
+static void error (context * ctx, const char * format, ...) {
+	va_list args;
+	va_start(args, format);
+	fprintf(stderr, "%s:%d: error: ", ctx->file, ctx->line);
+	vfprintf(stderr, format, args);
+	fprintf(stderr, "\n");
+	va_end(args);
+	ctx->failed = true;
+}
+
+static char * duplicate (const char * str, size_t length) {
+	char * copy = (char *) malloc(length + 1);
+	if (!copy) {
+		fprintf(stderr, "Could not allocate memory\n");
+		exit(2);
+	}
+	memcpy(copy, str, length);
+	copy[length] = 0;
+	return copy;
+}
+
+static void * grow (void * array, size_t * capacity, size_t count, size_t elementSize) {
+	if (count < *capacity) return array;
+	*capacity = *capacity ? *capacity * 2 : 64;
+	array = realloc(array, *capacity * elementSize);
+	if (!array) {
+		fprintf(stderr, "Could not allocate memory\n");
+		exit(2);
+	}
+	return array;
+}
+
+static bool isActive (const context * ctx) {
+	return !ctx->condDepth || ctx->conds[ctx->condDepth-1].active;
+}
+
+static bool isIdentStart (char c) { return isalpha((unsigned char)c) || c == '_'; }
+static bool isIdentChar (char c) { return isalnum((unsigned char)c) || c == '_'; }
+
+static char * skipSpace (const char * s) {
+	while (isspace((unsigned char)*s)) s++;
+	return (char *) s;
+}
+
+static void trimEnd (char * s) {
+	size_t length = strlen(s);
+	while (length && isspace((unsigned char)s[length-1])) s[--length] = 0;
+}
+
+// Reads an identifier into buffer (lowercased), returns the position after it
+static const char * readIdent (const char * s, char * buffer, size_t size) {
+	size_t i = 0;
+	while (isIdentChar(*s)) {
+		if (i + 1 < size) buffer[i++] = tolower((unsigned char)*s);
+		s++;
+	}
+	buffer[i] = 0;
+	return s;
+}
+
+static symbol * findSymbol (context * ctx, const char * name) {
+	for (size_t i = 0; i < ctx->symCount; i++) {
+		if (!strcmp(ctx->syms[i].name, name)) return &ctx->syms[i];
+	}
+	return NULL;
+}
+
+static void lowercase (char * dst, const char * src, size_t size) {
+	size_t i = 0;
+	for (; src[i] && i + 1 < size; i++) dst[i] = tolower((unsigned char)src[i]);
+	dst[i] = 0;
+}
+
+static void defineSymbol (context * ctx, const char * rawName, int64_t value, uint8_t kind) {
+	char name[MAX_LINE];
+	lowercase(name, rawName, sizeof(name));
+	symbol * sym = findSymbol(ctx, name);
+	if (sym) {
+		if (sym->pass == ctx->pass && sym->kind != SYM_SET && kind != SYM_SET && sym->kind != SYM_DEFINE) {
+			error(ctx, "'%s' is already defined", rawName);
+			return;
+		}
+		if (kind == SYM_LABEL && ctx->pass == 2 && (sym->value != value || sym->seg != ctx->seg)) {
+			error(ctx, "Label '%s' moved between passes", rawName);
+		}
+	} else {
+		ctx->syms = (symbol *) grow(ctx->syms, &ctx->symCap, ctx->symCount, sizeof(symbol));
+		sym = &ctx->syms[ctx->symCount++];
+		sym->name = duplicate(name, strlen(name));
+	}
+	sym->value = value;
+	sym->kind = kind;
+	sym->seg = ctx->seg;
+	sym->pass = ctx->pass;
+}
+
+static bool isDefined (context * ctx, const char * name) {
+	char lower[MAX_LINE];
+	lowercase(lower, name, sizeof(lower));
+	symbol * sym = findSymbol(ctx, lower);
+	return sym && sym->pass == ctx->pass;
+}
+
+// Expressions, with the operator precedence of C
+
+typedef struct {
+	context * ctx;
+	const char * s;
+	bool failed;
+} parser;
+
+static int64_t parseOr (parser * p);
+
+static bool accept (parser * p, const char * token) {
+	p->s = skipSpace(p->s);
+	size_t length = strlen(token);
+	if (strncmp(p->s, token, length)) return false;
+	// Don't mistake the first character of a longer operator for a shorter one
+	char next = p->s[length];
+	if (length == 1 && (token[0] == '<' || token[0] == '>') && (next == token[0] || next == '=')) return false;
+	if (length == 1 && (token[0] == '&' || token[0] == '|') && next == token[0]) return false;
+	if (length == 1 && (token[0] == '!' || token[0] == '=') && next == '=') return false;
+	p->s += length;
+	return true;
+}
+
+static void parseFail (parser * p, const char * message) {
+	if (!p->failed) error(p->ctx, "%s in expression", message);
+	p->failed = true;
+}
+
+static int64_t parseNumber (parser * p) {
+	const char * s = p->s;
+	int base = 10;
+	if (*s == '$') { base = 16; s++; }
+	else if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) { base = 16; s += 2; }
+	else if (s[0] == '0' && (s[1] == 'b' || s[1] == 'B')) { base = 2; s += 2; }
+	char * end;
+	int64_t value = strtoll(s, &end, base);
+	if (end == s || isIdentChar(*end)) parseFail(p, "Malformed number");
+	p->s = end;
+	return value;
+}
+
+static int64_t parsePrimary (parser * p) {
+	p->s = skipSpace(p->s);
+	if (accept(p, "(")) {
+		int64_t value = parseOr(p);
+		if (!accept(p, ")")) parseFail(p, "Missing ')'");
+		return value;
+	}
+	if (isdigit((unsigned char)*p->s) || *p->s == '$') return parseNumber(p);
+	if (p->s[0] == '\'' && p->s[1] && p->s[2] == '\'') {
+		int64_t value = (unsigned char)p->s[1];
+		p->s += 3;
+		return value;
+	}
+	if (!isIdentStart(*p->s)) {
+		parseFail(p, "Unexpected character");
+		return 0;
+	}
+	char name[MAX_LINE];
+	p->s = readIdent(p->s, name, sizeof(name));
+	if (!strcmp(name, "defined")) {
+		if (!accept(p, "(")) { parseFail(p, "Missing '('"); return 0; }
+		p->s = skipSpace(p->s);
+		char arg[MAX_LINE];
+		p->s = readIdent(p->s, arg, sizeof(arg));
+		if (!accept(p, ")")) parseFail(p, "Missing ')'");
+		return isDefined(p->ctx, arg);
+	}
+	p->s = skipSpace(p->s);
+	if (*p->s == '(') {
+		p->s++;
+		int64_t arg = parseOr(p);
+		if (!accept(p, ")")) parseFail(p, "Missing ')'");
+		if (!strcmp(name, "low") || !strcmp(name, "byte1")) return arg & 0xFF;
+		if (!strcmp(name, "high") || !strcmp(name, "byte2")) return (arg >> 8) & 0xFF;
+		if (!strcmp(name, "byte3")) return (arg >> 16) & 0xFF;
+		if (!strcmp(name, "byte4")) return (arg >> 24) & 0xFF;
+		if (!strcmp(name, "lwrd")) return arg & 0xFFFF;
+		if (!strcmp(name, "hwrd")) return (arg >> 16) & 0xFFFF;
+		if (!strcmp(name, "exp2")) return arg >= 0 && arg < 63 ? (int64_t)1 << arg : 0;
+		if (!strcmp(name, "log2")) { int64_t bit = -1; while (arg > 0) { arg >>= 1; bit++; } return bit; }
+		parseFail(p, "Unknown function");
+		return 0;
+	}
+	if (!strcmp(name, "pc")) return p->ctx->segPC[SEG_CODE];
+	symbol * sym = findSymbol(p->ctx, name);
+	if (!sym || sym->kind == SYM_REG) {
+		p->ctx->undefinedSym = true;
+		return 0;
+	}
+	return sym->value;
+}
+
+static int64_t parseUnary (parser * p) {
+	if (accept(p, "-")) return -parseUnary(p);
+	if (accept(p, "+")) return parseUnary(p);
+	if (accept(p, "~")) return ~parseUnary(p);
+	if (accept(p, "!")) return !parseUnary(p);
+	return parsePrimary(p);
+}
+
+static int64_t parseMul (parser * p) {
+	int64_t value = parseUnary(p);
+	for (;;) {
+		if (accept(p, "*")) value *= parseUnary(p);
+		else if (accept(p, "/")) { int64_t d = parseUnary(p); if (d) value /= d; else parseFail(p, "Division by zero"); }
+		else if (accept(p, "%")) { int64_t d = parseUnary(p); if (d) value %= d; else parseFail(p, "Division by zero"); }
+		else return value;
+	}
+}
+
+static int64_t parseAdd (parser * p) {
+	int64_t value = parseMul(p);
+	for (;;) {
+		if (accept(p, "+")) value += parseMul(p);
+		else if (accept(p, "-")) value -= parseMul(p);
+		else return value;
+	}
+}
+
+static int64_t parseShift (parser * p) {
+	int64_t value = parseAdd(p);
+	for (;;) {
+		if (accept(p, "<<")) value = (int64_t)((uint64_t)value << (parseAdd(p) & 63));
+		else if (accept(p, ">>")) value >>= parseAdd(p) & 63;
+		else return value;
+	}
+}
+
+static int64_t parseRel (parser * p) {
+	int64_t value = parseShift(p);
+	for (;;) {
+		if (accept(p, "<=")) value = value <= parseShift(p);
+		else if (accept(p, ">=")) value = value >= parseShift(p);
+		else if (accept(p, "<")) value = value < parseShift(p);
+		else if (accept(p, ">")) value = value > parseShift(p);
+		else return value;
+	}
+}
+
+static int64_t parseEq (parser * p) {
+	int64_t value = parseRel(p);
+	for (;;) {
+		if (accept(p, "==")) value = value == parseRel(p);
+		else if (accept(p, "!=")) value = value != parseRel(p);
+		else return value;
+	}
+}
+
+static int64_t parseBitAnd (parser * p) {
+	int64_t value = parseEq(p);
+	while (accept(p, "&")) value &= parseEq(p);
+	return value;
+}
+
+static int64_t parseBitXor (parser * p) {
+	int64_t value = parseBitAnd(p);
+	while (accept(p, "^")) value ^= parseBitAnd(p);
+	return value;
+}
+
+static int64_t parseBitOr (parser * p) {
+	int64_t value = parseBitXor(p);
+	while (accept(p, "|")) value |= parseBitXor(p);
+	return value;
+}
+
+static int64_t parseAnd (parser * p) {
+	int64_t value = parseBitOr(p);
+	while (accept(p, "&&")) { int64_t rhs = parseBitOr(p); value = value && rhs; }
+	return value;
+}
+
+static int64_t parseOr (parser * p) {
+	int64_t value = parseAnd(p);
+	while (accept(p, "||")) { int64_t rhs = parseAnd(p); value = value || rhs; }
+	return value;
+}
+
+// Evaluates an expression. On pass 1, undefined symbols are allowed (and evaluate to 0) if allowUndefined is set
+static bool evaluate (context * ctx, const char * expr, int64_t * value, bool allowUndefined) {
+	parser p = {ctx, expr, false};
+	ctx->undefinedSym = false;
+	*value = parseOr(&p);
+	if (!p.failed && *skipSpace(p.s)) parseFail(&p, "Unexpected trailing characters");
+	if (p.failed) return false;
+	if (ctx->undefinedSym && !(allowUndefined && ctx->pass == 1)) {
+		error(ctx, "Undefined symbol in '%s'", expr);
+		return false;
+	}
+	return true;
+}
+
+// Operands
+
+static bool parseReg (context * ctx, const char * str, uint8_t * reg) {
+	char name[MAX_LINE];
+	const char * s = skipSpace(str);
+	const char * end = readIdent(s, name, sizeof(name));
+	if (end == s || *skipSpace(end)) {
+		error(ctx, "'%s' is not a register", str);
+		return false;
+	}
+	if (name[0] == 'r' && isdigit((unsigned char)name[1])) {
+		char * numEnd;
+		long num = strtol(name + 1, &numEnd, 10);
+		if (!*numEnd && num >= 0 && num < 32) {
+			*reg = (uint8_t)num;
+			return true;
+		}
+	}
+	symbol * sym = findSymbol(ctx, name);
+	if (sym && sym->kind == SYM_REG) {
+		*reg = (uint8_t)sym->value;
+		return true;
+	}
+	error(ctx, "'%s' is not a register", str);
+	return false;
+}
+
+static bool parseRange (context * ctx, const char * str, int64_t min, int64_t max, int32_t * out) {
+	int64_t value;
+	if (!evaluate(ctx, str, &value, false)) return false;
+	if (value < min || value > max) {
+		error(ctx, "'%s' (%lld) is out of range %lld..%lld", str, (long long)value, (long long)min, (long long)max);
+		return false;
+	}
+	*out = (int32_t)value;
+	return true;
+}
+
+static bool parsePtr (context * ctx, const char * str, avrAsm_insn * insn) {
+	const char * s = skipSpace(str);
+	bool predec = false;
+	if (*s == '-') { predec = true; s = skipSpace(s + 1); }
+	char c = tolower((unsigned char)*s);
+	if ((c != 'x' && c != 'y' && c != 'z') || isIdentChar(s[1])) {
+		error(ctx, "'%s' is not a pointer register", str);
+		return false;
+	}
+	insn->ptr = c == 'x' ? 26 : c == 'y' ? 28 : 30;
+	s = skipSpace(s + 1);
+	insn->k = 0;
+	if (predec) {
+		insn->ptrMode = AVRASM_PTR_PREDEC;
+	} else if (*s == '+' && !*skipSpace(s + 1)) {
+		insn->ptrMode = AVRASM_PTR_POSTINC;
+		s = skipSpace(s + 1);
+	} else if (*s == '+') {
+		if (insn->ptr == 26) {
+			error(ctx, "X has no displacement mode");
+			return false;
+		}
+		insn->ptrMode = AVRASM_PTR_DISP;
+		return parseRange(ctx, s + 1, 0, 63, &insn->k);
+	} else {
+		insn->ptrMode = AVRASM_PTR_PLAIN;
+	}
+	if (*s) {
+		error(ctx, "Malformed pointer operand '%s'", str);
+		return false;
+	}
+	return true;
+}
+
+// Splits operands on the commas outside of parentheses, returns their amount
+static int splitOperands (char * s, char ** operands, int max) {
+	s = skipSpace(s);
+	if (!*s) return 0;
+	int count = 0, depth = 0;
+	operands[count++] = s;
+	for (; *s; s++) {
+		if (*s == '(') depth++;
+		else if (*s == ')') depth--;
+		else if (*s == ',' && !depth) {
+			*s = 0;
+			if (count == max) return max + 1;
+			operands[count++] = skipSpace(s + 1);
+		}
+	}
+	for (int i = 0; i < count; i++) trimEnd(operands[i]);
+	return count;
+}
+
+static const int expectedOperands[] = {
+	[AVRASM_FMT_NONE] = 0,
+	[AVRASM_FMT_RD] = 1,
+	[AVRASM_FMT_RD_RR] = 2,
+	[AVRASM_FMT_RD_K] = 2,
+	[AVRASM_FMT_RD_B] = 2,
+	[AVRASM_FMT_A_B] = 2,
+	[AVRASM_FMT_RD_A] = 2,
+	[AVRASM_FMT_A_RR] = 2,
+	[AVRASM_FMT_RD_K16] = 2,
+	[AVRASM_FMT_K16_RR] = 2,
+	[AVRASM_FMT_RD_PTR] = 2,
+	[AVRASM_FMT_PTR_RR] = 2,
+	[AVRASM_FMT_K] = 1,
+	[AVRASM_FMT_RD_K6] = 2,
+};
+
+static int findOp (const char * mnemonic) {
+	for (int op = 0; op < AVRASM_OP_COUNT; op++) {
+		if (!strcmp(avrAsm_ops[op].name, mnemonic)) return op;
+	}
+	return -1;
+}
+
+static bool decodeOperands (context * ctx, avrAsm_insn * insn, char * operandText) {
+	const avrAsm_opInfo * info = &avrAsm_ops[insn->op];
+	char * ops[3];
+	int count = splitOperands(operandText, ops, 2);
+	if (count != expectedOperands[info->format]) {
+		error(ctx, "'%s' takes %d operand(s)", info->name, expectedOperands[info->format]);
+		return false;
+	}
+	switch (info->format) {
+		case AVRASM_FMT_NONE:
+			return true;
+		case AVRASM_FMT_RD:
+			return parseReg(ctx, ops[0], &insn->d);
+		case AVRASM_FMT_RD_RR:
+			if (!parseReg(ctx, ops[0], &insn->d) || !parseReg(ctx, ops[1], &insn->r)) return false;
+			if (insn->op == AVRASM_MOVW && ((insn->d | insn->r) & 1)) {
+				error(ctx, "movw needs even registers");
+				return false;
+			}
+			return true;
+		case AVRASM_FMT_RD_K:
+			if (!parseReg(ctx, ops[0], &insn->d)) return false;
+			if (insn->d < 16) {
+				error(ctx, "'%s' needs one of r16..r31", info->name);
+				return false;
+			}
+			if (!parseRange(ctx, ops[1], -128, 255, &insn->k)) return false;
+			insn->k &= 0xFF;
+			return true;
+		case AVRASM_FMT_RD_K6:
+			if (!parseReg(ctx, ops[0], &insn->d)) return false;
+			if (insn->d < 24 || (insn->d & 1)) {
+				error(ctx, "'%s' needs one of r24, r26, r28 or r30", info->name);
+				return false;
+			}
+			return parseRange(ctx, ops[1], 0, 63, &insn->k);
+		case AVRASM_FMT_RD_B:
+			if (!parseReg(ctx, ops[0], &insn->d)) return false;
+			{
+				int32_t bit;
+				if (!parseRange(ctx, ops[1], 0, 7, &bit)) return false;
+				insn->r = (uint8_t)bit;
+			}
+			return true;
+		case AVRASM_FMT_A_B:
+			if (!parseRange(ctx, ops[0], 0, 31, &insn->k)) return false;
+			{
+				int32_t bit;
+				if (!parseRange(ctx, ops[1], 0, 7, &bit)) return false;
+				insn->r = (uint8_t)bit;
+			}
+			return true;
+		case AVRASM_FMT_RD_A:
+			return parseReg(ctx, ops[0], &insn->d) && parseRange(ctx, ops[1], 0, 63, &insn->k);
+		case AVRASM_FMT_A_RR:
+			return parseRange(ctx, ops[0], 0, 63, &insn->k) && parseReg(ctx, ops[1], &insn->d);
+		case AVRASM_FMT_RD_K16:
+			return parseReg(ctx, ops[0], &insn->d) && parseRange(ctx, ops[1], 0, 0xFFFF, &insn->k);
+		case AVRASM_FMT_K16_RR:
+			return parseRange(ctx, ops[0], 0, 0xFFFF, &insn->k) && parseReg(ctx, ops[1], &insn->d);
+		case AVRASM_FMT_RD_PTR:
+			if (!parseReg(ctx, ops[0], &insn->d) || !parsePtr(ctx, ops[1], insn)) return false;
+			break;
+		case AVRASM_FMT_PTR_RR:
+			if (!parsePtr(ctx, ops[0], insn) || !parseReg(ctx, ops[1], &insn->d)) return false;
+			break;
+		case AVRASM_FMT_K: {
+			int64_t target;
+			if (!evaluate(ctx, ops[0], &target, false)) return false;
+			int64_t offset = target - (insn->addr + 1);
+			int64_t range = avrAsm_isBranch(insn->op) ? 64 : 2048;
+			if (offset < -range || offset >= range) {
+				error(ctx, "'%s' is out of reach of %s", ops[0], info->name);
+				return false;
+			}
+			insn->k = (int32_t)target;
+			return true;
+		}
+	}
+	// ld / st / ldd / std
+	bool disp = insn->ptrMode == AVRASM_PTR_DISP;
+	if ((insn->op == AVRASM_LDD || insn->op == AVRASM_STD) != disp) {
+		if (!disp && insn->ptrMode == AVRASM_PTR_PLAIN) return true;	// ldd r0, Y is accepted as ld r0, Y
+		error(ctx, "%s with the wrong pointer mode", info->name);
+		return false;
+	}
+	return true;
+}
+
+static void addInsn (context * ctx, int op, char * operandText, const char * text) {
+	avrAsm_program * program = ctx->program;
+	program->insns = (avrAsm_insn *) grow(program->insns, &ctx->insnCap, program->count, sizeof(avrAsm_insn));
+	avrAsm_insn * insn = &program->insns[program->count];
+	memset(insn, 0, sizeof(avrAsm_insn));
+	insn->addr = (uint16_t)ctx->segPC[SEG_CODE];
+	insn->op = (uint8_t)op;
+	insn->words = avrAsm_ops[op].words;
+	insn->file = ctx->file;
+	insn->line = ctx->line;
+	insn->text = duplicate(text, strlen(text));
+	if (decodeOperands(ctx, insn, operandText)) program->count++;
+	else free(insn->text);
+}
+
+// Source handling
+
+static bool assembleFile (context * ctx, const char * path);
+
+static void stripComments (context * ctx, char * line) {
+	char * out = line;
+	bool inString = false;
+	for (char * s = line; *s; s++) {
+		if (ctx->inComment) {
+			if (s[0] == '*' && s[1] == '/') { ctx->inComment = false; s++; }
+			continue;
+		}
+		if (*s == '"') inString = !inString;
+		if (!inString) {
+			if (*s == ';' || (s[0] == '/' && s[1] == '/')) break;
+			if (s[0] == '/' && s[1] == '*') { ctx->inComment = true; s++; continue; }
+		}
+		*out++ = *s;
+	}
+	*out = 0;
+}
+
+// Reads a quoted string argument, returns false if there is none
+static bool readString (const char * s, char * buffer, size_t size) {
+	s = skipSpace(s);
+	if (*s != '"') return false;
+	s++;
+	size_t i = 0;
+	while (*s && *s != '"') {
+		if (i + 1 < size) buffer[i++] = *s;
+		s++;
+	}
+	buffer[i] = 0;
+	return *s == '"';
+}
+
+static void pushCondition (context * ctx, bool value) {
+	if (ctx->condDepth == MAX_CONDS) {
+		error(ctx, "Conditionals nested too deep");
+		return;
+	}
+	bool parentActive = isActive(ctx);
+	conditional * cond = &ctx->conds[ctx->condDepth++];
+	cond->parentActive = parentActive;
+	cond->active = parentActive && value;
+	cond->taken = cond->active;
+}
+
+// Evaluates a condition only if it can matter, since inactive branches may use undefined symbols
+static bool condition (context * ctx, const char * expr, bool needed) {
+	if (!needed) return false;
+	int64_t value;
+	return evaluate(ctx, expr, &value, false) && value;
+}
+
+// Handles the conditional directives, returns true if it was one
+static bool handleConditional (context * ctx, const char * directive, const char * args) {
+	conditional * top = ctx->condDepth ? &ctx->conds[ctx->condDepth-1] : NULL;
+	if (!strcmp(directive, "if")) {
+		pushCondition(ctx, condition(ctx, args, isActive(ctx)));
+	} else if (!strcmp(directive, "ifdef") || !strcmp(directive, "ifndef")) {
+		char name[MAX_LINE];
+		readIdent(skipSpace(args), name, sizeof(name));
+		pushCondition(ctx, isDefined(ctx, name) == !strcmp(directive, "ifdef"));
+	} else if (!strcmp(directive, "elseif") || !strcmp(directive, "elif")) {
+		if (!top) { error(ctx, ".%s without .if", directive); return true; }
+		top->active = top->parentActive && !top->taken && condition(ctx, args, top->parentActive && !top->taken);
+		top->taken = top->taken || top->active;
+	} else if (!strcmp(directive, "else")) {
+		if (!top) { error(ctx, ".else without .if"); return true; }
+		top->active = top->parentActive && !top->taken;
+		top->taken = true;
+	} else if (!strcmp(directive, "endif")) {
+		if (!top) { error(ctx, ".endif without .if"); return true; }
+		ctx->condDepth--;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// Parses "name = expr" of .equ / .set / .def
+static bool parseAssignment (context * ctx, char * args, char ** name, char ** value) {
+	char * eq = strchr(args, '=');
+	if (!eq) {
+		error(ctx, "Missing '='");
+		return false;
+	}
+	*eq = 0;
+	*name = skipSpace(args);
+	trimEnd(*name);
+	*value = skipSpace(eq + 1);
+	if (!isIdentStart(**name)) {
+		error(ctx, "Malformed symbol name '%s'", *name);
+		return false;
+	}
+	return true;
+}
+
+static void handleDirective (context * ctx, const char * directive, char * args) {
+	if (!strcmp(directive, "equ") || !strcmp(directive, "set")) {
+		char * name, * value;
+		if (!parseAssignment(ctx, args, &name, &value)) return;
+		int64_t result;
+		if (!evaluate(ctx, value, &result, true)) return;
+		if (ctx->undefinedSym) return;	// Forward reference on pass 1, done on pass 2
+		defineSymbol(ctx, name, result, directive[0] == 'e' ? SYM_EQU : SYM_SET);
+	} else if (!strcmp(directive, "def")) {
+		char * name, * value;
+		uint8_t reg;
+		if (!parseAssignment(ctx, args, &name, &value) || !parseReg(ctx, value, &reg)) return;
+		char lower[MAX_LINE];
+		lowercase(lower, name, sizeof(lower));
+		symbol * sym = findSymbol(ctx, lower);
+		if (sym && sym->kind == SYM_REG) sym->pass = 0;	// .def can be redefined
+		defineSymbol(ctx, name, reg, SYM_REG);
+	} else if (!strcmp(directive, "undef")) {
+		char name[MAX_LINE];
+		readIdent(skipSpace(args), name, sizeof(name));
+		symbol * sym = findSymbol(ctx, name);
+		if (sym) sym->pass = 0;
+	} else if (!strcmp(directive, "define")) {
+		char name[MAX_LINE];
+		char * rest = (char *) readIdent(skipSpace(args), name, sizeof(name));
+		if (!*name) { error(ctx, "Missing name for .define"); return; }
+		int64_t value = 1;
+		rest = skipSpace(rest);
+		if (*rest && !evaluate(ctx, rest, &value, false)) return;
+		defineSymbol(ctx, name, value, SYM_DEFINE);
+	} else if (!strcmp(directive, "include")) {
+		char file[MAX_LINE];
+		if (!readString(args, file, sizeof(file))) { error(ctx, "Missing file name for .include"); return; }
+		// Relative to the including file first, then the include directories
+		char path[2 * MAX_LINE];
+		const char * slash = strrchr(ctx->file, '/');
+		snprintf(path, sizeof(path), "%.*s%s", slash ? (int)(slash - ctx->file + 1) : 0, ctx->file, file);
+		FILE * test = fopen(path, "r");
+		for (size_t i = 0; !test && ctx->options && i < ctx->options->includeDirCount; i++) {
+			snprintf(path, sizeof(path), "%s/%s", ctx->options->includeDirs[i], file);
+			test = fopen(path, "r");
+		}
+		if (!test) { error(ctx, "Could not find include file '%s'", file); return; }
+		fclose(test);
+		const char * file_ = ctx->file;
+		int line = ctx->line;
+		if (ctx->includeDepth == MAX_INCLUDES) { error(ctx, "Includes nested too deep"); return; }
+		ctx->includeDepth++;
+		assembleFile(ctx, path);
+		ctx->includeDepth--;
+		ctx->file = file_;
+		ctx->line = line;
+	} else if (!strcmp(directive, "cseg")) {
+		ctx->seg = SEG_CODE;
+	} else if (!strcmp(directive, "dseg")) {
+		ctx->seg = SEG_DATA;
+	} else if (!strcmp(directive, "eseg")) {
+		ctx->seg = SEG_EEPROM;
+	} else if (!strcmp(directive, "org")) {
+		int64_t value;
+		if (evaluate(ctx, args, &value, false)) ctx->segPC[ctx->seg] = (uint32_t)value;
+	} else if (!strcmp(directive, "byte")) {
+		int64_t value;
+		if (ctx->seg == SEG_CODE) { error(ctx, ".byte is only allowed in the data and EEPROM segments"); return; }
+		if (evaluate(ctx, args, &value, false)) ctx->segPC[ctx->seg] += (uint32_t)value;
+	} else if (!strcmp(directive, "error")) {
+		char message[MAX_LINE];
+		error(ctx, "%s", readString(args, message, sizeof(message)) ? message : args);
+	} else if (!strcmp(directive, "warning")) {
+		char message[MAX_LINE];
+		if (ctx->pass == 2) fprintf(stderr, "%s:%d: warning: %s\n", ctx->file, ctx->line, readString(args, message, sizeof(message)) ? message : args);
+	} else if (!strcmp(directive, "message") || !strcmp(directive, "device") || !strcmp(directive, "list")
+		|| !strcmp(directive, "nolist") || !strcmp(directive, "listmac") || !strcmp(directive, "pragma")) {
+		// Nothing to do
+	} else {
+		error(ctx, "Unsupported directive '.%s'", directive);
+	}
+}
+
+static void processLine (context * ctx, char * line) {
+	stripComments(ctx, line);
+	trimEnd(line);
+	char * s = skipSpace(line);
+	if (!*s) return;
+
+	// The C preprocessor lines of the Atmel include files
+	if (*s == '#') {
+		char directive[MAX_LINE];
+		char * args = (char *) readIdent(s + 1, directive, sizeof(directive));
+		if (!strcmp(directive, "ifndef") || !strcmp(directive, "ifdef") || !strcmp(directive, "if")
+			|| !strcmp(directive, "elif") || !strcmp(directive, "else") || !strcmp(directive, "endif")) {
+			handleConditional(ctx, directive, args);
+		} else if (isActive(ctx) && (!strcmp(directive, "define") || !strcmp(directive, "undef"))) {
+			handleDirective(ctx, directive, args);
+		}
+		return;
+	}
+
+	// Label
+	if (isIdentStart(*s)) {
+		const char * end = s;
+		while (isIdentChar(*end)) end++;
+		if (*end == ':') {
+			if (isActive(ctx)) {
+				char name[MAX_LINE];
+				snprintf(name, sizeof(name), "%.*s", (int)(end - s), s);
+				defineSymbol(ctx, name, ctx->segPC[ctx->seg], SYM_LABEL);
+				if (ctx->pass == 2 && ctx->seg == SEG_CODE) {
+					avrAsm_program * program = ctx->program;
+					program->labels = (avrAsm_label *) grow(program->labels, &ctx->labelCap, program->labelCount, sizeof(avrAsm_label));
+					program->labels[program->labelCount].name = duplicate(name, strlen(name));
+					program->labels[program->labelCount].addr = (uint16_t)ctx->segPC[SEG_CODE];
+					program->labelCount++;
+				}
+			}
+			s = skipSpace(end + 1);
+			if (!*s) return;
+		}
+	}
+
+	if (*s == '.') {
+		char directive[MAX_LINE];
+		char * args = (char *) readIdent(s + 1, directive, sizeof(directive));
+		if (handleConditional(ctx, directive, args)) return;
+		if (isActive(ctx)) handleDirective(ctx, directive, args);
+		return;
+	}
+	if (!isActive(ctx)) return;
+
+	char mnemonic[MAX_LINE];
+	char * operands = (char *) readIdent(s, mnemonic, sizeof(mnemonic));
+	int op = findOp(mnemonic);
+	if (op < 0) {
+		error(ctx, "Unsupported instruction '%s'", mnemonic);
+		return;
+	}
+	if (ctx->seg != SEG_CODE) {
+		error(ctx, "Instructions are only allowed in the code segment");
+		return;
+	}
+	if (ctx->pass == 2) addInsn(ctx, op, operands, s);
+	ctx->segPC[SEG_CODE] += avrAsm_ops[op].words;
+}
+
+static bool assembleFile (context * ctx, const char * path) {
+	FILE * file = fopen(path, "r");
+	if (!file) {
+		fprintf(stderr, "Could not open '%s'\n", path);
+		ctx->failed = true;
+		return false;
+	}
+	// The instructions point to the file name, so keep 1 copy of it
+	const char * name = NULL;
+	for (size_t i = 0; i < ctx->fileCount && !name; i++) {
+		if (!strcmp(ctx->files[i], path)) name = ctx->files[i];
+	}
+	if (!name) {
+		ctx->files = (char **) realloc(ctx->files, (ctx->fileCount + 1) * sizeof(char *));
+		if (!ctx->files) {
+			fprintf(stderr, "Could not allocate memory\n");
+			exit(2);
+		}
+		name = ctx->files[ctx->fileCount++] = duplicate(path, strlen(path));
+	}
+	ctx->file = name;
+	ctx->line = 0;
+	char line[MAX_LINE];
+	while (fgets(line, sizeof(line), file)) {
+		ctx->line++;
+		processLine(ctx, line);
+	}
+	fclose(file);
+	return !ctx->failed;
+}
+
+static int compareInsns (const void * a, const void * b) {
+	return (int)((const avrAsm_insn *)a)->addr - (int)((const avrAsm_insn *)b)->addr;
+}
+
+static int compareLabels (const void * a, const void * b) {
+	return (int)((const avrAsm_label *)a)->addr - (int)((const avrAsm_label *)b)->addr;
+}
+
+int avrAsm_parseArgs (avrAsm_options * options, int argc, char ** argv) {
+	int out = 1;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-I") || !strcmp(argv[i], "-D")) {
+			if (i + 1 == argc) {
+				fprintf(stderr, "Missing value for %s\n", argv[i]);
+				return -1;
+			}
+			bool include = argv[i][1] == 'I';
+			size_t * count = include ? &options->includeDirCount : &options->defineCount;
+			if (*count == (include ? AVRASM_MAX_INCLUDE_DIRS : AVRASM_MAX_DEFINES)) {
+				fprintf(stderr, "Too many %s arguments\n", argv[i]);
+				return -1;
+			}
+			(include ? options->includeDirs : options->defines)[(*count)++] = argv[++i];
+		} else {
+			argv[out++] = argv[i];
+		}
+	}
+	return out;
+}
+
+avrAsm_program * avrAsm_load (const char * path, const avrAsm_options * options) {
+	context ctx;
+	memset(&ctx, 0, sizeof(context));
+	ctx.options = options;
+	ctx.program = (avrAsm_program *) calloc(1, sizeof(avrAsm_program));
+	if (!ctx.program) {
+		fprintf(stderr, "Could not allocate memory\n");
+		return NULL;
+	}
+
+	for (ctx.pass = 1; ctx.pass <= 2 && !ctx.failed; ctx.pass++) {
+		ctx.seg = SEG_CODE;
+		ctx.segPC[SEG_CODE] = 0;
+		ctx.segPC[SEG_DATA] = 0x60;
+		ctx.segPC[SEG_EEPROM] = 0;
+		ctx.condDepth = 0;
+		ctx.inComment = false;
+		ctx.file = "<command line>";
+		ctx.line = 0;
+		for (size_t i = 0; options && i < options->defineCount; i++) {
+			const char * eq = strchr(options->defines[i], '=');
+			char name[MAX_LINE];
+			snprintf(name, sizeof(name), "%.*s", eq ? (int)(eq - options->defines[i]) : (int)strlen(options->defines[i]), options->defines[i]);
+			int64_t value = 1;
+			if (eq && !evaluate(&ctx, eq + 1, &value, false)) break;
+			defineSymbol(&ctx, name, value, SYM_DEFINE);
+		}
+		if (ctx.failed) break;
+		// The data segment starts at SRAM_START
+		if (assembleFile(&ctx, path) && ctx.condDepth) {
+			error(&ctx, "Missing .endif");
+		}
+		symbol * sramStart = findSymbol(&ctx, "sram_start");
+		if (ctx.pass == 1 && sramStart && sramStart->value != 0x60) {
+			fprintf(stderr, "Only devices with SRAM_START at 0x60 are supported\n");
+			ctx.failed = true;
+		}
+	}
+
+	avrAsm_program * program = ctx.program;
+	for (size_t i = 0; i < ctx.symCount; i++) free(ctx.syms[i].name);
+	free(ctx.syms);
+	if (ctx.failed) {
+		avrAsm_delete(program);
+		// The instructions are gone, so the file names can go too
+		for (size_t i = 0; i < ctx.fileCount; i++) free(ctx.files[i]);
+		free(ctx.files);
+		return NULL;
+	}
+	// The file names are leaked on purpose, the instructions point to them for as long as the program lives
+
+	qsort(program->insns, program->count, sizeof(avrAsm_insn), compareInsns);
+	qsort(program->labels, program->labelCount, sizeof(avrAsm_label), compareLabels);
+	program->size = 0;
+	for (size_t i = 0; i < program->count; i++) {
+		avrAsm_insn * insn = &program->insns[i];
+		if (i && insn->addr < program->insns[i-1].addr + program->insns[i-1].words) {
+			fprintf(stderr, "%s:%d: error: Overlapping code at 0x%04X\n", insn->file, insn->line, insn->addr);
+			avrAsm_delete(program);
+			return NULL;
+		}
+		program->size = insn->addr + insn->words;
+	}
+	program->byAddr = (int32_t *) malloc((program->size + 1) * sizeof(int32_t));
+	if (!program->byAddr) {
+		fprintf(stderr, "Could not allocate memory\n");
+		avrAsm_delete(program);
+		return NULL;
+	}
+	for (uint32_t addr = 0; addr <= program->size; addr++) program->byAddr[addr] = -1;
+	for (size_t i = 0; i < program->count; i++) program->byAddr[program->insns[i].addr] = (int32_t)i;
+	return program;
+}
+
+int32_t avrAsm_findLabel (const avrAsm_program * program, const char * name) {
+	for (size_t i = 0; i < program->labelCount; i++) {
+		const char * a = program->labels[i].name, * b = name;
+		while (*a && tolower((unsigned char)*a) == tolower((unsigned char)*b)) { a++; b++; }
+		if (!*a && !*b) return program->labels[i].addr;
+	}
+	return -1;
+}
+
+const avrAsm_label * avrAsm_labelAt (const avrAsm_program * program, uint16_t addr) {
+	const avrAsm_label * label = NULL;
+	for (size_t i = 0; i < program->labelCount && program->labels[i].addr <= addr; i++) label = &program->labels[i];
+	return label;
+}
+
+const avrAsm_insn * avrAsm_insnAt (const avrAsm_program * program, int32_t addr) {
+	if (addr < 0 || (uint32_t)addr >= program->size || program->byAddr[addr] < 0) return NULL;
+	return &program->insns[program->byAddr[addr]];
+}
+
+void avrAsm_delete (avrAsm_program * program) {
+	if (!program) return;
+	for (size_t i = 0; i < program->count; i++) free(program->insns[i].text);
+	for (size_t i = 0; i < program->labelCount; i++) free(program->labels[i].name);
+	free(program->insns);
+	free(program->labels);
+	free(program->byAddr);
+	free(program);
+}
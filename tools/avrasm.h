@@ -0,0 +1,172 @@
+/*
+	t85APU tools - AVR assembly front-end
+	© alexmush, 2024
+	Assembles the firmware source (avr/main.asm, in the AVRA dialect) into a list of decoded instructions,
+	shared by the tools that work on the firmware instead of the emulator.
+*/
+
+#ifndef __T85APU_AVRASM_H__
+#define __T85APU_AVRASM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define AVRASM_MAX_INCLUDE_DIRS	8
+#define AVRASM_MAX_DEFINES		16
+
+// Operand layouts
+enum {
+	AVRASM_FMT_NONE,
+	AVRASM_FMT_RD,		// d
+	AVRASM_FMT_RD_RR,	// d, r
+	AVRASM_FMT_RD_K,	// d, 8-bit immediate (d is r16..r31)
+	AVRASM_FMT_RD_B,	// d, bit number
+	AVRASM_FMT_A_B,		// I/O address (0..31), bit number
+	AVRASM_FMT_RD_A,	// d, I/O address (0..63)
+	AVRASM_FMT_A_RR,	// I/O address (0..63), r (stored in d)
+	AVRASM_FMT_RD_K16,	// d, data address
+	AVRASM_FMT_K16_RR,	// data address, r (stored in d)
+	AVRASM_FMT_RD_PTR,	// d, pointer register with mode and displacement
+	AVRASM_FMT_PTR_RR,	// pointer register with mode and displacement, r (stored in d)
+	AVRASM_FMT_K,		// program address
+	AVRASM_FMT_RD_K6,	// d (r24..r30, even), 6-bit immediate
+};
+
+// Mnemonics
+enum {
+	AVRASM_ADD, AVRASM_ADC, AVRASM_SUB, AVRASM_SBC, AVRASM_AND, AVRASM_OR, AVRASM_EOR,
+	AVRASM_CP, AVRASM_CPC, AVRASM_CPSE, AVRASM_MOV, AVRASM_MOVW,
+	AVRASM_LDI, AVRASM_ANDI, AVRASM_ORI, AVRASM_SUBI, AVRASM_SBCI, AVRASM_CPI, AVRASM_SBR, AVRASM_CBR,
+	AVRASM_ADIW, AVRASM_SBIW,
+	AVRASM_CLR, AVRASM_SER, AVRASM_COM, AVRASM_NEG, AVRASM_INC, AVRASM_DEC, AVRASM_TST,
+	AVRASM_LSL, AVRASM_LSR, AVRASM_ROL, AVRASM_ROR, AVRASM_ASR, AVRASM_SWAP,
+	AVRASM_BST, AVRASM_BLD, AVRASM_SBRS, AVRASM_SBRC,
+	AVRASM_SBI, AVRASM_CBI, AVRASM_SBIS, AVRASM_SBIC, AVRASM_IN, AVRASM_OUT,
+	AVRASM_LDS, AVRASM_STS, AVRASM_LD, AVRASM_LDD, AVRASM_ST, AVRASM_STD, AVRASM_PUSH, AVRASM_POP,
+	AVRASM_RJMP, AVRASM_RCALL, AVRASM_IJMP, AVRASM_ICALL, AVRASM_RET, AVRASM_RETI,
+	AVRASM_BREQ, AVRASM_BRNE, AVRASM_BRCS, AVRASM_BRCC, AVRASM_BRSH, AVRASM_BRLO, AVRASM_BRMI, AVRASM_BRPL,
+	AVRASM_BRGE, AVRASM_BRLT, AVRASM_BRHS, AVRASM_BRHC, AVRASM_BRTS, AVRASM_BRTC, AVRASM_BRVS, AVRASM_BRVC,
+	AVRASM_BRIE, AVRASM_BRID,
+	AVRASM_CLI, AVRASM_SEI, AVRASM_NOP,
+	AVRASM_OP_COUNT
+};
+
+// SREG bits, also used as flag masks with (1 << AVRASM_FLAG_X)
+enum {
+	AVRASM_FLAG_C, AVRASM_FLAG_Z, AVRASM_FLAG_N, AVRASM_FLAG_V, AVRASM_FLAG_S, AVRASM_FLAG_H, AVRASM_FLAG_T, AVRASM_FLAG_I
+};
+
+// Pointer modes for ld / st
+enum {
+	AVRASM_PTR_PLAIN,	// X
+	AVRASM_PTR_POSTINC,	// X+
+	AVRASM_PTR_PREDEC,	// -X
+	AVRASM_PTR_DISP,	// Y+q
+};
+
+typedef struct __avrasm_opinfo {
+	const char * name;
+	uint8_t format;
+	uint8_t words;
+	uint8_t cycles;		// Without a taken branch or a skip
+	uint8_t flagsRead;	// SREG bits read
+	uint8_t flagsWritten;	// SREG bits written
+	int8_t branchFlag;	// For conditional branches: the SREG bit tested
+	bool branchIfSet;	// For conditional branches: whether the branch is taken if the bit is set
+} avrAsm_opInfo;
+
+typedef struct __avrasm_insn {
+	uint16_t addr;	// In words
+	uint8_t op;
+	uint8_t words;
+	uint8_t d;	// Destination (or source for out / sts / st / std) register
+	uint8_t r;	// Source register, or bit number
+	int32_t k;	// Immediate, I/O address, data address, program address or displacement
+	uint8_t ptr;	// Pointer register (26, 28 or 30) for ld / st
+	uint8_t ptrMode;
+	const char * file;
+	int line;
+	char * text;	// The source line, without comments
+} avrAsm_insn;
+
+typedef struct __avrasm_label {
+	char * name;	// As written in the source
+	uint16_t addr;	// In words
+} avrAsm_label;
+
+typedef struct __avrasm_program {
+	avrAsm_insn * insns;	// Sorted by address
+	size_t count;
+	avrAsm_label * labels;	// Code labels, sorted by address
+	size_t labelCount;
+	int32_t * byAddr;	// Instruction index at each word address, -1 if there is none
+	uint32_t size;	// In words, the highest address used + 1
+} avrAsm_program;
+
+typedef struct __avrasm_options {
+	const char * includeDirs[AVRASM_MAX_INCLUDE_DIRS];
+	size_t includeDirCount;
+	const char * defines[AVRASM_MAX_DEFINES];	// "NAME" or "NAME=value", like AVRA's -D
+	size_t defineCount;
+} avrAsm_options;
+
+extern const avrAsm_opInfo avrAsm_ops[AVRASM_OP_COUNT];
+
+/**
+ * @brief Parses the command line arguments shared by the firmware tools (-I dir, -D NAME[=value]).
+ *
+ * @param options Where to add the include directories and defines.
+ * @param argc The argument count, as passed to main.
+ * @param argv The arguments, as passed to main. The parsed ones are removed.
+ * @return The amount of arguments left, or -1 if an argument was malformed.
+ */
+int avrAsm_parseArgs (avrAsm_options * options, int argc, char ** argv);
+/**
+ * @brief Assembles a source file.
+ *
+ * @param path The path to the source file.
+ * @param options The include directories and defines, can be a null pointer.
+ * @return The pointer to the assembled program. Returns a null pointer if an error has occured, after printing it.
+ */
+avrAsm_program * avrAsm_load (const char * path, const avrAsm_options * options);
+/**
+ * @brief Looks up a code label.
+ *
+ * @param program The program to look the label up in.
+ * @param name The label name, case-insensitive.
+ * @return The word address of the label, or -1 if there is no such label.
+ */
+int32_t avrAsm_findLabel (const avrAsm_program * program, const char * name);
+/**
+ * @brief Finds the code label an address belongs to, i.e. the last one at or before it.
+ *
+ * @param program The program to look the label up in.
+ * @param addr The word address.
+ * @return The label, or a null pointer if there is none before @p addr.
+ */
+const avrAsm_label * avrAsm_labelAt (const avrAsm_program * program, uint16_t addr);
+/**
+ * @brief Returns the instruction at an address.
+ *
+ * @param program The program.
+ * @param addr The word address.
+ * @return The instruction, or a null pointer if no instruction starts at @p addr.
+ */
+const avrAsm_insn * avrAsm_insnAt (const avrAsm_program * program, int32_t addr);
+/**
+ * @brief Tells whether an instruction skips the next one (cpse, sbrs, sbrc, sbis or sbic).
+ */
+bool avrAsm_isSkip (uint8_t op);
+/**
+ * @brief Tells whether an instruction is a conditional branch.
+ */
+bool avrAsm_isBranch (uint8_t op);
+/**
+ * @brief Deletes an assembled program from memory.
+ *
+ * @param program The program to delete.
+ */
+void avrAsm_delete (avrAsm_program * program);
+
+#endif
@@ -0,0 +1,322 @@
+/*
+	t85APU batch renderer
+	© alexmush, 2024
+	Renders a manifest of register logs into WAV files on a fixed pool of threads, and prints a summary of how it went.
+	Each thread has 1 t85APU, 1 register log and 1 output buffer that it reuses for every job (the t85APU is reset with t85APU_reset),
+	so after the first few jobs nothing gets allocated per job, and the threads share nothing but the index of the next job.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "t85apu.h"
+#include "t85apu_reglog.h"
+
+#define CHUNK			4096	// Samples written at a time
+#define WAV_HEADER_SIZE	44
+#define MAX_LINE		4096
+
+#ifdef T85APU_REGWRITE_BUFFER_SIZE
+#define NEW_APU(bufferSize) t85APU_new(0, 0, T85APU_OUTPUT_PB4)
+#else
+#define NEW_APU(bufferSize) t85APU_new(0, 0, T85APU_OUTPUT_PB4, bufferSize)
+#endif
+
+struct options {
+	size_t threads = 0;	// 0 for the amount of hardware threads
+	double rate = 48000;
+	unsigned quality = 1;
+	unsigned outputType = T85APU_OUTPUT_PB4;
+	size_t bufferSize = 16;
+	double tail = 0.5;
+	const char * reportPath = NULL;
+};
+
+struct job {
+	std::string logPath;
+	std::string outputPath;
+	double rate;
+	unsigned quality;
+	unsigned outputType;
+};
+
+struct jobResult {
+	bool ok;
+	size_t writes;
+	uint64_t samples;
+	double seconds;	// Of audio
+	double renderTime;	// Wall time of the job, including reading the log and writing the output
+	size_t thread;
+};
+
+// Everything a thread reuses from job to job
+struct worker {
+	t85APU * apu;
+	t85APU_regLog * log;
+	size_t capacity;	// Of the writes of the register log
+	std::vector<uint8_t> bytes;	// CHUNK samples, little-endian
+	size_t jobs;
+	size_t failed;
+	double seconds;
+	double busy;
+};
+
+// Parses "<register log> <output> [rate] [quality] [output type]", returns false on an empty line or a comment
+static bool parseJob (const char * line, const options & opt, job & j, bool & valid) {
+	char logPath[MAX_LINE], outputPath[MAX_LINE];
+	double rate;
+	unsigned quality, outputType;
+	valid = true;
+	int fields = sscanf(line, "%s %s %lf %u %u", logPath, outputPath, &rate, &quality, &outputType);
+	if (fields < 1 || logPath[0] == '#') return false;
+	j.logPath = logPath;
+	j.outputPath = fields >= 2 ? outputPath : "";
+	j.rate = fields >= 3 ? rate : opt.rate;
+	j.quality = fields >= 4 ? quality : opt.quality;
+	j.outputType = fields >= 5 ? outputType : opt.outputType;
+	valid = fields >= 2 && j.rate > 0 && j.quality <= 1 && j.outputType <= T85APU_OUTPUT_PB4_EXACT;
+	return true;
+}
+
+static bool loadManifest (const char * path, const options & opt, std::vector<job> & jobs) {
+	FILE * file = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (!file) {
+		fprintf(stderr, "Could not open manifest '%s'\n", path);
+		return false;
+	}
+	char line[MAX_LINE];
+	size_t lineNumber = 0;
+	bool success = true;
+	while (fgets(line, sizeof(line), file)) {
+		lineNumber++;
+		job j;
+		bool valid;
+		if (!parseJob(line, opt, j, valid)) continue;
+		if (!valid) {
+			fprintf(stderr, "Line %zu of the manifest is not \"<register log> <output> [rate] [quality] [output type]\"\n", lineNumber);
+			success = false;
+			break;
+		}
+		jobs.push_back(j);
+	}
+	if (file != stdin) fclose(file);
+	return success;
+}
+
+static void putLE (uint8_t * buffer, uint32_t value, int bytes) {
+	for (int i = 0; i < bytes; i++) buffer[i] = (value >> (i*8)) & 0xFF;
+}
+
+// 16-bit mono PCM
+static bool writeWavHeader (FILE * file, double rate, uint64_t samples) {
+	uint8_t header[WAV_HEADER_SIZE];
+	uint32_t dataSize = (uint32_t)std::min<uint64_t>(samples * 2, UINT32_MAX - 36);
+	uint32_t sampleRate = (uint32_t)std::lround(rate);
+	memcpy(header, "RIFF", 4);
+	putLE(header+4, 36 + dataSize, 4);
+	memcpy(header+8, "WAVEfmt ", 8);
+	putLE(header+16, 16, 4);	// Size of the fmt chunk
+	putLE(header+20, 1, 2);	// PCM
+	putLE(header+22, 1, 2);	// Mono
+	putLE(header+24, sampleRate, 4);
+	putLE(header+28, sampleRate * 2, 4);	// Bytes per second
+	putLE(header+32, 2, 2);	// Bytes per frame
+	putLE(header+34, 16, 2);	// Bits per sample
+	memcpy(header+36, "data", 4);
+	putLE(header+40, dataSize, 4);
+	return fwrite(header, 1, WAV_HEADER_SIZE, file) == WAV_HEADER_SIZE;
+}
+
+static bool renderJob (worker & w, const job & j, const options & opt, jobResult & result) {
+	if (!t85APU_regLog_read(w.log, &w.capacity, j.logPath.c_str())) return false;
+	const t85APU_regLog * log = w.log;
+	t85APU * apu = w.apu;
+
+	// The settings are not touched by t85APU_reset, and the register write buffer is emptied separately since it is external hardware
+	t85APU_setClocknRate(apu, log->clock, j.rate);
+	t85APU_setOutputType(apu, j.outputType);
+	t85APU_setQuality(apu, j.quality);
+	t85APU_reset(apu);
+	while (apu->shiftRegCurIdx || t85APU_shiftRegisterPending(apu)) t85APU_shiftReg(apu, 0);
+
+	FILE * file = fopen(j.outputPath.c_str(), "wb");
+	if (!file) {
+		fprintf(stderr, "Could not open '%s' for writing\n", j.outputPath.c_str());
+		return false;
+	}
+	bool success = writeWavHeader(file, j.rate, 0);
+
+	// Each write is pushed before the first sample that starts at or after its timestamp
+	double ticksPerSample = log->clock / j.rate, ticks = 0, tmp;
+	uint64_t clocks = 0, end = (log->count ? log->writes[log->count-1].time : 0) + (uint64_t)(opt.tail * log->clock);
+	uint64_t samples = 0;
+	size_t next = 0, buffered = 0;
+	uint8_t * bytes = w.bytes.data();
+	while (success && clocks < end) {
+		while (next < log->count && log->writes[next].time <= clocks) {
+			t85APU_writeReg(apu, log->writes[next].addr, log->writes[next].data);
+			next++;
+		}
+		ticks += ticksPerSample;
+		clocks += (uint64_t)floor(ticks);
+		ticks = modf(ticks, &tmp);
+		uint16_t sample = (uint16_t)t85APU_calcS16(apu);
+		bytes[2*buffered+0] = sample & 0xFF;
+		bytes[2*buffered+1] = sample >> 8;
+		samples++;
+		if (++buffered == CHUNK) {
+			success = fwrite(bytes, 2, buffered, file) == buffered;
+			buffered = 0;
+		}
+	}
+	if (success && buffered) success = fwrite(bytes, 2, buffered, file) == buffered;
+	// Now that the length is known
+	if (success) success = !fseek(file, 0, SEEK_SET) && writeWavHeader(file, j.rate, samples);
+	if (fclose(file)) success = false;
+	if (!success) {
+		fprintf(stderr, "Could not write '%s'\n", j.outputPath.c_str());
+		return false;
+	}
+	result.writes = log->count;
+	result.samples = samples;
+	result.seconds = samples / j.rate;
+	return true;
+}
+
+static void runWorker (worker & w, size_t index, const std::vector<job> & jobs, std::vector<jobResult> & results, std::atomic<size_t> & nextJob, const options & opt) {
+	for (;;) {
+		size_t i = nextJob.fetch_add(1, std::memory_order_relaxed);
+		if (i >= jobs.size()) break;
+		jobResult & result = results[i];
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		result.ok = renderJob(w, jobs[i], opt, result);
+		result.renderTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		result.thread = index;
+		w.jobs++;
+		w.busy += result.renderTime;
+		if (result.ok) w.seconds += result.seconds;
+		else w.failed++;
+	}
+}
+
+static bool writeReport (const char * path, const std::vector<job> & jobs, const std::vector<jobResult> & results) {
+	FILE * file = fopen(path, "w");
+	if (!file) {
+		fprintf(stderr, "Could not open '%s' for writing\n", path);
+		return false;
+	}
+	fprintf(file, "register log,output,status,writes,samples,seconds,render ms,thread\n");
+	for (size_t i = 0; i < jobs.size(); i++) {
+		const jobResult & r = results[i];
+		fprintf(file, "%s,%s,%s,%zu,%llu,%.6f,%.3f,%zu\n", jobs[i].logPath.c_str(), jobs[i].outputPath.c_str(), r.ok ? "ok" : "failed",
+			r.writes, (unsigned long long)r.samples, r.seconds, r.renderTime * 1000, r.thread);
+	}
+	bool success = !fclose(file);
+	if (!success) fprintf(stderr, "Could not write '%s'\n", path);
+	return success;
+}
+
+int main (int argc, char ** argv) {
+	options opt;
+	const char * manifestPath = NULL;
+	bool valid = true;
+	for (int i = 1; valid && i < argc; i++) {
+		const char * value = i + 1 < argc ? argv[i + 1] : NULL;
+		if (argv[i][0] != '-' || !argv[i][1]) {
+			valid = !manifestPath;
+			manifestPath = argv[i];
+		}
+		else if (value && !strcmp(argv[i], "-t") && (opt.threads = strtoul(value, NULL, 0)) > 0) i++;
+		else if (value && !strcmp(argv[i], "-r") && (opt.rate = atof(value)) > 0) i++;
+		else if (value && !strcmp(argv[i], "-q") && (opt.quality = strtoul(value, NULL, 0)) <= 1) i++;
+		else if (value && !strcmp(argv[i], "-o") && (opt.outputType = strtoul(value, NULL, 0)) <= T85APU_OUTPUT_PB4_EXACT) i++;
+		else if (value && !strcmp(argv[i], "-B") && (opt.bufferSize = strtoul(value, NULL, 0)) > 0) i++;
+		else if (value && !strcmp(argv[i], "-T") && (opt.tail = atof(value)) >= 0) i++;
+		else if (value && !strcmp(argv[i], "-s")) opt.reportPath = argv[++i];
+		else valid = false;
+	}
+	if (!valid || !manifestPath) {
+		fprintf(stderr,
+			"Usage: t85apu_batch <manifest> [-t threads] [-r rate] [-q quality] [-o output type] [-B buffer size] [-T tail] [-s report]\n"
+			"  The manifest (or - for stdin) has a job per line: <register log> <output WAV> [rate] [quality] [output type]\n"
+			"  with the paths not containing whitespace, and the rest defaulting to the options. Empty lines and lines starting with # are skipped.\n"
+			"  -t  Threads to render on, the amount of hardware threads by default\n"
+			"  -r  Sample rate, 48000 by default\n"
+			"  -q  Quality of the sample rate converter, 1 (averaging) by default\n"
+			"  -o  Output type (T85APU_OUTPUT_XXX), 0 (PB4) by default\n"
+			"  -B  Size of the register write buffer, 16 by default\n"
+			"  -T  Seconds rendered after the last write of each log, 0.5 by default\n"
+			"  -s  Write a CSV report of every job to this file\n");
+		return 1;
+	}
+
+	std::vector<job> jobs;
+	if (!loadManifest(manifestPath, opt, jobs)) return 2;
+	size_t threadCount = opt.threads ? opt.threads : std::thread::hardware_concurrency();
+	if (!threadCount) threadCount = 1;
+	if (threadCount > jobs.size() && !jobs.empty()) threadCount = jobs.size();
+
+	std::vector<worker> workers(threadCount);
+	for (worker & w : workers) {
+		w.apu = NEW_APU(opt.bufferSize);
+		w.log = t85APU_regLog_new(0, 0);
+		w.capacity = 0;
+		w.bytes.resize(CHUNK * 2);
+		w.jobs = w.failed = 0;
+		w.seconds = w.busy = 0;
+		if (!w.apu || !w.log) {
+			fprintf(stderr, "Could not allocate the workers\n");
+			for (worker & v : workers) {
+				t85APU_delete(v.apu);
+				t85APU_regLog_delete(v.log);
+			}
+			return 2;
+		}
+	}
+
+	std::vector<jobResult> results(jobs.size(), jobResult{false, 0, 0, 0, 0, 0});
+	std::atomic<size_t> nextJob(0);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	// The calling thread is worker 0
+	std::vector<std::thread> threads;
+	for (size_t t = 1; t < threadCount; t++)
+		threads.emplace_back(runWorker, std::ref(workers[t]), t, std::cref(jobs), std::ref(results), std::ref(nextJob), std::cref(opt));
+	runWorker(workers[0], 0, jobs, results, nextJob, opt);
+	for (std::thread & thread : threads) thread.join();
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	size_t failed = 0;
+	double seconds = 0, busy = 0;
+	for (const worker & w : workers) {
+		failed += w.failed;
+		seconds += w.seconds;
+		busy += w.busy;
+	}
+	printf("Rendered %zu of %zu register logs on %zu threads", jobs.size() - failed, jobs.size(), threadCount);
+	if (failed) printf(", %zu failed", failed);
+	printf("\n%.1f s of audio in %.3f s", seconds, wall);
+	if (wall > 0) printf(", %.0f jobs per second, %.0f times real time", jobs.size() / wall, seconds / wall);
+	printf("\n");
+	// How much of the time the threads spent on jobs rather than waiting for the last ones, with 1 thread per core the throughput scales by about as much
+	if (wall > 0) printf("The threads spent %.0f%% of the time on jobs (%.3f s over %zu threads)\n", 100 * busy / wall / threadCount, busy, threadCount);
+	printf("%6s %8s %8s %12s %10s\n", "thread", "jobs", "failed", "audio s", "busy s");
+	for (size_t t = 0; t < threadCount; t++)
+		printf("%6zu %8zu %8zu %12.1f %10.3f\n", t, workers[t].jobs, workers[t].failed, workers[t].seconds, workers[t].busy);
+
+	bool reported = !opt.reportPath || writeReport(opt.reportPath, jobs, results);
+	for (worker & w : workers) {
+		t85APU_delete(w.apu);
+		t85APU_regLog_delete(w.log);
+	}
+	if (!reported) return 2;
+	return failed ? 3 : 0;
+}
@@ -0,0 +1,404 @@
+/*
+	t85APU firmware cycle budget analyzer
+	© alexmush, 2024
+	Calculates the best and worst case cycle counts of every path through the timer interrupt of the firmware (avr/main.asm),
+	for each register handler of CallTable, and fails if any of them does not fit into the 512-cycle frame.
+	A baseline file (-k) lists the handlers that are known not to fit, with their worst case, which they then only fail on going over.
+	With BURST_WRITES, it also checks that a register write started at the latest point BURST_LIMIT allows ends in time.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "avrasm.h"
+
+#define DEFAULT_BUDGET		512	// 2 overflows of Timer1 at CK
+#define OVF1_VECTOR			4	// Timer1 overflow, the same on the ATtiny25/45/85
+#define INTERRUPT_RESPONSE	4	// Cycles from the interrupt to the vector
+#define JUMP_TABLE			"CallTable"
+#define JUMP_TABLE_END		"CallTableEnd"
+#define PADDING				"Delay"	// Only runs when there is slack, until the second overflow
+#define BURST_WRITE			"BurstWrite"	// Loops back for another register write, checked separately
+#define BURST_CHECK			"BurstCheck"	// Reads TCNT1 after the second overflow and compares it to BURST_LIMIT
+
+#define INVALID_SPAN ((span){INT32_MAX, -1})
+#define MAX_BASELINE		64
+
+typedef struct {
+	int32_t best, worst;	// In cycles, best > worst if there is no path
+} span;
+
+/*
+	Every instruction is a node twice: before the ijmp into the jump table has to be taken (the paths that end without it are not counted),
+	and after it or when it is not required. Each node holds the cycles from it up until the ret / reti that ends it.
+*/
+typedef struct {
+	const avrAsm_program * program;
+	span * spans;
+	uint8_t * state;
+	int32_t * worstNext;	// The successor node on the worst path, -1 if there is none
+	int32_t tableStart, tableEnd;
+	int32_t onlyEntry;	// The jump table entry ijmp is restricted to, -1 for all of them, -2 for none
+	int32_t padding;	// Paths into it are not followed
+	int32_t burstWrite;	// Neither are paths into it
+	bool failed;
+} analyzer;
+
+enum {STATE_NEW, STATE_ACTIVE, STATE_DONE};
+
+static inline bool spanValid (span s) {
+	return s.best <= s.worst;
+}
+
+static inline span spanAdd (span s, int32_t cycles) {
+	if (!spanValid(s)) return s;
+	return (span){s.best + cycles, s.worst + cycles};
+}
+
+static span visit (analyzer * an, int32_t node);
+
+// Follows an edge to an address, with the cycles it takes
+static span follow (analyzer * an, const avrAsm_insn * from, int32_t addr, bool needIjmp, int32_t cycles, int32_t * worstNode, int32_t * worst) {
+	const avrAsm_insn * to = avrAsm_insnAt(an->program, addr);
+	if (!to) {
+		fprintf(stderr, "%s:%d: error: the execution goes outside of the program (to 0x%04X)\n", from->file, from->line, addr);
+		an->failed = true;
+		return INVALID_SPAN;
+	}
+	if (addr == an->padding || addr == an->burstWrite) return INVALID_SPAN;
+	int32_t node = (to - an->program->insns) * 2 + needIjmp;
+	span s = spanAdd(visit(an, node), cycles);
+	if (spanValid(s) && s.worst > *worst) {
+		*worst = s.worst;
+		*worstNode = node;
+	}
+	return s;
+}
+
+static span merge (span a, span b) {
+	if (!spanValid(a)) return b;
+	if (!spanValid(b)) return a;
+	return (span){a.best < b.best ? a.best : b.best, a.worst > b.worst ? a.worst : b.worst};
+}
+
+static span visit (analyzer * an, int32_t node) {
+	if (an->state[node] == STATE_DONE) return an->spans[node];
+	const avrAsm_insn * insn = &an->program->insns[node / 2];
+	bool needIjmp = node & 1;
+	if (an->state[node] == STATE_ACTIVE) {
+		fprintf(stderr, "%s:%d: error: loop without a known amount of iterations\n", insn->file, insn->line);
+		an->failed = true;
+		return INVALID_SPAN;
+	}
+	an->state[node] = STATE_ACTIVE;
+
+	const avrAsm_opInfo * info = &avrAsm_ops[insn->op];
+	int32_t next = insn->addr + insn->words;
+	int32_t worstNode = -1, worst = -1;
+	span result = INVALID_SPAN;
+	switch (insn->op) {
+		case AVRASM_RET:
+		case AVRASM_RETI:
+			if (!needIjmp) result = (span){info->cycles, info->cycles};
+			break;
+		case AVRASM_RJMP:
+			result = follow(an, insn, insn->k, needIjmp, info->cycles, &worstNode, &worst);
+			break;
+		case AVRASM_RCALL: {
+			int32_t calleeNode = -1, calleeWorst = -1;
+			span callee = follow(an, insn, insn->k, false, info->cycles, &calleeNode, &calleeWorst);
+			if (spanValid(callee)) result = follow(an, insn, next, needIjmp, 0, &worstNode, &worst);
+			if (spanValid(result)) result = (span){result.best + callee.best, result.worst + callee.worst};
+			break;
+		}
+		case AVRASM_IJMP:
+			for (int32_t entry = an->tableStart; entry < an->tableEnd; entry++) {
+				if (an->onlyEntry != -1 && an->onlyEntry != entry) continue;
+				result = merge(result, follow(an, insn, entry, false, info->cycles, &worstNode, &worst));
+			}
+			if (an->tableStart < 0) {
+				fprintf(stderr, "%s:%d: error: ijmp without the '%s' jump table\n", insn->file, insn->line, JUMP_TABLE);
+				an->failed = true;
+			}
+			break;
+		case AVRASM_ICALL:
+			fprintf(stderr, "%s:%d: error: icall targets are not known\n", insn->file, insn->line);
+			an->failed = true;
+			break;
+		default:
+			result = follow(an, insn, next, needIjmp, info->cycles, &worstNode, &worst);
+			if (avrAsm_isBranch(insn->op)) {
+				result = merge(result, follow(an, insn, insn->k, needIjmp, info->cycles + 1, &worstNode, &worst));
+			} else if (avrAsm_isSkip(insn->op)) {
+				const avrAsm_insn * skipped = avrAsm_insnAt(an->program, next);
+				int32_t words = skipped ? skipped->words : 1;
+				result = merge(result, follow(an, insn, next + words, needIjmp, info->cycles + words, &worstNode, &worst));
+			}
+			break;
+	}
+
+	an->spans[node] = result;
+	an->worstNext[node] = worstNode;
+	an->state[node] = STATE_DONE;
+	return result;
+}
+
+// Analyzes the interrupt, with ijmp going only to the given jump table entry (the paths without it are not counted then)
+static int32_t vectorNode (const analyzer * an, int32_t onlyEntry) {
+	return (avrAsm_insnAt(an->program, OVF1_VECTOR) - an->program->insns) * 2 + (onlyEntry >= 0);
+}
+
+static span analyze (analyzer * an, int32_t onlyEntry) {
+	memset(an->state, STATE_NEW, an->program->count * 2);
+	an->onlyEntry = onlyEntry;
+	const avrAsm_insn * vector = avrAsm_insnAt(an->program, OVF1_VECTOR);
+	if (!vector) {
+		fprintf(stderr, "error: there is no Timer1 overflow interrupt vector\n");
+		an->failed = true;
+		return INVALID_SPAN;
+	}
+	return spanAdd(visit(an, vectorNode(an, onlyEntry)), INTERRUPT_RESPONSE);
+}
+
+// Analyzes one more register write of the burst mode, from BurstWrite up until the end of reti
+static span analyzeBurst (analyzer * an) {
+	memset(an->state, STATE_NEW, an->program->count * 2);
+	an->onlyEntry = -1;
+	const avrAsm_insn * insn = avrAsm_insnAt(an->program, an->burstWrite);
+	if (!insn) return INVALID_SPAN;
+	return visit(an, (insn - an->program->insns) * 2 + 1);
+}
+
+// The cycles from reading TCNT1 at BurstCheck up until BurstWrite, and the BURST_LIMIT it is compared to
+static bool burstCheck (const analyzer * an, int32_t * cycles, int32_t * limit) {
+	int32_t addr = avrAsm_findLabel(an->program, BURST_CHECK);
+	*cycles = 0;
+	*limit = -1;
+	while (addr >= 0 && addr < an->burstWrite) {
+		const avrAsm_insn * insn = avrAsm_insnAt(an->program, addr);
+		if (!insn) return false;
+		if (insn->op == AVRASM_CPI) *limit = insn->k;
+		*cycles += avrAsm_ops[insn->op].cycles;
+		addr += insn->words;
+	}
+	return addr == an->burstWrite && *limit >= 0;
+}
+
+// The handlers known to be over the budget, one "<handler> <worst case>" per line, # starts a comment
+typedef struct {
+	char name[64];
+	int32_t worst;
+	bool found;
+} baselineEntry;
+
+static int loadBaseline (const char * path, baselineEntry * entries) {
+	FILE * file = fopen(path, "r");
+	if (!file) {
+		fprintf(stderr, "Could not open %s\n", path);
+		return -1;
+	}
+	char line[256];
+	int count = 0, lineNumber = 0;
+	while (fgets(line, sizeof(line), file)) {
+		lineNumber++;
+		char name[64];
+		int worst;
+		if (line[0] == '#' || sscanf(line, "%63s", name) != 1) continue;
+		if (sscanf(line, "%63s %d", name, &worst) != 2 || count >= MAX_BASELINE) {
+			fprintf(stderr, "%s:%d: error: expected a handler and its worst case\n", path, lineNumber);
+			fclose(file);
+			return -1;
+		}
+		snprintf(entries[count].name, sizeof(entries[count].name), "%s", name);
+		entries[count].worst = worst;
+		entries[count++].found = false;
+	}
+	fclose(file);
+	return count;
+}
+
+// Checks the worst case of a handler against the budget, or against its baseline if it has one
+static bool checkHandler (const char * name, int32_t worst, int32_t budget, baselineEntry * baseline, int baselineCount) {
+	for (int i = 0; i < baselineCount; i++) {
+		if (strcmp(baseline[i].name, name)) continue;
+		baseline[i].found = true;
+		if (worst > baseline[i].worst) {
+			fprintf(stderr, "error: %s is %d cycles over its baseline of %d\n", name, worst - baseline[i].worst, baseline[i].worst);
+			return false;
+		}
+		if (worst > budget) printf("%s: %d cycles over the budget, known from the baseline\n", name, worst - budget);
+		else printf("%s: fits the budget now, its baseline can be removed\n", name);
+		return true;
+	}
+	if (worst > budget) {
+		fprintf(stderr, "error: %s is %d cycles over the budget\n", name, worst - budget);
+		return false;
+	}
+	return true;
+}
+
+// The operand of a jump table entry, i.e. the handler name
+static void entryName (const avrAsm_insn * insn, char * name, size_t size) {
+	const char * text = insn->text;
+	while (*text && !isspace((unsigned char)*text)) text++;
+	while (isspace((unsigned char)*text)) text++;
+	snprintf(name, size, "%s", text);
+	size_t length = strlen(name);
+	while (length && isspace((unsigned char)name[length-1])) name[--length] = 0;
+}
+
+// Prints the instructions on the worst path, going into the called subroutines
+static void printWorstPath (const analyzer * an, int32_t node, int depth) {
+	const avrAsm_program * program = an->program;
+	const avrAsm_label * lastLabel = NULL;
+	while (node >= 0) {
+		const avrAsm_insn * insn = &program->insns[node / 2];
+		const avrAsm_label * label = avrAsm_labelAt(program, insn->addr);
+		if (label && label != lastLabel && label->addr == insn->addr) printf("%*s%s:\n", depth * 2, "", label->name);
+		lastLabel = label;
+		printf("%*s  0x%04X  %4d left  %s\n", depth * 2, "", insn->addr, an->spans[node].worst, insn->text);
+		if (insn->op == AVRASM_RCALL) {
+			const avrAsm_insn * callee = avrAsm_insnAt(program, insn->k);
+			printWorstPath(an, (callee - program->insns) * 2, depth + 1);
+			lastLabel = NULL;
+		}
+		node = an->worstNext[node];
+	}
+}
+
+int main (int argc, char ** argv) {
+	avrAsm_options options;
+	memset(&options, 0, sizeof(options));
+	argc = avrAsm_parseArgs(&options, argc, argv);
+
+	int32_t budget = DEFAULT_BUDGET;
+	bool verbose = false;
+	const char * source = NULL, * baselinePath = NULL;
+	bool usage = argc < 0;
+	for (int i = 1; i < argc && !usage; i++) {
+		if (!strcmp(argv[i], "-b") && i + 1 < argc) budget = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-k") && i + 1 < argc) baselinePath = argv[++i];
+		else if (!strcmp(argv[i], "-v")) verbose = true;
+		else if (!source) source = argv[i];
+		else usage = true;
+	}
+	if (usage || !source || budget <= 0) {
+		fprintf(stderr, "Usage: t85apu_cycles [-I include dir] [-D NAME[=value]] [-b budget] [-k baseline file] [-v] <firmware source>\n");
+		fprintf(stderr, "\t-b sets the cycle budget of a frame, 512 by default\n\t-k allows the handlers in the file to go over the budget, up to the worst case it has for them\n\t-v prints the worst path\n");
+		return 1;
+	}
+	baselineEntry baseline[MAX_BASELINE];
+	int baselineCount = baselinePath ? loadBaseline(baselinePath, baseline) : 0;
+	if (baselineCount < 0) return 2;
+	avrAsm_program * program = avrAsm_load(source, &options);
+	if (!program) return 2;
+
+	analyzer an;
+	memset(&an, 0, sizeof(an));
+	an.program = program;
+	an.spans = (span *) calloc(program->count * 2, sizeof(span));
+	an.state = (uint8_t *) calloc(program->count * 2, 1);
+	an.worstNext = (int32_t *) calloc(program->count * 2, sizeof(int32_t));
+	if (!an.spans || !an.state || !an.worstNext) {
+		fprintf(stderr, "Could not allocate memory\n");
+		return 2;
+	}
+	an.tableStart = avrAsm_findLabel(program, JUMP_TABLE);
+	an.tableEnd = avrAsm_findLabel(program, JUMP_TABLE_END);
+	if (an.tableStart < 0 || an.tableEnd < an.tableStart) an.tableStart = an.tableEnd = -1;
+	an.padding = avrAsm_findLabel(program, PADDING);
+	an.burstWrite = avrAsm_findLabel(program, BURST_WRITE);
+
+	printf("Frame budget: %d cycles, from the Timer1 overflow to the end of reti\n\n", budget);
+	printf("%-12s %-20s %6s %6s %6s\n", "Register", "Handler", "Best", "Worst", "Slack");
+
+	// The frame without a register write, then the register handlers, grouped by the handler
+	span total = analyze(&an, -2), noWrite = total;
+	if (spanValid(total)) printf("%-12s %-20s %6d %6d %6d\n", "-", "(no write)", total.best, total.worst, budget - total.worst);
+	int32_t worstEntry = -2;
+	// The handlers are checked after the table, in its order
+	struct {
+		char name[64];
+		int32_t worst;
+	} handlers[MAX_BASELINE];
+	int handlerCount = 0;
+	for (int32_t entry = an.tableStart; entry >= 0 && entry < an.tableEnd && !an.failed;) {
+		const avrAsm_insn * insn = avrAsm_insnAt(program, entry);
+		if (!insn || insn->op != AVRASM_RJMP) {
+			fprintf(stderr, "%s:%d: error: the jump table can only have rjmp\n", insn ? insn->file : source, insn ? insn->line : 0);
+			an.failed = true;
+			break;
+		}
+		char name[64], nextName[64];
+		entryName(insn, name, sizeof(name));
+		int32_t last = entry;
+		while (last + 1 < an.tableEnd && avrAsm_insnAt(program, last + 1)) {
+			entryName(avrAsm_insnAt(program, last + 1), nextName, sizeof(nextName));
+			if (strcmp(name, nextName)) break;
+			last++;
+		}
+		span s = analyze(&an, entry);
+		if (!spanValid(s)) break;
+		char registers[16];
+		if (last == entry) snprintf(registers, sizeof(registers), "0x%02X", entry - an.tableStart);
+		else snprintf(registers, sizeof(registers), "0x%02X..0x%02X", entry - an.tableStart, last - an.tableStart);
+		printf("%-12s %-20s %6d %6d %6d\n", registers, name, s.best, s.worst, budget - s.worst);
+		if (handlerCount < MAX_BASELINE) {
+			snprintf(handlers[handlerCount].name, sizeof(handlers[handlerCount].name), "%s", name);
+			handlers[handlerCount++].worst = s.worst;
+		}
+		if (s.worst > total.worst || !spanValid(total)) worstEntry = entry;
+		total = merge(total, s);
+		entry = last + 1;
+	}
+
+	int ret = 0;
+	if (an.failed || !spanValid(total)) {
+		fprintf(stderr, "Could not analyze '%s'\n", source);
+		ret = 2;
+	} else {
+		printf("\nWorst case: %d cycles, %d cycles of slack\n", total.worst, budget - total.worst);
+		if (total.best < budget / 2) printf("Best case: %d cycles, padded with %s up until the second overflow\n", total.best, PADDING);
+		if (an.burstWrite >= 0) {
+			// TCNT1 is read at the start of the instruction, and BurstWrite is only reached if it is below the limit
+			span burst = analyzeBurst(&an);
+			int32_t checkCycles, limit;
+			if (!spanValid(burst) || an.failed || !burstCheck(&an, &checkCycles, &limit)) {
+				fprintf(stderr, "Could not analyze the burst writes of '%s'\n", source);
+				ret = 2;
+			} else {
+				int32_t latest = budget / 2 + limit - 1 + checkCycles + burst.worst;
+				printf("Burst writes: %d..%d cycles each, the last one ends by cycle %d with a BURST_LIMIT of %d (at most %d)\n",
+					burst.best, burst.worst, latest, limit, limit + budget - latest);
+				if (latest > budget) {
+					fprintf(stderr, "error: BURST_LIMIT lets the burst writes go over the budget by %d cycles\n", latest - budget);
+					ret = 1;
+				}
+			}
+		}
+		if (verbose) {
+			printf("\nWorst path (cycles left up until the end of reti):\n");
+			analyze(&an, worstEntry);
+			printWorstPath(&an, vectorNode(&an, worstEntry), 0);
+		}
+		if (baselinePath) {
+			printf("\n");
+			if (!checkHandler("(no write)", noWrite.worst, budget, baseline, baselineCount)) ret = 1;
+			for (int i = 0; i < handlerCount; i++)
+				if (!checkHandler(handlers[i].name, handlers[i].worst, budget, baseline, baselineCount)) ret = 1;
+			for (int i = 0; i < baselineCount; i++)
+				if (!baseline[i].found) printf("%s: not in the jump table, its baseline can be removed\n", baseline[i].name);
+		} else if (total.worst > budget) {
+			fprintf(stderr, "error: the worst case is over the budget by %d cycles\n", total.worst - budget);
+			ret = 1;
+		}
+	}
+
+	free(an.spans);
+	free(an.state);
+	free(an.worstNext);
+	avrAsm_delete(program);
+	return ret;
+}
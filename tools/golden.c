@@ -0,0 +1,818 @@
+/*
+	t85APU golden output checker
+	© alexmush, 2024
+	Runs a corpus of register streams, which exercises every register handler, through the emulator:
+	- "check" runs the reference engine (t85apu_ref.c) in lockstep with it, and reports the first update where the two diverge, with both of their states
+	- "hash" compares the hashes of its outputs with the ones in a golden file (or writes them there with -u), which is much faster
+	- "firmware" runs the firmware backend (t85apu_firmware.h) in lockstep with it, and reports the first update after which the state of the recompiled
+	  firmware or its output differs from the emulator's. Both are compared once the whole update has run, so there is no offset between them
+	- "latency" pushes a write that is heard right away after different amounts of others, and reports where it is not first heard on the sample
+	  that t85APU_getLatency says it is, in every render setting but the point-sampled PWM output
+	- "optimize" runs every corpus entry before and after t85APU_regLog_optimize, and reports the first update where the optimized one
+	  has a setting that the original does not have within the delay and advance the optimizer reported
+	- "dump" saves the corpus as register logs (see t85apu_reglog.h)
+*/
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "t85apu.h"
+#include "t85apu_firmware.h"
+#include "t85apu_reglog.h"
+#include "t85apu_regdefines.h"
+#include "t85apu_ref.h"
+
+#define CLOCK 8000000.0
+#define BUFFER_SIZE 16
+#define TAIL_UPDATES 2048	// Rendered after the last write of each stream
+
+#ifdef T85APU_FIRMWARE_BURST_WRITES
+#define FIRMWARE_BURST_WRITES true
+#else
+#define FIRMWARE_BURST_WRITES false
+#endif
+
+// Corpus
+
+typedef struct {
+	t85APU_regLog * log;
+	size_t capacity;
+	uint64_t time;
+	uint32_t seed;
+} corpus;
+
+static void emit (corpus * c, uint8_t addr, uint8_t data) {
+	if (!c->log) return;
+	if (c->log->count >= c->capacity) {
+		size_t capacity = c->capacity ? c->capacity * 2 : 256;
+		t85APU_regWrite * writes = (t85APU_regWrite *) realloc(c->log->writes, capacity * sizeof(t85APU_regWrite));
+		if (!writes) {
+			fprintf(stderr, "Could not allocate the corpus\n");
+			t85APU_regLog_delete(c->log);
+			c->log = NULL;
+			return;
+		}
+		c->log->writes = writes;
+		c->capacity = capacity;
+	}
+	c->log->writes[c->log->count++] = (t85APU_regWrite){c->time, addr, data};
+}
+
+static void waitUpdates (corpus * c, uint64_t updates) {
+	c->time += updates * 512;
+}
+
+static uint32_t nextRandom (corpus * c) {
+	c->seed ^= c->seed << 13;
+	c->seed ^= c->seed >> 17;
+	c->seed ^= c->seed << 5;
+	return c->seed;
+}
+
+// PILOx, PHIxx, DUTYx, VOL_x, CFG_x, with and without phase resets
+static void corpusTones (corpus * c) {
+	for (uint8_t ch = 0; ch < 5; ch++) {
+		emit(c, VOL_A+ch, 0x40 + ch*0x20);
+		emit(c, CFG_A+ch, Pan((ch & 3), (3 - (ch & 3))));
+		emit(c, DUTYA+ch, 0x80);
+	}
+	for (uint8_t octave = 0; octave < 8; octave++) {
+		for (uint8_t ch = 0; ch < 5; ch++) {
+			emit(c, PILOA+ch, 0x31 + ch*0x2B + octave*7);
+			emit(c, PHIAB+ch/2, (ch & 1 ? PitchHi_Sq_B(octave) | PitchHi_Sq_A((7-octave)) : PitchHi_Sq_A(octave) | PitchHi_Sq_B((7-octave))));
+			emit(c, DUTYA+ch, octave*0x20 + ch*3);
+			waitUpdates(c, 37);
+		}
+		// Phase resets, and rewriting the same octaves
+		emit(c, PHIAB, PitchHi_Sq_A(octave) | PitchHi_Sq_B((7-octave)) | bit(PR_SQ_A));
+		emit(c, PHICD, PitchHi_Sq_A(octave) | PitchHi_Sq_B((7-octave)) | bit(PR_SQ_C) | bit(PR_SQ_D));
+		emit(c, PHIEN, PitchHi_Sq_E(octave) | bit(PR_SQ_E) | bit(PR_NOISE));
+		waitUpdates(c, 200);
+	}
+	// Duty 0 and 0xFF, volumes with bit 7, every pan
+	for (uint8_t ch = 0; ch < 5; ch++) {
+		emit(c, DUTYA+ch, ch & 1 ? 0xFF : 0x00);
+		emit(c, VOL_A+ch, 0xFF - ch);
+		emit(c, CFG_A+ch, ch * 3);
+		waitUpdates(c, 300);
+	}
+}
+
+// NTPLO, NTPHI, the noise channel's pitch and the noise enable of every channel
+static void corpusNoise (corpus * c) {
+	static const uint16_t xors[] = {0x2400, 0x0000, 0xFFFF, 0xB400, 0x0001, 0x8000};
+	for (uint8_t ch = 0; ch < 5; ch++) {
+		emit(c, VOL_A+ch, 0x60);
+		emit(c, DUTYA+ch, 0x40 + ch*0x30);
+		emit(c, PILOA+ch, 0x50 + ch*0x11);
+		emit(c, CFG_A+ch, bit(NOISE_EN) | Pan(3, 3));
+	}
+	emit(c, PHIAB, PitchHi_Sq_A(5) | PitchHi_Sq_B(6));
+	emit(c, PHICD, PitchHi_Sq_C(4) | PitchHi_Sq_D(7));
+	for (size_t i = 0; i < sizeof(xors)/sizeof(xors[0]); i++) {
+		emit(c, NTPLO, xors[i] & 0xFF);
+		emit(c, NTPHI, xors[i] >> 8);
+		for (uint8_t octave = 0; octave < 8; octave += 3) {
+			emit(c, PILON, 0xFF - i*0x21);
+			emit(c, PHIEN, PitchHi_Sq_E(3) | PitchHi_Noise(octave));
+			waitUpdates(c, 400);
+		}
+		emit(c, CFG_A + i%5, Pan(2, 1));
+		waitUpdates(c, 100);
+		emit(c, CFG_A + i%5, bit(NOISE_EN) | Pan(1, 2));
+	}
+}
+
+// ELDLO, ELDHI, E_SHP, EPLOA, EPLOB and EPIHI, with every envelope shape and both envelopes on every channel
+static void corpusEnvelopes (corpus * c) {
+	for (uint8_t ch = 0; ch < 5; ch++) {
+		emit(c, PILOA+ch, 0x20 + ch*0x19);
+		emit(c, PHIAB+ch/2, 0x55);
+		emit(c, DUTYA+ch, 0x80);
+		emit(c, VOL_A+ch, ch & 1 ? 0x80 : 0x00);	// Full and half envelope volume
+		emit(c, CFG_A+ch, bit(ENV_EN) | EnvNum(ch) | Pan(3, 3));
+	}
+	for (uint8_t shape = 0; shape < 16; shape++) {
+		uint8_t speed = shape * 0x11;
+		emit(c, ELDLO, 0x10 * shape);
+		emit(c, ELDHI, 0xF0 - shape);
+		emit(c, EPLOA, 0x80 + speed);
+		emit(c, EPLOB, 0xFF - speed);
+		// Slow, fast (bit 3 / 7) and every octave
+		emit(c, EPIHI, PitchHi_Env_A(shape & 7) | PitchHi_Env_B(shape & 0xF));
+		emit(c, E_SHP, (shape & 7) | (shape & 8 ? 0 : bit(ENVA_RST)) | ((15 - shape) & 7) << 4 | bit(ENVB_RST));
+		waitUpdates(c, 700);
+		// Changes of the shape without a reset, flipping the attack
+		emit(c, E_SHP, shape ^ (bit(ENVA_ATT) | bit(ENVB_ATT)));
+		emit(c, EPIHI, PitchHi_Env_A((shape | 8)) | PitchHi_Env_B((7 - (shape & 7))));
+		waitUpdates(c, 500);
+		emit(c, EPLOA, speed);
+		waitUpdates(c, 300);
+	}
+	// The envelope sample slots, which no handler writes to
+	for (uint8_t ch = 0; ch < 5; ch++) emit(c, CFG_A+ch, bit(ENV_EN) | bit(ENV_SMP) | EnvNum(ch) | Pan(2, 2));
+	waitUpdates(c, 100);
+}
+
+// The unused register numbers, including the ones that only differ in bit 7
+static void corpusUnused (corpus * c) {
+	emit(c, VOL_A, 0x7F);
+	emit(c, PILOA, 0x40);
+	emit(c, DUTYA, 0x80);
+	for (unsigned addr = 0x20; addr < 0x100; addr += 3) {
+		emit(c, addr, addr ^ 0xA5);
+		waitUpdates(c, 2);
+	}
+	emit(c, VOL_A | 0x80, 0x33);
+	emit(c, PILOA | 0x80, 0x90);
+	waitUpdates(c, 100);
+}
+
+// More writes at once than the register write buffer holds
+static void corpusBuffer (corpus * c) {
+	for (int burst = 0; burst < 8; burst++) {
+		for (int i = 0; i < BUFFER_SIZE + 4; i++) emit(c, VOL_A + i%5, burst*0x20 + i);
+		for (int i = 0; i < 5; i++) emit(c, PILOA+i, 0x10 * (burst+i));
+		waitUpdates(c, burst * 5);
+	}
+}
+
+// Random writes to every register, weighted towards audible settings
+static void corpusRandom (corpus * c) {
+	for (int i = 0; i < 3000; i++) {
+		uint32_t r = nextRandom(c);
+		uint8_t addr = r % 33, data = r >> 8;
+		if (addr >= CFG_A && addr <= CFG_E && r >> 16 & 1) data |= Pan(3, 3);
+		if (addr == E_SHP && r >> 17 & 1) data |= bit(ENVA_RST) | bit(ENVB_RST);
+		emit(c, addr, data);
+		waitUpdates(c, r >> 24 & 0x0F);
+	}
+}
+
+typedef struct {
+	const char * name;
+	void (*build) (corpus * c);
+	uint32_t seed;
+} corpusEntry;
+
+static const corpusEntry corpusEntries[] = {
+	{"tones",		corpusTones,		0},
+	{"noise",		corpusNoise,		0},
+	{"envelopes",	corpusEnvelopes,	0},
+	{"unused",		corpusUnused,		0},
+	{"buffer",		corpusBuffer,		0},
+	{"random1",		corpusRandom,		12345},
+	{"random2",		corpusRandom,		0xC0FFEE},
+	{"random3",		corpusRandom,		0x85A9},
+};
+#define CORPUS_SIZE (sizeof(corpusEntries)/sizeof(corpusEntries[0]))
+
+static t85APU_regLog * buildEntry (const corpusEntry * entry) {
+	corpus c = {t85APU_regLog_new(CLOCK, 0), 0, 0, entry->seed};
+	if (!c.log) return NULL;
+	entry->build(&c);
+	return c.log;
+}
+
+// Render settings
+
+typedef struct {
+	const char * name;
+	double rate;	// 0 for CLOCK / 512
+	uint_fast8_t quality;
+	uint_fast8_t outputType;
+	bool burstWrites;	// Not in the reference engine, so only hashed
+} renderConfig;
+
+static const renderConfig renderConfigs[] = {
+	{"update",		0,				0,	T85APU_OUTPUT_PB4,			false},
+	{"4x-exact",	CLOCK / 128,	1,	T85APU_OUTPUT_PB4_EXACT,	false},
+	{"44100",		44100,			1,	T85APU_OUTPUT_PB4,			false},
+	{"48000-exact",	48000,			0,	T85APU_OUTPUT_PB4_EXACT,	false},
+	{"burst",		0,				0,	T85APU_OUTPUT_PB4,			true},
+};
+#define CONFIG_COUNT (sizeof(renderConfigs)/sizeof(renderConfigs[0]))
+
+static t85APU * newEmulator (const renderConfig * config) {
+	#ifdef T85APU_REGWRITE_BUFFER_SIZE
+	t85APU * apu = t85APU_new(CLOCK, config->rate, config->outputType);
+	#else
+	t85APU * apu = t85APU_new(CLOCK, config->rate, config->outputType, BUFFER_SIZE);
+	#endif
+	if (!apu) return NULL;
+	t85APU_setQuality(apu, config->quality);
+	t85APU_setBurstWrites(apu, config->burstWrites);
+	return apu;
+}
+
+// Steps through the samples of a register stream, keeping track of the master clocks like the emulator does
+typedef struct {
+	const t85APU_regLog * log;
+	size_t next;
+	double ticksPerSample;
+	double ticks;
+	uint64_t clocks;
+	uint64_t end;
+} replay;
+
+static void replayInit (replay * r, const t85APU_regLog * log, const renderConfig * config) {
+	r->log = log;
+	r->next = 0;
+	r->ticksPerSample = config->rate ? CLOCK / config->rate : 512;
+	r->ticks = 0;
+	r->clocks = 0;
+	r->end = (log->count ? log->writes[log->count-1].time : 0) + TAIL_UPDATES * 512;
+}
+
+// Returns the amount of writes due before the next sample, which start at r->log->writes[r->next]
+static size_t replayDue (replay * r) {
+	size_t first = r->next;
+	while (r->next < r->log->count && r->log->writes[r->next].time <= r->clocks) r->next++;
+	return r->next - first;
+}
+
+static void replayAdvance (replay * r) {
+	double tmp;
+	r->ticks += r->ticksPerSample;
+	r->clocks += (uint64_t)floor(r->ticks);
+	r->ticks = modf(r->ticks, &tmp);
+}
+
+// Lockstep check
+
+static bool compareField (const char * name, size_t index, size_t count, uint32_t ref, uint32_t emu, bool print) {
+	if (print) {
+		char label[32];
+		if (count > 1) snprintf(label, sizeof(label), "%s[%zu]", name, index);
+		else snprintf(label, sizeof(label), "%s", name);
+		printf("  %-20s %08" PRIX32 "  %08" PRIX32 "%s\n", label, ref, emu, ref != emu ? "  <<" : "");
+	}
+	return ref == emu;
+}
+
+#define COMPARE(field) same &= compareField(#field, 0, 1, ref->field, apu->field, print)
+#define COMPARE_ARRAY(field, count) for (size_t i = 0; i < (count); i++) same &= compareField(#field, i, (count), ref->field[i], apu->field[i], print)
+
+// Compares the states of the firmware, and of the output
+static bool compareStates (const t85APU_ref * ref, const t85APU * apu, bool print) {
+	bool same = true;
+	if (print) printf("  %-20s %-8s  %-8s\n", "", "ref", "emu");
+	COMPARE(noiseLFSR);
+	COMPARE_ARRAY(envPhaseAccs, 2);
+	COMPARE_ARRAY(envStates, 2);
+	COMPARE(envShape);
+	COMPARE_ARRAY(dutyCycles, 5);
+	COMPARE(noiseXOR);
+	COMPARE_ARRAY(volumes, 5);
+	COMPARE_ARRAY(channelConfigs, 5);
+	COMPARE(envLdBuffer);
+	COMPARE_ARRAY(increments, 8);
+	COMPARE_ARRAY(shiftedIncrements, 8);
+	COMPARE_ARRAY(octaveValues, 7);
+	COMPARE_ARRAY(tonePhaseAccs, 5);
+	COMPARE(noisePhaseAcc);
+	COMPARE_ARRAY(envSmpVolume, 4);
+	COMPARE(noiseMask);
+	COMPARE(envZeroFlg);
+	COMPARE(clockCycle);
+	COMPARE(outPending);
+	COMPARE_ARRAY(channelOutput, 5);
+	COMPARE(currentOutput);
+	COMPARE_ARRAY(outputQueue, 2);
+	COMPARE(shiftRegCurIdx);
+	return same;
+}
+
+// Returns 0 if the emulator matched the reference engine all the way through
+static int checkEntry (const corpusEntry * entry, const renderConfig * config) {
+	t85APU_regLog * log = buildEntry(entry);
+	t85APU * apu = log ? newEmulator(config) : NULL;
+	if (!apu) {
+		t85APU_regLog_delete(log);
+		return 2;
+	}
+	t85APU_ref ref;
+	t85APU_ref_init(&ref, CLOCK, config->rate, config->outputType, config->quality, BUFFER_SIZE);
+	uint_fast8_t shift = 16 - apu->outputBitdepth;
+
+	replay r;
+	replayInit(&r, log, config);
+	int result = 0;
+	for (uint64_t sample = 0; r.clocks < r.end; sample++) {
+		for (size_t i = replayDue(&r); i; i--) {
+			const t85APU_regWrite * write = &log->writes[r.next - i];
+			t85APU_writeReg(apu, write->addr, write->data);
+			t85APU_ref_writeReg(&ref, write->addr, write->data);
+		}
+		uint64_t start = r.clocks;
+		replayAdvance(&r);
+		uint32_t refOutput = t85APU_ref_calc(&ref, shift);
+		uint32_t emuOutput = t85APU_calcU16(apu);
+		if (refOutput != emuOutput || !compareStates(&ref, apu, false)) {
+			printf("%s, %s: diverged in sample %" PRIu64 " (master clocks %" PRIu64 "..%" PRIu64 ", update %" PRIu64 ")\n",
+				entry->name, config->name, sample, start, r.clocks, (r.clocks - 1) / 512);
+			printf("  %-20s %08" PRIX32 "  %08" PRIX32 "%s\n", "output", refOutput, emuOutput, refOutput != emuOutput ? "  <<" : "");
+			compareStates(&ref, apu, true);
+			result = 1;
+			break;
+		}
+	}
+	if (!result) printf("%s, %s: OK\n", entry->name, config->name);
+	t85APU_delete(apu);
+	t85APU_regLog_delete(log);
+	return result;
+}
+
+// Firmware lockstep check
+
+// The data addresses of the firmware's state (see the registers and the .dseg of avr/main.asm)
+#define FW_PHASE_ACCS		4	// r4..r15, A to E and the noise
+#define FW_ENV_SMP_VOLUMES	20	// r20..r23
+#define FW_NOISE_MASK		24
+#define FW_ENV_ZERO_FLG		25
+#define FW_OCR1B			(0x20 + 0x2B)
+#define FW_NOISE_LFSR		0x60
+#define FW_ENV_PHASE_ACCS	(FW_NOISE_LFSR + 2)
+#define FW_ENV_STATES		(FW_ENV_PHASE_ACCS + 8)	// After the sample phase accumulators
+#define FW_ENV_SHAPE		(FW_ENV_STATES + 2)
+#define FW_DUTY_CYCLES		(FW_ENV_SHAPE + 1)
+#define FW_NOISE_XOR		(FW_DUTY_CYCLES + 5)
+#define FW_VOLUMES			(FW_NOISE_XOR + 2)
+#define FW_CHANNEL_CONFIGS	(FW_VOLUMES + 5)
+#define FW_ENV_LD_BUFFER	(FW_CHANNEL_CONFIGS + 5)
+#define FW_INCREMENTS		(FW_ENV_LD_BUFFER + 2)
+#define FW_SHIFTED_INCS_L	(FW_INCREMENTS + 8)
+#define FW_SHIFTED_INCS_H	(FW_SHIFTED_INCS_L + 8)
+#define FW_OCTAVE_VALUES	(FW_SHIFTED_INCS_H + 8)
+
+static uint16_t firmwareWord (const t85APU_firmware * fw, uint_fast16_t addr) {
+	return fw->data[addr] | fw->data[addr+1] << 8;
+}
+
+// Reads the state of the firmware into the fields of the emulator that hold it
+static void readFirmware (const t85APU_firmware * fw, t85APU * state) {
+	state->noiseLFSR = firmwareWord(fw, FW_NOISE_LFSR);
+	for (size_t i = 0; i < 2; i++) state->envPhaseAccs[i] = firmwareWord(fw, FW_ENV_PHASE_ACCS + i*2);
+	for (size_t i = 0; i < 2; i++) state->envStates[i] = fw->data[FW_ENV_STATES + i];
+	state->envShape = fw->data[FW_ENV_SHAPE];
+	for (size_t i = 0; i < 5; i++) state->dutyCycles[i] = fw->data[FW_DUTY_CYCLES + i];
+	state->noiseXOR = firmwareWord(fw, FW_NOISE_XOR);
+	for (size_t i = 0; i < 5; i++) state->volumes[i] = fw->data[FW_VOLUMES + i];
+	for (size_t i = 0; i < 5; i++) state->channelConfigs[i] = fw->data[FW_CHANNEL_CONFIGS + i];
+	state->envLdBuffer = firmwareWord(fw, FW_ENV_LD_BUFFER);
+	for (size_t i = 0; i < 8; i++) state->increments[i] = fw->data[FW_INCREMENTS + i];
+	for (size_t i = 0; i < 8; i++) state->shiftedIncrements[i] = fw->data[FW_SHIFTED_INCS_L + i] | fw->data[FW_SHIFTED_INCS_H + i] << 8;
+	for (size_t i = 0; i < 7; i++) state->octaveValues[i] = fw->data[FW_OCTAVE_VALUES + i];
+	for (size_t i = 0; i < 5; i++) state->tonePhaseAccs[i] = firmwareWord(fw, FW_PHASE_ACCS + i*2);
+	state->noisePhaseAcc = firmwareWord(fw, FW_PHASE_ACCS + 10);
+	for (size_t i = 0; i < 4; i++) state->envSmpVolume[i] = fw->data[FW_ENV_SMP_VOLUMES + i];
+	state->noiseMask = fw->data[FW_NOISE_MASK];
+	state->envZeroFlg = fw->data[FW_ENV_ZERO_FLG];
+}
+
+// Compares the state of the firmware (read into ref) with the emulator's, without the output stage that the firmware does not have
+static bool compareFirmware (const t85APU * ref, const t85APU * apu, bool print) {
+	bool same = true;
+	if (print) printf("  %-20s %-8s  %-8s\n", "", "firmware", "emu");
+	COMPARE(noiseLFSR);
+	COMPARE_ARRAY(envPhaseAccs, 2);
+	COMPARE_ARRAY(envStates, 2);
+	COMPARE(envShape);
+	COMPARE_ARRAY(dutyCycles, 5);
+	COMPARE(noiseXOR);
+	COMPARE_ARRAY(volumes, 5);
+	COMPARE_ARRAY(channelConfigs, 5);
+	COMPARE(envLdBuffer);
+	COMPARE_ARRAY(increments, 8);
+	COMPARE_ARRAY(shiftedIncrements, 8);
+	COMPARE_ARRAY(octaveValues, 7);
+	COMPARE_ARRAY(tonePhaseAccs, 5);
+	COMPARE(noisePhaseAcc);
+	COMPARE_ARRAY(envSmpVolume, 4);
+	COMPARE(noiseMask);
+	COMPARE(envZeroFlg);
+	return same;
+}
+
+// Returns 0 if the recompiled firmware matched the emulator all the way through, both run an update at a time
+static int firmwareEntry (const corpusEntry * entry, const renderConfig * config) {
+	t85APU_regLog * log = buildEntry(entry);
+	t85APU * apu = log ? newEmulator(config) : NULL;
+	t85APU * fwApu = apu ? newEmulator(config) : NULL;
+	t85APU * state = fwApu ? (t85APU *) calloc(1, sizeof(t85APU)) : NULL;
+	if (!state || !t85APU_useFirmware(fwApu)) {
+		free(state);
+		t85APU_delete(fwApu);
+		t85APU_delete(apu);
+		t85APU_regLog_delete(log);
+		return 2;
+	}
+	t85APU_firmware * fw = (t85APU_firmware *) fwApu->backendData;
+
+	replay r;
+	replayInit(&r, log, config);
+	int result = 0;
+	for (uint64_t update = 0; r.clocks < r.end; update++) {
+		for (size_t i = replayDue(&r); i; i--) {
+			const t85APU_regWrite * write = &log->writes[r.next - i];
+			t85APU_writeReg(apu, write->addr, write->data);
+			t85APU_writeReg(fwApu, write->addr, write->data);
+		}
+		replayAdvance(&r);
+		uint32_t emuOutput = t85APU_runUpdate(apu);
+		// The backend returns on the second overflow, so the rest of the update is run up until the next one
+		t85APU_runUpdate(fwApu);
+		t85APU_firmware_runUntil(fw, fw->frameStart);
+		readFirmware(fw, state);
+		uint32_t fwOutput = fw->data[FW_OCR1B];
+		if (fw->halted || fwOutput != emuOutput || !compareFirmware(state, apu, false)) {
+			printf("%s, firmware%s: diverged in update %" PRIu64 "%s\n",
+				entry->name, config->burstWrites ? " (burst)" : "", update, fw->halted ? ", the firmware has halted" : "");
+			printf("  %-20s %08" PRIX32 "  %08" PRIX32 "%s\n", "output", fwOutput, emuOutput, fwOutput != emuOutput ? "  <<" : "");
+			compareFirmware(state, apu, true);
+			result = 1;
+			break;
+		}
+	}
+	if (!result) printf("%s, firmware%s: OK\n", entry->name, config->burstWrites ? " (burst)" : "");
+	free(state);
+	t85APU_delete(fwApu);
+	t85APU_delete(apu);
+	t85APU_regLog_delete(log);
+	return result;
+}
+
+// Latency
+
+// Channel A held high (no increment, full duty) at volume 0, so the write of its volume is heard from the update that takes it
+static const uint8_t latencySetup[][2] = {{PILOA, 0x00}, {DUTYA, 0xFF}, {CFG_A, Pan(3, 3)}, {VOL_A, 0x00}};
+#define LATENCY_SETUP_UPDATES 8	// Enough to take the setup
+// The writes ahead of it, which do not change the output, with handlers of different lengths
+static const uint8_t latencyFillers[] = {PHICD, EPIHI, PHIAB, NTPLO, PHIEN, ELDHI, PILOB, E_SHP + 0x20};
+#define LATENCY_FILLERS (sizeof(latencyFillers)/sizeof(latencyFillers[0]))
+static const size_t latencyAhead[] = {0, 1, 2, 3, 6, 10, BUFFER_SIZE - 1};
+#define LATENCY_PHASES 12	// Samples rendered after the setup, to start from different points of the update and of the sample rate converter
+
+static void writeBoth (t85APU * apu, t85APU * quiet, uint8_t addr, uint8_t data) {
+	t85APU_writeReg(apu, addr, data);
+	t85APU_writeReg(quiet, addr, data);
+}
+
+// Returns 0 if a write pushed after the given amount of others is first heard on the sample t85APU_getLatency says it is
+static int latencyCase (const renderConfig * config, size_t ahead, unsigned phase) {
+	// The same writes go to both, but the one to be heard
+	t85APU * apu = newEmulator(config);
+	t85APU * quiet = apu ? newEmulator(config) : NULL;
+	if (!quiet) {
+		t85APU_delete(apu);
+		return 2;
+	}
+	double ticksPerSample = config->rate ? CLOCK / config->rate : 512;
+	for (size_t i = 0; i < sizeof(latencySetup)/sizeof(latencySetup[0]); i++) writeBoth(apu, quiet, latencySetup[i][0], latencySetup[i][1]);
+	uint64_t samples = (uint64_t)ceil(LATENCY_SETUP_UPDATES * 512 / ticksPerSample) + phase;
+	for (uint64_t i = 0; i < samples; i++) {
+		t85APU_calcU16(apu);
+		t85APU_calcU16(quiet);
+	}
+	for (size_t i = 0; i < ahead; i++) writeBoth(apu, quiet, latencyFillers[i % LATENCY_FILLERS], (uint8_t)(i * 0x35 + phase * 0x11));
+
+	t85APU_latency latency;
+	if (!t85APU_getLatency(apu, apu->shiftRegCurIdx, &latency)) {
+		printf("%s, %zu writes ahead, phase %u: no latency\n", config->name, ahead, phase);
+		t85APU_delete(quiet);
+		t85APU_delete(apu);
+		return 1;
+	}
+	t85APU_writeReg(apu, VOL_A, 0x7F);
+	// Up to twice as late as it should be heard
+	uint64_t heard = 0;
+	for (uint64_t sample = 1; sample <= latency.samples * 2 + 2 && !heard; sample++)
+		if (t85APU_calcU16(apu) != t85APU_calcU16(quiet)) heard = sample;
+	int result = 0;
+	if (heard != latency.samples) {
+		printf("%s, %zu writes ahead, phase %u: heard on sample %" PRIu64 ", t85APU_getLatency says %" PRIu64
+			" (queue %" PRIu64 ", update %" PRIu64 ", output %" PRIu64 ", resampler %" PRIu64 " master clocks)\n",
+			config->name, ahead, phase, heard, latency.samples, latency.queue, latency.update, latency.output, latency.resampler);
+		result = 1;
+	}
+	t85APU_delete(quiet);
+	t85APU_delete(apu);
+	return result;
+}
+
+static int latencyConfig (const renderConfig * config) {
+	int result = 0;
+	for (size_t a = 0; a < sizeof(latencyAhead)/sizeof(latencyAhead[0]); a++) {
+		for (unsigned phase = 0; phase < LATENCY_PHASES; phase++) {
+			int caseResult = latencyCase(config, latencyAhead[a], phase);
+			if (caseResult > result) result = caseResult;
+		}
+	}
+	if (!result) printf("%s, latency: OK\n", config->name);
+	return result;
+}
+
+// Hashes
+
+// FNV-1a of the 16-bit output of the emulator
+static int hashEntry (const corpusEntry * entry, const renderConfig * config, uint64_t * hash) {
+	t85APU_regLog * log = buildEntry(entry);
+	t85APU * apu = log ? newEmulator(config) : NULL;
+	if (!apu) {
+		t85APU_regLog_delete(log);
+		return 2;
+	}
+	replay r;
+	replayInit(&r, log, config);
+	*hash = 0xCBF29CE484222325ULL;
+	while (r.clocks < r.end) {
+		for (size_t i = replayDue(&r); i; i--) {
+			const t85APU_regWrite * write = &log->writes[r.next - i];
+			t85APU_writeReg(apu, write->addr, write->data);
+		}
+		replayAdvance(&r);
+		uint16_t output = t85APU_calcU16(apu);
+		*hash = (*hash ^ (output & 0xFF)) * 0x100000001B3ULL;
+		*hash = (*hash ^ (output >> 8)) * 0x100000001B3ULL;
+	}
+	t85APU_delete(apu);
+	t85APU_regLog_delete(log);
+	return 0;
+}
+
+static bool findGolden (FILE * file, const char * entry, const char * config, uint64_t * hash) {
+	char line[256], name[64], setting[64];
+	rewind(file);
+	while (fgets(line, sizeof(line), file)) {
+		if (line[0] == '#') continue;
+		if (sscanf(line, "%63s %63s %" SCNx64, name, setting, hash) == 3 && !strcmp(name, entry) && !strcmp(setting, config)) return true;
+	}
+	return false;
+}
+
+static int hashCorpus (const char * path, bool update) {
+	FILE * file = fopen(path, update ? "w" : "r");
+	if (!file) {
+		fprintf(stderr, "Could not open %s\n", path);
+		return 2;
+	}
+	if (update) fprintf(file, "# t85APU golden output hashes, written by t85apu_golden hash -u\n# corpus entry, render setting, FNV-1a of the 16-bit output\n");
+	int result = 0;
+	for (size_t e = 0; e < CORPUS_SIZE; e++) {
+		for (size_t s = 0; s < CONFIG_COUNT; s++) {
+			uint64_t hash, golden;
+			if (hashEntry(&corpusEntries[e], &renderConfigs[s], &hash)) {
+				result = 2;
+				continue;
+			}
+			if (update) {
+				fprintf(file, "%s %s %016" PRIx64 "\n", corpusEntries[e].name, renderConfigs[s].name, hash);
+			} else if (!findGolden(file, corpusEntries[e].name, renderConfigs[s].name, &golden)) {
+				printf("%s, %s: no golden hash\n", corpusEntries[e].name, renderConfigs[s].name);
+				result = 1;
+			} else if (hash != golden) {
+				printf("%s, %s: hash %016" PRIx64 ", expected %016" PRIx64 "\n", corpusEntries[e].name, renderConfigs[s].name, hash, golden);
+				result = 1;
+			}
+		}
+	}
+	fclose(file);
+	if (!update) printf(result ? "The output differs from the golden hashes, run \"t85apu_golden check\" to find where\n" : "All outputs match the golden hashes\n");
+	return result;
+}
+
+// Optimizer
+
+// The settings the register writes leave in the t85APU. The phases that run from them are not compared, since a write applied an update
+// earlier or later shifts them for good. The envelope load value is only read by the phase resets, so it is compared as the one each envelope got reset to
+static const struct {
+	const char * name;
+	size_t count;
+} settingFields[] = {
+	{"increments",		8},
+	{"octaveValues",	7},
+	{"dutyCycles",		5},
+	{"volumes",			5},
+	{"channelConfigs",	5},
+	{"noiseXOR",		1},
+	{"envLoaded",		2},
+	{"envShape",		1},
+};
+#define SETTING_COUNT (8+7+5+5+5+1+2+1)
+
+static void getSettings (const t85APU * apu, const uint16_t * envLoaded, uint16_t * settings) {
+	for (size_t i = 0; i < 8; i++) *settings++ = apu->increments[i];
+	for (size_t i = 0; i < 7; i++) *settings++ = apu->octaveValues[i];
+	for (size_t i = 0; i < 5; i++) *settings++ = apu->dutyCycles[i];
+	for (size_t i = 0; i < 5; i++) *settings++ = apu->volumes[i];
+	for (size_t i = 0; i < 5; i++) *settings++ = apu->channelConfigs[i];
+	*settings++ = apu->noiseXOR;
+	*settings++ = envLoaded[0];
+	*settings++ = envLoaded[1];
+	*settings++ = apu->envShape;
+}
+
+static void settingName (size_t index, char * name, size_t size) {
+	for (size_t f = 0; f < sizeof(settingFields)/sizeof(settingFields[0]); index -= settingFields[f++].count) {
+		if (index >= settingFields[f].count) continue;
+		if (settingFields[f].count > 1) snprintf(name, size, "%s[%zu]", settingFields[f].name, index);
+		else snprintf(name, size, "%s", settingFields[f].name);
+		return;
+	}
+}
+
+// The settings before the first update and after every update. The writes are pushed from the update their timestamp falls on, as soon as there is room for them,
+// which is how the optimizer expects them to be applied
+static uint16_t * renderSettings (const t85APU_regWrite * writes, size_t count, uint64_t updates) {
+	t85APU * apu = newEmulator(&renderConfigs[0]);
+	uint16_t * settings = apu ? (uint16_t *) malloc((updates + 1) * SETTING_COUNT * sizeof(uint16_t)) : NULL;
+	if (!settings) {
+		fprintf(stderr, "Could not allocate the settings\n");
+		t85APU_delete(apu);
+		return NULL;
+	}
+	size_t next = 0;
+	uint16_t envLoaded[2] = {apu->envLdBuffer, apu->envLdBuffer};
+	getSettings(apu, envLoaded, settings);
+	for (uint64_t update = 0; update < updates; update++) {
+		for (; next < count && writes[next].time <= update << 9; next++) {
+			const uint8_t pair[1][2] = {{writes[next].addr, writes[next].data}};
+			if (!t85APU_writeRegs(apu, pair, 1)) break;
+		}
+		uint16_t taken = apu->shiftRegister[0];
+		t85APU_runUpdate(apu);
+		if ((taken & 0x8000) && (taken >> 8 & 0x7F) == E_SHP) {
+			if (taken & bit(ENVA_RST)) envLoaded[0] = apu->envLdBuffer;
+			if (taken & bit(ENVB_RST)) envLoaded[1] = apu->envLdBuffer;
+		}
+		getSettings(apu, envLoaded, settings + (update + 1) * SETTING_COUNT);
+	}
+	t85APU_delete(apu);
+	return settings;
+}
+
+// Returns 0 if every setting of the optimized log is one the original has within the reported delay and advance
+static int optimizeEntry (const corpusEntry * entry) {
+	t85APU_regLog * log = buildEntry(entry);
+	t85APU_regWrite * optimized = log ? (t85APU_regWrite *) malloc(log->count * sizeof(t85APU_regWrite)) : NULL;
+	if (!optimized) {
+		t85APU_regLog_delete(log);
+		return 2;
+	}
+	memcpy(optimized, log->writes, log->count * sizeof(t85APU_regWrite));
+	t85APU_regOptStats stats;
+	size_t count = t85APU_regLog_optimize(optimized, log->count, &stats);
+
+	uint64_t updates = (log->count ? (log->writes[log->count-1].time + 511) >> 9 : 0) + TAIL_UPDATES;
+	uint16_t * before = renderSettings(log->writes, log->count, updates);
+	uint16_t * after = before ? renderSettings(optimized, count, updates) : NULL;
+	int result = after ? 0 : 2;
+	uint64_t delay = stats.worstDelay >> 9, advance = stats.worstAdvance >> 9;
+	// Row n holds the settings after n updates
+	for (uint64_t update = 0; update <= updates && !result; update++) {
+		// Applied up to delay updates later than in the original, or up to advance updates earlier
+		uint64_t first = update > delay ? update - delay : 0, last = update + advance < updates ? update + advance : updates;
+		for (size_t k = 0; k < SETTING_COUNT && !result; k++) {
+			uint16_t value = after[update * SETTING_COUNT + k];
+			bool found = false;
+			for (uint64_t other = first; other <= last && !found; other++) found = before[other * SETTING_COUNT + k] == value;
+			if (found) continue;
+			char name[32];
+			settingName(k, name, sizeof(name));
+			printf("%s, optimized: %s is %04X after %" PRIu64 " updates, which the original does not have after %" PRIu64 "..%" PRIu64 " (%04X in it)\n",
+				entry->name, name, value, update, first, last, before[update * SETTING_COUNT + k]);
+			result = 1;
+		}
+	}
+	if (!result) printf("%s, optimized: OK (%zu of %zu writes kept, applied up to %" PRIu64 " updates later and %" PRIu64 " earlier)\n",
+		entry->name, count, log->count, delay, advance);
+	free(before);
+	free(after);
+	free(optimized);
+	t85APU_regLog_delete(log);
+	return result;
+}
+
+int main (int argc, char ** argv) {
+	if (argc >= 2 && !strcmp(argv[1], "check")) {
+		int result = 0;
+		bool found = false;
+		for (size_t e = 0; e < CORPUS_SIZE; e++) {
+			if (argc >= 3 && strcmp(argv[2], corpusEntries[e].name)) continue;
+			found = true;
+			for (size_t s = 0; s < CONFIG_COUNT; s++) {
+				if (renderConfigs[s].burstWrites) continue;
+				int entryResult = checkEntry(&corpusEntries[e], &renderConfigs[s]);
+				if (entryResult > result) result = entryResult;
+			}
+		}
+		if (!found) {
+			fprintf(stderr, "No corpus entry named %s\n", argv[2]);
+			return 2;
+		}
+		return result;
+	}
+	if (argc >= 2 && !strcmp(argv[1], "firmware")) {
+		int result = 0;
+		bool found = false;
+		for (size_t e = 0; e < CORPUS_SIZE; e++) {
+			if (argc >= 3 && strcmp(argv[2], corpusEntries[e].name)) continue;
+			found = true;
+			// Only at the update rate, and in the register write mode the firmware was recompiled with
+			for (size_t s = 0; s < CONFIG_COUNT; s++) {
+				if (renderConfigs[s].rate || renderConfigs[s].burstWrites != FIRMWARE_BURST_WRITES) continue;
+				int entryResult = firmwareEntry(&corpusEntries[e], &renderConfigs[s]);
+				if (entryResult > result) result = entryResult;
+			}
+		}
+		if (!found) {
+			fprintf(stderr, "No corpus entry named %s\n", argv[2]);
+			return 2;
+		}
+		return result;
+	}
+	if (argc >= 2 && !strcmp(argv[1], "latency")) {
+		int result = 0;
+		for (size_t s = 0; s < CONFIG_COUNT; s++) {
+			// The point-sampled PWM output only shows the new duty on the samples that land in the pulse, which may be any amount later
+			if (renderConfigs[s].outputType == T85APU_OUTPUT_PB4_EXACT && !renderConfigs[s].quality) continue;
+			int configResult = latencyConfig(&renderConfigs[s]);
+			if (configResult > result) result = configResult;
+		}
+		return result;
+	}
+	if (argc >= 2 && !strcmp(argv[1], "optimize")) {
+		int result = 0;
+		for (size_t e = 0; e < CORPUS_SIZE; e++) {
+			int entryResult = optimizeEntry(&corpusEntries[e]);
+			if (entryResult > result) result = entryResult;
+		}
+		return result;
+	}
+	if (argc >= 3 && !strcmp(argv[1], "hash"))
+		return hashCorpus(argv[2], argc >= 4 && !strcmp(argv[3], "-u"));
+	if (argc >= 3 && !strcmp(argv[1], "dump")) {
+		for (size_t e = 0; e < CORPUS_SIZE; e++) {
+			char path[4096];
+			snprintf(path, sizeof(path), "%s/%s.t85l", argv[2], corpusEntries[e].name);
+			t85APU_regLog * log = buildEntry(&corpusEntries[e]);
+			if (!log || !t85APU_regLog_save(log, path)) {
+				t85APU_regLog_delete(log);
+				return 2;
+			}
+			t85APU_regLog_delete(log);
+		}
+		return 0;
+	}
+	fprintf(stderr,
+		"Usage: t85apu_golden check [corpus entry]\n"
+		"       t85apu_golden hash <golden file> [-u]\n"
+		"       t85apu_golden firmware [corpus entry]\n"
+		"       t85apu_golden latency\n"
+		"       t85apu_golden optimize\n"
+		"       t85apu_golden dump <directory>\n");
+	return 2;
+}
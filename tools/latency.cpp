@@ -0,0 +1,226 @@
+/*
+	t85APU audio callback latency benchmark
+	© alexmush, 2024
+	Simulates a periodic audio callback rendering the emulator, with bursts of register writes injected into it like a game's sound driver would,
+	and reports the percentiles of how long the callbacks took for every output type, quality and block size - the worst case is what causes dropouts.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "t85apu.h"
+#include "t85apu_regdefines.h"
+
+#define DRIVER_RATE		60	// Sound driver ticks per second, each one writes a few registers
+#define ROW_TICKS		6	// Every this many ticks a song row starts, which writes a lot more of them
+#define RESET_SECONDS	5	// Every this many seconds the clock and rate are set again, like when the audio device changes
+#define HISTOGRAM_BUCKETS	32	// Powers of 2 of nanoseconds
+
+struct options {
+	std::vector<size_t> blockSizes;
+	double rate = 48000;
+	double clock = 8000000;
+	double seconds = 10;
+	size_t bufferSize = 16;
+	bool paced = false;
+	bool histogram = false;
+	double failFraction = 0;	// 0 if it never fails
+};
+
+struct driver {
+	uint32_t seed;
+	uint64_t ticks;
+	size_t writes;
+	size_t late;	// Writes that did not fit into the buffer in the callback they were made in
+	std::vector<uint16_t> backlog;	// Writes waiting for room in the buffer, packed like it holds them
+};
+
+static uint32_t nextRandom (driver & d) {
+	d.seed ^= d.seed << 13;
+	d.seed ^= d.seed >> 17;
+	d.seed ^= d.seed << 5;
+	return d.seed;
+}
+
+static void queueWrite (driver & d, uint8_t addr, uint8_t data) {
+	d.backlog.push_back(0x8000 | addr << 8 | data);
+	d.writes++;
+}
+
+// Pushes as much of the backlog as fits into the buffer, the rest waits for the next callback like a driver with its own queue would
+static void flushWrites (driver & d, t85APU * apu, size_t queued) {
+	size_t taken = t85APU_writePackedRegs(apu, d.backlog.data(), d.backlog.size());
+	d.late += std::min(queued, d.backlog.size() - taken);
+	d.backlog.erase(d.backlog.begin(), d.backlog.begin() + taken);
+}
+
+// A sound driver tick: the pitches, volumes and duty cycles of the playing notes, and on a new row the configs, the envelopes and the noise too
+static void driverTick (driver & d) {
+	bool row = !(d.ticks % ROW_TICKS);
+	for (uint8_t ch = 0; ch < 5; ch++) {
+		uint32_t r = nextRandom(d);
+		queueWrite(d, PILOA + ch, r);
+		queueWrite(d, VOL_A + ch, r >> 8);
+		if (!row) continue;
+		queueWrite(d, DUTYA + ch, r >> 16);
+		queueWrite(d, CFG_A + ch, (r >> 24) | Pan(3, 3));
+	}
+	if (row) {
+		uint32_t r = nextRandom(d);
+		queueWrite(d, PHIAB, r);
+		queueWrite(d, PHICD, r >> 8);
+		queueWrite(d, PHIEN, r >> 16);
+		queueWrite(d, NTPLO, r >> 24);
+		queueWrite(d, E_SHP, r | bit(ENVA_RST) | bit(ENVB_RST));
+		queueWrite(d, EPLOA, r >> 8);
+		queueWrite(d, EPLOB, r >> 16);
+		queueWrite(d, EPIHI, r >> 24);
+	}
+	d.ticks++;
+}
+
+static double percentile (const std::vector<uint64_t> & sorted, double p) {
+	size_t index = (size_t)(p * sorted.size());
+	if (index >= sorted.size()) index = sorted.size() - 1;
+	return sorted[index] / 1000.0;
+}
+
+// Returns the p99.9 of the callback time as a fraction of the callback period
+static double runConfig (const options & opt, uint_fast8_t outputType, uint_fast8_t quality, size_t blockSize) {
+	#ifdef T85APU_REGWRITE_BUFFER_SIZE
+	t85APU * apu = t85APU_new(opt.clock, opt.rate, outputType);
+	#else
+	t85APU * apu = t85APU_new(opt.clock, opt.rate, outputType, opt.bufferSize);
+	#endif
+	if (!apu) return -1;
+	t85APU_setQuality(apu, quality);
+
+	std::vector<int16_t> output(blockSize);
+	size_t callbacks = (size_t)(opt.seconds * opt.rate / blockSize);
+	std::vector<uint64_t> times(callbacks);
+	driver d = {0x85A9, 0, 0, 0, {}};
+	double period = blockSize / opt.rate;
+	double samplesPerTick = opt.rate / DRIVER_RATE;
+	uint64_t samples = 0, resets = 0;
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < callbacks; i++) {
+		if (opt.paced) std::this_thread::sleep_until(begin + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(i * period)));
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		// The driver ticks that fall into this block are written at its start, like from a game thread between callbacks
+		size_t queued = d.backlog.size();
+		while (d.ticks * samplesPerTick < samples + blockSize) driverTick(d);
+		flushWrites(d, apu, d.backlog.size() - queued);
+		if ((samples + blockSize) / opt.rate >= (resets + 1) * RESET_SECONDS) {
+			t85APU_setClocknRate(apu, opt.clock, opt.rate);
+			resets++;
+		}
+		for (size_t j = 0; j < blockSize; j++) output[j] = t85APU_calcS16(apu);
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+		times[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+		samples += blockSize;
+	}
+	t85APU_delete(apu);
+
+	std::vector<uint64_t> sorted(times);
+	std::sort(sorted.begin(), sorted.end());
+	double periodUs = period * 1e6;
+	double p999 = percentile(sorted, 0.999);
+	printf("%-10s %7u %6zu %9.1f %8.2f %8.2f %8.2f %8.2f %9.3f%% %9zu/%zu\n",
+		outputType == T85APU_OUTPUT_PB4_EXACT ? "PB4_EXACT" : "PB4", (unsigned)quality, blockSize, periodUs,
+		percentile(sorted, 0.5), percentile(sorted, 0.99), p999, sorted.back() / 1000.0, 100.0 * sorted.back() / 1000.0 / periodUs, d.late, d.writes);
+
+	if (opt.histogram) {
+		size_t buckets[HISTOGRAM_BUCKETS] = {0};
+		for (uint64_t time : times) {
+			size_t bucket = 0;
+			while (time >> (bucket + 1) && bucket < HISTOGRAM_BUCKETS - 1) bucket++;
+			buckets[bucket]++;
+		}
+		for (size_t b = 0; b < HISTOGRAM_BUCKETS; b++) {
+			if (!buckets[b]) continue;
+			printf("    %10.2f us and up: %zu\n", (double)((uint64_t)1 << b) / 1000.0, buckets[b]);
+		}
+	}
+	return p999 / periodUs;
+}
+
+static bool parseBlockSizes (const char * list, std::vector<size_t> & blockSizes) {
+	blockSizes.clear();
+	while (*list) {
+		char * end;
+		unsigned long size = strtoul(list, &end, 0);
+		if (end == list || !size) return false;
+		blockSizes.push_back(size);
+		list = *end == ',' ? end + 1 : end;
+		if (*end && *end != ',') return false;
+	}
+	return !blockSizes.empty();
+}
+
+int main (int argc, char ** argv) {
+	options opt;
+	opt.blockSizes = {64, 128};
+	for (int i = 1; i < argc; i++) {
+		const char * value = i + 1 < argc ? argv[i + 1] : NULL;
+		if (!strcmp(argv[i], "-p")) opt.paced = true;
+		else if (!strcmp(argv[i], "-h")) opt.histogram = true;
+		else if (value && !strcmp(argv[i], "-b") && parseBlockSizes(value, opt.blockSizes)) i++;
+		else if (value && !strcmp(argv[i], "-r") && (opt.rate = atof(value)) > 0) i++;
+		else if (value && !strcmp(argv[i], "-c") && (opt.clock = atof(value)) > 0) i++;
+		else if (value && !strcmp(argv[i], "-s") && (opt.seconds = atof(value)) > 0) i++;
+		else if (value && !strcmp(argv[i], "-B") && (opt.bufferSize = strtoul(value, NULL, 0)) > 0) i++;
+		else if (value && !strcmp(argv[i], "-f") && (opt.failFraction = atof(value)) > 0) i++;
+		else {
+			fprintf(stderr,
+				"Usage: t85apu_latency [-b block sizes] [-r rate] [-c clock] [-s seconds] [-B buffer size] [-p] [-h] [-f fraction]\n"
+				"  -b  Comma-separated frames per callback, 64,128 by default\n"
+				"  -r  Sample rate, 48000 by default\n"
+				"  -c  Master clock, 8000000 by default\n"
+				"  -s  Seconds of audio per configuration, 10 by default\n"
+				"  -B  Size of the register write buffer, 16 by default\n"
+				"  -p  Pace the callbacks in real time instead of back to back, so that the caches go cold between them like in a real audio thread\n"
+				"  -h  Print a histogram of the callback times too\n"
+				"  -f  Fail if the p99.9 of any configuration is over this fraction of the callback period\n");
+			return 1;
+		}
+	}
+
+	for (size_t blockSize : opt.blockSizes) {
+		if (opt.seconds * opt.rate < blockSize) {
+			fprintf(stderr, "%.3f s is less than a callback of %zu frames\n", opt.seconds, blockSize);
+			return 1;
+		}
+	}
+
+	printf("Rate %.0f Hz, clock %.0f Hz, buffer size %zu, %.1f s per configuration, %s, %u driver ticks per second\n",
+		opt.rate, opt.clock, opt.bufferSize, opt.seconds, opt.paced ? "paced in real time" : "back to back", DRIVER_RATE);
+	printf("%-10s %7s %6s %9s %8s %8s %8s %8s %10s %s\n", "output", "quality", "block", "period", "p50", "p99", "p99.9", "max", "max/period", "late/writes");
+	printf("%-10s %7s %6s %9s %8s %8s %8s %8s\n", "", "", "", "us", "us", "us", "us", "us");
+	bool failed = false;
+	for (uint_fast8_t outputType = T85APU_OUTPUT_PB4; outputType <= T85APU_OUTPUT_PB4_EXACT; outputType++) {
+		for (uint_fast8_t quality = 0; quality <= 1; quality++) {
+			for (size_t blockSize : opt.blockSizes) {
+				double fraction = runConfig(opt, outputType, quality, blockSize);
+				if (fraction < 0) {
+					fprintf(stderr, "Could not create the t85APU\n");
+					return 2;
+				}
+				if (opt.failFraction && fraction > opt.failFraction) failed = true;
+			}
+		}
+	}
+	if (failed) {
+		fprintf(stderr, "The p99.9 of a configuration is over %.1f%% of its callback period\n", opt.failFraction * 100);
+		return 3;
+	}
+	return 0;
+}
@@ -0,0 +1,224 @@
+/*
+	t85APU MIDI driver tool
+	© alexmush, 2024
+	Plays a stream of timestamped MIDI events (see t85apu_midi.h) from a file or a pipe through the MIDI driver into raw samples,
+	or measures the latency from a note-on arriving to it being audible at the output, including the register write buffer and the output delay of the chip.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "t85apu_midi.h"
+
+#define CLOCK			8000000.0
+#define CHUNK			1024	// Samples rendered at a time when playing
+#define TAIL_SECONDS	1.0		// Rendered after the last event when playing
+#define LEAD_IN_SECONDS	0.02	// Rendered before the note-on, so that the setup writes of the driver are applied
+#define TIMEOUT_SECONDS	0.05	// A note that is not audible by then counts as lost
+#define MAX_TRIALS		4096
+
+#ifdef T85APU_REGWRITE_BUFFER_SIZE
+#define NEW_APU(rate, bufferSize) t85APU_new(CLOCK, rate, T85APU_OUTPUT_PB4)
+#else
+#define NEW_APU(rate, bufferSize) t85APU_new(CLOCK, rate, T85APU_OUTPUT_PB4, bufferSize)
+#endif
+
+static bool writeSamples (FILE * file, const int16_t * samples, size_t count) {
+	uint8_t bytes[CHUNK * 2];
+	for (size_t i = 0; i < count; i++) {
+		bytes[2*i+0] = (uint16_t)samples[i] & 0xFF;
+		bytes[2*i+1] = (uint16_t)samples[i] >> 8;
+	}
+	return fwrite(bytes, 2, count, file) == count;
+}
+
+// Renders until the driver reaches the given time
+static bool renderUntil (t85APU_midiDriver * driver, double ticksPerSample, uint64_t time, FILE * output) {
+	int16_t samples[CHUNK];
+	while (t85APU_midiDriver_getTime(driver) < time) {
+		size_t count = (size_t)((time - t85APU_midiDriver_getTime(driver)) / ticksPerSample) + 1;
+		if (count > CHUNK) count = CHUNK;
+		t85APU_midiDriver_render(driver, samples, count);
+		if (!writeSamples(output, samples, count)) return false;
+	}
+	return true;
+}
+
+static int play (const char * eventsPath, const char * outputPath, double rate, double decay) {
+	FILE * events = strcmp(eventsPath, "-") ? fopen(eventsPath, "r") : stdin;
+	FILE * output = strcmp(outputPath, "-") ? fopen(outputPath, "wb") : stdout;
+	if (!events || !output) {
+		fprintf(stderr, "Could not open '%s'\n", events ? outputPath : eventsPath);
+		if (events && events != stdin) fclose(events);
+		return 2;
+	}
+	t85APU * apu = NEW_APU(rate, 16);
+	t85APU_midiDriver * driver = t85APU_midiDriver_new(apu);
+	int result = 0;
+	if (!driver) result = 2;
+	else {
+		t85APU_midiDriver_setDecay(driver, decay);
+		t85APU_midiEvent event;
+		uint64_t last = 0;
+		// Rendered up to each event as it is read, so that a live pipe gets played as it comes in
+		while (!result && t85APU_midi_readEvent(events, CLOCK, &event)) {
+			if (!renderUntil(driver, CLOCK / rate, event.time, output) || !t85APU_midiDriver_queue(driver, &event)) result = 2;
+			last = event.time;
+		}
+		if (!result && !feof(events)) result = 3;	// The line that could not be parsed has been reported
+		if (!result && !renderUntil(driver, CLOCK / rate, last + (uint64_t)(TAIL_SECONDS * CLOCK), output)) result = 2;
+		if (result == 2) fprintf(stderr, "Could not write the samples\n");
+	}
+	t85APU_midiDriver_delete(driver);
+	t85APU_delete(apu);
+	if (events != stdin) fclose(events);
+	if (output != stdout) fclose(output);
+	return result;
+}
+
+typedef struct {
+	double rate;
+	size_t blockSize;
+	size_t bufferSize;
+	double decay;
+	size_t trials;
+} latencyOptions;
+
+// Runs 1 note-on (or chord) arriving at the given fraction of a block, with every channel but the one muted.
+// Returns the master clocks from the arrival and from the scheduled time to the first audible sample of the channel, or false if it never got audible
+static bool runTrial (const latencyOptions * opt, bool sampleAccurate, double arrivalFraction, const uint8_t * notes, size_t noteCount, int channel,
+	double * fromArrival, double * fromSchedule) {
+	t85APU * apu = NEW_APU(opt->rate, opt->bufferSize);
+	t85APU_midiDriver * driver = t85APU_midiDriver_new(apu);
+	if (!driver) {
+		t85APU_delete(apu);
+		return false;
+	}
+	t85APU_midiDriver_setDecay(driver, opt->decay);
+	for (int ch = 0; ch < 5; ch++) t85APU_setMute(apu, ch, ch != channel);
+
+	double ticksPerSample = CLOCK / opt->rate, blockTicks = opt->blockSize * ticksPerSample;
+	size_t leadInBlocks = (size_t)(LEAD_IN_SECONDS * opt->rate / opt->blockSize) + 1;
+	int16_t * block = (int16_t *) malloc(opt->blockSize * sizeof(int16_t));
+	for (size_t b = 0; b < leadInBlocks; b++) t85APU_midiDriver_render(driver, block, opt->blockSize);
+	int16_t silence = block[opt->blockSize - 1];
+
+	// It arrives during the callback of the last lead-in block, so the earliest it can be handled is the start of the next one.
+	// Sample-accurate scheduling delays it by exactly one block from when it arrived, block scheduling plays it at the start of the next block
+	double arrival = (leadInBlocks - 1 + arrivalFraction) * blockTicks;
+	uint64_t scheduled = sampleAccurate ? (uint64_t)(arrival + blockTicks) : (uint64_t)(leadInBlocks * blockTicks);
+	for (size_t i = 0; i < noteCount; i++) {
+		t85APU_midiEvent event = {scheduled, 0x90, notes[i], 0x7F};
+		t85APU_midiDriver_queue(driver, &event);
+	}
+
+	bool audible = false;
+	size_t timeoutBlocks = (size_t)(TIMEOUT_SECONDS * opt->rate / opt->blockSize) + 1;
+	for (size_t b = 0; b < timeoutBlocks && !audible; b++) {
+		double blockStart = (leadInBlocks + b) * blockTicks;
+		t85APU_midiDriver_render(driver, block, opt->blockSize);
+		for (size_t i = 0; i < opt->blockSize; i++) {
+			if (block[i] == silence) continue;
+			double time = blockStart + i * ticksPerSample;
+			*fromArrival = time - arrival;
+			*fromSchedule = time - scheduled;
+			audible = true;
+			break;
+		}
+	}
+	free(block);
+	t85APU_midiDriver_delete(driver);
+	t85APU_delete(apu);
+	return audible;
+}
+
+static int compareDoubles (const void * a, const void * b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+static double percentile (const double * sorted, size_t count, double p) {
+	size_t index = (size_t)(p * count);
+	return sorted[index < count ? index : count - 1];
+}
+
+static void printRow (const char * mode, size_t chord, const char * which, double * values, size_t count, size_t lost) {
+	if (!count) {
+		printf("%-7s %5zu %-6s  all %zu lost\n", mode, chord, which, lost);
+		return;
+	}
+	qsort(values, count, sizeof(double), compareDoubles);
+	double us = 1e6 / CLOCK;
+	printf("%-7s %5zu %-6s %8.1f %8.1f %8.1f %8.1f %8.1f %5zu\n", mode, chord, which, values[0] * us, percentile(values, count, 0.5) * us,
+		percentile(values, count, 0.99) * us, values[count-1] * us, (values[count-1] - values[0]) * us, lost);
+}
+
+static int latency (const latencyOptions * opt) {
+	static double arrivalFirst[MAX_TRIALS], arrivalLast[MAX_TRIALS];
+	printf("Rate %.0f Hz, block %zu samples (%.1f us), buffer size %zu, %s\n", opt->rate, opt->blockSize, opt->blockSize / opt->rate * 1e6, opt->bufferSize,
+		opt->decay ? "decaying notes" : "held notes");
+	printf("Latency from the note-on arriving to the first audible sample of its channel, for the first and the last note of a chord\n");
+	printf("%-7s %5s %-6s %8s %8s %8s %8s %8s %5s\n", "mode", "chord", "note", "min", "p50", "p99", "max", "jitter", "lost");
+	for (int sampleAccurate = 0; sampleAccurate <= 1; sampleAccurate++) {
+		double pipeline = 0;
+		size_t pipelineCount = 0;
+		for (size_t chord = 1; chord <= 5; chord++) {
+			size_t first = 0, last = 0, lost = 0;
+			uint32_t seed = 0x85A9 + chord;
+			for (size_t t = 0; t < opt->trials; t++) {
+				uint8_t notes[5];
+				for (size_t i = 0; i < chord; i++) {
+					seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+					notes[i] = 36 + i * 12 + seed % 12;	// In different octaves, so they are all distinct
+				}
+				seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+				double fraction = (double)(seed % 1000) / 1000;
+				double fromArrival, fromSchedule;
+				// A fresh driver gives the notes of a chord the channels in order
+				if (runTrial(opt, sampleAccurate, fraction, notes, chord, 0, &fromArrival, &fromSchedule)) {
+					arrivalFirst[first++] = fromArrival;
+					pipeline += fromSchedule;
+					pipelineCount++;
+				} else lost++;
+				if (runTrial(opt, sampleAccurate, fraction, notes, chord, (int)chord - 1, &fromArrival, &fromSchedule)) {
+					arrivalLast[last++] = fromArrival;
+				} else lost++;
+			}
+			const char * mode = sampleAccurate ? "sample" : "block";
+			printRow(mode, chord, "first", arrivalFirst, first, lost);
+			if (chord > 1) printRow(mode, chord, "last", arrivalLast, last, lost);
+		}
+		if (pipelineCount)
+			printf("%-7s on average %.1f us of it is from the scheduled time of the first note to it being audible (the write buffer and the output delay)\n",
+				sampleAccurate ? "sample" : "block", pipeline / pipelineCount * 1e6 / CLOCK);
+	}
+	return 0;
+}
+
+int main (int argc, char ** argv) {
+	if (argc >= 4 && !strcmp(argv[1], "play"))
+		return play(argv[2], argv[3], argc >= 5 ? atof(argv[4]) : 48000, argc >= 6 ? atof(argv[5]) : 0);
+
+	latencyOptions opt = {48000, 128, 16, 0, 200};
+	bool valid = argc >= 2 && !strcmp(argv[1], "latency");
+	for (int i = 2; valid && i < argc; i++) {
+		const char * value = i + 1 < argc ? argv[i + 1] : NULL;
+		if (value && !strcmp(argv[i], "-r") && (opt.rate = atof(value)) > 0) i++;
+		else if (value && !strcmp(argv[i], "-b") && (opt.blockSize = strtoul(value, NULL, 0)) > 0) i++;
+		else if (value && !strcmp(argv[i], "-B") && (opt.bufferSize = strtoul(value, NULL, 0)) > 0) i++;
+		else if (value && !strcmp(argv[i], "-d") && (opt.decay = atof(value)) >= 0) i++;
+		else if (value && !strcmp(argv[i], "-n") && (opt.trials = strtoul(value, NULL, 0)) > 0 && opt.trials <= MAX_TRIALS) i++;
+		else valid = false;
+	}
+	if (!valid) {
+		fprintf(stderr,
+			"Usage: t85apu_midi play <events> <output> [rate] [decay]\n"
+			"         Plays a text stream of MIDI events (a file, or - for stdin) into raw signed 16-bit little-endian mono samples (a file, or - for stdout)\n"
+			"       t85apu_midi latency [-r rate] [-b block size] [-B buffer size] [-d decay] [-n trials]\n"
+			"         Measures the note-on latency with block scheduling (the events play at the start of the next block)\n"
+			"         and sample-accurate scheduling (the events play exactly one block after they arrived)\n");
+		return 1;
+	}
+	return latency(&opt);
+}
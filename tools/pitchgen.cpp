@@ -0,0 +1,44 @@
+/*
+	t85APU pitch table generator
+	© alexmush, 2024
+	Prints the note tables of t85apu_pitch.hpp as a C header with static const arrays, for use from C.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "t85apu_pitch.hpp"
+
+static void printTable (const char * prefix, const char * name, const t85APUPitch * pitches) {
+	printf("static const uint8_t %s_%sIncrements[128] = {", prefix, name);
+	for (int i = 0; i < 128; i++) printf("%s0x%02X,", i % 16 ? " " : "\n\t", pitches[i].increment);
+	printf("\n};\n");
+	printf("static const uint8_t %s_%sOctaves[128] = {", prefix, name);
+	for (int i = 0; i < 128; i++) printf("%s%2d,", i % 16 ? " " : "\n\t", pitches[i].octave);
+	printf("\n};\n");
+	printf("static const float %s_%sCents[128] = {", prefix, name);
+	for (int i = 0; i < 128; i++) printf("%s%+9.4ff,", i % 8 ? " " : "\n\t", pitches[i].cents);
+	printf("\n};\n\n");
+}
+
+int main (int argc, char ** argv) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: t85apu_pitchgen <clock in Hz> [array name prefix] [A4 frequency in Hz]\n");
+		return 1;
+	}
+	double clock = atof(argv[1]);
+	const char * prefix = argc > 2 ? argv[2] : "t85apu";
+	double a4 = argc > 3 ? atof(argv[3]) : 440.0;
+	if (clock <= 0 || a4 <= 0) {
+		fprintf(stderr, "The clock speed and the A4 frequency have to be positive\n");
+		return 1;
+	}
+
+	t85APUNoteTable table = t85APU_makeNoteTable(clock, a4);
+	printf("// Generated by t85apu_pitchgen for a %.0f Hz master clock and A4 = %g Hz\n", clock, a4);
+	printf("// Indexed by MIDI note number, put the octaves into the octave registers with the PitchHi_XXX macros\n\n");
+	printf("#include <stdint.h>\n\n");
+	printTable(prefix, "tone", table.tone);
+	printTable(prefix, "envelope", table.envelope);
+	return 0;
+}
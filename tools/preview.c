@@ -0,0 +1,63 @@
+/*
+	t85APU waveform preview
+	© alexmush, 2024
+	Prints the waveform preview of a register log (see t85APU_regLog_preview in t85apu_reglog.h), one line per block with a bar from its minimum to its maximum,
+	and how much faster than real time it was rendered.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "t85apu_reglog.h"
+
+#define BAR_WIDTH 64
+
+int main (int argc, char ** argv) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: t85apu_preview <register log> [blocks] [stride]\n");
+		return 1;
+	}
+	t85APU_regLog * log = t85APU_regLog_load(argv[1]);
+	if (!log) return 2;
+	size_t blockCount = argc >= 3 ? strtoul(argv[2], NULL, 0) : 64;
+	uint32_t stride = argc >= 4 ? strtoul(argv[3], NULL, 0) : 16;
+	if (!blockCount) blockCount = 1;
+
+	uint64_t updates = (log->count ? log->writes[log->count-1].time : 0) / 512 + 1;
+	uint32_t blockUpdates = (uint32_t)((updates + blockCount - 1) / blockCount);
+	#ifdef T85APU_REGWRITE_BUFFER_SIZE
+	t85APU * apu = t85APU_new(log->clock, 0, T85APU_OUTPUT_PB4);
+	#else
+	t85APU * apu = t85APU_new(log->clock, 0, T85APU_OUTPUT_PB4, 1);
+	#endif
+	t85APU_previewBlock * blocks = (t85APU_previewBlock *) malloc(blockCount * sizeof(t85APU_previewBlock));
+	if (!apu || !blocks) {
+		fprintf(stderr, "Could not allocate the preview\n");
+		free(blocks);
+		t85APU_delete(apu);
+		t85APU_regLog_delete(log);
+		return 2;
+	}
+
+	clock_t start = clock();
+	t85APU_regLog_preview(log, apu, blockUpdates, stride, blocks, blockCount);
+	double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	for (size_t b = 0; b < blockCount; b++) {
+		char bar[BAR_WIDTH + 1];
+		size_t min = blocks[b].min * BAR_WIDTH / 256, max = blocks[b].max * BAR_WIDTH / 256, rms = (size_t)(blocks[b].rms * BAR_WIDTH / 256);
+		for (size_t i = 0; i < BAR_WIDTH; i++) bar[i] = i < min || i > max ? ' ' : i == rms ? '|' : '#';
+		bar[BAR_WIDTH] = 0;
+		printf("%10.3f s  %3u %3u %6.1f  %s\n", (double)b * blockUpdates * 512 / log->clock, blocks[b].min, blocks[b].max, blocks[b].rms, bar);
+	}
+	double length = (double)updates * 512 / log->clock;
+	printf("\n%.1f s of audio previewed in %.3f ms", length, seconds * 1000);
+	if (seconds > 0) printf(", %.0f times real time", length / seconds);
+	printf("\n");
+
+	free(blocks);
+	t85APU_delete(apu);
+	t85APU_regLog_delete(log);
+	return 0;
+}
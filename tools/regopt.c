@@ -0,0 +1,33 @@
+/*
+	t85APU register log optimizer
+	© alexmush, 2024
+	Removes dead and redundant writes from a register log, see t85APU_regLog_optimize in t85apu_reglog.h.
+*/
+
+#include <stdio.h>
+
+#include "t85apu_reglog.h"
+
+int main (int argc, char ** argv) {
+	if (argc < 3) {
+		fprintf(stderr, "Usage: t85apu_regopt <input log> <output log>\n");
+		return 1;
+	}
+	t85APU_regLog * log = t85APU_regLog_load(argv[1]);
+	if (!log) return 2;
+
+	size_t before = log->count;
+	t85APU_regOptStats stats;
+	log->count = t85APU_regLog_optimize(log->writes, log->count, &stats);
+
+	printf("Writes:             %zu -> %zu\n", before, log->count);
+	printf("Dropped dead:       %zu\n", stats.droppedDead);
+	printf("Dropped redundant:  %zu\n", stats.droppedRedundant);
+	printf("Reordered:          %zu\n", stats.reordered);
+	printf("Worst delay:        %llu master clocks (%.3f ms)\n", (unsigned long long)stats.worstDelay, stats.worstDelay * 1000.0 / log->clock);
+	printf("Worst advance:      %llu master clocks (%.3f ms)\n", (unsigned long long)stats.worstAdvance, stats.worstAdvance * 1000.0 / log->clock);
+
+	int result = t85APU_regLog_save(log, argv[2]) ? 0 : 3;
+	t85APU_regLog_delete(log);
+	return result;
+}
@@ -0,0 +1,156 @@
+/*
+	t85APU seek index tool
+	© alexmush, 2024
+	Builds the seek index of a register log (see t85APU_seekIndex in t85apu_reglog.h), or checks one by seeking to random times with it memory-mapped,
+	comparing the state to the one of a linear replay of the log and timing both.
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "t85apu_reglog.h"
+
+#define BUFFER_SIZE 16
+
+static t85APU * newAPU (double clock) {
+	#ifdef T85APU_REGWRITE_BUFFER_SIZE
+	return t85APU_new(clock, 0, T85APU_OUTPUT_PB4);
+	#else
+	return t85APU_new(clock, 0, T85APU_OUTPUT_PB4, BUFFER_SIZE);
+	#endif
+}
+
+static int compareTimes (const void * a, const void * b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static int build (const t85APU_regLog * log, const char * path, double seconds) {
+	t85APU * apu = newAPU(log->clock);
+	if (!apu) return 2;
+	clock_t start = clock();
+	t85APU_seekIndex * index = t85APU_seekIndex_build(log, apu, seconds);
+	double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+	t85APU_delete(apu);
+	if (!index || !t85APU_seekIndex_save(index, path)) {
+		t85APU_seekIndex_delete(index);
+		return 2;
+	}
+	printf("%zu checkpoints of %zu bytes every %.3f s, built in %.3f ms\n", index->count, index->stateSize, index->interval / log->clock, elapsed * 1000);
+	t85APU_seekIndex_delete(index);
+	return 0;
+}
+
+static int check (const t85APU_regLog * log, const char * path, size_t seeks) {
+	#ifndef _WIN32
+	int fd = open(path, O_RDONLY);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info)) {
+		fprintf(stderr, "Could not open seek index '%s'\n", path);
+		if (fd >= 0) close(fd);
+		return 2;
+	}
+	void * mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED) {
+		fprintf(stderr, "Could not map seek index '%s'\n", path);
+		return 2;
+	}
+	t85APU_seekIndex * index = t85APU_seekIndex_open(mapped, info.st_size);
+	#else
+	t85APU_seekIndex * index = t85APU_seekIndex_load(path);
+	#endif
+
+	t85APU * seeked = newAPU(log->clock), * linear = newAPU(log->clock);
+	uint64_t * times = (uint64_t *) malloc(seeks * sizeof(uint64_t));
+	uint8_t * expected = NULL, * actual = NULL;
+	int result = 2;
+	if (!index || !seeked || !linear || !times) goto end;
+	size_t stateSize = t85APU_getStateSize(linear);
+	expected = (uint8_t *) malloc(stateSize);
+	actual = (uint8_t *) malloc(stateSize);
+	if (!expected || !actual) goto end;
+
+	uint64_t length = (log->count ? log->writes[log->count-1].time : 0) + 1;
+	uint32_t seed = 0x85A9;
+	for (size_t i = 0; i < seeks; i++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		times[i] = (uint64_t)((double)seed / 4294967296.0 * length);
+	}
+	qsort(times, seeks, sizeof(uint64_t), compareTimes);
+
+	result = 0;
+	double seekTime = 0, linearTime = 0;
+	uint64_t now = 0;
+	size_t next = 0, mismatches = 0;
+	for (size_t i = 0; i < seeks; i++) {
+		clock_t start = clock();
+		while (next < log->count && log->writes[next].time < times[i]) {
+			t85APU_advance(linear, log->writes[next].time - now);
+			now = log->writes[next].time;
+			t85APU_writeReg(linear, log->writes[next].addr, log->writes[next].data);
+			next++;
+		}
+		t85APU_advance(linear, times[i] - now);
+		now = times[i];
+		linearTime += (double)(clock() - start) / CLOCKS_PER_SEC;
+
+		size_t seekedNext;
+		start = clock();
+		if (!t85APU_seekIndex_seek(index, log, seeked, times[i], &seekedNext)) {
+			result = 2;
+			goto end;
+		}
+		seekTime += (double)(clock() - start) / CLOCKS_PER_SEC;
+
+		t85APU_saveState(linear, expected);
+		t85APU_saveState(seeked, actual);
+		if (seekedNext != next || memcmp(expected, actual, stateSize)) {
+			if (!mismatches) printf("Mismatch when seeking to %" PRIu64 " master clocks\n", times[i]);
+			mismatches++;
+		}
+	}
+	printf("%zu seeks, %zu mismatched, %.3f ms per seek on average (the linear replay up to all of them took %.3f ms)\n",
+		seeks, mismatches, seeks ? seekTime * 1000 / seeks : 0, linearTime * 1000);
+	if (mismatches) result = 3;
+
+	end:
+	free(expected);
+	free(actual);
+	free(times);
+	t85APU_delete(seeked);
+	t85APU_delete(linear);
+	t85APU_seekIndex_delete(index);
+	#ifndef _WIN32
+	munmap(mapped, info.st_size);
+	#endif
+	return result;
+}
+
+int main (int argc, char ** argv) {
+	if (argc < 4 || (strcmp(argv[1], "build") && strcmp(argv[1], "check"))) {
+		fprintf(stderr,
+			"Usage: t85apu_seek build <register log> <seek index> [interval in seconds]\n"
+			"       t85apu_seek check <register log> <seek index> [seeks]\n");
+		return 1;
+	}
+	t85APU_regLog * log = t85APU_regLog_load(argv[2]);
+	if (!log) return 2;
+	int result = !strcmp(argv[1], "build")
+		? build(log, argv[3], argc >= 5 ? atof(argv[4]) : 1.0)
+		: check(log, argv[3], argc >= 5 ? strtoul(argv[4], NULL, 0) : 1000);
+	t85APU_regLog_delete(log);
+	return result;
+}
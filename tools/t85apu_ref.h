@@ -0,0 +1,80 @@
+/*
+	t85APU reference engine
+	© alexmush, 2024
+	A frozen copy of the tick-by-tick emulation, that the optimized one in emu/t85apu.c is checked against by t85apu_golden.
+	Do NOT optimize this - it is only meant to be obviously correct.
+*/
+
+#ifndef __T85APU_REF_H__
+#define __T85APU_REF_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define T85APU_REF_BUFFER_SIZE 256
+
+typedef struct __t85apu_ref {
+	// Replica of internal RAM
+	uint16_t noiseLFSR;
+	uint16_t envPhaseAccs[2];
+	uint8_t envStates[2];
+	uint8_t envShape;
+
+	uint8_t dutyCycles[5];
+	uint16_t noiseXOR;
+	uint8_t volumes[5];
+	uint8_t channelConfigs[5];
+	uint16_t envLdBuffer;
+
+	uint8_t increments[8];
+	uint16_t shiftedIncrements[8];
+	uint8_t octaveValues[7];
+
+	// Replica of registers
+	uint16_t tonePhaseAccs[5];
+	uint16_t noisePhaseAcc;
+
+	uint8_t envSmpVolume[4];
+
+	uint8_t noiseMask;
+	uint8_t envZeroFlg;
+
+	// Output
+	uint_fast8_t outputType;
+	uint_fast8_t outputBitdepth;
+	uint_fast16_t clockCycle;
+	bool outPending;
+	uint16_t channelOutput[5];
+	uint32_t currentOutput;
+	uint32_t outputQueue[3];
+
+	// Sample rate converter
+	double ticksPerClockCycle;
+	double ticks;
+	uint_fast8_t quality;
+
+	// Register write buffer, a write is taken from it on every update
+	uint16_t shiftRegister[T85APU_REF_BUFFER_SIZE];
+	size_t shiftRegSize;
+	size_t shiftRegCurIdx;
+} t85APU_ref;
+
+/**
+ * @brief Initializes the reference engine, with the same meaning of the parameters as in @c t85APU_new and @c t85APU_setQuality.
+ * @note Only the @c T85APU_OUTPUT_PB4 and @c T85APU_OUTPUT_PB4_EXACT output types are supported, without the output stage, the mutes, the backends and the burst mode.
+ *
+ * @param ref The reference engine to initialize.
+ * @param shiftRegisterSize The size of the register write buffer, 1..T85APU_REF_BUFFER_SIZE.
+ */
+void t85APU_ref_init (t85APU_ref * ref, double clock, double rate, uint_fast8_t outputType, uint_fast8_t quality, size_t shiftRegisterSize);
+/**
+ * @brief Same as @c t85APU_writeReg.
+ */
+void t85APU_ref_writeReg (t85APU_ref * ref, uint8_t addr, uint8_t data);
+/**
+ * @brief Same as @c t85APU_calc, shifted left by @p shift like the other @c t85APU_calcXXX functions.
+ */
+uint32_t t85APU_ref_calc (t85APU_ref * ref, uint_fast8_t shift);
+
+#endif
@@ -0,0 +1,131 @@
+/*
+	t85APU event trace dumper
+	© alexmush, 2024
+	Replays a register log (see t85apu_reglog.h) through the emulator built with T85APU_TRACE, and prints every event of its trace,
+	with how long each register write sat in the register write buffer.
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "t85apu.h"
+#include "t85apu_reglog.h"
+
+#define TAIL_UPDATES 64	// Replayed after the last write, to let the buffer drain
+#define QUEUE_TIMES 4096	// Queue times kept for the writes still in the buffer, more than any buffer can hold
+#define DEFAULT_BUFFER_SIZE 16	// The same as the golden corpus runs with
+
+typedef struct {
+	uint64_t queueTimes[QUEUE_TIMES];	// By sequence number
+	uint32_t newestQueued;
+	size_t queued, dropped, applied, unmatched;
+	uint64_t latencyTotal, latencyWorst;
+	uint64_t lost;
+} traceStats;
+
+static void printRecord (const t85APU_traceRecord * record, traceStats * stats) {
+	printf("%12" PRIu64 " %8" PRIu64 "+%03u  ", record->time, record->time / 512, (unsigned)(record->time % 512));
+	switch (record->type) {
+		case T85APU_TRACE_QUEUE:
+			stats->queued++;
+			stats->queueTimes[record->value % QUEUE_TIMES] = record->time;
+			stats->newestQueued = record->value;
+			printf("queue     %02X = %02X  #%" PRIu32 "\n", record->addr, record->data, record->value);
+			break;
+		case T85APU_TRACE_DROP:
+			stats->dropped++;
+			printf("drop      %02X = %02X  the buffer is full\n", record->addr, record->data);
+			break;
+		case T85APU_TRACE_APPLY:
+			stats->applied++;
+			// Only matched if its queue event was seen, and is still remembered
+			if (record->value && stats->newestQueued >= record->value && stats->newestQueued - record->value < QUEUE_TIMES) {
+				uint64_t latency = record->time - stats->queueTimes[record->value % QUEUE_TIMES];
+				stats->latencyTotal += latency;
+				if (latency > stats->latencyWorst) stats->latencyWorst = latency;
+				printf("apply     %02X = %02X  #%" PRIu32 ", queued for %" PRIu64 " master clocks\n", record->addr, record->data, record->value, latency);
+			} else {
+				stats->unmatched++;
+				printf("apply     %02X = %02X  #%" PRIu32 "\n", record->addr, record->data, record->value);
+			}
+			break;
+		case T85APU_TRACE_ENV_OVERFLOW:
+			printf("env %c     overflow to %02X\n", 'A' + record->addr, record->data);
+			break;
+		case T85APU_TRACE_ENV_HOLD:
+			printf("env %c     hold\n", 'A' + record->addr);
+			break;
+		case T85APU_TRACE_NOISE_MASK:
+			printf("noise     mask %02X\n", record->data);
+			break;
+		default:
+			printf("unknown event %u\n", record->type);
+			break;
+	}
+}
+
+static void drainTrace (t85APU * apu, uint64_t * cursor, traceStats * stats) {
+	t85APU_traceRecord records[256];
+	for (;;) {
+		uint64_t from = *cursor;
+		size_t count = t85APU_traceRead(apu, cursor, records, 256);
+		if (*cursor - from > count) {
+			stats->lost += *cursor - from - count;
+			printf("  ... %" PRIu64 " events lost\n", *cursor - from - count);
+		}
+		for (size_t i = 0; i < count; i++) printRecord(&records[i], stats);
+		if (count < 256) break;
+	}
+}
+
+int main (int argc, char ** argv) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: t85apu_trace <register log> [register write buffer size, %d by default]\n", DEFAULT_BUFFER_SIZE);
+		return 1;
+	}
+	t85APU_regLog * log = t85APU_regLog_load(argv[1]);
+	if (!log) return 2;
+	size_t bufferSize = argc >= 3 ? strtoul(argv[2], NULL, 0) : DEFAULT_BUFFER_SIZE;
+	if (bufferSize < 1) bufferSize = 1;
+
+	// A sample per master clock, so every write is pushed right before the master clock it is timestamped with
+	#ifdef T85APU_REGWRITE_BUFFER_SIZE
+	t85APU * apu = t85APU_new(log->clock, log->clock, T85APU_OUTPUT_PB4);
+	#else
+	t85APU * apu = t85APU_new(log->clock, log->clock, T85APU_OUTPUT_PB4, bufferSize);
+	#endif
+	traceStats * stats = (traceStats *) calloc(1, sizeof(traceStats));
+	if (!apu || !stats) {
+		fprintf(stderr, "Could not allocate the t85APU\n");
+		t85APU_delete(apu);
+		t85APU_regLog_delete(log);
+		return 2;
+	}
+	t85APU_setQuality(apu, 0);
+
+	printf("%12s %12s  event\n", "master clock", "update");
+	uint64_t cursor = 0, end = (log->count ? log->writes[log->count-1].time : 0) + TAIL_UPDATES * 512;
+	size_t next = 0;
+	for (uint64_t clock = 0; clock < end; clock++) {
+		while (next < log->count && log->writes[next].time <= clock) {
+			t85APU_writeReg(apu, log->writes[next].addr, log->writes[next].data);
+			next++;
+		}
+		t85APU_calc(apu);
+		if (!(clock & 511)) drainTrace(apu, &cursor, stats);
+	}
+	drainTrace(apu, &cursor, stats);
+
+	printf("\nQueued %zu writes, dropped %zu, applied %zu", stats->queued, stats->dropped, stats->applied);
+	if (stats->applied > stats->unmatched)
+		printf(", queued for %.1f master clocks on average and %" PRIu64 " at worst", (double)stats->latencyTotal / (stats->applied - stats->unmatched), stats->latencyWorst);
+	printf("\n");
+	if (stats->lost) printf("Lost %" PRIu64 " events, T85APU_TRACE is too small\n", stats->lost);
+
+	free(stats);
+	t85APU_delete(apu);
+	t85APU_regLog_delete(log);
+	return 0;
+}